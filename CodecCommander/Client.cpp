@@ -27,6 +27,55 @@ const IOExternalMethodDispatch CodecCommanderClient::sMethods[kClientNumMethods]
       0,
       1, // One output
       0
+    },
+    { // kClientExecuteVerbAsync
+      (IOExternalMethodAction)&CodecCommanderClient::executeVerbAsync,
+      1, // One input
+      0,
+      0, // Response is sent to the async port
+      0
+    },
+    { // kClientExecuteVerbs
+      (IOExternalMethodAction)&CodecCommanderClient::executeVerbs,
+      0,
+      kIOUCVariableStructureSize, // Commands
+      0,
+      kIOUCVariableStructureSize  // Responses, one per command
+    },
+    { // kClientRingDoorbell
+      (IOExternalMethodAction)&CodecCommanderClient::ringDoorbell,
+      0, // Commands are in the verb ring
+      0,
+      0, // Responses are written to the verb ring
+      0
+    },
+    { // kClientDumpCodec
+      (IOExternalMethodAction)&CodecCommanderClient::dumpCodec,
+      0,
+      0,
+      1, // Size of the snapshot (also when the buffer is too small)
+      kIOUCVariableStructureSize  // CodecDump snapshot
+    },
+    { // kClientRegisterEvents
+      (IOExternalMethodAction)&CodecCommanderClient::registerEvents,
+      1, // Event mask, 0 to stop
+      0,
+      0, // Events are sent to the async port
+      0
+    },
+    { // kClientSetTrace
+      (IOExternalMethodAction)&CodecCommanderClient::setTrace,
+      1, // 1 on, 0 off
+      0,
+      1, // Whether it was on
+      0
+    },
+    { // kClientReadTrace
+      (IOExternalMethodAction)&CodecCommanderClient::readTrace,
+      1, // Sequence to read from (kVerbTraceOldest)
+      0,
+      2, // Sequence to continue from, entries lost
+      kIOUCVariableStructureSize  // VerbTraceEntry array
     }
 };
 
@@ -43,6 +92,7 @@ bool CodecCommanderClient::initWithTask(task_t owningTask, void* securityID, UIn
     DebugLog("Client::initWithTask(type %u)\n", (unsigned int)type);
     
     mTask = owningTask;
+    mRingMemory = NULL;
     
     return super::initWithTask(owningTask, securityID, type, properties);
 }
@@ -77,9 +127,45 @@ void CodecCommanderClient::stop(IOService * provider)
 {
     DebugLog("Client::stop\n");
     
+    // no events after the client is gone
+    mDriver->registerEvents(this, 0, NULL);
+    
     super::stop(provider);
 }
 
+void CodecCommanderClient::free()
+{
+    OSSafeReleaseNULL(mRingMemory);
+    
+    super::free();
+}
+
+IOReturn CodecCommanderClient::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory)
+{
+    if (type != kClientMemoryVerbRing)
+        return kIOReturnBadArgument;
+    
+    if (!mRingMemory)
+    {
+        IOBufferMemoryDescriptor* ringMemory = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                                                     sizeof(VerbRing), PAGE_SIZE);
+        if (!ringMemory)
+            return kIOReturnNoMemory;
+        VerbRing* ring = (VerbRing*)ringMemory->getBytesNoCopy();
+        bzero(ring, sizeof(VerbRing));
+        ring->entries = kVerbRingEntries;
+        // another thread of the client may have mapped it meanwhile
+        if (!OSCompareAndSwapPtr(NULL, ringMemory, (void* volatile*)&mRingMemory))
+            ringMemory->release();
+    }
+    
+    // the reference is the caller's
+    mRingMemory->retain();
+    *options = 0;
+    *memory = mRingMemory;
+    return kIOReturnSuccess;
+}
+
 IOReturn CodecCommanderClient::externalMethod(uint32_t selector, IOExternalMethodArguments* arguments,
                                               IOExternalMethodDispatch* dispatch, OSObject* target, void* reference)
 
@@ -92,7 +178,8 @@ IOReturn CodecCommanderClient::externalMethod(uint32_t selector, IOExternalMetho
         
         if (!target)
         {
-            if (selector == kClientExecuteVerb)
+            if (selector == kClientExecuteVerb || selector == kClientExecuteVerbs || selector == kClientDumpCodec ||
+                selector == kClientSetTrace || selector == kClientReadTrace)
                 target = mDriver;
             else
                 target = this;
@@ -108,3 +195,220 @@ IOReturn CodecCommanderClient::executeVerb(CodecCommander* target, void* referen
     return kIOReturnSuccess;
 }
 
+IOReturn CodecCommanderClient::executeVerbs(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    // only inline structures, so at most kClientMaxVerbs
+    UInt32 size = arguments->structureInputSize;
+    if (!arguments->structureInput || !arguments->structureOutput || !size || size % sizeof(UInt32) ||
+        size > kClientMaxVerbs * sizeof(UInt32) || arguments->structureOutputSize < size)
+        return kIOReturnBadArgument;
+
+    target->executeCommands((const UInt32*)arguments->structureInput, (UInt32*)arguments->structureOutput, size / sizeof(UInt32));
+    arguments->structureOutputSize = size;
+    return kIOReturnSuccess;
+}
+
+UInt32 CodecCommanderClient::ringAction(void* target, void*, void*, void*)
+{
+    CodecCommanderClient* self = (CodecCommanderClient*)target;
+    VerbRing* ring = (VerbRing*)self->mRingMemory->getBytesNoCopy();
+    
+    // the ring is user writable: indexes are taken modulo its size, at most one ring's worth per snapshot
+    UInt32 completed = ring->completed;
+    UInt32 count = ring->submitted - completed;
+    if (count > kVerbRingEntries)
+        count = kVerbRingEntries;
+    OSMemoryBarrier();
+    
+    UInt32 succeeded = 0;
+    for (UInt32 done = 0; done < count;)
+    {
+        UInt32 index = (completed + done) % kVerbRingEntries;
+        UInt32 chunk = count - done < kVerbRingEntries - index ? count - done : kVerbRingEntries - index;
+        succeeded += self->mDriver->executeCommands(&ring->commands[index], &ring->responses[index], chunk);
+        done += chunk;
+    }
+    
+    // responses are visible before they are marked complete
+    OSMemoryBarrier();
+    ring->completed = completed + count;
+    return succeeded;
+}
+
+bool CodecCommanderClient::submitRing()
+{
+    retain();
+    if (mDriver->submitClientAction(ringAction, this, ringDone, NULL, this))
+        return true;
+    release();
+    return false;
+}
+
+void CodecCommanderClient::ringDone(void* owner, void* refcon, UInt32 result)
+{
+    CodecCommanderClient* self = (CodecCommanderClient*)refcon;
+    VerbRing* ring = (VerbRing*)self->mRingMemory->getBytesNoCopy();
+    
+    // take what was submitted while the snapshot ran (the client saw busy and did not ring),
+    // as a new request so that driver requests queued meanwhile go first
+    ring->busy = 0;
+    OSMemoryBarrier();
+    if (ring->submitted != ring->completed && !self->isInactive() && OSCompareAndSwap(0, 1, &ring->busy))
+    {
+        if (!self->submitRing())
+            ring->busy = 0;
+    }
+    self->release();
+}
+
+IOReturn CodecCommanderClient::ringDoorbell(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    if (!target->mRingMemory)
+        return kIOReturnNotReady;
+    
+    // already being worked on, what was submitted is picked up when the current request is done
+    VerbRing* ring = (VerbRing*)target->mRingMemory->getBytesNoCopy();
+    if (!OSCompareAndSwap(0, 1, &ring->busy))
+        return kIOReturnSuccess;
+    
+    if (!target->submitRing())
+    {
+        ring->busy = 0;
+        return kIOReturnNoResources;
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn CodecCommanderClient::dumpCodec(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    // snapshots over 4K come back through a memory descriptor
+    IOMemoryDescriptor* descriptor = arguments->structureOutputDescriptor;
+    UInt32 size = descriptor ? (UInt32)descriptor->getLength() : arguments->structureOutputSize;
+    if (size > kClientMaxDump)
+        size = kClientMaxDump;
+    if (size < sizeof(CodecDumpHeader))
+        return kIOReturnBadArgument;
+
+    void* buffer = IOMalloc(size);
+    if (!buffer)
+        return kIOReturnNoMemory;
+
+    IOReturn result = kIOReturnSuccess;
+    UInt32 used = target->dumpCodec(buffer, size);
+    arguments->scalarOutput[0] = used;
+    if (!used)
+        result = kIOReturnNotResponding;
+    else if (used > size)
+        result = kIOReturnNoSpace;
+    else if (descriptor)
+    {
+        if ((result = descriptor->prepare()) == kIOReturnSuccess)
+        {
+            descriptor->writeBytes(0, buffer, used);
+            descriptor->complete();
+            arguments->structureOutputDescriptorSize = used;
+        }
+    }
+    else
+    {
+        memcpy(arguments->structureOutput, buffer, used);
+        arguments->structureOutputSize = used;
+    }
+
+    IOFree(buffer, size);
+    return result;
+}
+
+// Outstanding kClientExecuteVerbAsync call
+struct AsyncVerb
+{
+    OSAsyncReference64 reference;
+    CodecCommanderClient* client;
+};
+
+static void executeVerbDone(void* owner, void* refcon, UInt32 result)
+{
+    AsyncVerb* verb = (AsyncVerb*)refcon;
+    io_user_reference_t args[1] = { result };
+    CodecCommanderClient::sendAsyncResult64(verb->reference, kIOReturnSuccess, args, 1);
+    verb->client->release();
+    IOFree(verb, sizeof(AsyncVerb));
+}
+
+IOReturn CodecCommanderClient::executeVerbAsync(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    if (!arguments->asyncWakePort)
+        return kIOReturnBadArgument;
+
+    AsyncVerb* verb = (AsyncVerb*)IOMalloc(sizeof(AsyncVerb));
+    if (!verb)
+        return kIOReturnNoMemory;
+    bcopy(arguments->asyncReference, verb->reference, sizeof(OSAsyncReference64));
+    // keep the client around until the response is sent
+    verb->client = target;
+    target->retain();
+
+    if (!target->mDriver->executeCommandAsync((UInt32)arguments->scalarInput[0], executeVerbDone, NULL, verb))
+    {
+        target->release();
+        IOFree(verb, sizeof(AsyncVerb));
+        return kIOReturnNoResources;
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn CodecCommanderClient::registerEvents(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    UInt32 mask = (UInt32)arguments->scalarInput[0] & kCodecEventMaskAll;
+    if (mask && !arguments->asyncWakePort)
+        return kIOReturnBadArgument;
+    
+    if (!target->mDriver->registerEvents(target, mask, arguments->asyncReference))
+        return kIOReturnNoResources;
+    return kIOReturnSuccess;
+}
+
+IOReturn CodecCommanderClient::setTrace(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    arguments->scalarOutput[0] = target->setTracing(arguments->scalarInput[0] != 0);
+    return kIOReturnSuccess;
+}
+
+IOReturn CodecCommanderClient::readTrace(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    // more than 4K of entries come back through a memory descriptor
+    IOMemoryDescriptor* descriptor = arguments->structureOutputDescriptor;
+    UInt32 max = (UInt32)((descriptor ? descriptor->getLength() : arguments->structureOutputSize) / sizeof(VerbTraceEntry));
+    if (max > kVerbTraceEntries)
+        max = kVerbTraceEntries;
+    if (!max)
+        return kIOReturnBadArgument;
+
+    VerbTraceEntry* entries = (VerbTraceEntry*)IOMalloc(max * sizeof(VerbTraceEntry));
+    if (!entries)
+        return kIOReturnNoMemory;
+
+    IOReturn result = kIOReturnSuccess;
+    UInt32 cursor = (UInt32)arguments->scalarInput[0], dropped;
+    UInt32 count = target->readTrace(&cursor, entries, max, &dropped);
+    UInt32 used = count * sizeof(VerbTraceEntry);
+    arguments->scalarOutput[0] = cursor;
+    arguments->scalarOutput[1] = dropped;
+    if (descriptor)
+    {
+        if ((result = descriptor->prepare()) == kIOReturnSuccess)
+        {
+            descriptor->writeBytes(0, entries, used);
+            descriptor->complete();
+            arguments->structureOutputDescriptorSize = used;
+        }
+    }
+    else
+    {
+        memcpy(arguments->structureOutput, entries, used);
+        arguments->structureOutputSize = used;
+    }
+
+    IOFree(entries, max * sizeof(VerbTraceEntry));
+    return result;
+}
@@ -0,0 +1,49 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_ClientMethods_h
+#define CodecCommander_ClientMethods_h
+
+// Interface of CodecCommanderClient (plain C, also included by hda-verb):
+// method selectors of IOConnectCall*Method, their limits, and the properties
+// hda-verb matches the CodecCommander services by.
+
+enum
+{
+    kClientExecuteVerb = 0,     // scalar: command in, response out
+    kClientExecuteVerbAsync,
+    kClientExecuteVerbs,        // structure: commands in, responses out
+    kClientRingDoorbell,        // see VerbRing.h
+    kClientDumpCodec,           // structure out: CodecDump.h snapshot
+    kClientRegisterEvents,      // async, see CodecEvent.h
+    kClientSetTrace,
+    kClientReadTrace,           // see VerbTrace.h
+    kClientNumMethods
+};
+
+// Most verbs in one kClientExecuteVerbs call (commands and responses are passed inline)
+#define kClientMaxVerbs             1024
+// Largest CodecDump snapshot returned by kClientDumpCodec
+#define kClientMaxDump              (64 * 1024)
+
+#define kCodecVendorID              "IOHDACodecVendorID"
+#define kCodecAddress               "IOHDACodecAddress"
+#define kCodecController            "CodecCommander Controller"
+
+#endif
@@ -19,6 +19,7 @@
 
 #include <libkern/version.h>
 #include "CodecCommander.h"
+#include "ProfileIndex.h"
 
 //REVIEW: avoids problem with Xcode 5.1.0 where -dead_strip eliminates these required symbols
 #include <libkern/OSKextLib.h>
@@ -37,8 +38,6 @@ static IOPMPowerState powerStateArray[ kPowerStateCount ] =
     { 1,kIOPMDeviceUsable, IOPMPowerOn, IOPMPowerOn, 0,0,0,0,0,0,0,0 }
 };
 
-static IORecursiveLock* g_lock;
-
 extern "C"
 {
 
@@ -47,9 +46,13 @@ kern_return_t CodecCommander_Start(kmod_info_t* ki, void * d)
 {
 	AlwaysLog("Version %s starting on OS X Darwin %d.%d.\n", ki->version, version_major, version_minor);
 
-	g_lock = IORecursiveLockAlloc();
-	if (!g_lock)
+	if (!IntelHDA::initControllers())
+		return KERN_FAILURE;
+	if (!ProfileIndex::initIndexCache())
+	{
+		IntelHDA::freeControllers();
 		return KERN_FAILURE;
+	}
 
 	return KERN_SUCCESS;
 }
@@ -57,11 +60,8 @@ kern_return_t CodecCommander_Start(kmod_info_t* ki, void * d)
 __attribute__((visibility("hidden")))
 kern_return_t CodecCommander_Stop(kmod_info_t* ki, void * d)
 {
-	if (g_lock)
-	{
-		IORecursiveLockFree(g_lock);
-		g_lock = 0;
-	}
+	ProfileIndex::freeIndexCache();
+	IntelHDA::freeControllers();
 
 	return KERN_SUCCESS;
 }
@@ -90,37 +90,6 @@ bool CodecCommanderResidency::start(IOService *provider)
 
 OSDefineMetaClassAndStructors(CodecCommander, IOService)
 
-//REVIEW: getHDADriver and getAudioDevice are only used by "Check Infinitely"
-// Note: "Check Infinitely" should be called "Check Periodically"
-
-static IOAudioDevice* getHDADriver(IORegistryEntry* registryEntry)
-{
-	IOAudioDevice* audioDevice = NULL;
-	while (registryEntry)
-	{
-		audioDevice = OSDynamicCast(IOAudioDevice, registryEntry);
-		if (audioDevice)
-			break;
-		registryEntry = registryEntry->getChildEntry(gIOServicePlane);
-	}
-#ifdef DEBUG
-	if (!audioDevice)
-		AlwaysLog("getHDADriver unable to find IOAudioDevice\n");
-#endif
-	return audioDevice;
-}
-
-IOAudioDevice* CodecCommander::getAudioDevice()
-{
-	if (!mAudioDevice)
-	{
-		mAudioDevice = getHDADriver(mProvider);
-		if (mAudioDevice)
-			mAudioDevice->retain();
-	}
-	return mAudioDevice;
-}
-
 /******************************************************************************
  * CodecCommander::init - parse kernel extension Info.plist
  ******************************************************************************/
@@ -143,6 +112,7 @@ bool CodecCommander::init(OSDictionary *dictionary)
 	mEAPDPoweredDown = true;
 	mColdBoot = true; // assume booting from cold since hibernate is broken on most hacks
 	mHDAPrevPowerState = kIOAudioDeviceSleep; // assume hda codec has no power at cold boot
+	mPolledPowerState = kIOAudioDeviceSleep;
 
     return true;
 }
@@ -170,6 +140,114 @@ static void setNumberProperty(IOService* service, const char* key, UInt32 value)
 }
 
 
+static void setNumberProperty(OSDictionary* dict, const char* key, UInt32 value)
+{
+	OSNumber* num = OSNumber::withNumber(value, 32);
+	if (num)
+	{
+		dict->setObject(key, num);
+		num->release();
+	}
+}
+
+/******************************************************************************
+ * CodecCommander::updateStatisticsProperties - publish verb timing/cache statistics in ioreg
+ ******************************************************************************/
+void CodecCommander::updateStatisticsProperties()
+{
+	const HDALatencyStats& stats = mIntelHDA->getLatencyStats();
+
+	OSDictionary* dict = OSDictionary::withCapacity(7);
+	OSArray* histogram = OSArray::withCapacity(HDA_LATENCY_BUCKETS);
+	if (dict && histogram)
+	{
+		setNumberProperty(dict, "Count", stats.count);
+		setNumberProperty(dict, "Timeouts", stats.timeouts);
+		setNumberProperty(dict, "Min", stats.min);
+		setNumberProperty(dict, "Median", mIntelHDA->getLatencyMedian());
+		setNumberProperty(dict, "Max", stats.max);
+		setNumberProperty(dict, "Expected", mIntelHDA->getExpectedLatency());
+		for (unsigned i = 0; i < HDA_LATENCY_BUCKETS; i++)
+		{
+			OSNumber* num = OSNumber::withNumber(stats.buckets[i], 32);
+			if (num)
+			{
+				histogram->setObject(num);
+				num->release();
+			}
+		}
+		dict->setObject("Histogram", histogram);
+		setProperty("Verb Latency (us)", dict);
+	}
+	OSSafeRelease(histogram);
+	OSSafeRelease(dict);
+
+	dict = OSDictionary::withCapacity(2);
+	if (dict)
+	{
+		setNumberProperty(dict, "Hits", mIntelHDA->getParamCacheHits());
+		setNumberProperty(dict, "Misses", mIntelHDA->getParamCacheMisses());
+		setProperty("Parameter Cache", dict);
+		dict->release();
+	}
+
+	if (mConfiguration->getShadowMode() != ShadowOff && (dict = OSDictionary::withCapacity(4)))
+	{
+		HDAShadowStats shadowStats;
+		mCodecManager->getShadowStats(&shadowStats);
+		setNumberProperty(dict, "Skipped", shadowStats.skipped);
+		setNumberProperty(dict, "Verified", shadowStats.verified);
+		setNumberProperty(dict, "Mismatched", shadowStats.mismatched);
+		setNumberProperty(dict, "Invalidated", shadowStats.invalidated);
+		setProperty("Shadow Registers", dict);
+		dict->release();
+	}
+
+	HDAResetStats resetStats;
+	mCodecManager->getResetStats(&resetStats);
+	if (resetStats.resets && (dict = OSDictionary::withCapacity(4)))
+	{
+		setNumberProperty(dict, "Resets", resetStats.resets);
+		setNumberProperty(dict, "Timeouts", resetStats.timeouts);
+		setNumberProperty(dict, "Last Ready (us)", resetStats.lastReady);
+		setNumberProperty(dict, "Max Ready (us)", resetStats.maxReady);
+		setProperty("Codec Reset", dict);
+		dict->release();
+	}
+
+	const HDAController* controller = mIntelHDA->getController();
+	if (controller && (dict = OSDictionary::withCapacity(4)))
+	{
+		setNumberProperty(dict, "Acquired", controller->acquired);
+		setNumberProperty(dict, "Contended", controller->contended);
+		setNumberProperty(dict, "Max Wait (us)", controller->maxWait);
+		setNumberProperty(dict, "Total Wait (us)", (UInt32)controller->totalWait);
+		setProperty("Controller Lock", dict);
+		dict->release();
+	}
+
+	if (mVerbQueue && (dict = OSDictionary::withCapacity(5)))
+	{
+		const VerbQueue::Stats& driver = mVerbQueue->getStats(VerbQueue::kPriorityDriver);
+		const VerbQueue::Stats& client = mVerbQueue->getStats(VerbQueue::kPriorityClient);
+		setNumberProperty(dict, "Driver Requests", driver.requests);
+		setNumberProperty(dict, "Driver Max Latency (us)", driver.maxLatency);
+		setNumberProperty(dict, "Client Requests", client.requests);
+		setNumberProperty(dict, "Client Max Latency (us)", client.maxLatency);
+		setNumberProperty(dict, "Client Max Waiting", client.maxDepth);
+		setProperty("Verb Queue", dict);
+		dict->release();
+	}
+
+	if (mUnsolicitedTimer && (dict = OSDictionary::withCapacity(2)))
+	{
+		setNumberProperty(dict, "Received", mIntelHDA->getUnsolicitedReceived());
+		setNumberProperty(dict, "Dropped", mIntelHDA->getUnsolicitedDropped());
+		setProperty("Unsolicited Responses", dict);
+		dict->release();
+	}
+}
+
 /******************************************************************************
  * CodecCommander::start - start kernel extension and init PM
  ******************************************************************************/
@@ -184,25 +262,60 @@ bool CodecCommander::start(IOService *provider)
 	// cache the provider
 	mProvider = provider;
 
-	IORecursiveLockLock(g_lock);
+	mEventLock = IOLockAlloc();
+	if (!mEventLock)
+	{
+		stop(provider);
+		return false;
+	}
+
+	// runs the commands of this instance's timer, power management and user client paths
+	// (register access is serialized per controller by IntelHDA)
+	mVerbQueue = new VerbQueue;
+	if (!mVerbQueue || !mVerbQueue->start())
+	{
+		stop(provider);
+		return false;
+	}
+
 	mIntelHDA = new IntelHDA(provider, PIO);
 	if (!mIntelHDA || !mIntelHDA->initialize())
 	{
-		IORecursiveLockUnlock(g_lock);
 		AlwaysLog("Error initializing IntelHDA instance\n");
 		stop(provider);
 		return false;
 	}
+#ifdef DEBUG
+	// debug builds trace every command instead of logging it (see VerbTrace.h)
+	mIntelHDA->setTracing(true);
+#endif
+
+	// codec may already be driven along with another codec (see CodecAddressMask)
+	if (!mIntelHDA->claimCodec(mIntelHDA->getCodecAddress()))
+	{
+		OSNumber* manager = OSDynamicCast(OSNumber, provider->getProperty(kCodecManagedBy));
+		AlwaysLog("stopping as codec %d is managed by CodecCommander of codec %d\n", mIntelHDA->getCodecAddress(), manager ? manager->unsigned32BitValue() : -1);
+		stop(provider);
+		return false;
+	}
+	mClaimedCodecs = 1 << mIntelHDA->getCodecAddress();
 
 	// Populate HDA properties for client matching
 	setNumberProperty(this, kCodecVendorID, mIntelHDA->getCodecVendorId());
 	setNumberProperty(this, kCodecAddress, mIntelHDA->getCodecAddress());
 	setNumberProperty(this, kCodecFuncGroupType, mIntelHDA->getCodecGroupType());
+	if (IOPCIDevice* controller = mIntelHDA->getPCIDevice())
+	{
+		// "HDEF@1b", as the controller shows in ioreg
+		char name[64];
+		const char* location = controller->getLocation();
+		snprintf(name, sizeof(name), "%s@%s", controller->getName(), location ? location : "");
+		setProperty(kCodecController, name);
+	}
 
 	mConfiguration = new Configuration(this->getProperty(kCodecProfile), mIntelHDA, kCodecCommanderKey);
 	if (!mConfiguration || mConfiguration->getDisable())
 	{
-		IORecursiveLockUnlock(g_lock);
 		AlwaysLog("stopping due to codec profile Disable flag\n");
 		stop(provider);
 		return false;
@@ -211,74 +324,123 @@ bool CodecCommander::start(IOService *provider)
 	setProperty("Merged Profile", mConfiguration->mMergedConfig);
 #endif
 
+	// switch to CORB/RIRB transport if requested by profile
+	if (mConfiguration->getCommandMode() != mIntelHDA->getCommandMode())
+		mIntelHDA->setCommandMode(mConfiguration->getCommandMode());
+	mIntelHDA->setShadowMode(mConfiguration->getShadowMode());
+
 	if (mConfiguration->getUpdateNodes())
 	{
 		// need to wait a bit until codec can actually respond to immediate verbs
 		IOSleep(mConfiguration->getSendDelay());
 
-		// Fetch Pin Capabilities from the range of nodes
-		DebugLog("Getting EAPD supported node list.\n");
-		
-		mEAPDCapableNodes = OSArray::withCapacity(3);
+		mEAPDCapableNodes = CodecManager::findEAPDNodes(mIntelHDA);
 		if (!mEAPDCapableNodes)
 		{
-			IORecursiveLockUnlock(g_lock);
 			stop(provider);
 			return false;
 		}
-		
-		UInt16 start = mIntelHDA->getStartingNode();
-		UInt16 end = start + mIntelHDA->getTotalNodes();
-		for (UInt16 node = start; node < end; node++)
-		{
-			UInt32 response = mIntelHDA->sendCommand(node, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP);
-			if (response == -1)
-			{
-				DebugLog("Failed to retrieve pin capabilities for node 0x%02x.\n", node);
-				continue;
-			}
-			
-			// if bit 16 is set in pincap - node supports EAPD
-			if (HDA_PINCAP_IS_EAPD_CAPABLE(response))
-			{
-				OSNumber* num = OSNumber::withNumber(node, 16);
-				if (num)
-				{
-					mEAPDCapableNodes->setObject(num);
-					num->release();
-				}
-				AlwaysLog("Node ID 0x%02x supports EAPD, will update state after sleep.\n", node);
-			}
-		}
 	}
-	
+
+	mCodecManager = new CodecManager(mIntelHDA, mConfiguration, mEAPDCapableNodes);
+	if (!mCodecManager)
+	{
+		stop(provider);
+		return false;
+	}
+	if (UInt16 mask = mConfiguration->getCodecAddressMask() & ~(1 << mIntelHDA->getCodecAddress()))
+		addManagedCodecs(mask);
+	setNumberProperty(this, "Codec Mask", mCodecManager->getCodecMask());
+
 	// Execute any custom commands registered for initialization
 	customCommands(kStateInit);
 
-	IORecursiveLockUnlock(g_lock);
-	
-    // init power state management & set state as PowerOn
-    PMinit();
-    registerPowerDriver(this, powerStateArray, kPowerStateCount);
-	provider->joinPMtree(this);
+	// unsolicited responses arrive through the RIRB, so only with CORB/RIRB transport
+	bool unsolicited = false;
+	if (mConfiguration->getUnsolicitedEvents())
+	{
+		registerUnsolicitedTags();
+		unsolicited = mIntelHDA->enableUnsolicited(true);
+		if (!unsolicited)
+			AlwaysLog("Unsolicited Events requires Command Mode DMA, events will not be handled\n");
+	}
 
-	// no need to start timer unless "Check Infinitely" is enabled
-	if (mConfiguration->getCheckInfinite())
+	updateStatisticsProperties();
+
+	// timers are set up before power management, which may call setPowerState right away
+	mWorkLoop = IOWorkLoop::workLoop();
+	if (!mWorkLoop)
 	{
-		DebugLog("Infinite workloop requested, will start now!\n");
+		stop(provider);
+		return false;
+	}
 
-		// setup workloop and timer
-		mWorkLoop = IOWorkLoop::workLoop();
+	// setup timer for the part of wake that waits for Send Delay
+	mWakeTimer = IOTimerEventSource::timerEventSource(this,
+												  OSMemberFunctionCast(IOTimerEventSource::Action, this,
+												  &CodecCommander::onWakeTimer));
+	if (!mWakeTimer || mWorkLoop->addEventSource(mWakeTimer) != kIOReturnSuccess)
+	{
+		stop(provider);
+		return false;
+	}
+
+	if (mConfiguration->getCheckInfinite())
+	{
+		// setup timer polling the IOAudioDevice power state, armed while one is attached
 		mTimer = IOTimerEventSource::timerEventSource(this,
 													  OSMemberFunctionCast(IOTimerEventSource::Action, this,
 													  &CodecCommander::onTimerAction));
-		if (!mWorkLoop || !mTimer)
+		if (!mTimer || mWorkLoop->addEventSource(mTimer) != kIOReturnSuccess)
 		{
 			stop(provider);
 			return false;
 		}
+	}
+
+	if (unsolicited)
+	{
+		DebugLog("Unsolicited events requested, RIRB will be polled every %d ms while awake\n", mConfiguration->getUnsolicitedInterval());
 
-		if (mWorkLoop->addEventSource(mTimer) != kIOReturnSuccess)
+		// setup timer, armed when codec is awake (no access to the controller's interrupt)
+		mUnsolicitedTimer = IOTimerEventSource::timerEventSource(this,
+													  OSMemberFunctionCast(IOTimerEventSource::Action, this,
+													  &CodecCommander::onUnsolicitedAction));
+		if (!mUnsolicitedTimer)
+		{
+			stop(provider);
+			return false;
+		}
+
+		if (mWorkLoop->addEventSource(mUnsolicitedTimer) != kIOReturnSuccess)
+		{
+			stop(provider);
+			return false;
+		}
+	}
+
+    // init power state management & set state as PowerOn
+    PMinit();
+    registerPowerDriver(this, powerStateArray, kPowerStateCount);
+	provider->joinPMtree(this);
+
+	if (mConfiguration->getCheckInfinite())
+	{
+		DebugLog("Following IOAudioDevice power state changes\n");
+
+		// AppleHDA usually publishes its IOAudioDevice after CodecCommander has started
+		OSDictionary* matching = serviceMatching("IOAudioDevice");
+		if (matching)
+		{
+			mAudioDevicePublished = addMatchingNotification(gIOFirstPublishNotification, matching,
+															&CodecCommander::audioDeviceNotification, this,
+															(void*)gIOFirstPublishNotification);
+			mAudioDeviceTerminated = addMatchingNotification(gIOTerminatedNotification, matching,
+															 &CodecCommander::audioDeviceNotification, this,
+															 (void*)gIOTerminatedNotification);
+			matching->release();
+		}
+		if (!mAudioDevicePublished || !mAudioDeviceTerminated)
 		{
 			stop(provider);
 			return false;
@@ -296,17 +458,53 @@ void CodecCommander::stop(IOService *provider)
 {
     DebugLog("Stopping...\n");
 
+    PMstop();
+
+	// No more IOAudioDevice power state changes
+	if (mAudioDevicePublished)
+		mAudioDevicePublished->remove();
+	mAudioDevicePublished = NULL;
+	if (mAudioDeviceTerminated)
+		mAudioDeviceTerminated->remove();
+	mAudioDeviceTerminated = NULL;
+	if (mWorkLoop && mAudioDevice)
+		mWorkLoop->runAction(&CodecCommander::detachAudioDeviceAction, this, mAudioDevice);
+
+	// Run queued commands and power state changes while their timers and codecs are still there
+	if (mVerbQueue)
+		mVerbQueue->stop();
+
     // if workloop is active - release it
 	if (mTimer)
 		mTimer->cancelTimeout();
 	if (mWorkLoop && mTimer)
 		mWorkLoop->removeEventSource(mTimer);
-    OSSafeReleaseNULL(mTimer);// disable outstanding calls
+	OSSafeReleaseNULL(mTimer);
+	if (mUnsolicitedTimer)
+		mUnsolicitedTimer->cancelTimeout();
+	if (mWorkLoop && mUnsolicitedTimer)
+		mWorkLoop->removeEventSource(mUnsolicitedTimer);
+	OSSafeReleaseNULL(mUnsolicitedTimer);
+	if (mWakeTimer)
+		mWakeTimer->cancelTimeout();
+	if (mWorkLoop && mWakeTimer)
+		mWorkLoop->removeEventSource(mWakeTimer);
+	OSSafeReleaseNULL(mWakeTimer);
+	OSSafeReleaseNULL(mDeferredAck);
     OSSafeReleaseNULL(mWorkLoop);
+
+	delete mVerbQueue;
+	mVerbQueue = NULL;
 	
-    PMstop();
-	
-	// Free IntelHDA engine
+	// Free other codecs, then IntelHDA engine
+	delete mCodecManager;
+	mCodecManager = NULL;
+	for (int address = 0; address < HDA_MAX_CODECS; address++)
+	{
+		if (mClaimedCodecs & (1 << address))
+			mIntelHDA->releaseCodec(address);
+	}
+	mClaimedCodecs = 0;
 	delete mIntelHDA;
 	mIntelHDA = NULL;
 	
@@ -315,48 +513,290 @@ void CodecCommander::stop(IOService *provider)
 	mConfiguration = NULL;
 	
 	OSSafeReleaseNULL(mEAPDCapableNodes);
-	OSSafeReleaseNULL(mAudioDevice);
 	mProvider = NULL;
 
+	// user clients were stopped (and unregistered) before us, nothing posts events anymore
+	if (mEventLock)
+		IOLockFree(mEventLock);
+	mEventLock = NULL;
+
     super::stop(provider);
 }
 
+// Actions run on the verb queue thread (see VerbQueue::runAction)
+
+// each sets the source its commands are traced with (VerbTrace.h)
+
+static UInt32 setEAPDAction(void* target, void* logicLevel, void* source, void*)
+{
+	((CodecManager*)target)->setTraceSource((UInt8)(uintptr_t)source);
+	return ((CodecManager*)target)->setEAPD((UInt8)(uintptr_t)logicLevel);
+}
+
+static UInt32 customCommandsAction(void* target, void* newState, void*, void*)
+{
+	static const UInt8 sources[kStateCount] = { kVerbTraceSleep, kVerbTraceWake, kVerbTraceInit };
+	((CodecManager*)target)->setTraceSource(sources[(uintptr_t)newState]);
+	return ((CodecManager*)target)->customCommands((CodecCommanderState)(uintptr_t)newState);
+}
+
+static UInt32 resetCodecsAction(void* target, void* source, void*, void*)
+{
+	((CodecManager*)target)->setTraceSource((UInt8)(uintptr_t)source);
+	return ((CodecManager*)target)->resetCodecs();
+}
+
+static UInt32 checkSettingsResetAction(void* target, void*, void*, void*)
+{
+	((CodecManager*)target)->setTraceSource(kVerbTraceWake);
+	return ((CodecManager*)target)->checkSettingsReset();
+}
+
+static UInt32 getUnsolicitedAction(void* target, void* responses, void* max, void*)
+{
+	((IntelHDA*)target)->setTraceSource(kVerbTraceEvent);
+	return ((IntelHDA*)target)->getUnsolicited((UInt32*)responses, (UInt32)(uintptr_t)max);
+}
+
+static UInt32 executeCommandAction(void* target, void* command, void*, void*)
+{
+	((IntelHDA*)target)->setTraceSource(kVerbTraceUser);
+	return ((IntelHDA*)target)->sendCommand((UInt32)(uintptr_t)command);
+}
+
+static UInt32 executeCommandsAction(void* target, void* commands, void* responses, void* count)
+{
+	((IntelHDA*)target)->setTraceSource(kVerbTraceUser);
+	return ((IntelHDA*)target)->sendCommands((const UInt32*)commands, (UInt32*)responses, (UInt32)(uintptr_t)count);
+}
+
+static UInt32 dumpCodecAction(void* target, void* buffer, void* size, void*)
+{
+	((IntelHDA*)target)->setTraceSource(kVerbTraceUser);
+	return ((IntelHDA*)target)->dumpCodec(buffer, (UInt32)(uintptr_t)size);
+}
+
+// power state of a function group node, or pin sense of a pin
+static UInt32 getEventStateAction(void* target, void* node, void* functionGroup, void*)
+{
+	IntelHDA* intelHDA = (IntelHDA*)target;
+	UInt8 nodeId = (UInt8)(uintptr_t)node;
+	intelHDA->setTraceSource(kVerbTraceEvent);
+	UInt32 groupType = intelHDA->sendCommand(nodeId, HDA_VERB_GET_PARAM, HDA_PARM_FUNCGRP);
+	if ((UInt32)-1 == groupType)
+		return -1;
+	*(bool*)functionGroup = groupType & 0xFF;
+	return *(bool*)functionGroup ? intelHDA->sendCommand(nodeId, HDA_VERB_GET_PSTATE, HDA_PARM_NULL) :
+		intelHDA->sendCommand(nodeId, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+}
+
+/******************************************************************************
+ * CodecCommander::audioDeviceNotification - AppleHDA's IOAudioDevice published or terminated
+ ******************************************************************************/
+bool CodecCommander::audioDeviceNotification(void* target, void* refCon, IOService* newService, IONotifier* notifier)
+{
+	CodecCommander* self = (CodecCommander*)target;
+
+	// only the IOAudioDevice driving this codec
+	IORegistryEntry* entry = newService;
+	while (entry && entry != self->mProvider)
+		entry = entry->getParentEntry(gIOServicePlane);
+	if (!entry)
+		return true;
+
+	self->mWorkLoop->runAction(refCon == gIOTerminatedNotification ?
+							   &CodecCommander::detachAudioDeviceAction : &CodecCommander::attachAudioDeviceAction,
+							   self, newService);
+	return true;
+}
+
+IOReturn CodecCommander::attachAudioDeviceAction(OSObject* owner, void* audioDevice, void*, void*, void*)
+{
+	CodecCommander* self = (CodecCommander*)owner;
+	IOAudioDevice* device = OSDynamicCast(IOAudioDevice, (OSObject*)audioDevice);
+	if (!device || self->mAudioDevice)
+		return kIOReturnSuccess;
+
+	device->retain();
+	self->mAudioDevice = device;
+	device->registerInterestedDriver(self);
+	DebugLog("Following power state changes of IOAudioDevice %s\n", device->getName());
+
+	// it is published once initialized, start from the state it is in now
+	self->mPolledPowerState = device->getPowerState();
+	self->deferAudioDeviceState(NULL, self->mPolledPowerState);
+
+	// idle sleep (fugue state) goes through IOAudioDevice's own power state changes,
+	// which power management notifications don't see, so poll for those
+	if (self->mTimer)
+		self->mTimer->setTimeoutMS(self->mConfiguration->getCheckInterval());
+	return kIOReturnSuccess;
+}
+
+IOReturn CodecCommander::detachAudioDeviceAction(OSObject* owner, void* audioDevice, void*, void*, void*)
+{
+	CodecCommander* self = (CodecCommander*)owner;
+	if (!audioDevice || audioDevice != self->mAudioDevice)
+		return kIOReturnSuccess;
+
+	DebugLog("IOAudioDevice %s gone\n", self->mAudioDevice->getName());
+	if (self->mTimer)
+		self->mTimer->cancelTimeout();
+	self->mAudioDevice->deRegisterInterestedDriver(self);
+	OSSafeReleaseNULL(self->mAudioDevice);
+	return kIOReturnSuccess;
+}
+
 /******************************************************************************
- * CodecCommander::onTimerAction - repeats the action each time timer fires
+ * CodecCommander::onTimerAction - poll IOAudioDevice power state every Check Interval
  ******************************************************************************/
 void CodecCommander::onTimerAction()
 {
+	if (!mAudioDevice)
+		return;
 	mTimer->setTimeoutMS(mConfiguration->getCheckInterval());
 
-	IOAudioDevice* audioDevice = getAudioDevice();
-	if (!audioDevice)
+	// check if hda codec is powered - we are monitoring ocurrences of fugue state
+	IOAudioDevicePowerState powerState = mAudioDevice->getPowerState();
+	if (powerState != mPolledPowerState)
+	{
+		// the verb queue ignores changes it has already seen through notifications
+		mPolledPowerState = powerState;
+		deferAudioDeviceState(NULL, powerState);
+	}
+}
+
+/******************************************************************************
+ * CodecCommander::powerStateWillChangeTo/powerStateDidChangeTo - IOAudioDevice power state changes
+ ******************************************************************************/
+IOReturn CodecCommander::powerStateWillChangeTo(IOPMPowerFlags capabilities, unsigned long stateNumber, IOService* whatDevice)
+{
+	// power down EAPDs properly, while the codec still has power
+	if (!whatDevice || whatDevice != mAudioDevice || (capabilities & kIOPMDeviceUsable))
+		return IOPMAckImplied;
+	return deferAudioDeviceState(whatDevice, kIOAudioDeviceSleep);
+}
+
+IOReturn CodecCommander::powerStateDidChangeTo(IOPMPowerFlags capabilities, unsigned long stateNumber, IOService* whatDevice)
+{
+	if (!whatDevice || whatDevice != mAudioDevice || !(capabilities & kIOPMDeviceUsable))
+		return IOPMAckImplied;
+	return deferAudioDeviceState(whatDevice, kIOAudioDeviceActive);
+}
+
+IOReturn CodecCommander::deferAudioDeviceState(IOService* audioDevice, IOAudioDevicePowerState powerState)
+{
+	// audioDevice (if any) is acknowledged once the state change has run
+	if (audioDevice)
+		audioDevice->retain();
+	if (mVerbQueue->submitAction(audioDeviceStateAction, this, (void*)(uintptr_t)powerState, audioDevice, NULL,
+								 audioDeviceStateDone, this, audioDevice))
+		// same bound as deferPowerState
+		return 1000 * 1000;
+
+	if (audioDevice)
+		audioDevice->release();
+	return IOPMAckImplied;
+}
+
+UInt32 CodecCommander::audioDeviceStateAction(void* target, void* powerState, void* audioDevice, void*)
+{
+	CodecCommander* self = (CodecCommander*)target;
+	IOAudioDevicePowerState newState = (IOAudioDevicePowerState)(uintptr_t)powerState;
+
+	// check if hda codec is powered - we are monitoring ocurrences of fugue state
+	// (Idle and Active both have power, only a change to or from Sleep matters)
+	if ((newState == kIOAudioDeviceSleep) == (self->mHDAPrevPowerState == kIOAudioDeviceSleep))
+		return 0;
+
+	DebugLog("Power state transition from %s to %s recorded.\n",
+			 getPowerState(self->mHDAPrevPowerState), getPowerState(newState));
+	self->mHDAPrevPowerState = newState;
+
+	// notify about codec power loss state
+	if (newState == kIOAudioDeviceSleep)
+	{
+		DebugLog("HDA codec lost power\n");
+		stateChangeAction(self, (void*)(uintptr_t)kIOAudioDeviceSleep, NULL, NULL); // power down EAPDs properly
+		// 1 when acknowledged later, by the sleep retrying EAPD
+		return self->deferAcknowledge((IOService*)audioDevice, true);
+	}
+	// if no power after semi-sleep (fugue) state and power was restored - set EAPD bit
+	else
+	{
+		DebugLog("--> hda codec power restored\n");
+		stateChangeAction(self, (void*)(uintptr_t)kIOAudioDeviceActive, NULL, NULL);
+	}
+	return 0;
+}
+
+void CodecCommander::audioDeviceStateDone(void* owner, void* refcon, UInt32 result)
+{
+	IOService* audioDevice = (IOService*)refcon;
+	if (audioDevice && !result)
+	{
+		audioDevice->acknowledgePowerChange((CodecCommander*)owner);
+		audioDevice->release();
+	}
+}
+
+/******************************************************************************
+ * CodecCommander::onUnsolicitedAction - dispatches unsolicited responses received since last time
+ ******************************************************************************/
+void CodecCommander::onUnsolicitedAction()
+{
+	UInt32 responses[8];
+	UInt32 count, total = 0;
+	do
+	{
+		count = mVerbQueue->runAction(getUnsolicitedAction, mIntelHDA, responses, (void*)(uintptr_t)arrsize(responses));
+
+		for (UInt32 i = 0; i < count; i++)
+			dispatchUnsolicited(responses[i]);
+		total += count;
+	} while (count == arrsize(responses));
+
+	if (total)
+		updateStatisticsProperties();
+
+	mUnsolicitedTimer->setTimeoutMS(mConfiguration->getUnsolicitedInterval());
+}
+
+/******************************************************************************
+ * CodecCommander::dispatchUnsolicited - handles one unsolicited response
+ ******************************************************************************/
+void CodecCommander::dispatchUnsolicited(UInt32 response)
+{
+	UInt8 tag = HDA_UNSOL_TAG(response);
+	UInt8 node = mUnsolicitedNodes[tag];
+	if (!node)
+	{
+		DebugLog("Unsolicited response 0x%08x with unregistered tag %d\n", response, tag);
 		return;
+	}
 
-    // check if hda codec is powered - we are monitoring ocurrences of fugue state
-	IOAudioDevicePowerState powerState = audioDevice->getPowerState();
-	
-	// if hda codec changed power state
-	if (powerState != mHDAPrevPowerState)
-	{
-		DebugLog("Power state transition from %s to %s recorded.\n",
-				  getPowerState(mHDAPrevPowerState), getPowerState(powerState));
-		
-		// store current power state as previous state for next workloop cycle
-		mHDAPrevPowerState = powerState;
-		
-		// notify about codec power loss state
-		if (powerState == kIOAudioDeviceSleep)
-		{
-			DebugLog("HDA codec lost power\n");
-			handleStateChange(kIOAudioDeviceSleep); // power down EAPDs properly
-		}
+	bool functionGroup = false;
+	UInt32 state = mVerbQueue->runAction(getEventStateAction, mIntelHDA, (void*)(uintptr_t)node, &functionGroup);
+	if ((UInt32)-1 == state)
+		return;
 
-		// if no power after semi-sleep (fugue) state and power was restored - set EAPD bit
-		if (powerState != kIOAudioDeviceSleep)
-		{
-			DebugLog("--> hda codec power restored\n");
-			handleStateChange(kIOAudioDeviceActive);
-		}
+	if (functionGroup)
+	{
+		// power event, handled like a power state transition of the IOAudioDevice
+		bool powered = HDA_PSTATE_ACTUAL(state) < HDA_PARM_PS_D3_HOT;
+		DebugLog("Power event on node 0x%02x, codec now in D%d\n", node, HDA_PSTATE_ACTUAL(state));
+		if (!powered && !mEAPDPoweredDown)
+			changeState(kIOAudioDeviceSleep);
+		else if (powered && mEAPDPoweredDown)
+			changeState(kIOAudioDeviceActive);
+	}
+	else
+	{
+		// jack event, some codecs drop EAPD when a jack is plugged or removed
+		DebugLog("Jack event on node 0x%02x, %s\n", node, HDA_PIN_SENSE_PRESENCE(state) ? "plugged" : "unplugged");
+		postEvent(kCodecEventJack, HDA_PIN_SENSE_PRESENCE(state) ? 1 : 0, node);
+		if (!mEAPDPoweredDown && mConfiguration->getUpdateNodes())
+			setEAPD(0x02, kVerbTraceEvent);
 	}
 }
 
@@ -365,44 +805,195 @@ void CodecCommander::onTimerAction()
  ******************************************************************************/
 void CodecCommander::handleStateChange(IOAudioDevicePowerState newState)
 {
+	// a step still waiting for Send Delay is superseded by any later change
+	cancelDeferredStep();
+
 	switch (newState)
 	{
 		case kIOAudioDeviceSleep:
 			mColdBoot = false;
 			if (mConfiguration->getSleepNodes())
 			{
-				if (!setEAPD(0x00) && mConfiguration->getPerformResetOnEAPDFail())
+				if (!setEAPD(0x00, kVerbTraceSleep) && mConfiguration->getPerformResetOnEAPDFail())
 				{
 					AlwaysLog("BLURP! setEAPD(0x00) failed... attempt fix with codec reset\n");
-					performCodecReset();
-					setEAPD(0x00);
+					performCodecReset(kVerbTraceSleep);
+					// retried from the timer, the verb queue goes on meanwhile
+					deferStep(kDeferredSleepRetry, mCodecManager->getSendDelay());
+					break;
 				}
 			}
-
-			customCommands(kStateSleep);
-			mEAPDPoweredDown = true;
+			finishSleep();
 			break;
 
 		case kIOAudioDeviceIdle:	// note kIOAudioDeviceIdle is not used
 		case kIOAudioDeviceActive:
 			mIntelHDA->applyIntelTCSEL();
-			
-			if (mConfiguration->getUpdateNodes())
+
+			// writes can only be skipped while the codecs keep what was written
+			mVerbQueue->runAction(checkSettingsResetAction, mCodecManager);
+
+			// some codecs will produce loud pop when EAPD is enabled too soon, need custom delay until codec inits
+			// (one delay for all codecs driven here: the longest any of them asks for). The rest of
+			// the wake runs from a timer, so neither power management nor the verb queue waits for it.
+			if (UInt16 delay = mConfiguration->getUpdateNodes() ? mCodecManager->getSendDelay() : 0)
 			{
-				if (!setEAPD(0x02) && mConfiguration->getPerformResetOnEAPDFail())
-				{
-					AlwaysLog("BLURP! setEAPD(0x02) failed... attempt fix with codec reset\n");
-					performCodecReset();
-					setEAPD(0x02);
-				}
+				deferStep(kDeferredWake, delay);
+				break;
 			}
+			finishWake();
+			break;
+	}
 
-			if (!mColdBoot)
-				customCommands(kStateWake);
+	updateStatisticsProperties();
+}
 
-			mEAPDPoweredDown = false;
-			break;
+/******************************************************************************
+ * CodecCommander::finishSleep - custom commands of a sleep, after EAPD
+ ******************************************************************************/
+void CodecCommander::finishSleep()
+{
+	customCommands(kStateSleep);
+	mEAPDPoweredDown = true;
+	postEvent(kCodecEventSleep);
+}
+
+/******************************************************************************
+ * CodecCommander::finishWake - EAPD and custom commands of a wake, after Send Delay
+ ******************************************************************************/
+void CodecCommander::finishWake(bool retry)
+{
+	if (mConfiguration->getUpdateNodes())
+	{
+		if (!setEAPD(0x02, kVerbTraceWake) && !retry && mConfiguration->getPerformResetOnEAPDFail())
+		{
+			AlwaysLog("BLURP! setEAPD(0x02) failed... attempt fix with codec reset\n");
+			performCodecReset(kVerbTraceWake);
+			// retried from the timer, the verb queue goes on meanwhile
+			deferStep(kDeferredWakeRetry, mCodecManager->getSendDelay());
+			return;
+		}
 	}
+
+	if (!mColdBoot)
+		customCommands(kStateWake);
+
+	mEAPDPoweredDown = false;
+	postEvent(kCodecEventWake);
+}
+
+/******************************************************************************
+ * CodecCommander::deferStep - continue a state change on mWakeTimer after delay ms
+ ******************************************************************************/
+void CodecCommander::deferStep(DeferredStep step, UInt16 delay)
+{
+	clock_interval_to_deadline(delay, kMillisecondScale, &mWakeDeadline);
+	mDeferredStep = step;
+	mWakeTimer->setTimeoutMS(delay);
+}
+
+/******************************************************************************
+ * CodecCommander::cancelDeferredStep - drop a step still waiting for Send Delay
+ ******************************************************************************/
+void CodecCommander::cancelDeferredStep()
+{
+	DeferredStep step = mDeferredStep;
+	if (step == kDeferredNone)
+		return;
+
+	mDeferredStep = kDeferredNone;
+	mWakeTimer->cancelTimeout();
+	if (step == kDeferredSleepRetry)
+	{
+		// EAPD stays as the failed write left it, the rest of the sleep is done now
+		DebugLog("EAPD retry cancelled, finishing sleep\n");
+		finishSleep();
+		acknowledgeDeferred();
+	}
+	else
+		DebugLog("Wake cancelled before Send Delay elapsed\n");
+}
+
+/******************************************************************************
+ * CodecCommander::deferAcknowledge - keep a power change unacknowledged until a deferred sleep is done
+ ******************************************************************************/
+bool CodecCommander::deferAcknowledge(IOService* service, bool powerChange)
+{
+	// the codec must still have power when EAPD is retried
+	if (!service || mDeferredStep != kDeferredSleepRetry || mDeferredAck)
+		return false;
+
+	mDeferredAck = service;
+	mDeferredAckChange = powerChange;
+	return true;
+}
+
+void CodecCommander::acknowledgeDeferred()
+{
+	if (!mDeferredAck)
+		return;
+
+	if (mDeferredAckChange)
+		mDeferredAck->acknowledgePowerChange(this);
+	else
+		mDeferredAck->acknowledgeSetPowerState();
+	OSSafeReleaseNULL(mDeferredAck);
+}
+
+/******************************************************************************
+ * CodecCommander::onWakeTimer - Send Delay elapsed, finish the state change on the verb queue thread
+ ******************************************************************************/
+void CodecCommander::onWakeTimer()
+{
+	mVerbQueue->runAction(wakeTimerAction, this);
+}
+
+UInt32 CodecCommander::wakeTimerAction(void* target, void*, void*, void*)
+{
+	CodecCommander* self = (CodecCommander*)target;
+
+	// cancelled, or armed again for later while this timer was on its way
+	UInt64 now;
+	clock_get_uptime(&now);
+	DeferredStep step = self->mDeferredStep;
+	if (step == kDeferredNone || now < self->mWakeDeadline)
+		return 0;
+
+	self->mDeferredStep = kDeferredNone;
+	if (step == kDeferredSleepRetry)
+	{
+		self->setEAPD(0x00, kVerbTraceSleep);
+		self->finishSleep();
+		self->acknowledgeDeferred();
+	}
+	else
+		self->finishWake(step == kDeferredWakeRetry);
+	self->updateStatisticsProperties();
+	return 0;
+}
+
+/******************************************************************************
+ * CodecCommander::changeState - run a state change seen on the workloop on the verb queue thread
+ ******************************************************************************/
+void CodecCommander::changeState(IOAudioDevicePowerState newState)
+{
+	mVerbQueue->runAction(stateChangeAction, this, (void*)(uintptr_t)newState);
+}
+
+UInt32 CodecCommander::stateChangeAction(void* target, void* newState, void*, void*)
+{
+	CodecCommander* self = (CodecCommander*)target;
+	IOAudioDevicePowerState state = (IOAudioDevicePowerState)(uintptr_t)newState;
+
+	// EAPD still reads as powered down while a wake waits for Send Delay, that wake covers this
+	// (and a sleep waiting to retry EAPD covers another sleep)
+	if (state == kIOAudioDeviceActive && (self->mDeferredStep == kDeferredWake || self->mDeferredStep == kDeferredWakeRetry))
+		return 0;
+	if (state == kIOAudioDeviceSleep && self->mDeferredStep == kDeferredSleepRetry)
+		return 0;
+
+	self->handleStateChange(state);
+	return 0;
 }
 
 /******************************************************************************
@@ -410,62 +1001,134 @@ void CodecCommander::handleStateChange(IOAudioDevicePowerState newState)
  ******************************************************************************/
 void CodecCommander::customCommands(CodecCommanderState newState)
 {
-	UInt32 layoutID = mIntelHDA->getLayoutID();
-
-	IORecursiveLockLock(g_lock);
+	mVerbQueue->runAction(customCommandsAction, mCodecManager, (void*)(uintptr_t)newState);
+}
 
-	OSArray* commands = mConfiguration->getCustomCommands();
-	unsigned count = commands->getCount();
-	for (unsigned i = 0; i < count; i++)
+/******************************************************************************
+ * CodecCommander::addManagedCodecs - drive codecs in mask that have no CodecCommander of their own
+ ******************************************************************************/
+void CodecCommander::addManagedCodecs(UInt16 mask)
+{
+	// find the IOHDACodecFunction of each codec on this controller
+	IORegistryEntry* functions[HDA_MAX_CODECS] = {};
+	IOPCIDevice* device = mIntelHDA->getPCIDevice();
+	IORegistryIterator* iter = device ? IORegistryIterator::iterateOver(device, gIOServicePlane, kIORegistryIterateRecursively) : NULL;
+	if (iter)
 	{
-		OSData* data = (OSData*)commands->getObject(i);
-		CustomCommand* customCommand = (CustomCommand*)data->getBytesNoCopy();
+		while (IORegistryEntry* entry = iter->getNextObject())
+		{
+			if (!OSDynamicCast(OSNumber, entry->getProperty(kCodecSubsystemID)))
+				continue;
+			OSNumber* address = OSDynamicCast(OSNumber, entry->getProperty(kCodecAddress));
+			IORegistryEntry* parent = entry->getParentEntry(gIOServicePlane);
+			if (!address && parent)
+				address = OSDynamicCast(OSNumber, parent->getProperty(kCodecAddress));
+			if (address && address->unsigned32BitValue() < HDA_MAX_CODECS)
+				functions[address->unsigned32BitValue()] = entry;
+		}
+		iter->release();
+	}
 
-		if (((customCommand->OnInit && (newState == kStateInit)) ||
-			(customCommand->OnWake && (newState == kStateWake)) ||
-			(customCommand->OnSleep && (newState == kStateSleep))) &&
-			(-1 == customCommand->layoutID || layoutID == customCommand->layoutID))
+	// Only published codecs, claimed before probing: a CodecCommander starting on one
+	// of them meanwhile backs off, codecs with a CodecCommander of their own are skipped.
+	for (int address = 0; address < HDA_MAX_CODECS; address++)
+	{
+		if (!(mask & (1 << address)))
+			continue;
+		if (!functions[address])
 		{
-			for (int i = 0; i < customCommand->CommandCount; i++)
-			{
-				DebugLog("--> custom command 0x%08x\n", customCommand->Commands[i]);
-				executeCommand(customCommand->Commands[i]);
-			}
+			DebugLog("Codec %d is not published (yet), not added\n", address);
+			mask &= ~(1 << address);
+		}
+		else if (!mIntelHDA->claimCodec(address))
+		{
+			DebugLog("Codec %d has its own CodecCommander\n", address);
+			mask &= ~(1 << address);
 		}
 	}
 
-	IORecursiveLockUnlock(g_lock);
+	UInt16 added = mCodecManager->addCodecs(mask, this->getProperty(kCodecProfile), kCodecCommanderKey, mProvider);
+	mClaimedCodecs |= added;
+
+	for (int address = 0; address < HDA_MAX_CODECS; address++)
+	{
+		if (added & (1 << address))
+			// shows in ioreg who drives the codec
+			functions[address]->setProperty(kCodecManagedBy, mIntelHDA->getCodecAddress(), 32);
+		else if (mask & (1 << address))
+			mIntelHDA->releaseCodec(address);
+	}
 }
 
 /******************************************************************************
- * CodecCommander::setOutputs - set EAPD status bit on SP/HP
+ * CodecCommander::findCodecCommander - CodecCommander attached to an IOHDACodecFunction
  ******************************************************************************/
-bool CodecCommander::setEAPD(UInt8 logicLevel)
+CodecCommander* CodecCommander::findCodecCommander(IORegistryEntry* function)
 {
-    // some codecs will produce loud pop when EAPD is enabled too soon, need custom delay until codec inits
-    IOSleep(mConfiguration->getSendDelay());
+	// look at children for CodecCommander instance
+	OSIterator* iter = function->getChildIterator(gIOServicePlane);
+	if (!iter)
+	{
+		DebugLog("can't get child iterator\n");
+		return NULL;
+	}
+	CodecCommander* result = NULL;
+	while (OSObject* entry = iter->getNextObject())
+	{
+		result = OSDynamicCast(CodecCommander, entry);
+		if (result)
+			break;
+	}
+	iter->release();
+	return result;
+}
 
-	IORecursiveLockLock(g_lock);
+/******************************************************************************
+ * CodecCommander::registerUnsolicitedTags - find tags enabled by SET_UNSOLICITED_ENABLE custom commands
+ ******************************************************************************/
+void CodecCommander::registerUnsolicitedTags()
+{
+	UInt32 layoutID = mConfiguration->getLayoutID();
 
-    // for nodes supporting EAPD bit 1 in logicLevel defines EAPD logic state: 1 - enable, 0 - disable
-	unsigned count = mEAPDCapableNodes->getCount();
-	bool result = true;
+	OSArray* commands = mConfiguration->getCustomCommands();
+	unsigned count = commands->getCount();
 	for (unsigned i = 0; i < count; i++)
 	{
-		OSNumber* nodeId = (OSNumber*)mEAPDCapableNodes->getObject(i);
-		if (-1 == mIntelHDA->sendCommand(nodeId->unsigned8BitValue(), HDA_VERB_EAPDBTL_SET, logicLevel))
-			result = false;
-	}
+		OSData* data = (OSData*)commands->getObject(i);
+		CustomCommand* customCommand = (CustomCommand*)data->getBytesNoCopy();
+		if ((UInt32)-1 != customCommand->layoutID && layoutID != customCommand->layoutID)
+			continue;
 
-	IORecursiveLockUnlock(g_lock);
+		for (unsigned j = 0; j < customCommand->CommandCount; j++)
+		{
+			UInt32 command = customCommand->Commands[j];
+			if (((command >> 8) & 0xFFF) != HDA_VERB_SET_UNSOLICITED_ENABLE || !HDA_UNSOL_ENABLED(command))
+				continue;
+			UInt8 node = (command >> 20) & 0xFF;
+			UInt8 tag = HDA_UNSOL_ENABLE_TAG(command);
+			if (mUnsolicitedNodes[tag] && mUnsolicitedNodes[tag] != node)
+				AlwaysLog("Unsolicited tag %d used by nodes 0x%02x and 0x%02x, events go to 0x%02x\n", tag, mUnsolicitedNodes[tag], node, node);
+			mUnsolicitedNodes[tag] = node;
+			DebugLog("Unsolicited tag %d registered for node 0x%02x\n", tag, node);
+		}
+	}
+}
 
+/******************************************************************************
+ * CodecCommander::setOutputs - set EAPD status bit on SP/HP
+ ******************************************************************************/
+bool CodecCommander::setEAPD(UInt8 logicLevel, UInt8 source)
+{
+	bool result = mVerbQueue->runAction(setEAPDAction, mCodecManager, (void*)(uintptr_t)logicLevel, (void*)(uintptr_t)source);
+	if (!result)
+		postEvent(kCodecEventEAPDFailed, logicLevel);
 	return result;
 }
 
 /******************************************************************************
  * CodecCommander::performCodecReset - reset function group and set power to D3
  *****************************************************************************/
-void CodecCommander::performCodecReset()
+void CodecCommander::performCodecReset(UInt8 source)
 {
 	/*
      This function can be used to reset codec on dekstop boards, for example H87-HD3,
@@ -474,10 +1137,9 @@ void CodecCommander::performCodecReset()
 
     if (!mColdBoot)
 	{
-		IORecursiveLockLock(g_lock);
-		mIntelHDA->resetCodec();
+		mVerbQueue->runAction(resetCodecsAction, mCodecManager, (void*)(uintptr_t)source);
         mEAPDPoweredDown = true;
-		IORecursiveLockUnlock(g_lock);
+		postEvent(kCodecEventCodecReset);
     }
 }
 
@@ -488,10 +1150,74 @@ IOReturn CodecCommander::setPowerState(unsigned long powerStateOrdinal, IOServic
 {
 	DebugLog("setPowerState %ld\n", powerStateOrdinal);
 
+	return deferPowerState(this, powerStateOrdinal, false);
+}
+
+IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal, IOService *policyMaker, IOService *service)
+{
+	DebugLog("setPowerStateExternal %ld\n", powerStateOrdinal);
+
+	return deferPowerState(service, powerStateOrdinal, true);
+}
+
+/******************************************************************************
+ * CodecCommander::deferPowerState - hand a power state change to the verb queue thread
+ ******************************************************************************/
+IOReturn CodecCommander::deferPowerState(IOService* service, unsigned long powerStateOrdinal, bool external)
+{
+	postEvent(kCodecEventPowerState, (UInt32)powerStateOrdinal);
+
+	// power management goes on with other drivers meanwhile, and is acknowledged when done
+	service->retain();
+	if (mVerbQueue && mVerbQueue->submitAction(powerStateAction, this, (void*)powerStateOrdinal, (void*)external, service,
+											   powerStateDone, service, NULL))
+	{
+		// longest it should take: a codec reset and the verbs (Send Delay is waited on a timer)
+		return 1000 * 1000;
+	}
+	service->release();
+
+	if (external)
+		changePowerStateExternal(powerStateOrdinal);
+	else
+		changePowerState(powerStateOrdinal);
+	return IOPMAckImplied;
+}
+
+UInt32 CodecCommander::powerStateAction(void* target, void* powerStateOrdinal, void* external, void* service)
+{
+	CodecCommander* self = (CodecCommander*)target;
+	if (external)
+		self->changePowerStateExternal((unsigned long)powerStateOrdinal);
+	else
+		self->changePowerState((unsigned long)powerStateOrdinal);
+
+	// 1 when acknowledged later, by the sleep retrying EAPD
+	return self->deferAcknowledge((IOService*)service, false);
+}
+
+void CodecCommander::powerStateDone(void* owner, void* refcon, UInt32 result)
+{
+	IOService* service = (IOService*)owner;
+	if (result)
+		return;
+	service->acknowledgeSetPowerState();
+	service->release();
+}
+
+/******************************************************************************
+ * CodecCommander::changePowerState - power state change, on the verb queue thread
+ ******************************************************************************/
+void CodecCommander::changePowerState(unsigned long powerStateOrdinal)
+{
 	switch (powerStateOrdinal)
 	{
 		case kPowerStateSleep:
 			DebugLog("--> asleep(%d)\n", (int)powerStateOrdinal);
+			if (mUnsolicitedTimer)
+				mUnsolicitedTimer->cancelTimeout();
+			// a wake still waiting for Send Delay never turned EAPD on
+			cancelDeferredStep();
 			if (!mEAPDPoweredDown)
 				// set EAPD logic level 0 to cause EAPD to power off properly
 				handleStateChange(kIOAudioDeviceSleep);
@@ -500,9 +1226,11 @@ IOReturn CodecCommander::setPowerState(unsigned long powerStateOrdinal, IOServic
 		case kPowerStateDoze:	// note kPowerStateDoze never happens
 		case kPowerStateNormal:
 			DebugLog("--> awake(%d)\n", (int)powerStateOrdinal);
+			if (mUnsolicitedTimer)
+				mUnsolicitedTimer->setTimeoutMS(mConfiguration->getUnsolicitedInterval());
 			if (mConfiguration->getPerformReset())
 				// issue codec reset at wake and cold boot
-				performCodecReset();
+				performCodecReset(kVerbTraceWake);
 
 			// when "Perform Reset"=false and "Perform Reset on External Wake"=true...
 			// we want power transitions, including setting EAPD to be handled
@@ -510,33 +1238,17 @@ IOReturn CodecCommander::setPowerState(unsigned long powerStateOrdinal, IOServic
 			if ((mConfiguration->getPerformReset() || !mConfiguration->getPerformResetOnExternalWake()) && mEAPDPoweredDown)
 				// set EAPD bit at wake or cold boot
 				handleStateChange(kIOAudioDeviceActive);
-
-			// if infinite checking requested
-			if (mConfiguration->getCheckInfinite())
-			{
-				// if checking infinitely then make sure to delay workloop
-				if (mColdBoot)
-					mTimer->setTimeoutMS(20000); // create a nasty 20sec delay for AudioEngineOutput to initialize
-				// if we are waking it will be already initialized
-				else
-					mTimer->setTimeoutMS(100); // so fire timer for workLoop almost immediately
-				
-				DebugLog("--> workloop started\n");
-			}
 			break;
 	}
-	
-    return IOPMAckImplied;
 }
 
-IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal, IOService *policyMaker)
+void CodecCommander::changePowerStateExternal(unsigned long powerStateOrdinal)
 {
-	DebugLog("setPowerStateExternal %ld\n", powerStateOrdinal);
-
 	switch (powerStateOrdinal)
 	{
 		case kPowerStateSleep:
 			DebugLog("--> asleep(%d)\n", (int)powerStateOrdinal);
+			cancelDeferredStep();
 			if (!mEAPDPoweredDown)
 				// set EAPD logic level 0 to cause EAPD to power off properly
 				handleStateChange(kIOAudioDeviceSleep);
@@ -547,15 +1259,13 @@ IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal,
 			DebugLog("--> awake(%d)\n", (int)powerStateOrdinal);
 			if (mEAPDPoweredDown && mConfiguration->getPerformResetOnExternalWake())
 				// issue codec reset at wake and cold boot
-				performCodecReset();
+				performCodecReset(kVerbTraceWake);
 
 			if (mEAPDPoweredDown)
 				// set EAPD bit at wake or cold boot
 				handleStateChange(kIOAudioDeviceActive);
 			break;
 	}
-
-	return IOPMAckImplied;
 }
 
 /******************************************************************************
@@ -563,10 +1273,141 @@ IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal,
  ******************************************************************************/
 UInt32 CodecCommander::executeCommand(UInt32 command)
 {
-	if (mIntelHDA)
-		return mIntelHDA->sendCommand(command);
-	
-	return -1;
+	if (!mIntelHDA || !mVerbQueue)
+		return -1;
+
+	// queued behind power management and timer commands
+	return mVerbQueue->sendCommand(mIntelHDA, command, VerbQueue::kPriorityClient);
+}
+
+/******************************************************************************
+ * CodecCommander::executeCommandAsync - Queue an external command, completion gets the response
+ ******************************************************************************/
+bool CodecCommander::executeCommandAsync(UInt32 command, VerbQueue::Completion completion, void* owner, void* refcon)
+{
+	if (!mIntelHDA || !mVerbQueue)
+		return false;
+
+	return mVerbQueue->submitAction(executeCommandAction, mIntelHDA, (void*)(uintptr_t)command, NULL, NULL,
+									completion, owner, refcon, VerbQueue::kPriorityClient);
+}
+
+/******************************************************************************
+ * CodecCommander::executeCommands - Execute external commands in one request
+ ******************************************************************************/
+UInt32 CodecCommander::executeCommands(const UInt32* commands, UInt32* responses, UInt32 count)
+{
+	if (!mIntelHDA || !mVerbQueue)
+	{
+		for (UInt32 i = 0; i < count; i++)
+			responses[i] = -1;
+		return 0;
+	}
+
+	// a driver request waits for at most the whole batch, not for each verb of it
+	return mVerbQueue->runAction(executeCommandsAction, mIntelHDA, (void*)commands, responses, (void*)(uintptr_t)count,
+								 VerbQueue::kPriorityClient);
+}
+
+/******************************************************************************
+ * CodecCommander::dumpCodec - Snapshot of the whole function group in one request
+ ******************************************************************************/
+UInt32 CodecCommander::dumpCodec(void* buffer, UInt32 size)
+{
+	if (!mIntelHDA || !mVerbQueue)
+		return 0;
+
+	return mVerbQueue->runAction(dumpCodecAction, mIntelHDA, buffer, (void*)(uintptr_t)size, NULL, VerbQueue::kPriorityClient);
+}
+
+/******************************************************************************
+ * CodecCommander::submitClientAction - Queue work of a user client
+ ******************************************************************************/
+bool CodecCommander::submitClientAction(VerbQueue::Action action, void* target, VerbQueue::Completion completion, void* owner, void* refcon)
+{
+	if (!mVerbQueue)
+		return false;
+
+	return mVerbQueue->submitAction(action, target, NULL, NULL, NULL, completion, owner, refcon, VerbQueue::kPriorityClient);
+}
+
+/******************************************************************************
+ * CodecCommander::setTracing - Turn the verb trace of the controller on or off
+ ******************************************************************************/
+bool CodecCommander::setTracing(bool enable)
+{
+	return mIntelHDA && mIntelHDA->setTracing(enable);
+}
+
+/******************************************************************************
+ * CodecCommander::readTrace - Copy verb trace entries (no need to wait for the verb queue)
+ ******************************************************************************/
+UInt32 CodecCommander::readTrace(UInt32* cursor, VerbTraceEntry* entries, UInt32 max, UInt32* dropped)
+{
+	*dropped = 0;
+	return mIntelHDA ? mIntelHDA->readTrace(cursor, entries, max, dropped) : 0;
+}
+
+/******************************************************************************
+ * CodecCommander::registerEvents - Add, change or remove a user client receiving events
+ ******************************************************************************/
+bool CodecCommander::registerEvents(CodecCommanderClient* client, UInt32 mask, OSAsyncReference64 reference)
+{
+	if (!mEventLock)
+		return false;
+
+	IOLockLock(mEventLock);
+	EventClient* slot = NULL;
+	for (int i = 0; i < kClientMaxEventClients; i++)
+	{
+		if (mEventClients[i].client == client)
+		{
+			slot = &mEventClients[i];
+			break;
+		}
+		if (!slot && !mEventClients[i].client && mask)
+			slot = &mEventClients[i];
+	}
+	if (slot && mask)
+	{
+		slot->client = client;
+		slot->mask = mask;
+		bcopy(reference, slot->reference, sizeof(OSAsyncReference64));
+	}
+	else if (slot)
+		slot->client = NULL;
+	IOLockUnlock(mEventLock);
+
+	return slot || !mask;
+}
+
+/******************************************************************************
+ * CodecCommander::postEvent - Send an event to the user clients registered for it
+ ******************************************************************************/
+void CodecCommander::postEvent(UInt32 event, UInt32 value, UInt8 node)
+{
+	if (!mEventLock)
+		return;
+
+	UInt64 now;
+	clock_get_uptime(&now);
+	absolutetime_to_nanoseconds(now, &now);
+
+	io_user_reference_t args[kCodecEventArgs];
+	args[kCodecEventArgType] = event;
+	args[kCodecEventArgValue] = value;
+	args[kCodecEventArgNode] = node;
+	args[kCodecEventArgCodec] = mIntelHDA ? mIntelHDA->getCodecAddress() : 0;
+	args[kCodecEventArgTime] = now;
+
+	// sending never blocks, the event is dropped if the client's queue is full
+	IOLockLock(mEventLock);
+	for (int i = 0; i < kClientMaxEventClients; i++)
+	{
+		if (mEventClients[i].client && (mEventClients[i].mask & kCodecEventMask(event)))
+			CodecCommanderClient::sendAsyncResult64(mEventClients[i].reference, kIOReturnSuccess, args, kCodecEventArgs);
+	}
+	IOLockUnlock(mEventLock);
 }
 
 /******************************************************************************
@@ -627,10 +1468,8 @@ bool CodecCommanderPowerHook::start(IOService *provider)
 	}
 
 	// load configuration based on codec
-	IORecursiveLockLock(g_lock);
 	IntelHDA intelHDA(provider, PIO);
 	Configuration config(this->getProperty(kCodecProfile), &intelHDA, kCodecCommanderPowerHookKey);
-	IORecursiveLockUnlock(g_lock);
 
 	// certain codecs are disabled (0x8086 for Intel HDMI, for example)
 	if (config.getDisable())
@@ -652,23 +1491,7 @@ bool CodecCommanderPowerHook::start(IOService *provider)
 		DebugLog("parent entry IOHDACodecFunction not found\n");
 		return false;
 	}
-	// look at children for CodecCommander instance
-	OSIterator* iter = entry->getChildIterator(gIOServicePlane);
-	if (!iter)
-	{
-		DebugLog("can't get child iterator\n");
-		return false;
-	}
-	while (OSObject* entry = iter->getNextObject())
-	{
-		CodecCommander* commander = OSDynamicCast(CodecCommander, entry);
-		if (commander)
-		{
-			mCodecCommander = commander;
-			break;
-		}
-	}
-	iter->release();
+	mCodecCommander = CodecCommander::findCodecCommander(entry);
 
 	// if no CodecCommander instance found, don't attach
 	if (!mCodecCommander)
@@ -700,7 +1523,7 @@ IOReturn CodecCommanderPowerHook::setPowerState(unsigned long powerStateOrdinal,
 	DebugLog("PowerHook: setPowerState %ld\n", powerStateOrdinal);
 
 	if (mCodecCommander)
-		return mCodecCommander->setPowerStateExternal(powerStateOrdinal, policyMaker);
+		return mCodecCommander->setPowerStateExternal(powerStateOrdinal, policyMaker, this);
 
 	return IOPMAckImplied;
 }
@@ -729,24 +1552,23 @@ IOService* CodecCommanderProbeInit::probe(IOService* provider, SInt32* score)
 		return NULL;
 	}
 
-	IORecursiveLockLock(g_lock);
-
+	// commands are serialized per controller by IntelHDA
 	IntelHDA intelHDA(provider, PIO);
 	DebugLog("ProbeInit2 codec(pre-init) 0x%08x\n", intelHDA.getCodecVendorId());
 
 	if (!intelHDA.initialize())
 	{
 		AlwaysLog("ProbeInit2 intelHDA.initialize failed\n");
-		IORecursiveLockUnlock(g_lock);
 		return NULL;
 	}
+	intelHDA.setTraceSource(kVerbTraceProbe);
+#ifdef DEBUG
+	intelHDA.setTracing(true);
+#endif
 
 	UInt32 layoutID = intelHDA.getLayoutID();
-	if (-1 == layoutID)
-	{
-		IORecursiveLockUnlock(g_lock);
+	if ((UInt32)-1 == layoutID)
 		return NULL;
-	}
 
 	DebugLog("ProbeInit2 codec 0x%08x\n", intelHDA.getCodecVendorId());
 
@@ -760,13 +1582,10 @@ IOService* CodecCommanderProbeInit::probe(IOService* provider, SInt32* score)
 	{
 		OSData* data = (OSData*)commands->getObject(i);
 		CustomCommand* customCommand = (CustomCommand*)data->getBytesNoCopy();
-		if (-1 == customCommand->layoutID || layoutID == customCommand->layoutID)
+		if ((UInt32)-1 == customCommand->layoutID || layoutID == customCommand->layoutID)
 		{
-			for (int i = 0; i < customCommand->CommandCount; i++)
-			{
-				DebugLog("--> custom probe command 0x%08x\n", customCommand->Commands[i]);
-				intelHDA.sendCommand(customCommand->Commands[i]);
-			}
+			DebugLog("--> custom probe command(s) (%d)\n", customCommand->CommandCount);
+			intelHDA.sendCommands(customCommand->Commands, NULL, customCommand->CommandCount);
 			commandsSent++;
 		}
 	}
@@ -774,8 +1593,10 @@ IOService* CodecCommanderProbeInit::probe(IOService* provider, SInt32* score)
 	if (commandsSent)
 		AlwaysLog("CodecCommanderProbeInit sent %d command(s) during probe (0x%08x)\n", commandsSent, intelHDA.getCodecVendorId());
 
-	// configure pin defaults from "PinConfigDefault"
+	// configure pin defaults from "PinConfigDefault" (four verbs per pin, sent in batches)
 	int pinConfigsSet = 0;
+	UInt32 pinCommands[64];
+	unsigned pinCommandCount = 0;
 	if (OSArray* pinConfigs = config.getPinConfigDefault())
 	{
 		count = pinConfigs->getCount();
@@ -792,17 +1613,22 @@ IOService* CodecCommanderProbeInit::probe(IOService* provider, SInt32* score)
 				if (!pins) continue;
 				unsigned count = pins->getCount();
 				if (count & 1) continue;
-				for (int i = 0; i < count; i += 2)
+				for (unsigned i = 0; i < count; i += 2)
 				{
 					UInt32 node = getNumberFromArray(pins, i);
 					if ((UInt32)-1 != node)
 					{
 						UInt32 config = getNumberFromArray(pins, i+1);
 						DebugLog("--> custom pin config, node=0x%02x : 0x%08x\n", node, config);
-						intelHDA.sendCommand(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_0, config>>0);
-						intelHDA.sendCommand(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_1, config>>8);
-						intelHDA.sendCommand(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_2, config>>16);
-						intelHDA.sendCommand(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_3, config>>24);
+						if (pinCommandCount + 4 > arrsize(pinCommands))
+						{
+							intelHDA.sendCommands(pinCommands, NULL, pinCommandCount);
+							pinCommandCount = 0;
+						}
+						pinCommands[pinCommandCount++] = HDA_COMMAND_12(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_0, config>>0);
+						pinCommands[pinCommandCount++] = HDA_COMMAND_12(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_1, config>>8);
+						pinCommands[pinCommandCount++] = HDA_COMMAND_12(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_2, config>>16);
+						pinCommands[pinCommandCount++] = HDA_COMMAND_12(node, HDA_VERB_SET_CONFIG_DEFAULT_BYTES_3, config>>24);
 						pinConfigsSet++;
 					}
 				}
@@ -810,10 +1636,11 @@ IOService* CodecCommanderProbeInit::probe(IOService* provider, SInt32* score)
 		}
 	}
 
+	if (pinCommandCount)
+		intelHDA.sendCommands(pinCommands, NULL, pinCommandCount);
+
 	if (pinConfigsSet)
 		AlwaysLog("CodecCommanderProbeInit set %d pinconfig(s) during probe (0x%08x)\n", pinConfigsSet, intelHDA.getCodecVendorId());
 
-	IORecursiveLockUnlock(g_lock);
-
 	return NULL;
 }
@@ -23,8 +23,13 @@
 #define CodecCommander CodecCommander
 
 #include "Common.h"
+#include "CodecManager.h"
 #include "Configuration.h"
 #include "IntelHDA.h"
+#include "VerbQueue.h"
+#include "ClientMethods.h"
+#include "VerbRing.h"
+#include "CodecEvent.h"
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -37,20 +42,8 @@ enum
 	kPowerStateCount
 };
 
-// Track audio codec state transitions
-enum CodecCommanderState
-{
-	kStateSleep,
-	kStateWake,
-	kStateInit
-};
-
-// External client methods
-enum
-{
-	kClientExecuteVerb = 0,
-	kClientNumMethods
-};
+// Most user clients registered for events at once
+#define kClientMaxEventClients 8
 
 extern "C"
 {
@@ -68,6 +61,8 @@ private:
 	virtual bool start(IOService *provider);
 };
 
+class CodecCommanderClient;
+
 class CodecCommander : public IOService
 {
     typedef IOService super;
@@ -84,47 +79,141 @@ public:
 	
     // workloop parameters
     void onTimerAction();
+    void onUnsolicitedAction();
+    void onWakeTimer();
     
     // power management event
     virtual IOReturn setPowerState(unsigned long powerStateOrdinal, IOService *policyMaker);
-	IOReturn setPowerStateExternal(unsigned long powerStateOrdinal, IOService *policyMaker);
+	// power state change seen by CodecCommanderPowerHook, service is acknowledged when done
+	IOReturn setPowerStateExternal(unsigned long powerStateOrdinal, IOService *policyMaker, IOService *service);
+	// power state changes of the IOAudioDevice followed by "Check Infinitely"
+	virtual IOReturn powerStateWillChangeTo(IOPMPowerFlags capabilities, unsigned long stateNumber, IOService *whatDevice);
+	virtual IOReturn powerStateDidChangeTo(IOPMPowerFlags capabilities, unsigned long stateNumber, IOService *whatDevice);
 	
 	UInt32 executeCommand(UInt32 command);
+	// queue command and return at once, completion gets the response
+	bool executeCommandAsync(UInt32 command, VerbQueue::Completion completion, void* owner, void* refcon);
+	// run commands as one request, returns number that succeeded (failed ones respond -1)
+	UInt32 executeCommands(const UInt32* commands, UInt32* responses, UInt32 count);
+	// queue action behind other client requests, completion gets its result
+	bool submitClientAction(VerbQueue::Action action, void* target, VerbQueue::Completion completion, void* owner, void* refcon);
+	// CodecDump snapshot of the codec, see IntelHDA::dumpCodec
+	UInt32 dumpCodec(void* buffer, UInt32 size);
+	// send CodecEvent events in mask to the client's async port (mask 0 unregisters)
+	bool registerEvents(CodecCommanderClient* client, UInt32 mask, OSAsyncReference64 reference);
+	// verb trace of the controller, see IntelHDA::setTracing and readTrace
+	bool setTracing(bool enable);
+	UInt32 readTrace(UInt32* cursor, VerbTraceEntry* entries, UInt32 max, UInt32* dropped);
 
 private:
 	IOService* mProvider = NULL;
-	IOAudioDevice* mAudioDevice = NULL;
 	IOAudioDevicePowerState mHDAPrevPowerState;
+
+	// AppleHDA's IOAudioDevice for this codec, attached and detached on the workloop
+	IOAudioDevice* mAudioDevice = NULL;
+	IOAudioDevicePowerState mPolledPowerState;
+	IONotifier* mAudioDevicePublished = NULL;
+	IONotifier* mAudioDeviceTerminated = NULL;
 	unsigned long mPrevPowerStateOrdinal = -1;
 	
 	Configuration *mConfiguration = NULL;
 	IntelHDA *mIntelHDA = NULL;
+	CodecManager *mCodecManager = NULL;
+	UInt16 mClaimedCodecs = 0;	// own and managed codecs, see IntelHDA::claimCodec
+	VerbQueue *mVerbQueue = NULL;
 	
 	IOWorkLoop* mWorkLoop = NULL;
 	IOTimerEventSource* mTimer = NULL;
+	IOTimerEventSource* mUnsolicitedTimer = NULL;
+
+	// part of a state change waiting for Send Delay (verb queue thread only): a wake before
+	// EAPD and custom commands, or a sleep or wake retrying EAPD after a codec reset
+	enum DeferredStep { kDeferredNone, kDeferredWake, kDeferredWakeRetry, kDeferredSleepRetry };
+	IOTimerEventSource* mWakeTimer = NULL;
+	UInt64 mWakeDeadline = 0;
+	DeferredStep mDeferredStep = kDeferredNone;
+	// power change acknowledged once a deferred sleep is done
+	IOService* mDeferredAck = NULL;
+	bool mDeferredAckChange = false;	// IOAudioDevice power change, not setPowerState
+
+	// node that enabled each unsolicited response tag (0 if none)
+	UInt8 mUnsolicitedNodes[HDA_UNSOL_TAGS] = {};
 	
 	// Define variables for EAPD state updating
 	OSArray* mEAPDCapableNodes = NULL;
 	
 	bool mEAPDPoweredDown, mColdBoot;
+
+	// user clients registered for events, under mEventLock
+	struct EventClient
+	{
+		CodecCommanderClient* client;
+		UInt32 mask;
+		OSAsyncReference64 reference;
+	};
+	EventClient mEventClients[kClientMaxEventClients] = {};
+	IOLock* mEventLock = NULL;
+
+	// send an event to the clients registered for it
+	void postEvent(UInt32 event, UInt32 value = 0, UInt8 node = 0);
 		
 	void handleStateChange(IOAudioDevicePowerState newState);
+	void finishSleep();
+	void finishWake(bool retry = false);
+	void deferStep(DeferredStep step, UInt16 delay);
+	void cancelDeferredStep();
+	bool deferAcknowledge(IOService* service, bool powerChange);
+	void acknowledgeDeferred();
+	static UInt32 wakeTimerAction(void* target, void*, void*, void*);
+
+	// state changes seen on the workloop (timers) are handled on the verb queue thread too
+	void changeState(IOAudioDevicePowerState newState);
+	static UInt32 stateChangeAction(void* target, void* newState, void*, void*);
+
+	// power state changes run on the verb queue thread
+	IOReturn deferPowerState(IOService* service, unsigned long powerStateOrdinal, bool external);
+	static UInt32 powerStateAction(void* target, void* powerStateOrdinal, void* external, void* service);
+	static void powerStateDone(void* owner, void* refcon, UInt32 result);
+	void changePowerState(unsigned long powerStateOrdinal);
+	void changePowerStateExternal(unsigned long powerStateOrdinal);
+
+	// IOAudioDevice power state changes, handled on the verb queue thread
+	static bool audioDeviceNotification(void* target, void* refCon, IOService* newService, IONotifier* notifier);
+	static IOReturn attachAudioDeviceAction(OSObject* owner, void* audioDevice, void*, void*, void*);
+	static IOReturn detachAudioDeviceAction(OSObject* owner, void* audioDevice, void*, void*, void*);
+	IOReturn deferAudioDeviceState(IOService* audioDevice, IOAudioDevicePowerState powerState);
+	static UInt32 audioDeviceStateAction(void* target, void* powerState, void* audioDevice, void*);
+	static void audioDeviceStateDone(void* owner, void* refcon, UInt32 result);
 	
 	// parse codec power state from ioreg
 	void parseCodecPowerState();
 	
-	// set the state of EAPD on outputs
-	bool setEAPD(UInt8 logicLevel);
+	// set the state of EAPD on outputs, source is recorded in the verb trace
+	bool setEAPD(UInt8 logicLevel, UInt8 source);
 	
 	// reset codec
-	void performCodecReset();
+	void performCodecReset(UInt8 source);
 	
 	// execute configured custom commands
 	void customCommands(CodecCommanderState newState);
 
-	IOAudioDevice* getAudioDevice();
-	
+	// drive the other codecs selected by CodecAddressMask
+	void addManagedCodecs(UInt16 mask);
+
+	// map unsolicited response tags enabled by custom commands to their nodes
+	void registerUnsolicitedTags();
+
+	// handle a jack (pin) or power (function group) unsolicited response
+	void dispatchUnsolicited(UInt32 response);
+
+	// publish verb latency and parameter cache statistics
+	void updateStatisticsProperties();
+
 	static const char* getPowerState(IOAudioDevicePowerState powerState);
+
+public:
+	// CodecCommander attached to an IOHDACodecFunction, if any
+	static CodecCommander* findCodecCommander(IORegistryEntry* function);
 };
 
 class CodecCommanderPowerHook : public IOService
@@ -170,9 +259,15 @@ private:
 	CodecCommander* mDriver;
 	task_t mTask;
 	SInt32 mOpenCount;
+	IOBufferMemoryDescriptor* mRingMemory;	// VerbRing, created when first mapped
 
 	static const IOExternalMethodDispatch sMethods[kClientNumMethods];
 
+	// verb ring work, one snapshot of it per request on the verb queue
+	static UInt32 ringAction(void* target, void*, void*, void*);
+	static void ringDone(void* owner, void* refcon, UInt32 result);
+	bool submitRing();
+
 public:
 	/* IOService overrides */
 	virtual bool start(IOService* provider);
@@ -181,6 +276,8 @@ public:
 	/* IOUserClient overrides */
 	virtual bool initWithTask(task_t owningTask, void * securityID, UInt32 type, OSDictionary* properties);
 	virtual IOReturn clientClose(void);
+	virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory);
+	virtual void free();
 
 	virtual IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments *arguments, IOExternalMethodDispatch* dispatch = 0,
 									OSObject* target = 0, void* reference = 0);
@@ -188,6 +285,13 @@ public:
 
 	/* External methods */
 	static IOReturn executeVerb(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn executeVerbAsync(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn executeVerbs(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn ringDoorbell(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn dumpCodec(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn registerEvents(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn setTrace(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn readTrace(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
 };
 
 #endif // __CodecCommander__
@@ -0,0 +1,69 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_CodecDump_h
+#define CodecCommander_CodecDump_h
+
+// Snapshot of a codec's audio function group returned by kClientDumpCodec
+// (plain C, also included by hda-verb):
+//   CodecDumpHeader
+//   CodecDumpNode[nodeCount]         widgets startNode.., in order
+//   UInt8 connections[connectionCount]
+// Values the codec did not answer are -1. A newer version only appends
+// fields to the header and node records, so check the sizes given there.
+
+#define kCodecDumpVersion   1
+
+typedef struct
+{
+    UInt32 version;             // kCodecDumpVersion
+    UInt32 size;                // whole snapshot, bytes
+    UInt16 headerSize;          // sizeof(CodecDumpHeader)
+    UInt16 nodeSize;            // sizeof(CodecDumpNode)
+    UInt32 vendorId;
+    UInt32 subsystemId;
+    UInt32 revisionId;
+    UInt8 codecAddress;
+    UInt8 audioRoot;            // audio function group node
+    UInt8 startNode;
+    UInt8 nodeCount;
+    UInt32 powerState;          // of the function group
+    UInt32 connectionCount;
+} CodecDumpHeader;
+
+typedef struct
+{
+    UInt32 widgetCaps;
+    UInt32 pinCaps;             // pin complexes only, else 0
+    UInt32 ampInCaps;
+    UInt32 ampOutCaps;
+    UInt32 configDefault;       // pin complexes only, as read now
+    UInt32 powerState;
+    UInt32 connectionSelect;
+    UInt32 pinControl;
+    UInt32 pinSense;
+    UInt32 eapd;
+    UInt32 ampIn[2];            // input amp index 0, left and right gain/mute
+    UInt32 ampOut[2];           // output amp, left and right gain/mute
+    UInt16 connectionIndex;     // connections of this node start here
+    UInt8 connectionLength;
+    UInt8 node;
+} CodecDumpNode;
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_CodecEvent_h
+#define CodecCommander_CodecEvent_h
+
+// Events sent to user clients registered with kClientRegisterEvents (plain C,
+// also included by hda-verb). Each one arrives at the async port as one
+// result with kCodecEventArgs arguments, indexed as below. Events are dropped
+// while the port's queue is full.
+
+enum
+{
+    kCodecEventPowerState = 0,  // value: new power state (0 sleep, 2 normal)
+    kCodecEventSleep,           // EAPD powered down, sleep commands sent
+    kCodecEventWake,            // EAPD powered up, wake commands sent
+    kCodecEventEAPDFailed,      // value: logic level that could not be set
+    kCodecEventCodecReset,      // function group reset
+    kCodecEventJack,            // node: pin, value: 1 plugged, 0 unplugged
+    kCodecEventCount
+};
+
+// mask argument of kClientRegisterEvents, 0 unregisters
+#define kCodecEventMask(event)  (1 << (event))
+#define kCodecEventMaskAll      ((1 << kCodecEventCount) - 1)
+
+// arguments of an event
+enum
+{
+    kCodecEventArgType = 0,
+    kCodecEventArgValue,
+    kCodecEventArgNode,
+    kCodecEventArgCodec,        // codec address
+    kCodecEventArgTime,         // nanoseconds since boot
+    kCodecEventArgs
+};
+
+#endif
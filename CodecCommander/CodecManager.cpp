@@ -0,0 +1,340 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "CodecManager.h"
+
+CodecManager::CodecManager(IntelHDA* primary, Configuration* configuration, OSArray* eapdNodes)
+{
+    mPrimary = primary;
+
+    UInt8 address = primary->getCodecAddress();
+    mCodecs[address].intelHDA = primary;
+    mCodecs[address].configuration = configuration;
+    mCodecs[address].eapdNodes = eapdNodes;
+    mCodecMask = 1 << address;
+}
+
+CodecManager::~CodecManager()
+{
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        ManagedCodec& codec = mCodecs[address];
+        if (!codec.intelHDA || codec.intelHDA == mPrimary)
+            continue;
+        OSSafeRelease(codec.eapdNodes);
+        delete codec.configuration;
+        delete codec.intelHDA;
+    }
+}
+
+UInt16 CodecManager::addCodecs(UInt16 mask, OSObject* codecProfiles, const char* name, IOService* provider)
+{
+    // STATESTS may have been cleared by the audio driver, so ask codecs not flagged there
+    UInt16 present = mPrimary->getPresentCodecs();
+    UInt16 added = 0;
+
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!(mask & (1 << address)) || mCodecs[address].intelHDA)
+            continue;
+
+        if (!(present & (1 << address)))
+        {
+            UInt32 vendor = (UInt32)address << 28 | HDA_COMMAND_12(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
+            mPrimary->sendAddressedCommands(&vendor, &vendor, 1);
+            if (vendor == (UInt32)-1)
+            {
+                DebugLog("No codec at address %d\n", address);
+                continue;
+            }
+        }
+
+        // the command mode is unused, commands go through the primary's transport
+        IntelHDA* intelHDA = new IntelHDA(provider, PIO);
+        if (!intelHDA)
+            break;
+        intelHDA->setTransport(mPrimary);
+        if (!intelHDA->initialize(true) || !intelHDA->setCodecAddress(address))
+        {
+            AlwaysLog("Unable to access codec at address %d\n", address);
+            delete intelHDA;
+            continue;
+        }
+
+        Configuration* configuration = new Configuration(codecProfiles, intelHDA, name);
+        if (!configuration || configuration->getDisable())
+        {
+            DebugLog("Codec 0x%08x at address %d is disabled by its profile\n", intelHDA->getCodecVendorId(), address);
+            delete configuration;
+            delete intelHDA;
+            continue;
+        }
+
+        OSArray* eapdNodes = NULL;
+        if (configuration->getUpdateNodes() && !(eapdNodes = findEAPDNodes(intelHDA)))
+        {
+            delete configuration;
+            delete intelHDA;
+            break;
+        }
+
+        intelHDA->setShadowMode(configuration->getShadowMode());
+        AlwaysLog("Managing codec 0x%08x at address %d\n", intelHDA->getCodecVendorId(), address);
+        mCodecs[address].intelHDA = intelHDA;
+        mCodecs[address].configuration = configuration;
+        mCodecs[address].eapdNodes = eapdNodes;
+        mCodecMask |= 1 << address;
+        added |= 1 << address;
+    }
+
+    return added;
+}
+
+OSArray* CodecManager::findEAPDNodes(IntelHDA* intelHDA)
+{
+    // Read the widget graph, including Pin Capabilities, for the range of nodes
+    DebugLog("Getting EAPD supported node list.\n");
+
+    OSArray* eapdNodes = OSArray::withCapacity(3);
+    if (!eapdNodes)
+        return NULL;
+
+    if (!intelHDA->enumerateTopology())
+        DebugLog("Failed to enumerate codec topology.\n");
+
+    UInt16 start = intelHDA->getStartingNode();
+    UInt16 end = start + intelHDA->getTotalNodes();
+    for (UInt16 node = start; node < end; node++)
+    {
+        if (HDA_WIDGET_TYPE(intelHDA->getWidgetCaps(node)) != HDA_WIDGET_TYPE_PIN)
+            continue;
+
+        // if bit 16 is set in pincap - node supports EAPD
+        if (HDA_PINCAP_IS_EAPD_CAPABLE(intelHDA->getPinCaps(node)))
+        {
+            OSNumber* num = OSNumber::withNumber(node, 16);
+            if (num)
+            {
+                eapdNodes->setObject(num);
+                num->release();
+            }
+            AlwaysLog("Node ID 0x%02x supports EAPD, will update state after sleep.\n", node);
+        }
+    }
+
+    return eapdNodes;
+}
+
+UInt16 CodecManager::getSendDelay()
+{
+    UInt16 delay = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (mCodecs[address].configuration && mCodecs[address].configuration->getSendDelay() > delay)
+            delay = mCodecs[address].configuration->getSendDelay();
+    }
+    return delay;
+}
+
+void CodecManager::setTraceSource(UInt8 source)
+{
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (mCodecs[address].intelHDA)
+            mCodecs[address].intelHDA->setTraceSource(source);
+    }
+}
+
+UInt32 CodecManager::sendPrograms(UInt32* const programs[HDA_MAX_CODECS], const UInt32 lengths[HDA_MAX_CODECS])
+{
+    // writes the codecs already hold are left out (see HDAShadowMode)
+    UInt32 kept[HDA_MAX_CODECS] = {};
+    UInt32 skipped = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!lengths[address])
+            continue;
+        kept[address] = mCodecs[address].intelHDA->elideRedundant(programs[address], lengths[address]);
+        skipped += lengths[address] - kept[address];
+    }
+
+    // one batch for all codecs, each codec's commands in program order
+    // (the link carries one command per frame whichever codec it is for,
+    // so the batch takes as long as all programs together)
+    UInt32 total = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+        total += kept[address];
+    if (!total)
+        return skipped;
+
+    // the shadow recorded the kept writes as written, which they never will be
+    UInt32* merged = (UInt32*)IOMalloc(total * sizeof(UInt32));
+    if (!merged)
+    {
+        for (int address = 0; address < HDA_MAX_CODECS; address++)
+            if (kept[address])
+                mCodecs[address].intelHDA->invalidateShadow();
+        return 0;
+    }
+    UInt32 count = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        memcpy(merged + count, programs[address], kept[address] * sizeof(UInt32));
+        count += kept[address];
+    }
+
+    UInt32 succeeded = mPrimary->sendAddressedCommands(merged, NULL, count);
+    IOFree(merged, total * sizeof(UInt32));
+
+    // the shadow recorded these as written, which is no longer certain
+    if (succeeded != count)
+    {
+        for (int address = 0; address < HDA_MAX_CODECS; address++)
+            if (kept[address])
+                mCodecs[address].intelHDA->invalidateShadow();
+    }
+    return succeeded + skipped;
+}
+
+void CodecManager::freePrograms(UInt32* programs[HDA_MAX_CODECS], const UInt32 lengths[HDA_MAX_CODECS])
+{
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (programs[address])
+            IOFree(programs[address], lengths[address] * sizeof(UInt32));
+        programs[address] = NULL;
+    }
+}
+
+bool CodecManager::setEAPD(UInt8 logicLevel)
+{
+    // for nodes supporting EAPD bit 1 in logicLevel defines EAPD logic state: 1 - enable, 0 - disable
+    UInt32* programs[HDA_MAX_CODECS] = {};
+    UInt32 lengths[HDA_MAX_CODECS] = {};
+    UInt32 total = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        ManagedCodec& codec = mCodecs[address];
+        if (!codec.eapdNodes || !(logicLevel ? codec.configuration->getUpdateNodes() : codec.configuration->getSleepNodes()))
+            continue;
+        unsigned count = codec.eapdNodes->getCount();
+        if (!count)
+            continue;
+        // counted as failed, so the caller can reset on EAPD fail
+        total += count;
+        if (!(programs[address] = (UInt32*)IOMalloc(count * sizeof(UInt32))))
+        {
+            AlwaysLog("Unable to set EAPD of codec %d, out of memory\n", address);
+            continue;
+        }
+        for (unsigned i = 0; i < count; i++)
+        {
+            OSNumber* nodeId = (OSNumber*)codec.eapdNodes->getObject(i);
+            programs[address][i] = (UInt32)address << 28 | HDA_COMMAND_12(nodeId->unsigned8BitValue(), HDA_VERB_EAPDBTL_SET, logicLevel);
+        }
+        lengths[address] = count;
+    }
+
+    UInt32 succeeded = sendPrograms(programs, lengths);
+    freePrograms(programs, lengths);
+    return succeeded == total;
+}
+
+UInt32 CodecManager::customCommands(CodecCommanderState newState)
+{
+    UInt32* programs[HDA_MAX_CODECS] = {};
+    UInt32 lengths[HDA_MAX_CODECS] = {};
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!mCodecs[address].configuration)
+            continue;
+
+        // copied, as write elision compacts the program in place
+        const CustomProgram& program = mCodecs[address].configuration->getCustomProgram(newState);
+        if (!program.CommandCount)
+            continue;
+        if (!(programs[address] = (UInt32*)IOMalloc(program.CommandCount * sizeof(UInt32))))
+        {
+            AlwaysLog("Unable to send custom commands to codec %d, out of memory\n", address);
+            continue;
+        }
+        DebugLog("--> custom command(s) (%d) for codec %d\n", program.CommandCount, address);
+        memcpy(programs[address], program.Commands, program.CommandCount * sizeof(UInt32));
+        lengths[address] = program.CommandCount;
+    }
+
+    UInt32 succeeded = sendPrograms(programs, lengths);
+    freePrograms(programs, lengths);
+    return succeeded;
+}
+
+bool CodecManager::resetCodecs()
+{
+    IntelHDA* codecs[HDA_MAX_CODECS];
+    unsigned count = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (mCodecs[address].intelHDA)
+            codecs[count++] = mCodecs[address].intelHDA;
+    }
+    return IntelHDA::resetCodecs(codecs, count);
+}
+
+bool CodecManager::checkSettingsReset()
+{
+    bool result = false;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (mCodecs[address].intelHDA && mCodecs[address].intelHDA->checkSettingsReset())
+            result = true;
+    }
+    return result;
+}
+
+void CodecManager::getShadowStats(HDAShadowStats* stats)
+{
+    bzero(stats, sizeof(*stats));
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!mCodecs[address].intelHDA)
+            continue;
+        const HDAShadowStats& codecStats = mCodecs[address].intelHDA->getShadowStats();
+        stats->skipped += codecStats.skipped;
+        stats->verified += codecStats.verified;
+        stats->mismatched += codecStats.mismatched;
+        stats->invalidated += codecStats.invalidated;
+    }
+}
+
+void CodecManager::getResetStats(HDAResetStats* stats)
+{
+    bzero(stats, sizeof(*stats));
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!mCodecs[address].intelHDA)
+            continue;
+        const HDAResetStats& codecStats = mCodecs[address].intelHDA->getResetStats();
+        stats->resets += codecStats.resets;
+        stats->timeouts += codecStats.timeouts;
+        if (codecStats.lastReady > stats->lastReady)
+            stats->lastReady = codecStats.lastReady;
+        if (codecStats.maxReady > stats->maxReady)
+            stats->maxReady = codecStats.maxReady;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_CodecManager_h
+#define CodecCommander_CodecManager_h
+
+#include "Common.h"
+#include "Configuration.h"
+#include "IntelHDA.h"
+
+// The codecs one CodecCommander instance drives: its own (primary) codec, plus
+// the codecs added from CodecAddressMask. Each codec keeps its own IntelHDA
+// (parameter cache, topology), Configuration and EAPD nodes, but commands for
+// all of them go through the primary codec's transport as one batch. That
+// saves a round of batches and Send Delay per codec, the commands themselves
+// still take as long as those of all codecs added up (pipelined through the
+// CORB in Command Mode DMA, one after the other with PIO).
+class CodecManager
+{
+	struct ManagedCodec
+	{
+		IntelHDA* intelHDA;
+		Configuration* configuration;
+		OSArray* eapdNodes;
+	};
+
+	IntelHDA* mPrimary;
+	ManagedCodec mCodecs[HDA_MAX_CODECS] = {};
+	UInt16 mCodecMask = 0;
+
+	UInt32 sendPrograms(UInt32* const programs[HDA_MAX_CODECS], const UInt32 lengths[HDA_MAX_CODECS]);
+	void freePrograms(UInt32* programs[HDA_MAX_CODECS], const UInt32 lengths[HDA_MAX_CODECS]);
+
+public:
+	// The primary codec's objects remain owned by the caller
+	CodecManager(IntelHDA* primary, Configuration* configuration, OSArray* eapdNodes);
+	~CodecManager();
+
+	// Add the codecs in mask that answer on the link and are not disabled by
+	// their profile. Returns the mask of codecs added.
+	UInt16 addCodecs(UInt16 mask, OSObject* codecProfiles, const char* name, IOService* provider);
+	inline UInt16 getCodecMask() { return mCodecMask; }
+
+	// Read the widget graph and return the EAPD capable pins (NULL if out of memory)
+	static OSArray* findEAPDNodes(IntelHDA* intelHDA);
+
+	// Longest "Send Delay" of all codecs
+	UInt16 getSendDelay();
+
+	// Source recorded in the verb trace for the commands of all codecs
+	void setTraceSource(UInt8 source);
+
+	// Set EAPD on all codecs with "Update Nodes" (logicLevel set) or "Sleep Nodes" (clear),
+	// false if any codec's EAPD was not written
+	bool setEAPD(UInt8 logicLevel);
+
+	// Send the custom commands of all codecs for a state (as compiled by their
+	// Configuration for the layout ID), returns number of commands sent
+	UInt32 customCommands(CodecCommanderState newState);
+
+	// Double function group reset of all codecs
+	bool resetCodecs();
+
+	// Drop the shadow of codecs that lost their settings, returns true if any did
+	bool checkSettingsReset();
+	// Shadow register statistics of all codecs added up
+	void getShadowStats(HDAShadowStats* stats);
+	// Reset statistics of all codecs, ready times are those of the slowest codec
+	void getResetStats(HDAResetStats* stats);
+};
+
+#endif
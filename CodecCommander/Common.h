@@ -29,19 +29,25 @@
 #endif
 #define AlwaysLog(args...) do { IOLog("CodecCommander: " args); } while (0)
 
+#define arrsize(array) (sizeof(array)/sizeof(array[0]))
+
 #include <IOKit/IOService.h>
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOTimerEventSource.h>
 #include <IOKit/IODeviceTreeSupport.h>
 #include <IOKit/IOCommandGate.h>
 #include <IOKit/IOUserClient.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/audio/IOAudioDevice.h>
 #include <IOKit/pci/IOPCIDevice.h>
+#include <kern/clock.h>
+
+// vendor id, address and controller keys are shared with hda-verb
+#include "ClientMethods.h"
 
 #define kCodecProfile               "Codec Profile"
-#define kCodecVendorID              "IOHDACodecVendorID"
-#define kCodecAddress               "IOHDACodecAddress"
 #define kCodecFuncGroupType         "IOHDACodecFunctionGroupType"
 #define kCodecSubsystemID           "IOHDACodecFunctionSubsystemID"
+#define kCodecManagedBy             "CodecCommander Managed By"
 
 #endif
@@ -19,6 +19,7 @@
 
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
 #include "Configuration.h"
+#include "ProfileIndex.h"
 
 // Constants for Configuration
 #define kDefault                    "Default"
@@ -28,6 +29,8 @@
 #define kCodecId                    "Codec Id"
 #define kDisable                    "Disable"
 #define kCodecAddressMask           "CodecAddressMask"
+#define kCommandMode                "Command Mode"
+#define kShadowVerbs                "Shadow Verbs"
 
 // Constants for EAPD command verb sending
 #define kUpdateNodes                "Update Nodes"
@@ -38,6 +41,10 @@
 #define kCheckInfinitely            "Check Infinitely"
 #define kCheckInterval              "Check Interval"
 
+// Jack/power events from codec unsolicited responses, and RIRB poll interval, ms
+#define kUnsolicitedEvents          "Unsolicited Events"
+#define kUnsolicitedInterval        "Unsolicited Interval"
+
 // Constants for custom commands
 #define kCustomCommands             "Custom Commands"
 #define kCustomCommand              "Command"
@@ -116,45 +123,6 @@ UInt32 Configuration::getIntegerValue(OSObject *obj, UInt32 defValue)
     return result;
 }
 
-OSDictionary* Configuration::locateConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 subsystemId)
-{
-    UInt16 vendor = codecVendorId >> 16;
-    UInt16 codec = codecVendorId & 0xFFFF;
-    OSObject* obj;
-
-    // check vendor_codec_HDA_full-subsystem first
-    char codecLookup[sizeof("vvvv_cccc_HDA_xxxx_dddd")];
-    snprintf(codecLookup, sizeof(codecLookup), "%04x_%04x_HDA_%04x_%04x", vendor, codec, subsystemId >> 16, subsystemId & 0xFFFF);
-    obj = profiles->getObject(codecLookup);
-    if (!obj)
-    {
-        // check vendor_codec_HDA_vendorsubid next
-        snprintf(codecLookup, sizeof(codecLookup), "%04x_%04x_HDA_%04x", vendor, codec, subsystemId >> 16);
-        obj = profiles->getObject(codecLookup);
-        if (!obj)
-        {
-            // check vendor_codec next
-            snprintf(codecLookup, sizeof(codecLookup), "%04x_%04x", vendor, codec);
-            obj = profiles->getObject(codecLookup);
-            if (!obj)
-            {
-                // not found, check for vendor override (used for Intel HDMI)
-                snprintf(codecLookup, sizeof(codecLookup), "%04x", vendor);
-                obj = profiles->getObject(codecLookup);
-            }
-        }
-    }
-
-    // look up actual dictionary (can be string redirect)
-    OSDictionary* dict;
-    if (OSString* str = OSDynamicCast(OSString, obj))
-        dict = OSDynamicCast(OSDictionary, profiles->getObject(str));
-    else
-        dict = OSDynamicCast(OSDictionary, obj);
-    
-    return dict;
-}
-
 OSObject* Configuration::translateEntry(OSObject* obj)
 {
     // Note: non-NULL result is retained...
@@ -300,14 +268,15 @@ OSDictionary* Configuration::getConfigurationOverride(const char* method, IOServ
     return result;
 }
 
-OSDictionary* Configuration::loadConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 subsystemId)
+OSDictionary* Configuration::loadConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 subsystemId, bool shared)
 {
     OSDictionary* defaultProfile = NULL;
     OSDictionary* codecProfile = NULL;
     if (profiles)
     {
         defaultProfile = OSDynamicCast(OSDictionary, profiles->getObject(kDefault));
-        codecProfile = locateConfiguration(profiles, codecVendorId, subsystemId);
+        // the index is kept for profiles shared by all instances, not for a merged copy
+        codecProfile = ProfileIndex::locate(profiles, codecVendorId, subsystemId, shared);
     }
     OSDictionary* result = NULL;
 
@@ -334,6 +303,8 @@ OSDictionary* Configuration::loadConfiguration(OSDictionary* profiles, UInt32 co
 
 Configuration::Configuration(OSObject* codecProfiles, IntelHDA* intelHDA, const char* name)
 {
+    mLayoutID = intelHDA->getLayoutID();
+    bzero(mCustomPrograms, sizeof(mCustomPrograms));
     OSDictionary* profiles = OSDynamicCast(OSDictionary, codecProfiles);
     UInt32 codecVendorId = intelHDA->getCodecVendorId();
     UInt32 hdaSubsystemId = intelHDA->getSubsystemId();
@@ -356,7 +327,7 @@ Configuration::Configuration(OSObject* codecProfiles, IntelHDA* intelHDA, const
     }
 
     // Retrieve platform profile configuration
-    OSDictionary* config = loadConfiguration(profiles, codecVendorId, hdaSubsystemId);
+    OSDictionary* config = loadConfiguration(profiles, codecVendorId, hdaSubsystemId, profiles == codecProfiles);
     if (profiles != codecProfiles)
         OSSafeRelease(profiles);
 
@@ -381,8 +352,30 @@ Configuration::Configuration(OSObject* codecProfiles, IntelHDA* intelHDA, const
         return;
     }
 
-    // Get CodecAddressMask
-    mCodecAddressMask = getIntegerValue(config, kCodecAddressMask, 1);
+    // Get CodecAddressMask (other codecs on the link to drive along with this one)
+    mCodecAddressMask = getIntegerValue(config, kCodecAddressMask, 0);
+
+    // Get command transport ("PIO" or "DMA", DMA uses CORB/RIRB when available)
+    mCommandMode = PIO;
+    if (config)
+    {
+        if (OSString* str = OSDynamicCast(OSString, config->getObject(kCommandMode)))
+            if (str->isEqualTo("DMA"))
+                mCommandMode = DMA;
+    }
+
+    // Get write elision ("Off", "Verify" or "Trust", see HDAShadowMode)
+    mShadowMode = ShadowOff;
+    if (config)
+    {
+        if (OSString* str = OSDynamicCast(OSString, config->getObject(kShadowVerbs)))
+        {
+            if (str->isEqualTo("Verify"))
+                mShadowMode = ShadowVerify;
+            else if (str->isEqualTo("Trust"))
+                mShadowMode = ShadowTrust;
+        }
+    }
 
     // Get delay for sending the verb
     mSendDelay = getIntegerValue(config, kSendDelay, 300);
@@ -410,6 +403,10 @@ Configuration::Configuration(OSObject* codecProfiles, IntelHDA* intelHDA, const
     mCheckInfinite = getBoolValue(config, kCheckInfinitely, false);
     mCheckInterval = getIntegerValue(config, kCheckInterval, 1000);
 
+    // Determine if unsolicited responses should be polled for and dispatched (needs DMA command mode)
+    mUnsolicitedEvents = getBoolValue(config, kUnsolicitedEvents, false);
+    mUnsolicitedInterval = getIntegerValue(config, kUnsolicitedInterval, 50);
+
     // load PinConfigDefault
     if (config)
     {
@@ -457,7 +454,7 @@ Configuration::Configuration(OSObject* codecProfiles, IntelHDA* intelHDA, const
                 customCommand->CommandCount = length / sizeof(customCommand->Commands[0]);
                 // byte reverse here, so the author of Info.pist doesn't have to...
                 UInt8* bytes = (UInt8*)data->getBytesNoCopy();
-                for (int i = 0; i < customCommand->CommandCount; i++)
+                for (UInt32 i = 0; i < customCommand->CommandCount; i++)
                 {
                     customCommand->Commands[i] = bytes[0]<<24 | bytes[1]<<16 | bytes[2]<<8 | bytes[3];
                     bytes += sizeof(UInt32);
@@ -477,16 +474,24 @@ Configuration::Configuration(OSObject* codecProfiles, IntelHDA* intelHDA, const
 
     OSSafeRelease(config);
 
+    compileCustomPrograms(intelHDA->getCodecAddress());
+
     // Dump parsed configuration
     DebugLog("Configuration\n");
     DebugLog("...Check Infinite: %s\n", mCheckInfinite ? "true" : "false");
     DebugLog("...Check Interval: %d\n", mCheckInterval);
+    DebugLog("...Unsolicited Events: %s\n", mUnsolicitedEvents ? "true" : "false");
+    DebugLog("...Unsolicited Interval: %d\n", mUnsolicitedInterval);
     DebugLog("...Perform Reset: %s\n", mPerformReset ? "true" : "false");
     DebugLog("...Perform Reset on External Wake: %s\n", mPerformResetOnExternalWake ? "true" : "false");
     DebugLog("...Perform Reset on EAPD Fail: %s\n", mPerformResetOnEAPDFail ? "true" : "false");
     DebugLog("...Send Delay: %d\n", mSendDelay);
+    DebugLog("...Command Mode: %s\n", mCommandMode == DMA ? "DMA" : "PIO");
+    DebugLog("...Shadow Verbs: %s\n", mShadowMode == ShadowTrust ? "Trust" : mShadowMode == ShadowVerify ? "Verify" : "Off");
     DebugLog("...Update Nodes: %s\n", mUpdateNodes ? "true" : "false");
     DebugLog("...Sleep Nodes: %s\n", mSleepNodes ? "true" : "false");
+    DebugLog("...Layout ID: %d (custom commands on init %d, sleep %d, wake %d)\n", mLayoutID, mCustomPrograms[kStateInit].CommandCount,
+             mCustomPrograms[kStateSleep].CommandCount, mCustomPrograms[kStateWake].CommandCount);
 
 #ifdef DEBUG
     if (mCustomCommands)
@@ -521,5 +526,44 @@ Configuration::~Configuration()
 #endif
     OSSafeRelease(mPinConfigDefault);
     OSSafeRelease(mCustomCommands);
+    for (int state = 0; state < kStateCount; state++)
+    {
+        if (mCustomPrograms[state].Commands)
+            IOFree(mCustomPrograms[state].Commands, mCustomPrograms[state].CommandCount * sizeof(UInt32));
+    }
 }
 
+void Configuration::compileCustomPrograms(UInt8 codecAddress)
+{
+    if (!mCustomCommands)
+        return;
+
+    // first pass counts, second pass fills
+    unsigned count = mCustomCommands->getCount();
+    for (int state = 0; state < kStateCount; state++)
+    {
+        CustomProgram& program = mCustomPrograms[state];
+        for (int pass = 0; pass < 2; pass++)
+        {
+            UInt32 length = 0;
+            for (unsigned i = 0; i < count; i++)
+            {
+                CustomCommand* customCommand = (CustomCommand*)((OSData*)mCustomCommands->getObject(i))->getBytesNoCopy();
+                if (!((customCommand->OnInit && state == kStateInit) ||
+                      (customCommand->OnWake && state == kStateWake) ||
+                      (customCommand->OnSleep && state == kStateSleep)) ||
+                    ((UInt32)-1 != customCommand->layoutID && mLayoutID != customCommand->layoutID))
+                    continue;
+                if (pass)
+                {
+                    for (UInt32 j = 0; j < customCommand->CommandCount; j++)
+                        program.Commands[length + j] = (UInt32)codecAddress << 28 | (customCommand->Commands[j] & 0x0FFFFFFF);
+                }
+                length += customCommand->CommandCount;
+            }
+            if (!length || (!pass && !(program.Commands = (UInt32*)IOMalloc(length * sizeof(UInt32)))))
+                break;
+            program.CommandCount = length;
+        }
+    }
+}
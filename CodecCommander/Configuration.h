@@ -28,6 +28,15 @@
 #define kCodecCommanderPowerHookKey "CodecCommanderPowerHook"
 #define kCodecCommanderProbeInitKey "CodecCommanderProbeInit"
 
+// Track audio codec state transitions
+enum CodecCommanderState
+{
+	kStateSleep,
+	kStateWake,
+	kStateInit,
+	kStateCount
+};
+
 typedef struct
 {
     bool OnInit;    // Execute command on initialization
@@ -38,6 +47,14 @@ typedef struct
     UInt32 Commands[0]; // 32-bit verb to execute (Codec Address will be filled in)
 } CustomCommand;
 
+// Custom commands of one state for the codec's layout ID, in order and with
+// the codec address filled in
+typedef struct
+{
+    UInt32* Commands;
+    UInt32 CommandCount;
+} CustomProgram;
+
 class Configuration
 {
     OSArray* mCustomCommands;
@@ -45,6 +62,8 @@ class Configuration
     
     bool mCheckInfinite;
     UInt16 mCheckInterval;
+    bool mUnsolicitedEvents;
+    UInt16 mUnsolicitedInterval;
     bool mPerformReset;
     bool mPerformResetOnExternalWake;
     bool mPerformResetOnEAPDFail;
@@ -52,10 +71,13 @@ class Configuration
     UInt16 mSendDelay;
     bool mDisable;
     UInt16 mCodecAddressMask;
+    HDACommandMode mCommandMode;
+    HDAShadowMode mShadowMode;
+    UInt32 mLayoutID;
+    CustomProgram mCustomPrograms[kStateCount];
 
     static UInt32 parseInteger(const char* str);
-    static OSDictionary* locateConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 hdaSubsystemId);
-    static OSDictionary* loadConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 hdaSubsystemId);
+    static OSDictionary* loadConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 hdaSubsystemId, bool shared);
     static bool getBoolValue(OSDictionary* dict, const char* key, bool defValue);
     static UInt32 getIntegerValue(OSDictionary* dict, const char* key, UInt32 defValue);
     static UInt32 getIntegerValue(OSObject* obj, UInt32 defValue);
@@ -63,6 +85,7 @@ class Configuration
     OSDictionary* getConfigurationOverride(const char* method, IOService* provider, const char* name);
     OSObject* translateArray(OSArray* array);
     OSObject* translateEntry(OSObject* obj);
+    void compileCustomPrograms(UInt8 codecAddress);
 
 public:
     inline bool getUpdateNodes() { return mUpdateNodes; };
@@ -73,9 +96,15 @@ public:
     inline UInt16 getSendDelay() { return mSendDelay; };
     inline bool getCheckInfinite() { return mCheckInfinite; };
     inline UInt16 getCheckInterval() { return mCheckInterval; };
+    inline bool getUnsolicitedEvents() { return mUnsolicitedEvents; }
+    inline UInt16 getUnsolicitedInterval() { return mUnsolicitedInterval; }
     inline OSArray* getCustomCommands() { return mCustomCommands; };
+    inline const CustomProgram& getCustomProgram(CodecCommanderState state) { return mCustomPrograms[state]; }
+    inline UInt32 getLayoutID() { return mLayoutID; }
     inline bool getDisable() { return mDisable; }
     inline UInt16 getCodecAddressMask() { return mCodecAddressMask; }
+    inline HDACommandMode getCommandMode() { return mCommandMode; }
+    inline HDAShadowMode getShadowMode() { return mShadowMode; }
     inline OSArray* getPinConfigDefault() { return mPinConfigDefault; }
 
     // Constructor
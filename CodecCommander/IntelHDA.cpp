@@ -26,6 +26,14 @@ unsigned ioDelayCount = 0;
 #define kIntelVendorID              0x8086
 #define kIntelRegTCSEL              0x44
 
+static inline UInt64 getUptimeMicroseconds()
+{
+    uint64_t abstime, nanoseconds;
+    clock_get_uptime(&abstime);
+    absolutetime_to_nanoseconds(abstime, &nanoseconds);
+    return nanoseconds / 1000;
+}
+
 static IOPCIDevice* getPCIDevice(IORegistryEntry* registryEntry)
 {
     IOPCIDevice* result = NULL;
@@ -58,6 +66,7 @@ IntelHDA::IntelHDA(IOService* provider, HDACommandMode commandMode)
 {
     mCommandMode = commandMode;
     mDevice = ::getPCIDevice(provider);
+    mController = attachController(mDevice);
 
     mCodecAddress = getPropertyValue(provider, kCodecAddress);
     mCodecVendorId = getPropertyValue(provider, kCodecVendorID);
@@ -71,6 +80,9 @@ IntelHDA::IntelHDA(IOService* provider, HDACommandMode commandMode)
 
 bool IntelHDA::setCodecAddress(UInt16 codecAddress)
 {
+    invalidateParameterCache();
+    invalidateShadow();
+    freeTopology();
     mCodecVendorId = -1;
     mCodecSubsystemId = -1;
     mAudioRoot = -1;
@@ -79,7 +91,7 @@ bool IntelHDA::setCodecAddress(UInt16 codecAddress)
     mCodecAddress = codecAddress;
     mCodecVendorId = getCodecVendorId();
 
-    if (mCodecVendorId == -1)
+    if (mCodecVendorId == (UInt32)-1)
     {
         // reset codec only if when no success getting codec vendor id
         if (!resetCodec())
@@ -101,11 +113,11 @@ void IntelHDA::resetHDA()
     if (!mRegMap)
         return;
 
-    mRegMap->STATESTS_SDIWAKE = mRegMap->STATESTS_SDIWAKE;
-    mRegMap->GCTL_CRST = 0;
-    mRegMap->GCTL_CRST = 1;
+    mRegMap->STATESTS = mRegMap->STATESTS;
+    mRegMap->GCTL &= ~HDA_GCTL_CRST;
+    mRegMap->GCTL |= HDA_GCTL_CRST;
     int count = 1000;
-    while (count-- && 0 == mRegMap->GCTL_CRST)
+    while (count-- && !(mRegMap->GCTL & HDA_GCTL_CRST))
         ::IODelay(100);
 
     ::IODelay(1000);    // 521 microsec min, according to HDA spec
@@ -114,6 +126,15 @@ void IntelHDA::resetHDA()
 
 IntelHDA::~IntelHDA()
 {
+    lockController();
+    stopDMA();
+    unlockController();
+    detachController(mController);
+    freeTopology();
+    if (mParamCache)
+        IOFree(mParamCache, kParamCacheSize * sizeof(ParamCacheEntry));
+    if (mShadow)
+        IOFree(mShadow, kShadowSize * sizeof(ShadowEntry));
     OSSafeRelease(mMemoryMap);
 }
 
@@ -154,7 +175,19 @@ bool IntelHDA::initialize(bool regMapOnly)
     
     DebugLog("Device memory @ 0x%08llx, size 0x%08llx\n", mDeviceMemory->getPhysicalAddress(), mDeviceMemory->getLength());
         
-    mMemoryMap = mDeviceMemory->map();
+    // one mapping per controller, shared by all instances on it
+    if (mController)
+    {
+        IORecursiveLockLock(mController->lock);
+        if (!mController->memoryMap)
+            mController->memoryMap = mDeviceMemory->map();
+        mMemoryMap = mController->memoryMap;
+        if (mMemoryMap)
+            mMemoryMap->retain();
+        IORecursiveLockUnlock(mController->lock);
+    }
+    else
+        mMemoryMap = mDeviceMemory->map();
 
     if (mMemoryMap == NULL)
     {
@@ -179,16 +212,19 @@ bool IntelHDA::initialize(bool regMapOnly)
     if (mRegMap->VMAJ != 1 || mRegMap->VMIN != 0)
         return false;
 
-    //DebugLog("CRST = %x\n", mRegMap->GCTL_CRST);
+    //DebugLog("CRST = %x\n", mRegMap->GCTL & HDA_GCTL_CRST);
 
     // exit early if only mRegMap needed
     if (regMapOnly)
         return true;
 
+    if (mCommandMode == DMA)
+        setCommandMode(DMA);
+
     // Note: Must reset the codec here for getVendorId to work.
     //  If the computer is restarted when the codec is in fugue state (D3cold),
     //  it will not respond without the Double Function Group Reset.
-    if (mCodecVendorId == -1 && this->getVendorId() == 0xFFFF)
+    if (mCodecVendorId == (UInt32)-1 && this->getVendorId() == 0xFFFF)
         this->resetCodec();
 
     // getVendorId initializes mCodecVendorId
@@ -218,7 +254,39 @@ bool IntelHDA::initialize(bool regMapOnly)
     return true;
 }
 
+bool IntelHDA::setCommandMode(HDACommandMode commandMode)
+{
+    if (commandMode == DMA)
+    {
+        // CORB/RIRB can only be used if no other driver is running them
+        lockController();
+        bool started = checkDMA();
+        unlockController();
+        if (!started)
+        {
+            AlwaysLog("CORB/RIRB not available, using PIO command mode\n");
+            mCommandMode = PIO;
+            return false;
+        }
+    }
+    else
+    {
+        lockController();
+        stopDMA();
+        unlockController();
+    }
+
+    mCommandMode = commandMode;
+    return true;
+}
+
 bool IntelHDA::resetCodec()
+{
+    IntelHDA* codec = this;
+    return resetCodecs(&codec, 1);
+}
+
+bool IntelHDA::resetCodecs(IntelHDA* const* codecs, unsigned count)
 {
     /*
      Reset is created by sending two Function Group resets, potentially separated
@@ -227,22 +295,109 @@ bool IntelHDA::resetCodec()
      most settings to their power on defaults.
      */
 
-    DebugLog("--> resetting codec\n");
+    DebugLog("--> resetting %u codec(s)\n", count);
 
-    UInt16 audioRoot = getAudioRoot();
-    if ((UInt16)-1 == audioRoot)
+    // commands for different codecs may share the idle frames, so reset all in step
+    UInt32 resets[HDA_MAX_CODECS];
+    UInt32 wakes[HDA_MAX_CODECS];
+    UInt32 powerStates[HDA_MAX_CODECS];
+    UInt32 polls[HDA_MAX_CODECS];
+    IntelHDA* reset[HDA_MAX_CODECS];
+    unsigned resetCount = 0;
+    for (unsigned i = 0; i < count && resetCount < HDA_MAX_CODECS; i++)
+    {
+        UInt16 audioRoot = codecs[i]->getAudioRoot();
+        if ((UInt16)-1 == audioRoot)
+            continue;
+        UInt32 address = (UInt32)(codecs[i]->mCodecAddress & 0xF) << 28;
+        resets[resetCount] = address | HDA_COMMAND_12(audioRoot, HDA_VERB_RESET, HDA_PARM_NULL);
+        wakes[resetCount] = address | HDA_COMMAND_12(audioRoot, HDA_VERB_SET_PSTATE, HDA_PARM_PS_D0);
+        powerStates[resetCount] = address | HDA_COMMAND_12(audioRoot, HDA_VERB_SET_PSTATE, HDA_PARM_PS_D3_HOT);
+        reset[resetCount++] = codecs[i];
+    }
+    if (!resetCount)
         return false;
 
-    this->sendCommand(audioRoot, HDA_VERB_RESET, HDA_PARM_NULL);
+    // SET_PSTATE clears PS-SettingsReset, so finding it set again later shows this reset took effect
+    IntelHDA* transport = reset[0]->getTransport();
+    transport->sendAddressedCommands(wakes, NULL, resetCount);
+
+    // nothing else may reach the codecs between the two resets
+    transport->lockController();
+    transport->sendAddressedCommands(resets, NULL, resetCount);
     IOSleep(1);
-    this->sendCommand(audioRoot, HDA_VERB_RESET, HDA_PARM_NULL);
-    IOSleep(220); // per-HDA spec, device must respond (D0) within 200ms
+    transport->sendAddressedCommands(resets, NULL, resetCount);
+    transport->unlockController();
+    UInt64 start = getUptimeMicroseconds();
+
+    // most codecs settle well before the spec's limit, so poll the power state
+    // until the reset shows instead of always waiting it out
+    IntelHDA* pending[HDA_MAX_CODECS];
+    unsigned pendingCount = resetCount;
+    for (unsigned i = 0; i < resetCount; i++)
+    {
+        pending[i] = reset[i];
+        reset[i]->invalidateParameterCache();
+        reset[i]->invalidateShadow();
+        reset[i]->mResetStats.resets++;
+    }
+    for (;;)
+    {
+        UInt32 states[HDA_MAX_CODECS];
+        for (unsigned i = 0; i < pendingCount; i++)
+            polls[i] = (UInt32)(pending[i]->mCodecAddress & 0xF) << 28 |
+                       HDA_COMMAND_12(pending[i]->getAudioRoot(), HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+        UInt64 pollStart = getUptimeMicroseconds();
+        transport->sendAddressedCommands(polls, states, pendingCount);
+        UInt64 now = getUptimeMicroseconds();
+        UInt32 pollTime = (UInt32)(now - pollStart);
+
+        UInt32 elapsed = (UInt32)(now - start);
+        unsigned stillPending = 0;
+        for (unsigned i = 0; i < pendingCount; i++)
+        {
+            // -1 while the codec does not answer yet. The actual state reaching the setting
+            // only counts once PS-SettingsReset shows the reset was done, or for codecs
+            // that don't report it, after kResetMinSettle.
+            if (states[i] == (UInt32)-1 || HDA_PSTATE_ACTUAL(states[i]) != HDA_PSTATE_SETTING(states[i]) ||
+                (!HDA_PSTATE_SETTINGS_RESET(states[i]) && elapsed < kResetMinSettle * 1000))
+            {
+                pending[stillPending++] = pending[i];
+                continue;
+            }
+            HDAResetStats& stats = pending[i]->mResetStats;
+            stats.lastReady = elapsed;
+            if (elapsed > stats.maxReady)
+                stats.maxReady = elapsed;
+            DebugLog("--> codec %d ready %u us after reset\n", pending[i]->mCodecAddress, elapsed);
+        }
+        pendingCount = stillPending;
+        if (!pendingCount)
+            break;
+
+        // A codec that does not answer costs a PIO timeout per poll, so stop polling
+        // when another round could run past the deadline and wait out the rest.
+        if (elapsed + 1000 + pollTime >= kResetReadyTimeout * 1000)
+        {
+            if (elapsed < kResetReadyTimeout * 1000)
+                IOSleep((kResetReadyTimeout * 1000 - elapsed + 999) / 1000);
+            elapsed = (UInt32)(getUptimeMicroseconds() - start);
+            for (unsigned i = 0; i < pendingCount; i++)
+            {
+                AlwaysLog("codec %d not seen ready %u us after reset\n", pending[i]->mCodecAddress, elapsed);
+                pending[i]->mResetStats.timeouts++;
+                pending[i]->mResetStats.lastReady = elapsed;
+            }
+            break;
+        }
+        IOSleep(1);
+    }
 
     // forcefully set power state to D3
-    this->sendCommand(audioRoot, HDA_VERB_SET_PSTATE, HDA_PARM_PS_D3_HOT);
+    transport->sendAddressedCommands(powerStates, NULL, resetCount);
     DebugLog("--> hda codec power restored\n");
 
-    return true;
+    return resetCount == count;
 }
 
 void IntelHDA::applyIntelTCSEL()
@@ -267,34 +422,39 @@ void IntelHDA::applyIntelTCSEL()
 
 UInt16 IntelHDA::getVendorId()
 {
-    if (mCodecVendorId == -1)
-        mCodecVendorId = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
-    
-    return mCodecVendorId >> 16;
+    return getCodecVendorId() >> 16;
 }
 
 UInt16 IntelHDA::getDeviceId()
 {
-    if (mCodecVendorId == -1)
-        mCodecVendorId = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
-    
-    return mCodecVendorId & 0xFFFF;
+    return getCodecVendorId() & 0xFFFF;
 }
 
 UInt32 IntelHDA::getCodecVendorId()
 {
-    if (mCodecVendorId == -1)
+    if (mCodecVendorId == (UInt32)-1)
+    {
+        // another instance on the controller may have read it already
+        HDACodecIdentity* identity = getCodecIdentity();
+        if (identity && identity->vendorId != (UInt32)-1)
+            return mCodecVendorId = identity->vendorId;
         mCodecVendorId = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
+        if (identity && mCodecVendorId != (UInt32)-1)
+            identity->vendorId = mCodecVendorId;
+    }
 
     return mCodecVendorId;
 }
 
 UInt16 IntelHDA::getAudioRoot()
 {
+    HDACodecIdentity* identity = getCodecIdentity();
+    if (mAudioRoot == (UInt16)-1 && identity)
+        mAudioRoot = identity->audioRoot;
     if (mAudioRoot == (UInt16)-1)
     {
         UInt32 nodes = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
-        if (nodes != -1)
+        if (nodes != (UInt32)-1)
         {
             UInt16 start = nodes & 0xFF;
             UInt16 end = start + ((nodes & 0xFF0000) >> 16);
@@ -305,6 +465,8 @@ UInt16 IntelHDA::getAudioRoot()
                 {
                     DebugLog("getAudioRoot found audio root = 0x%02x\n", node);
                     mAudioRoot = node;
+                    if (identity)
+                        identity->audioRoot = node;
                     break;
                 }
             }
@@ -317,36 +479,336 @@ UInt16 IntelHDA::getAudioRoot()
 
 UInt8 IntelHDA::getTotalNodes()
 {
-    if (mNodes == -1)
+    if (mNodes == (UInt32)-1)
     {
         UInt16 audioRoot = getAudioRoot();
         mNodes = this->sendCommand(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
         // in the case of an invalid response, use zero
-        if (mNodes == -1) mNodes = 0;
+        if (mNodes == (UInt32)-1) mNodes = 0;
     }
     return mNodes & 0x0000FF;
 }
 
 UInt8 IntelHDA::getStartingNode()
 {
-    if (mNodes == -1)
+    if (mNodes == (UInt32)-1)
     {
         UInt16 audioRoot = getAudioRoot();
         mNodes = this->sendCommand(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
         // in the case of an invalid response, use zero
-        if (mNodes == -1) mNodes = 0;
+        if (mNodes == (UInt32)-1) mNodes = 0;
     }
     return (mNodes & 0xFF0000) >> 16;
 }
 
+// Expand a connection list (ranges included); counts only if out is NULL
+static UInt32 expandConnections(const UInt32* responses, UInt32 length, bool longForm, UInt8* out)
+{
+    UInt32 total = 0;
+    UInt16 previous = 0;
+    for (UInt32 i = 0; i < length; i++)
+    {
+        UInt16 entry, node;
+        bool range;
+        if (longForm)
+        {
+            entry = (responses[i / 2] >> (16 * (i % 2))) & 0xFFFF;
+            range = entry & 0x8000;
+            node = entry & 0x7FFF;
+        }
+        else
+        {
+            entry = (responses[i / 4] >> (8 * (i % 4))) & 0xFF;
+            range = entry & 0x80;
+            node = entry & 0x7F;
+        }
+        if (node > 0xFF)
+            continue;
+        if (range && i && previous < node)
+        {
+            for (UInt16 n = previous + 1; n <= node; n++)
+            {
+                if (out) out[total] = n;
+                total++;
+            }
+        }
+        else
+        {
+            if (out) out[total] = node;
+            total++;
+        }
+        previous = node;
+    }
+    return total;
+}
+
+bool IntelHDA::enumerateTopology()
+{
+    freeTopology();
+
+    UInt16 audioRoot = getAudioRoot();
+    UInt8 start = getStartingNode();
+    UInt8 count = getTotalNodes();
+    if ((UInt16)-1 == audioRoot || !count)
+        return false;
+
+    // pass 1: AFG default amp caps, then capabilities and connection list length of every widget
+    const UInt32 kPass1 = 4;
+    UInt32 size1 = 2 + count * kPass1;
+    UInt32 bytes1 = 2 * size1 * sizeof(UInt32);
+    UInt32* commands = (UInt32*)IOMalloc(bytes1);
+    if (!commands)
+        return false;
+    UInt32* caps = commands + size1;
+    commands[0] = HDA_COMMAND_12(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_AMPCAP_IN);
+    commands[1] = HDA_COMMAND_12(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_AMPCAP_OUT);
+    for (UInt32 i = 0; i < count; i++)
+    {
+        UInt8 node = start + i;
+        commands[2 + i * kPass1 + 0] = HDA_COMMAND_12(node, HDA_VERB_GET_PARAM, HDA_PARM_AUDIOCAP);
+        commands[2 + i * kPass1 + 1] = HDA_COMMAND_12(node, HDA_VERB_GET_PARAM, HDA_PARM_AMPCAP_IN);
+        commands[2 + i * kPass1 + 2] = HDA_COMMAND_12(node, HDA_VERB_GET_PARAM, HDA_PARM_AMPCAP_OUT);
+        commands[2 + i * kPass1 + 3] = HDA_COMMAND_12(node, HDA_VERB_GET_PARAM, HDA_PARM_CONNLEN);
+    }
+    sendCommands(commands, caps, size1);
+    for (UInt32 i = 0; i < size1; i++)
+        if (caps[i] == (UInt32)-1) caps[i] = 0;
+#define NODE_CAPS(i, n) caps[2 + (i) * kPass1 + (n)]
+
+    // pass 2: pin caps and config default of pins, connection list entries
+    UInt32 size2 = 0;
+    for (UInt32 i = 0; i < count; i++)
+    {
+        UInt32 widgetCaps = NODE_CAPS(i, 0), connLen = NODE_CAPS(i, 3);
+        if (HDA_WIDGET_TYPE(widgetCaps) == HDA_WIDGET_TYPE_PIN)
+            size2 += 2;
+        if (HDA_WIDGET_HAS_CONN_LIST(widgetCaps))
+            size2 += (HDA_CONNLEN_LENGTH(connLen) + (HDA_CONNLEN_LONG_FORM(connLen) ? 1 : 3)) / (HDA_CONNLEN_LONG_FORM(connLen) ? 2 : 4);
+    }
+    UInt32 bytes2 = 2 * size2 * sizeof(UInt32);
+    UInt32* commands2 = size2 ? (UInt32*)IOMalloc(bytes2) : NULL;
+    if (size2 && !commands2)
+    {
+        IOFree(commands, bytes1);
+        return false;
+    }
+    UInt32* responses2 = commands2 + size2;
+    UInt32 n = 0;
+    for (UInt32 i = 0; i < count; i++)
+    {
+        UInt8 node = start + i;
+        UInt32 widgetCaps = NODE_CAPS(i, 0), connLen = NODE_CAPS(i, 3);
+        if (HDA_WIDGET_TYPE(widgetCaps) == HDA_WIDGET_TYPE_PIN)
+        {
+            commands2[n++] = HDA_COMMAND_12(node, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP);
+            commands2[n++] = HDA_COMMAND_12(node, HDA_VERB_GET_CONFIG_DEFAULT, 0);
+        }
+        if (HDA_WIDGET_HAS_CONN_LIST(widgetCaps))
+        {
+            UInt32 perVerb = HDA_CONNLEN_LONG_FORM(connLen) ? 2 : 4;
+            for (UInt32 index = 0; index < HDA_CONNLEN_LENGTH(connLen); index += perVerb)
+                commands2[n++] = HDA_COMMAND_12(node, HDA_VERB_GET_CONN_LIST, index);
+        }
+    }
+    if (size2)
+        sendCommands(commands2, responses2, size2);
+
+    // size the expanded connection lists (failed reads leave a node unconnected)
+    UInt32 connectionCount = 0;
+    n = 0;
+    for (UInt32 i = 0; i < count; i++)
+    {
+        UInt32 widgetCaps = NODE_CAPS(i, 0), connLen = NODE_CAPS(i, 3);
+        if (HDA_WIDGET_TYPE(widgetCaps) == HDA_WIDGET_TYPE_PIN)
+            n += 2;
+        if (HDA_WIDGET_HAS_CONN_LIST(widgetCaps))
+        {
+            bool longForm = HDA_CONNLEN_LONG_FORM(connLen);
+            UInt32 verbs = (HDA_CONNLEN_LENGTH(connLen) + (longForm ? 1 : 3)) / (longForm ? 2 : 4);
+            bool valid = true;
+            for (UInt32 v = 0; v < verbs; v++)
+                if (responses2[n + v] == (UInt32)-1) valid = false;
+            if (valid)
+                connectionCount += expandConnections(&responses2[n], HDA_CONNLEN_LENGTH(connLen), longForm, NULL);
+            n += verbs;
+        }
+    }
+
+    // one allocation holds all arrays: 32-bit arrays first, then 16-bit, then 8-bit
+    mTopologySize = count * 5 * sizeof(UInt32) + (count + 1) * sizeof(UInt16) + connectionCount;
+    mTopologyMemory = IOMalloc(mTopologySize);
+    if (!mTopologyMemory)
+    {
+        if (commands2) IOFree(commands2, bytes2);
+        IOFree(commands, bytes1);
+        mTopologySize = 0;
+        return false;
+    }
+    bzero(mTopologyMemory, mTopologySize);
+    mTopology.startNode = start;
+    mTopology.nodeCount = count;
+    mTopology.connectionCount = connectionCount;
+    mTopology.widgetCaps = (UInt32*)mTopologyMemory;
+    mTopology.pinCaps = mTopology.widgetCaps + count;
+    mTopology.ampInCaps = mTopology.pinCaps + count;
+    mTopology.ampOutCaps = mTopology.ampInCaps + count;
+    mTopology.configDefault = mTopology.ampOutCaps + count;
+    mTopology.connectionIndex = (UInt16*)(mTopology.configDefault + count);
+    mTopology.connections = (UInt8*)(mTopology.connectionIndex + count + 1);
+
+    n = 0;
+    UInt32 connection = 0;
+    for (UInt32 i = 0; i < count; i++)
+    {
+        UInt32 widgetCaps = NODE_CAPS(i, 0), connLen = NODE_CAPS(i, 3);
+        mTopology.widgetCaps[i] = widgetCaps;
+        mTopology.ampInCaps[i] = HDA_WIDGET_AMP_OVERRIDE(widgetCaps) ? NODE_CAPS(i, 1) : caps[0];
+        mTopology.ampOutCaps[i] = HDA_WIDGET_AMP_OVERRIDE(widgetCaps) ? NODE_CAPS(i, 2) : caps[1];
+        mTopology.connectionIndex[i] = connection;
+        if (HDA_WIDGET_TYPE(widgetCaps) == HDA_WIDGET_TYPE_PIN)
+        {
+            mTopology.pinCaps[i] = responses2[n] != (UInt32)-1 ? responses2[n] : 0;
+            mTopology.configDefault[i] = responses2[n + 1] != (UInt32)-1 ? responses2[n + 1] : 0;
+            n += 2;
+        }
+        if (HDA_WIDGET_HAS_CONN_LIST(widgetCaps))
+        {
+            bool longForm = HDA_CONNLEN_LONG_FORM(connLen);
+            UInt32 verbs = (HDA_CONNLEN_LENGTH(connLen) + (longForm ? 1 : 3)) / (longForm ? 2 : 4);
+            bool valid = true;
+            for (UInt32 v = 0; v < verbs; v++)
+                if (responses2[n + v] == (UInt32)-1) valid = false;
+            if (valid)
+                connection += expandConnections(&responses2[n], HDA_CONNLEN_LENGTH(connLen), longForm, &mTopology.connections[connection]);
+            n += verbs;
+        }
+    }
+    mTopology.connectionIndex[count] = connection;
+#undef NODE_CAPS
+
+    if (commands2) IOFree(commands2, bytes2);
+    IOFree(commands, bytes1);
+
+    DebugLog("enumerateTopology: %d nodes from 0x%02x, %d connections\n", count, start, connectionCount);
+    return true;
+}
+
+void IntelHDA::freeTopology()
+{
+    if (mTopologyMemory)
+        IOFree(mTopologyMemory, mTopologySize);
+    mTopologyMemory = NULL;
+    mTopologySize = 0;
+    bzero(&mTopology, sizeof(mTopology));
+}
+
+UInt16 IntelHDA::getConnections(UInt8 node, const UInt8** connections)
+{
+    if (!hasTopologyNode(node))
+    {
+        *connections = NULL;
+        return 0;
+    }
+    UInt8 index = node - mTopology.startNode;
+    *connections = &mTopology.connections[mTopology.connectionIndex[index]];
+    return mTopology.connectionIndex[index + 1] - mTopology.connectionIndex[index];
+}
+
+UInt32 IntelHDA::dumpCodec(void* buffer, UInt32 size)
+{
+    if (!mTopologyMemory && !enumerateTopology())
+        return 0;
+
+    UInt32 count = mTopology.nodeCount;
+    UInt32 required = sizeof(CodecDumpHeader) + count * sizeof(CodecDumpNode) + mTopology.connectionCount;
+    if (required > size)
+        return required;
+
+    // everything that is not a capability, in one program
+    const UInt32 kLive = 10;
+    UInt32 commandCount = 2 + count * kLive;
+    UInt32 bytes = 2 * commandCount * sizeof(UInt32);
+    UInt32* commands = (UInt32*)IOMalloc(bytes);
+    if (!commands)
+        return 0;
+    UInt32* responses = commands + commandCount;
+    UInt16 audioRoot = getAudioRoot();
+    commands[0] = HDA_COMMAND_12(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_REVISION);
+    commands[1] = HDA_COMMAND_12(audioRoot, HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+    for (UInt32 i = 0; i < count; i++)
+    {
+        UInt8 node = mTopology.startNode + i;
+        UInt32* live = &commands[2 + i * kLive];
+        live[0] = HDA_COMMAND_12(node, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+        live[1] = HDA_COMMAND_12(node, HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+        live[2] = HDA_COMMAND_12(node, HDA_VERB_GET_CONNECT_SEL, HDA_PARM_NULL);
+        live[3] = HDA_COMMAND_12(node, HDA_VERB_GET_PIN_WIDGET_CONTROL, HDA_PARM_NULL);
+        live[4] = HDA_COMMAND_12(node, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+        live[5] = HDA_COMMAND_12(node, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+        live[6] = HDA_COMMAND_4(node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(0, 1, 0));
+        live[7] = HDA_COMMAND_4(node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(0, 0, 0));
+        live[8] = HDA_COMMAND_4(node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(0, 1, 1));
+        live[9] = HDA_COMMAND_4(node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(0, 0, 1));
+    }
+    sendCommands(commands, responses, commandCount);
+
+    CodecDumpHeader* header = (CodecDumpHeader*)buffer;
+    CodecDumpNode* nodes = (CodecDumpNode*)(header + 1);
+    UInt8* connections = (UInt8*)(nodes + count);
+    bzero(buffer, required);
+    header->version = kCodecDumpVersion;
+    header->size = required;
+    header->headerSize = sizeof(CodecDumpHeader);
+    header->nodeSize = sizeof(CodecDumpNode);
+    header->vendorId = getCodecVendorId();
+    header->subsystemId = getSubsystemId();
+    header->revisionId = responses[0];
+    header->codecAddress = mCodecAddress;
+    header->audioRoot = audioRoot;
+    header->startNode = mTopology.startNode;
+    header->nodeCount = count;
+    header->powerState = responses[1];
+    header->connectionCount = mTopology.connectionCount;
+    for (UInt32 i = 0; i < count; i++)
+    {
+        CodecDumpNode& node = nodes[i];
+        const UInt32* live = &responses[2 + i * kLive];
+        node.node = mTopology.startNode + i;
+        node.widgetCaps = mTopology.widgetCaps[i];
+        node.pinCaps = mTopology.pinCaps[i];
+        node.ampInCaps = mTopology.ampInCaps[i];
+        node.ampOutCaps = mTopology.ampOutCaps[i];
+        node.configDefault = HDA_WIDGET_TYPE(node.widgetCaps) == HDA_WIDGET_TYPE_PIN ? live[0] : 0;
+        node.powerState = live[1];
+        node.connectionSelect = live[2];
+        node.pinControl = live[3];
+        node.pinSense = live[4];
+        node.eapd = live[5];
+        node.ampIn[0] = live[6];
+        node.ampIn[1] = live[7];
+        node.ampOut[0] = live[8];
+        node.ampOut[1] = live[9];
+        node.connectionIndex = mTopology.connectionIndex[i];
+        node.connectionLength = mTopology.connectionIndex[i + 1] - mTopology.connectionIndex[i];
+    }
+    memcpy(connections, mTopology.connections, mTopology.connectionCount);
+
+    IOFree(commands, bytes);
+    return required;
+}
+
 UInt32 IntelHDA::getSubsystemId()
 {
-    if (mCodecSubsystemId == -1)
+    if (mCodecSubsystemId == (UInt32)-1)
     {
+        HDACodecIdentity* identity = getCodecIdentity();
+        if (identity && identity->subsystemId != (UInt32)-1)
+            return mCodecSubsystemId = identity->subsystemId;
         UInt16 audioRoot = getAudioRoot();
         mCodecSubsystemId = this->sendCommand(audioRoot, HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL);
         // in the case of an invalid response, use zero
-        if (mCodecSubsystemId == -1) mCodecSubsystemId = 0;
+        if (mCodecSubsystemId == (UInt32)-1) mCodecSubsystemId = 0;
+        else if (identity) identity->subsystemId = mCodecSubsystemId;
     }
     return mCodecSubsystemId;
 }
@@ -360,6 +822,9 @@ UInt32 IntelHDA::getPCISubId()
 
 UInt32 IntelHDA::getLayoutID()
 {
+    if (mLayoutID != (UInt32)-1)
+        return mLayoutID;
+
     UInt32 layoutID = -1;
     if (mDevice)
     {
@@ -373,19 +838,17 @@ UInt32 IntelHDA::getLayoutID()
                 memcpy(&layoutID, data->getBytesNoCopy(), sizeof(UInt32));
         }
     }
-    return layoutID;
+    return mLayoutID = layoutID;
 }
 
 UInt32 IntelHDA::sendCommand(UInt8 nodeId, UInt16 verb, UInt8 payload)
 {
-    DebugLog("SendCommand: node 0x%02x, verb 0x%06x, payload 0x%02x.\n", nodeId, verb, payload);
-    return this->sendCommand((nodeId & 0xFF) << 20 | (verb & 0xFFF) << 8 | payload);
+    return this->sendCommand(HDA_COMMAND_12(nodeId, verb, payload));
 }
 
 UInt32 IntelHDA::sendCommand(UInt8 nodeId, UInt8 verb, UInt16 payload)
 {
-    DebugLog("SendCommand: node 0x%02x, verb 0x%02x, payload 0x%04x.\n", nodeId, verb, payload);
-    return this->sendCommand((nodeId & 0xFF) << 20 | (verb & 0xF) << 16 | payload);
+    return this->sendCommand(HDA_COMMAND_4(nodeId, verb, payload));
 }
 
 UInt32 IntelHDA::sendCommand(UInt32 command)
@@ -395,98 +858,1099 @@ UInt32 IntelHDA::sendCommand(UInt32 command)
     if (mDeviceMemory == NULL)
         return -1;
     
-    DebugLog("SendCommand: (w) --> 0x%08x\n", fullCommand);
-  
+    // each command is in the verb trace (logging every one changes timing too much)
     UInt32 response = -1;
     
+    mShadowStamp++;
+    if (lookupParameter(fullCommand, &response))
+        trace(fullCommand, response, kVerbTraceCached);
+    else if (skipRedundant(fullCommand))
+    {
+        response = 0;
+        trace(fullCommand, response, kVerbTraceSkipped);
+    }
+    else
+        this->executeCommands(&fullCommand, &response, 1);
+    
+    return response;
+}
+
+UInt32 IntelHDA::sendCommands(const UInt32* commands, UInt32* responses, UInt32 count)
+{
+    // commands are addressed and sent in chunks to keep stack usage bounded
+    const UInt32 kChunk = 32;
+    UInt32 fullCommands[kChunk];
+    UInt32 pendingResponses[kChunk];
+    UInt32 pendingIndex[kChunk];
+    UInt32 chunkResponses[kChunk];
+
+    if (mDeviceMemory == NULL)
+    {
+        if (responses)
+            for (UInt32 i = 0; i < count; i++)
+                responses[i] = -1;
+        return 0;
+    }
+
+    DebugLog("SendCommands: %u command(s) starting with 0x%08x\n", count, count ? commands[0] : 0);
+
+    mShadowStamp++;
+    UInt32 succeeded = 0;
+    for (UInt32 base = 0; base < count; base += kChunk)
+    {
+        UInt32 chunk = count - base < kChunk ? count - base : kChunk;
+        UInt32* results = responses ? &responses[base] : chunkResponses;
+
+        // answer cached parameters, skip writes that change nothing, send everything else
+        UInt32 pending = 0;
+        for (UInt32 i = 0; i < chunk; i++)
+        {
+            UInt32 fullCommand = (mCodecAddress & 0xF) << 28 | (commands[base + i] & 0x0FFFFFFF);
+            if (lookupParameter(fullCommand, &results[i]))
+            {
+                trace(fullCommand, results[i], kVerbTraceCached);
+                succeeded++;
+                continue;
+            }
+            if (skipRedundant(fullCommand))
+            {
+                results[i] = 0;
+                trace(fullCommand, results[i], kVerbTraceSkipped);
+                succeeded++;
+                continue;
+            }
+            pendingIndex[pending] = i;
+            fullCommands[pending++] = fullCommand;
+        }
+        if (!pending)
+            continue;
+
+        succeeded += this->executeCommands(fullCommands, pendingResponses, pending);
+        for (UInt32 i = 0; i < pending; i++)
+            results[pendingIndex[i]] = pendingResponses[i];
+    }
+
+    DebugLog("SendCommands: %u of %u command(s) succeeded\n", succeeded, count);
+
+    return succeeded;
+}
+
+UInt32 IntelHDA::sendAddressedCommands(const UInt32* fullCommands, UInt32* responses, UInt32 count)
+{
+    const UInt32 kChunk = 32;
+    UInt32 chunkResponses[kChunk];
+
+    if (mTransport)
+        return mTransport->sendAddressedCommands(fullCommands, responses, count);
+
+    if (mDeviceMemory == NULL)
+    {
+        if (responses)
+            for (UInt32 i = 0; i < count; i++)
+                responses[i] = -1;
+        return 0;
+    }
+
+    DebugLog("SendAddressedCommands: %u command(s) starting with 0x%08x\n", count, count ? fullCommands[0] : 0);
+
+    UInt32 succeeded = 0;
+    for (UInt32 base = 0; base < count; base += kChunk)
+    {
+        UInt32 chunk = count - base < kChunk ? count - base : kChunk;
+        UInt32* results = responses ? &responses[base] : chunkResponses;
+        succeeded += this->transmit(&fullCommands[base], results, chunk);
+        for (UInt32 i = 0; i < chunk; i++)
+            trace(fullCommands[base + i], results[i], results[i] == (UInt32)-1 ? kVerbTraceFailed : kVerbTraceSent);
+    }
+    return succeeded;
+}
+
+UInt32 IntelHDA::executeCommands(const UInt32* fullCommands, UInt32* responses, UInt32 count)
+{
+    UInt32 succeeded = mTransport ? mTransport->transmit(fullCommands, responses, count) : this->transmit(fullCommands, responses, count);
+
+    // parameters never change for a given codec, remember them
+    for (UInt32 i = 0; i < count; i++)
+    {
+        cacheParameter(fullCommands[i], responses[i]);
+        if (responses[i] == (UInt32)-1)
+            forgetShadow(fullCommands[i]);
+        trace(fullCommands[i], responses[i], responses[i] == (UInt32)-1 ? kVerbTraceFailed : kVerbTraceSent);
+    }
+
+    return succeeded;
+}
+
+UInt32 IntelHDA::transmit(const UInt32* fullCommands, UInt32* responses, UInt32 count)
+{
+    UInt32 succeeded = 0;
+
+    lockController();
     switch (mCommandMode)
     {
         case PIO:
-            response = this->executePIO(fullCommand);
+            for (UInt32 i = 0; i < count; i++)
+            {
+                responses[i] = this->executePIO(fullCommands[i]);
+                if (responses[i] != (UInt32)-1)
+                    succeeded++;
+            }
             break;
         case DMA:
-            AlwaysLog("Unsupported command mode DMA requested.\n");
-            response = -1;
+            if (this->checkDMA())
+            {
+                succeeded = this->executeDMA(fullCommands, responses, count);
+                break;
+            }
+            // rings could not be reprogrammed, PIO until they can
+            for (UInt32 i = 0; i < count; i++)
+            {
+                responses[i] = this->executePIO(fullCommands[i]);
+                if (responses[i] != (UInt32)-1)
+                    succeeded++;
+            }
             break;
         default:
-            response = -1;
+            for (UInt32 i = 0; i < count; i++)
+                responses[i] = -1;
             break;
     }
-    
-    DebugLog("SendCommand: (r) <-- 0x%08x\n", response);
-    
-    return response;
+    unlockController();
+
+    return succeeded;
 }
 
-UInt32 IntelHDA::executePIO(UInt32 command)
+// Parameter cache: open addressed, keyed by codec address, node and parameter ID
+
+#define PARAM_CACHE_KEY(fullCommand) (0x80000000 | ((fullCommand) >> 20) << 8 | ((fullCommand) & 0xFF))
+#define IS_GET_PARAM(fullCommand) ((((fullCommand) >> 8) & 0xFFF) == HDA_VERB_GET_PARAM)
+
+static inline unsigned paramCacheSlot(UInt32 key, unsigned probe)
 {
-    UInt16 status;
+    return ((key * 2654435761U) >> 23) + probe;
+}
 
-    DebugLog("executePIO(enter), ioDelayCount: %u\n", ioDelayCount);
-    
-    status = 0x1; // Busy status
-    
-    for (int i = 0; i < 100; i++)
+bool IntelHDA::lookupParameter(UInt32 fullCommand, UInt32* value)
+{
+    if (!IS_GET_PARAM(fullCommand))
+        return false;
+
+    if (mParamCache)
     {
-        status = mRegMap->ICS;
-        
-        if (!HDA_ICS_IS_BUSY(status))
-            break;
-        
-        ::IODelay(10);
-        DebugOnly(ioDelayCount++);
+        UInt32 key = PARAM_CACHE_KEY(fullCommand);
+        for (unsigned probe = 0; probe < kParamCacheSize; probe++)
+        {
+            ParamCacheEntry& entry = mParamCache[paramCacheSlot(key, probe) & (kParamCacheSize-1)];
+            if (!entry.key)
+                break;
+            if (entry.key == key)
+            {
+                *value = entry.value;
+                mParamCacheHits++;
+                return true;
+            }
+        }
     }
-    
-    DebugLog("executePIO(busy wait), ioDelayCount: %u\n", ioDelayCount);
+    mParamCacheMisses++;
+    return false;
+}
 
-    // HDA controller was not ready to receive PIO commands
-    if (HDA_ICS_IS_BUSY(status))
+void IntelHDA::cacheParameter(UInt32 fullCommand, UInt32 value)
+{
+    // failed reads are not cached, the codec may not be awake yet
+    if (!IS_GET_PARAM(fullCommand) || value == (UInt32)-1)
+        return;
+
+    if (!mParamCache)
     {
-        DebugLog("ExecutePIO timed out waiting for ICS readiness.\n");
-        return -1;
+        mParamCache = (ParamCacheEntry*)IOMalloc(kParamCacheSize * sizeof(ParamCacheEntry));
+        if (!mParamCache)
+            return;
+        bzero(mParamCache, kParamCacheSize * sizeof(ParamCacheEntry));
     }
-    
-    //DEBUG_LOG("IntelHDA::ExecutePIO ICB bit clear.\n");
-    
-    // Queue the verb for the HDA controller
-    mRegMap->ICW = command;
-    
-    status = 0x1; // Busy status
-    mRegMap->ICS = status;
-    
-    //DEBUG_LOG("IntelHDA::ExecutePIO Wrote verb and set ICB bit.\n");
-    
-    // Wait for HDA controller to return with a response
-    for (int i = 0; i < 100; i++)
+
+    UInt32 key = PARAM_CACHE_KEY(fullCommand);
+    for (unsigned probe = 0; probe < kParamCacheSize; probe++)
     {
-        status = mRegMap->ICS;
-        
-        if (!HDA_ICS_IS_BUSY(status))
-            break;
-        
-        ::IODelay(10);
-        DebugOnly(ioDelayCount++);
+        ParamCacheEntry& entry = mParamCache[paramCacheSlot(key, probe) & (kParamCacheSize-1)];
+        if (!entry.key || entry.key == key)
+        {
+            entry.key = key;
+            entry.value = value;
+            return;
+        }
     }
+}
 
-    DebugLog("executePIO(status wait), ioDelayCount: %u\n", ioDelayCount);
+void IntelHDA::invalidateParameterCache()
+{
+    if (mParamCache)
+        bzero(mParamCache, kParamCacheSize * sizeof(ParamCacheEntry));
+}
 
-    // Store the result validity while IRV is cleared
-    bool validResult = HDA_ICS_IS_VALID(status);
-    
-    UInt32 response;
-    
-    if (validResult)
-        response = mRegMap->IRR;
-    
-    // Reset IRV
-    status = 0x02; // Valid, Non-busy status
-    mRegMap->ICS = status;
-    
-    if (!validResult)
+// Shadow registers: open addressed like the parameter cache, keyed by node and
+// SET verb. Only verbs whose state reads back through a GET verb are shadowed.
+
+#define SHADOW_KEY(fullCommand) (0x80000000 | (((fullCommand) >> 8) & 0xFFFFF))
+
+static bool getShadowReadBack(UInt16 setVerb, UInt16* getVerb, unsigned* shift)
+{
+    *shift = 0;
+    switch (setVerb)
     {
-        DebugLog("ExecutePIO Invalid result received.\n");
-        return -1;
+        case 0x701:     // connection select
+        case 0x703:     // processing state
+        case 0x707:     // pin widget control
+        case HDA_VERB_SET_UNSOLICITED_ENABLE:
+        case HDA_VERB_EAPDBTL_SET:
+        case 0x70D:     // digital converter control 1
+        case 0x70F:     // volume knob
+        case 0x715: case 0x716: case 0x717: case 0x718: case 0x719: case 0x71A:   // GPIO
+            *getVerb = 0xF00 | (setVerb & 0xFF);
+            return true;
+        case HDA_VERB_SET_CONFIG_DEFAULT_BYTES_0:
+        case HDA_VERB_SET_CONFIG_DEFAULT_BYTES_1:
+        case HDA_VERB_SET_CONFIG_DEFAULT_BYTES_2:
+        case HDA_VERB_SET_CONFIG_DEFAULT_BYTES_3:
+            *getVerb = HDA_VERB_GET_CONFIG_DEFAULT;
+            *shift = (setVerb - HDA_VERB_SET_CONFIG_DEFAULT_BYTES_0) * 8;
+            return true;
     }
-    
-    return response;
+    return false;
+}
+
+IntelHDA::ShadowEntry* IntelHDA::lookupShadow(UInt32 fullCommand, bool create)
+{
+    if (!mShadow)
+    {
+        if (!create)
+            return NULL;
+        mShadow = (ShadowEntry*)IOMalloc(kShadowSize * sizeof(ShadowEntry));
+        if (!mShadow)
+            return NULL;
+        bzero(mShadow, kShadowSize * sizeof(ShadowEntry));
+    }
+
+    UInt32 key = SHADOW_KEY(fullCommand);
+    for (unsigned probe = 0; probe < kShadowSize; probe++)
+    {
+        ShadowEntry& entry = mShadow[paramCacheSlot(key, probe) & (kShadowSize-1)];
+        if (entry.key == key)
+            return &entry;
+        if (!entry.key)
+        {
+            if (!create)
+                return NULL;
+            entry.key = key;
+            entry.value = kShadowUnknown;
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+bool IntelHDA::skipRedundant(UInt32 fullCommand)
+{
+    if (mShadowMode == ShadowOff)
+        return false;
+
+    UInt16 verb = (fullCommand >> 8) & 0xFFF;
+    if (verb == HDA_VERB_RESET)
+    {
+        // everything after this starts from the power on defaults
+        invalidateShadow();
+        return false;
+    }
+    UInt16 getVerb;
+    unsigned shift;
+    if (!getShadowReadBack(verb, &getVerb, &shift))
+        return false;
+
+    ShadowEntry* entry = lookupShadow(fullCommand, true);
+    if (!entry)
+        return false;
+    UInt8 payload = fullCommand & 0xFF;
+    if (entry->value == payload)
+    {
+        // a value written earlier in this same send is known without asking
+        if (mShadowMode == ShadowTrust || entry->stamp == mShadowStamp)
+        {
+            mShadowStats.skipped++;
+            return true;
+        }
+
+        UInt32 read = (fullCommand & 0xFFF00000) | (UInt32)getVerb << 8;
+        UInt32 response;
+        this->executeCommands(&read, &response, 1);
+        if (response != (UInt32)-1 && ((response >> shift) & 0xFF) == payload)
+        {
+            entry->stamp = mShadowStamp;
+            mShadowStats.verified++;
+            mShadowStats.skipped++;
+            return true;
+        }
+        mShadowStats.mismatched++;
+    }
+
+    // record as written now, so later commands of the same send see it
+    entry->value = payload;
+    entry->stamp = mShadowStamp;
+    return false;
+}
+
+void IntelHDA::forgetShadow(UInt32 fullCommand)
+{
+    if (ShadowEntry* entry = lookupShadow(fullCommand, false))
+        entry->value = kShadowUnknown;
+}
+
+void IntelHDA::invalidateShadow()
+{
+    if (mShadow)
+    {
+        bzero(mShadow, kShadowSize * sizeof(ShadowEntry));
+        mShadowStats.invalidated++;
+    }
+}
+
+void IntelHDA::setShadowMode(HDAShadowMode shadowMode)
+{
+    mShadowMode = shadowMode;
+    invalidateShadow();
+}
+
+UInt32 IntelHDA::elideRedundant(UInt32* fullCommands, UInt32 count)
+{
+    if (mShadowMode == ShadowOff)
+        return count;
+
+    mShadowStamp++;
+    UInt32 kept = 0;
+    for (UInt32 i = 0; i < count; i++)
+    {
+        if (!skipRedundant(fullCommands[i]))
+            fullCommands[kept++] = fullCommands[i];
+    }
+    return kept;
+}
+
+bool IntelHDA::checkSettingsReset()
+{
+    if (mShadowMode == ShadowOff || !mShadow)
+        return false;
+
+    UInt16 audioRoot = getAudioRoot();
+    UInt32 state = (UInt16)-1 == audioRoot ? -1 : this->sendCommand(audioRoot, HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+    if (state != (UInt32)-1 && !HDA_PSTATE_SETTINGS_RESET(state))
+        return false;
+
+    DebugLog("codec %d settings reset, dropping shadow\n", mCodecAddress);
+    invalidateShadow();
+    return true;
+}
+
+// Controllers: one per PCI device, looked up under a global lock that is
+// only held while instances come and go
+
+static IOLock* gControllersLock = NULL;
+static HDAController gControllers[HDA_MAX_CONTROLLERS];
+
+bool IntelHDA::initControllers()
+{
+    gControllersLock = IOLockAlloc();
+    bzero(gControllers, sizeof(gControllers));
+    return gControllersLock != NULL;
+}
+
+void IntelHDA::freeControllers()
+{
+    for (int i = 0; i < HDA_MAX_CONTROLLERS; i++)
+    {
+        if (gControllers[i].lock)
+            IORecursiveLockFree(gControllers[i].lock);
+        OSSafeRelease(gControllers[i].memoryMap);
+        if (gControllers[i].trace)
+            IOFree(gControllers[i].trace, sizeof(HDAVerbTrace));
+    }
+    bzero(gControllers, sizeof(gControllers));
+    if (gControllersLock)
+    {
+        IOLockFree(gControllersLock);
+        gControllersLock = NULL;
+    }
+}
+
+HDAController* IntelHDA::attachController(IOPCIDevice* device)
+{
+    if (!device || !gControllersLock)
+        return NULL;
+
+    HDAController* result = NULL;
+    IOLockLock(gControllersLock);
+    for (int i = 0; i < HDA_MAX_CONTROLLERS && !result; i++)
+    {
+        if (gControllers[i].device == device)
+            result = &gControllers[i];
+    }
+    for (int i = 0; i < HDA_MAX_CONTROLLERS && !result; i++)
+    {
+        if (gControllers[i].device)
+            continue;
+        IORecursiveLock* lock = IORecursiveLockAlloc();
+        if (!lock)
+            break;
+        bzero(&gControllers[i], sizeof(gControllers[i]));
+        memset(gControllers[i].codecs, 0xFF, sizeof(gControllers[i].codecs));
+        gControllers[i].device = device;
+        gControllers[i].lock = lock;
+        result = &gControllers[i];
+    }
+    if (result)
+        result->references++;
+    IOLockUnlock(gControllersLock);
+
+    if (!result)
+        AlwaysLog("No controller entry available, commands are not serialized\n");
+    return result;
+}
+
+void IntelHDA::detachController(HDAController* controller)
+{
+    if (!controller || !gControllersLock)
+        return;
+
+    IOLockLock(gControllersLock);
+    if (!--controller->references)
+    {
+        OSSafeRelease(controller->memoryMap);
+        if (controller->trace)
+            IOFree(controller->trace, sizeof(HDAVerbTrace));
+        IORecursiveLockFree(controller->lock);
+        bzero(controller, sizeof(*controller));
+    }
+    IOLockUnlock(gControllersLock);
+}
+
+void IntelHDA::lockController()
+{
+    if (!mController)
+        return;
+
+    if (!IORecursiveLockTryLock(mController->lock))
+    {
+        UInt64 start = getUptimeMicroseconds();
+        IORecursiveLockLock(mController->lock);
+        UInt32 wait = (UInt32)(getUptimeMicroseconds() - start);
+        mController->contended++;
+        mController->totalWait += wait;
+        if (wait > mController->maxWait)
+            mController->maxWait = wait;
+    }
+    mController->acquired++;
+}
+
+void IntelHDA::unlockController()
+{
+    if (mController)
+        IORecursiveLockUnlock(mController->lock);
+}
+
+bool IntelHDA::claimCodec(UInt8 codecAddress)
+{
+    if (!mController)
+        return true;
+
+    lockController();
+    bool claimed = !(mController->claimed & (1 << codecAddress));
+    mController->claimed |= 1 << codecAddress;
+    unlockController();
+    return claimed;
+}
+
+void IntelHDA::releaseCodec(UInt8 codecAddress)
+{
+    if (!mController)
+        return;
+
+    lockController();
+    mController->claimed &= ~(1 << codecAddress);
+    unlockController();
+}
+
+UInt32 IntelHDA::getResponseTimeout()
+{
+    // a slow codec is slow for every verb, so allow a multiple of the learned latency
+    UInt32 timeout = mExpectedLatency * 16;
+    if (timeout < kPIOMinTimeout) timeout = kPIOMinTimeout;
+    if (timeout > kPIOMaxTimeout) timeout = kPIOMaxTimeout;
+    return timeout;
+}
+
+bool IntelHDA::waitForICS(UInt16* status, UInt32* elapsed)
+{
+    // Most verbs complete within a link frame or two, so spin on ICS for about
+    // the learned latency, then back off with growing delays until the deadline.
+    UInt32 spin = mExpectedLatency + (mExpectedLatency >> 1);
+    UInt32 timeout = getResponseTimeout();
+
+    UInt64 start = getUptimeMicroseconds();
+    UInt32 delay = 1;
+    for (;;)
+    {
+        *status = mRegMap->ICS;
+        *elapsed = (UInt32)(getUptimeMicroseconds() - start);
+        if (!HDA_ICS_IS_BUSY(*status))
+            return true;
+        if (*elapsed >= timeout)
+            return false;
+        if (*elapsed >= spin)
+        {
+            ::IODelay(delay);
+            DebugOnly(ioDelayCount++);
+            if (delay < kPIOMaxBackoff)
+                delay <<= 1;
+        }
+    }
+}
+
+void IntelHDA::recordLatency(UInt32 elapsed)
+{
+    if (!mLatencyStats.count || elapsed < mLatencyStats.min)
+        mLatencyStats.min = elapsed;
+    if (elapsed > mLatencyStats.max)
+        mLatencyStats.max = elapsed;
+    mLatencyStats.count++;
+
+    // bucket n holds [2^(n-1), 2^n) microseconds, bucket 0 is under 1 microsecond
+    unsigned bucket = 0;
+    for (UInt32 value = elapsed; value && bucket < HDA_LATENCY_BUCKETS-1; value >>= 1)
+        bucket++;
+    mLatencyStats.buckets[bucket]++;
+
+    learnLatency(elapsed);
+}
+
+void IntelHDA::learnLatency(UInt32 elapsed)
+{
+    // moving average kept scaled by 8, so each new sample has 1/8 weight
+    mLatencyAverage = mLatencyAverage - (mLatencyAverage >> 3) + elapsed;
+    mExpectedLatency = mLatencyAverage >> 3;
+    if (!mExpectedLatency)
+        mExpectedLatency = 1;
+}
+
+void IntelHDA::recordTrace(UInt32 fullCommand, UInt32 response, UInt8 status)
+{
+    HDAVerbTrace* trace = mController->trace;
+    UInt32 sequence = OSIncrementAtomic((volatile SInt32*)&trace->next);
+    VerbTraceEntry* entry = &trace->entries[sequence % kVerbTraceEntries];
+
+    // readers skip the entry until it is complete
+    entry->sequence = sequence - 1;
+    OSMemoryBarrier();
+    entry->time = mach_absolute_time();
+    entry->command = fullCommand;
+    entry->response = response;
+    entry->status = status;
+    entry->source = mTraceSource;
+    OSMemoryBarrier();
+    entry->sequence = sequence;
+}
+
+bool IntelHDA::setTracing(bool enable)
+{
+    if (!mController)
+        return false;
+
+    if (enable && !mController->trace)
+    {
+        HDAVerbTrace* trace = (HDAVerbTrace*)IOMalloc(sizeof(HDAVerbTrace));
+        if (!trace)
+            return false;
+        bzero(trace, sizeof(HDAVerbTrace));
+        // entries not written yet never match the sequence they are read for
+        for (UInt32 i = 0; i < kVerbTraceEntries; i++)
+            trace->entries[i].sequence = i - 1;
+        // another instance on the controller may have turned it on meanwhile
+        if (!OSCompareAndSwapPtr(NULL, trace, (void* volatile*)&mController->trace))
+            IOFree(trace, sizeof(HDAVerbTrace));
+    }
+
+    // the trace is kept when turned off, so what was recorded can still be read
+    OSMemoryBarrier();
+    return OSCompareAndSwap(!enable, enable, &mController->tracing) ? !enable : enable;
+}
+
+UInt32 IntelHDA::readTrace(UInt32* cursor, VerbTraceEntry* entries, UInt32 max, UInt32* dropped)
+{
+    HDAVerbTrace* trace = mController ? mController->trace : NULL;
+    *dropped = 0;
+    if (!trace)
+        return 0;
+
+    UInt32 next = trace->next;
+    UInt32 oldest = next > kVerbTraceEntries ? next - kVerbTraceEntries : 0;
+    if (*cursor == kVerbTraceOldest)
+        *cursor = oldest;
+    else if ((SInt32)(next - *cursor) < 0)
+        *cursor = next;
+    else if (next - *cursor > kVerbTraceEntries)
+    {
+        *dropped = oldest - *cursor;
+        *cursor = oldest;
+    }
+
+    UInt32 count = 0;
+    while (count < max && *cursor != next)
+    {
+        VerbTraceEntry* entry = &trace->entries[*cursor % kVerbTraceEntries];
+        entries[count] = *entry;
+        OSMemoryBarrier();
+        if (entries[count].sequence != *cursor || entry->sequence != *cursor)
+        {
+            // overwritten while copied, or still being written (read it next time)
+            if (trace->next - *cursor <= kVerbTraceEntries)
+                break;
+            (*dropped)++;
+            (*cursor)++;
+            continue;
+        }
+        absolutetime_to_nanoseconds(entries[count].time, &entries[count].time);
+        count++;
+        (*cursor)++;
+    }
+    return count;
+}
+
+UInt32 IntelHDA::getLatencyMedian()
+{
+    // upper bound of the bucket holding the middle sample
+    UInt32 total = 0;
+    for (unsigned bucket = 0; bucket < HDA_LATENCY_BUCKETS; bucket++)
+    {
+        total += mLatencyStats.buckets[bucket];
+        if (total && total >= (mLatencyStats.count + 1) / 2)
+        {
+            UInt32 median = 1 << bucket;
+            if (median > mLatencyStats.max) median = mLatencyStats.max;
+            if (median < mLatencyStats.min) median = mLatencyStats.min;
+            return median;
+        }
+    }
+    return 0;
+}
+
+UInt32 IntelHDA::executePIO(UInt32 command)
+{
+    UInt16 status;
+    UInt32 elapsed;
+
+    bool ready = waitForICS(&status, &elapsed);
+
+    // HDA controller was not ready to receive PIO commands
+    if (!ready)
+    {
+        DebugLog("ExecutePIO timed out waiting for ICS readiness.\n");
+        mLatencyStats.timeouts++;
+        return -1;
+    }
+    
+    //DEBUG_LOG("IntelHDA::ExecutePIO ICB bit clear.\n");
+    
+    // Queue the verb for the HDA controller
+    mRegMap->ICW = command;
+    
+    status = 0x1; // Busy status
+    mRegMap->ICS = status;
+    
+    //DEBUG_LOG("IntelHDA::ExecutePIO Wrote verb and set ICB bit.\n");
+    
+    // Wait for HDA controller to return with a response
+    bool completed = waitForICS(&status, &elapsed);
+
+    // Store the result validity while IRV is cleared
+    bool validResult = HDA_ICS_IS_VALID(status);
+    
+    UInt32 response;
+    
+    if (validResult)
+        response = mRegMap->IRR;
+    
+    // Reset IRV
+    status = 0x02; // Valid, Non-busy status
+    mRegMap->ICS = status;
+    
+    if (!completed)
+        mLatencyStats.timeouts++;
+    else if (validResult)
+        recordLatency(elapsed);
+
+    if (!validResult)
+    {
+        DebugLog("ExecutePIO Invalid result received.\n");
+        return -1;
+    }
+    
+    return response;
+}
+
+bool IntelHDA::startDMA()
+{
+    // controller must be out of reset, and rings must not be in use by another driver
+    if (!(mRegMap->GCTL & HDA_GCTL_CRST))
+    {
+        DebugLog("startDMA: controller is in reset\n");
+        return false;
+    }
+    if ((mRegMap->CORBCTL & HDA_CORBCTL_RUN) || (mRegMap->RIRBCTL & HDA_RIRBCTL_DMAEN))
+    {
+        DebugLog("startDMA: CORB/RIRB already running\n");
+        return false;
+    }
+
+    // pick largest ring size supported by both CORB and RIRB
+    UInt8 sizeCap = mRegMap->CORBSIZE & mRegMap->RIRBSIZE;
+    UInt8 size;
+    if (sizeCap & HDA_RINGSIZE_CAP_256)
+    {
+        mRingEntries = 256;
+        size = HDA_RINGSIZE_256;
+    }
+    else if (sizeCap & HDA_RINGSIZE_CAP_16)
+    {
+        mRingEntries = 16;
+        size = HDA_RINGSIZE_16;
+    }
+    else if (sizeCap & HDA_RINGSIZE_CAP_2)
+    {
+        mRingEntries = 2;
+        size = HDA_RINGSIZE_2;
+    }
+    else
+    {
+        DebugLog("startDMA: no usable CORB/RIRB size (0x%02x)\n", sizeCap);
+        return false;
+    }
+
+    // CORB (4 bytes/entry) followed by RIRB (8 bytes/entry), both 128-byte aligned
+    UInt32 corbBytes = mRingEntries * sizeof(UInt32);
+    UInt32 rirbBytes = mRingEntries * 2 * sizeof(UInt32);
+    mach_vm_address_t mask = mRegMap->GCAP_64OK ? 0xFFFFFFFFFFFFFF80ULL : 0x00000000FFFFFF80ULL;
+    mRingMemory = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, kIODirectionInOut | kIOMemoryPhysicallyContiguous, corbBytes + rirbBytes, mask);
+    if (!mRingMemory)
+    {
+        AlwaysLog("startDMA: unable to allocate CORB/RIRB memory\n");
+        return false;
+    }
+    if (mRingMemory->prepare() != kIOReturnSuccess)
+    {
+        AlwaysLog("startDMA: unable to prepare CORB/RIRB memory\n");
+        OSSafeReleaseNULL(mRingMemory);
+        return false;
+    }
+    bzero(mRingMemory->getBytesNoCopy(), corbBytes + rirbBytes);
+    mCORB = (volatile UInt32*)mRingMemory->getBytesNoCopy();
+    mRIRB = (volatile UInt32*)((UInt8*)mRingMemory->getBytesNoCopy() + corbBytes);
+    UInt64 corbPhys = mRingMemory->getPhysicalAddress();
+    UInt64 rirbPhys = corbPhys + corbBytes;
+
+    // program CORB and reset its read pointer (bit must be seen set, then cleared)
+    mRegMap->CORBLBASE = (UInt32)corbPhys;
+    mRegMap->CORBUBASE = (UInt32)(corbPhys >> 32);
+    mRegMap->CORBSIZE = (mRegMap->CORBSIZE & ~0x3) | size;
+    mRegMap->CORBRP = HDA_CORBRP_RST;
+    for (int i = 0; i < 100 && !(mRegMap->CORBRP & HDA_CORBRP_RST); i++)
+        ::IODelay(10);
+    mRegMap->CORBRP = 0;
+    for (int i = 0; i < 100 && (mRegMap->CORBRP & HDA_CORBRP_RST); i++)
+        ::IODelay(10);
+    if (mRegMap->CORBRP & HDA_CORBRP_RST)
+    {
+        AlwaysLog("startDMA: CORB read pointer reset failed\n");
+        stopDMA();
+        return false;
+    }
+    mRegMap->CORBWP = 0;
+    mCORBWritePointer = 0;
+
+    // program RIRB, reset write pointer, no response interrupts
+    mRegMap->RIRBLBASE = (UInt32)rirbPhys;
+    mRegMap->RIRBUBASE = (UInt32)(rirbPhys >> 32);
+    mRegMap->RIRBSIZE = (mRegMap->RIRBSIZE & ~0x3) | size;
+    mRegMap->RIRBWP = HDA_RIRBWP_RST;
+    mRegMap->RINTCNT = 1;
+    mRegMap->RIRBSTS = HDA_RIRBSTS_RINTFL | HDA_RIRBSTS_RIRBOIS;
+    mRIRBReadPointer = 0;
+    bzero(mLateResponses, sizeof(mLateResponses));
+
+    // start both DMA engines
+    mRegMap->RIRBCTL = HDA_RIRBCTL_DMAEN;
+    mRegMap->CORBCTL = HDA_CORBCTL_RUN;
+    for (int i = 0; i < 100 && !(mRegMap->CORBCTL & HDA_CORBCTL_RUN); i++)
+        ::IODelay(10);
+    if (!(mRegMap->CORBCTL & HDA_CORBCTL_RUN))
+    {
+        AlwaysLog("startDMA: CORB DMA engine did not start\n");
+        stopDMA();
+        return false;
+    }
+
+    DebugLog("startDMA: CORB/RIRB running with %d entries\n", mRingEntries);
+    return true;
+}
+
+bool IntelHDA::checkDMA()
+{
+    // Controller reset (sleep/wake, CRST) clears the ring registers behind our back,
+    // and another driver may have programmed its own rings since. Check before each use.
+    if (mRingMemory)
+    {
+        UInt64 corbPhys = mRingMemory->getPhysicalAddress();
+        if ((mRegMap->GCTL & HDA_GCTL_CRST) && (mRegMap->CORBCTL & HDA_CORBCTL_RUN) && (mRegMap->RIRBCTL & HDA_RIRBCTL_DMAEN) &&
+            mRegMap->CORBLBASE == (UInt32)corbPhys && mRegMap->CORBUBASE == (UInt32)(corbPhys >> 32))
+            return true;
+
+        AlwaysLog("CORB/RIRB no longer running (GCTL 0x%08x, CORBCTL 0x%02x), reprogramming\n", mRegMap->GCTL, mRegMap->CORBCTL);
+        bool unsolicited = mUnsolicitedEnabled;
+        releaseRings();
+        if (!startDMA())
+            return false;
+        if (unsolicited)
+        {
+            mRegMap->GCTL |= HDA_GCTL_UNSOL;
+            mUnsolicitedEnabled = true;
+        }
+        return true;
+    }
+
+    // lost earlier, they can be taken again once the controller is out of reset and unused
+    return startDMA();
+}
+
+void IntelHDA::stopDMA()
+{
+    if (!mRingMemory)
+        return;
+
+    if (mRegMap)
+    {
+        if (mUnsolicitedEnabled)
+            mRegMap->GCTL &= ~HDA_GCTL_UNSOL;
+        mRegMap->CORBCTL = 0;
+        mRegMap->RIRBCTL = 0;
+        for (int i = 0; i < 100 && ((mRegMap->CORBCTL & HDA_CORBCTL_RUN) || (mRegMap->RIRBCTL & HDA_RIRBCTL_DMAEN)); i++)
+            ::IODelay(10);
+    }
+
+    releaseRings();
+}
+
+void IntelHDA::releaseRings()
+{
+    // registers are left alone, they may belong to another driver by now
+    mRingMemory->complete();
+    OSSafeReleaseNULL(mRingMemory);
+    mCORB = NULL;
+    mRIRB = NULL;
+    mRingEntries = 0;
+    mUnsolicitedEnabled = false;
+}
+
+bool IntelHDA::enableUnsolicited(bool enable)
+{
+    // without the RIRB there is nowhere for the controller to put them
+    if (!mRingMemory)
+        return false;
+
+    lockController();
+    if (enable)
+        mRegMap->GCTL |= HDA_GCTL_UNSOL;
+    else
+        mRegMap->GCTL &= ~HDA_GCTL_UNSOL;
+    unlockController();
+    mUnsolicitedEnabled = enable;
+    return true;
+}
+
+void IntelHDA::queueUnsolicited(UInt32 response, UInt32 responseEx)
+{
+    // other codecs are handled by their own instance, which does not own the RIRB
+    if (HDA_RIRB_EX_CODEC(responseEx) != mCodecAddress)
+    {
+        DebugLog("dropped unsolicited response 0x%08x from codec %d\n", response, HDA_RIRB_EX_CODEC(responseEx));
+        return;
+    }
+
+    mUnsolicitedReceived++;
+    if (mUnsolicitedCount == kUnsolicitedQueueSize)
+    {
+        // keep the newest, events are state changes so the latest matters most
+        mUnsolicitedHead = (mUnsolicitedHead + 1) % kUnsolicitedQueueSize;
+        mUnsolicitedCount--;
+        mUnsolicitedDropped++;
+    }
+    mUnsolicitedQueue[(mUnsolicitedHead + mUnsolicitedCount) % kUnsolicitedQueueSize] = response;
+    mUnsolicitedCount++;
+}
+
+UInt32 IntelHDA::getUnsolicited(UInt32* responses, UInt32 max)
+{
+    lockController();
+    if (mRingMemory && checkDMA())
+    {
+        // no commands are in flight here, so every new entry should be unsolicited
+        UInt16 mask = mRingEntries - 1;
+        UInt16 writePointer = mRegMap->RIRBWP & 0xFF;
+        if (writePointer != mRIRBReadPointer)
+        {
+            OSSynchronizeIO();
+            while (mRIRBReadPointer != writePointer)
+            {
+                mRIRBReadPointer = (mRIRBReadPointer + 1) & mask;
+                UInt32 response = mRIRB[mRIRBReadPointer * 2];
+                UInt32 responseEx = mRIRB[mRIRBReadPointer * 2 + 1];
+                if (HDA_RIRB_EX_UNSOL(responseEx))
+                    queueUnsolicited(response, responseEx);
+                else if (!isLateResponse(HDA_RIRB_EX_CODEC(responseEx)))
+                    DebugLog("getUnsolicited dropped unexpected response 0x%08x\n", response);
+            }
+            mRegMap->RIRBSTS = HDA_RIRBSTS_RINTFL | HDA_RIRBSTS_RIRBOIS;
+        }
+    }
+    unlockController();
+
+    UInt32 count = 0;
+    while (count < max && mUnsolicitedCount)
+    {
+        responses[count++] = mUnsolicitedQueue[mUnsolicitedHead];
+        mUnsolicitedHead = (mUnsolicitedHead + 1) % kUnsolicitedQueueSize;
+        mUnsolicitedCount--;
+    }
+    return count;
+}
+
+bool IntelHDA::isLateResponse(UInt8 codec)
+{
+    // codecs answer in order, so owed responses come before those to newer commands
+    if (!mLateResponses[codec])
+        return false;
+    if (mach_absolute_time() > mLateDeadline)
+    {
+        // whatever is still owed never came (codec hung or gone)
+        bzero(mLateResponses, sizeof(mLateResponses));
+        return false;
+    }
+    mLateResponses[codec]--;
+    DebugLog("discarded late response from codec %d\n", codec);
+    return true;
+}
+
+UInt32 IntelHDA::executeDMA(const UInt32* commands, UInt32* responses, UInt32 count)
+{
+    // Commands are pipelined through the CORB, keeping at most mRingEntries-1 in flight.
+    // Responses are matched to commands in order per codec address, since responses
+    // from different codecs arriving in the same frame may be written in any order.
+    UInt32 submitted = 0, completed = 0, succeeded = 0;
+    UInt32 nextForCodec[HDA_MAX_CODECS+1];
+    for (int i = 0; i <= HDA_MAX_CODECS; i++)
+        nextForCodec[i] = 0;
+    for (UInt32 i = 0; i < count; i++)
+        responses[i] = -1;
+
+    // the codec has the same time to answer as with PIO, counted from the last answer
+    UInt16 mask = mRingEntries - 1;
+    UInt32 timeout = getResponseTimeout();
+    UInt64 waitStart = getUptimeMicroseconds();
+    while (completed < count)
+    {
+        // queue as many commands as the ring allows, then ring the doorbell once
+        bool waiting = submitted > completed;
+        UInt16 readPointer = mRegMap->CORBRP & 0xFF;
+        bool queued = false;
+        while (submitted < count && ((mCORBWritePointer + 1) & mask) != readPointer && submitted - completed < mask)
+        {
+            mCORBWritePointer = (mCORBWritePointer + 1) & mask;
+            mCORB[mCORBWritePointer] = commands[submitted++];
+            queued = true;
+        }
+        if (queued)
+        {
+            OSSynchronizeIO();
+            mRegMap->CORBWP = mCORBWritePointer;
+            if (!waiting)
+                waitStart = getUptimeMicroseconds();
+        }
+
+        // drain whatever the controller has written to the RIRB
+        UInt16 writePointer = mRegMap->RIRBWP & 0xFF;
+        UInt32 elapsed = (UInt32)(getUptimeMicroseconds() - waitStart);
+        if (writePointer == mRIRBReadPointer)
+        {
+            // no response within the timeout since the last one means codec is not responding
+            if (elapsed >= timeout)
+            {
+                DebugLog("executeDMA timed out after %u us, %u of %u commands completed\n", elapsed, completed, count);
+                break;
+            }
+            ::IODelay(10);
+            DebugOnly(ioDelayCount++);
+            continue;
+        }
+        UInt32 answered = completed;
+        OSSynchronizeIO();
+        while (mRIRBReadPointer != writePointer)
+        {
+            mRIRBReadPointer = (mRIRBReadPointer + 1) & mask;
+            UInt32 response = mRIRB[mRIRBReadPointer * 2];
+            UInt32 responseEx = mRIRB[mRIRBReadPointer * 2 + 1];
+            if (HDA_RIRB_EX_UNSOL(responseEx))
+            {
+                queueUnsolicited(response, responseEx);
+                continue;
+            }
+
+            // answer to a command of an earlier, timed out batch
+            UInt8 codec = HDA_RIRB_EX_CODEC(responseEx);
+            if (isLateResponse(codec))
+                continue;
+
+            // match with oldest outstanding command sent to the same codec
+            UInt32 index = nextForCodec[codec];
+            while (index < submitted && (commands[index] >> 28) != codec)
+                index++;
+            if (index >= submitted)
+            {
+                DebugLog("executeDMA dropped unexpected response 0x%08x from codec %d\n", response, codec);
+                continue;
+            }
+            responses[index] = response;
+            nextForCodec[codec] = index + 1;
+            completed++;
+            succeeded++;
+        }
+        mRegMap->RIRBSTS = HDA_RIRBSTS_RINTFL | HDA_RIRBSTS_RIRBOIS;
+
+        // unsolicited and late responses are no progress
+        if (completed != answered)
+        {
+            learnLatency(elapsed);
+            waitStart = getUptimeMicroseconds();
+        }
+    }
+
+    // A timeout leaves commands in the CORB or with the codec, answering later. Count what
+    // each codec still owes, so those answers are discarded instead of being taken for the
+    // responses of later commands.
+    if (completed < count)
+    {
+        for (int codec = 0; codec <= HDA_MAX_CODECS; codec++)
+            for (UInt32 index = nextForCodec[codec]; index < submitted; index++)
+                if ((commands[index] >> 28) == (UInt32)codec)
+                    mLateResponses[codec]++;
+        UInt64 timeout;
+        nanoseconds_to_absolutetime(kDMALateTimeout * 1000000ULL, &timeout);
+        mLateDeadline = mach_absolute_time() + timeout;
+    }
+
+    return succeeded;
 }
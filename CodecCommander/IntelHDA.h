@@ -21,6 +21,8 @@
 #define CodecCommander_IntelHDA_h
 
 #include "Common.h"
+#include "CodecDump.h"
+#include "VerbTrace.h"
 
 #ifdef DEBUG
 extern unsigned ioDelayCount;
@@ -34,9 +36,15 @@ extern unsigned ioDelayCount;
 #define HDA_VERB_EAPDBTL_SET	(UInt16)0x70C	// EAPD/BTL Enable Set
 #define HDA_VERB_RESET			(UInt16)0x7FF	// Function Reset Execute
 #define HDA_VERB_GET_SUBSYSTEM_ID	(UInt16)0xF20	// Get codec subsystem ID
+#define HDA_VERB_GET_CONN_LIST	(UInt16)0xF02	// Get Connection List Entry
+#define HDA_VERB_GET_CONFIG_DEFAULT	(UInt16)0xF1C	// Get Configuration Default
+#define HDA_VERB_GET_PIN_SENSE	(UInt16)0xF09	// Get Pin Sense
+#define HDA_VERB_GET_CONNECT_SEL	(UInt16)0xF01	// Get Connection Select Control
+#define HDA_VERB_GET_PIN_WIDGET_CONTROL	(UInt16)0xF07	// Get Pin Widget Control
+#define HDA_VERB_SET_UNSOLICITED_ENABLE	(UInt16)0x708	// Set Unsolicited Response enable/tag
 
 #define HDA_VERB_SET_AMP_GAIN	(UInt8)0x3		// Set Amp Gain / Mute
-#define HDA_VERB_GET_AMP_GAIN	(Uint8)0xB		// Get Amp Gain / Mute
+#define HDA_VERB_GET_AMP_GAIN	(UInt8)0xB		// Get Amp Gain / Mute
 
 #define HDA_PARM_NULL		(UInt8)0x00	// Empty or NULL payload
 
@@ -44,7 +52,11 @@ extern unsigned ioDelayCount;
 #define HDA_PARM_REVISION	(UInt8)0x02	// Revision ID
 #define HDA_PARM_NODECOUNT	(UInt8)0x04	// Subordinate Node Count
 #define HDA_PARM_FUNCGRP	(UInt8)0x05	// Function Group Type
+#define HDA_PARM_AUDIOCAP	(UInt8)0x09	// Audio Widget Capabilities
 #define HDA_PARM_PINCAP		(UInt8)0x0C	// Pin Capabilities
+#define HDA_PARM_AMPCAP_IN	(UInt8)0x0D	// Input Amplifier Capabilities
+#define HDA_PARM_CONNLEN	(UInt8)0x0E	// Connection List Length
+#define HDA_PARM_AMPCAP_OUT	(UInt8)0x12	// Output Amplifier Capabilities
 #define HDA_PARM_PWRSTS		(UInt8)0x0F	// Supported Power States
 
 #define HDA_PARM_PS_D0		(UInt8)0x00 // Powerstate D0: Fully on
@@ -58,12 +70,18 @@ extern unsigned ioDelayCount;
 #define HDA_VERB_SET_CONFIG_DEFAULT_BYTES_2      (UInt16)0x71e
 #define HDA_VERB_SET_CONFIG_DEFAULT_BYTES_3      (UInt16)0x71f
 
+// Compose raw commands (codec address is filled in when sent)
+#define HDA_COMMAND_12(nodeId, verb, payload) \
+	((UInt32)((nodeId) & 0xFF) << 20 | (UInt32)((verb) & 0xFFF) << 8 | (UInt32)((payload) & 0xFF))		// 12-bit verb, 8-bit payload
+#define HDA_COMMAND_4(nodeId, verb, payload) \
+	((UInt32)((nodeId) & 0xFF) << 20 | (UInt32)((verb) & 0xF) << 16 | (UInt32)((payload) & 0xFFFF))	// 4-bit verb, 16-bit payload
+
 #define HDA_TYPE_AFG	1	// return from PARM_FUNCGRP is 1 for Audio
 #define HDA_MAX_CODECS	15	// maximum number of codecs supported (0-14)
 
 // Dynamic payload parameters
 #define HDA_PARM_AMP_GAIN_GET(Index, Left, Output) \
-	(UInt16)((Output & 0x1) << 15 | (Left & 0x01) << 13 | Index & 0xF) // Get Amp gain / mute
+	(UInt16)(((Output) & 0x1) << 15 | ((Left) & 0x01) << 13 | ((Index) & 0xF)) // Get Amp gain / mute
 
 #define HDA_PARM_AMP_GAIN_SET(Gain, Mute, Index, SetRight, SetLeft, SetInput, SetOutput) \
 	(UInt16)((SetOutput & 0x01) << 15 | (SetInput & 0x01) << 14 | (SetLeft & 0x01) << 13 | (SetRight & 0x01) << 12 | \
@@ -78,14 +96,74 @@ extern unsigned ioDelayCount;
 // Determine if this Pin widget capabilities is marked EAPD capable
 #define HDA_PINCAP_IS_EAPD_CAPABLE(capabilities) ((capabilities) & (1<<16))
 
+// Audio widget capabilities (HDA_PARM_AUDIOCAP)
+#define HDA_WIDGET_TYPE(caps)			(((caps) >> 20) & 0xF)
+#define HDA_WIDGET_HAS_IN_AMP(caps)		((caps) & (1<<1))
+#define HDA_WIDGET_HAS_OUT_AMP(caps)	((caps) & (1<<2))
+#define HDA_WIDGET_AMP_OVERRIDE(caps)	((caps) & (1<<3))
+#define HDA_WIDGET_UNSOL_CAPABLE(caps)	((caps) & (1<<7))
+#define HDA_WIDGET_HAS_CONN_LIST(caps)	((caps) & (1<<8))
+
+#define HDA_WIDGET_TYPE_OUTPUT		0x0
+#define HDA_WIDGET_TYPE_INPUT		0x1
+#define HDA_WIDGET_TYPE_MIXER		0x2
+#define HDA_WIDGET_TYPE_SELECTOR	0x3
+#define HDA_WIDGET_TYPE_PIN			0x4
+#define HDA_WIDGET_TYPE_POWER		0x5
+#define HDA_WIDGET_TYPE_VOLKNOB		0x6
+#define HDA_WIDGET_TYPE_BEEP		0x7
+#define HDA_WIDGET_TYPE_VENDOR		0xF
+
+// Connection list length (HDA_PARM_CONNLEN)
+#define HDA_CONNLEN_LENGTH(len)		((len) & 0x7F)
+#define HDA_CONNLEN_LONG_FORM(len)	((len) & 0x80)
+
+// Global Control (GCTL) bits
+#define HDA_GCTL_CRST		(1<<0)		// Controller Reset (0 = in reset)
+#define HDA_GCTL_UNSOL		(1<<8)		// Accept Unsolicited Response Enable
+
+// CORB/RIRB register bits
+#define HDA_CORBRP_RST		(1<<15)		// CORB Read Pointer Reset
+#define HDA_CORBCTL_RUN		(1<<1)		// Enable CORB DMA Engine
+#define HDA_RIRBWP_RST		(1<<15)		// RIRB Write Pointer Reset
+#define HDA_RIRBCTL_DMAEN	(1<<1)		// RIRB DMA Enable
+#define HDA_RIRBSTS_RINTFL	(1<<0)		// Response Interrupt
+#define HDA_RIRBSTS_RIRBOIS	(1<<2)		// Response Overrun Interrupt Status
+
+// CORBSIZE/RIRBSIZE: size capability in bits 7:4, selected size in bits 1:0
+#define HDA_RINGSIZE_CAP_2		(1<<4)
+#define HDA_RINGSIZE_CAP_16		(1<<5)
+#define HDA_RINGSIZE_CAP_256	(1<<6)
+#define HDA_RINGSIZE_2			0x0
+#define HDA_RINGSIZE_16			0x1
+#define HDA_RINGSIZE_256		0x2
+
+// RIRB entry: 32-bit response followed by 32-bit extended response
+#define HDA_RIRB_EX_CODEC(ex)	((ex) & 0xF)		// Codec address of the response
+#define HDA_RIRB_EX_UNSOL(ex)	((ex) & (1<<4))		// Response is unsolicited
+
+// Unsolicited responses carry the tag given by SET_UNSOLICITED_ENABLE in bits 31:26
+#define HDA_UNSOL_ENABLED(payload)	((payload) & (1<<7))
+#define HDA_UNSOL_ENABLE_TAG(payload)	((payload) & 0x3F)
+#define HDA_UNSOL_TAG(response)		(((response) >> 26) & 0x3F)
+#define HDA_UNSOL_TAGS				64
+
+// Pin sense (HDA_VERB_GET_PIN_SENSE)
+#define HDA_PIN_SENSE_PRESENCE(sense)	((sense) & (1<<31))
+
+// Power state (HDA_VERB_GET_PSTATE): actual state in bits 7:4, requested in bits 3:0
+#define HDA_PSTATE_ACTUAL(state)	(((state) >> 4) & 0xF)
+#define HDA_PSTATE_SETTING(state)	((state) & 0xF)
+#define HDA_PSTATE_SETTINGS_RESET(state)	((state) & (1<<10))	// settings lost since the last SET_PSTATE
+
 typedef struct __attribute__((packed))
 {
 	// 00h: GCAP – Global Capabilities
-	volatile UInt16 GCAP_OSS		: 4;		// Number of Output Streams Supported
-	volatile UInt16 GCAP_ISS		: 4;		// Number of Input Streams Supported
-	volatile UInt16 GCAP_BSS		: 5;		// Number of Bidirectional Streams Supported
-	volatile UInt16 GCAP_NSDO		: 2;		// Number of Serial Data Out Signals
 	volatile UInt16 GCAP_64OK		: 1;		// 64 Bit Address Supported
+	volatile UInt16 GCAP_NSDO		: 2;		// Number of Serial Data Out Signals
+	volatile UInt16 GCAP_BSS		: 5;		// Number of Bidirectional Streams Supported
+	volatile UInt16 GCAP_ISS		: 4;		// Number of Input Streams Supported
+	volatile UInt16 GCAP_OSS		: 4;		// Number of Output Streams Supported
 	// 02h: VMIN – Minor Version
 	volatile UInt8  VMIN;						// Minor Version
 	// 03h: VMAJ – Major Version
@@ -95,17 +173,11 @@ typedef struct __attribute__((packed))
 	// 06h: INPAY – Input Payload Capability
 	volatile UInt16 INPAY;						// Input Payload Capability
 	// 08h: GCTL – Global Control
-	UInt32							: 23;		// Reserved
-	volatile UInt32 GCTL_UNSOL		: 1;		// Accept Unsolicited Response Enable
-	UInt32							: 6;		// Reserved
-	volatile UInt32 GCTL_FCNTRL		: 1;		// Flush Control
-	volatile UInt32 GCTL_CRST		: 1;		// Controller Reset
+	volatile UInt32 GCTL;						// Global Control (see HDA_GCTL_*)
 	// 0Ch: WAKEEN – Wake Enable
-	UInt16							: 1;		// Reserved
-	volatile UInt16 WAKEEN_SDIWEN	: 15;		// SDIN Wake Enable Flags
+	volatile UInt16 WAKEEN;						// SDIN Wake Enable Flags (bits 14:0)
 	// 0Eh: STATESTS – State Change Status
-	UInt16							: 1;		// Reserved
-	volatile UInt16 STATESTS_SDIWAKE: 15;		// SDIN State Change Status Flags
+	volatile UInt16 STATESTS;					// SDIN State Change Status Flags (bits 14:0)
 	// 10h: GSTS – Global Status
 	UInt16							: 14;		// Reserved
 	volatile UInt16 GSTS_FSTS		: 1;		// Flush Status
@@ -147,23 +219,15 @@ typedef struct __attribute__((packed))
 	// 44h: CORB Upper Base Address
 	volatile UInt32 CORBUBASE;		// CORB Upper Base Address
 	// 48h: CORBWP – CORB Write Pointer
-	UInt16							: 8;		// Reserved
-	volatile UInt16 CORBWP			: 8;		// CORB Write Pointer
+	volatile UInt16 CORBWP;						// CORB Write Pointer (bits 7:0)
 	// 4Ah: CORBRP – CORB Read Pointer
-	volatile UInt16 CORBRPRST		: 1;		// CORB Read Pointer Reset
-	UInt16							: 7;		// Reserved
-	volatile UInt16 CORBRP			: 8;		// CORB Read Pointer
+	volatile UInt16 CORBRP;						// CORB Read Pointer (bits 7:0), Reset (bit 15)
 	// 4Ch: CORBCTL – CORB Control
-	UInt8							: 6;		// Reserved
-	volatile UInt8 CORBRUN			: 1;		// Enable CORB DMA Engine
-	volatile UInt8 CMEIE			: 1;		// CORB Memory Error Interrupt Enable
+	volatile UInt8 CORBCTL;						// CORB Control (see HDA_CORBCTL_*)
 	// 4Dh: CORBSTS – CORB Status
-	UInt8							: 7;		// Reserved
-	volatile UInt8 CMEI				: 1;		// CORB Memory Error Indication
+	volatile UInt8 CORBSTS;						// CORB Memory Error Indication (bit 0)
 	// 4Eh: CORBSIZE – CORB Size
-	volatile UInt8 CORBSZCAP		: 4;		// CORB Size Capability
-	UInt8							: 2;		// Reserved
-	volatile UInt8 CORBSIZE			: 2;		// CORB Size
+	volatile UInt8 CORBSIZE;					// CORB Size (bits 1:0), Size Capability (bits 7:4)
 	
 	UInt8							: 8;		// Spacer
 	
@@ -172,26 +236,15 @@ typedef struct __attribute__((packed))
 	// 54h: RIRBUBASE – RIRB Upper Base Address
 	volatile UInt32 RIRBUBASE;					// RIRB Upper Base Address
 	// 58h: RIRBWP – RIRB Write Pointer
-	volatile UInt16 RIRBWPRST		: 1;		// RIRB Write Pointer Reset
-	UInt16							: 7;		// Reserved
-	volatile UInt16 RIRBWP			: 8;		// RIRB Write Pointer
+	volatile UInt16 RIRBWP;						// RIRB Write Pointer (bits 7:0), Reset (bit 15)
 	// 5Ah: RINTCNT – Response Interrupt Count
-	UInt16							: 8;
-	volatile UInt16 RINTCNT			: 8;		// N Response Interrupt Count
+	volatile UInt16 RINTCNT;					// N Response Interrupt Count (bits 7:0)
 	// 5Ch: RIRBCTL – RIRB Control
-	UInt8							: 5;		// Reserved
-	volatile UInt8 RINTCNT_RIRBOIC	: 1;		// Response Overrun Interrupt Control
-	volatile UInt8 RINTCNT_RIRBDMAEN: 1;		// RIRB DMA Enable
-	volatile UInt8 RINTCNT_RINTCTL	: 1;		// Response Interrupt Control
+	volatile UInt8 RIRBCTL;						// RIRB Control (see HDA_RIRBCTL_*)
 	// 5Dh: RIRBSTS – RIRB Status
-	UInt8							: 5;		// Reserved
-	volatile UInt8 RIRBSTS_RIRBOIS	: 1;		// Response Overrun Interrupt Status
-	UInt8							: 1;		// Reserved
-	volatile UInt8 RIRBSTS_RINTFL	: 1;		// Response Interrupt
+	volatile UInt8 RIRBSTS;						// RIRB Status (see HDA_RIRBSTS_*)
 	// 5Eh: RIRBSIZE – RIRB Size
-	volatile UInt8 RIRBSIZE_RIRBSZCAP: 4;		// RIRB Size Capability
-	UInt8							: 2;		// Reserved
-	volatile UInt8 RIRBSIZE			: 2;		// RIRB Size
+	volatile UInt8 RIRBSIZE;					// RIRB Size (bits 1:0), Size Capability (bits 7:4)
 	
 	UInt8							: 8;		// Spacer
 	
@@ -239,12 +292,105 @@ struct HDA_GCAP_EXT : HDA_GCAP
 	UInt8 MajorVersion;	
 };
 
+// Histogram of PIO verb completion times (microseconds)
+#define HDA_LATENCY_BUCKETS	16
+
+struct HDALatencyStats
+{
+	UInt32 count;		// completed verbs
+	UInt32 timeouts;	// verbs that timed out
+	UInt32 min;
+	UInt32 max;
+	UInt32 buckets[HDA_LATENCY_BUCKETS];	// bucket n counts [2^(n-1), 2^n), bucket 0 is under 1
+};
+
+// Codec widget graph in structure-of-arrays form, indexed by (node - startNode)
+struct HDATopology
+{
+	UInt8 startNode;
+	UInt8 nodeCount;
+	UInt16 connectionCount;
+	UInt32* widgetCaps;			// HDA_PARM_AUDIOCAP
+	UInt32* pinCaps;			// HDA_PARM_PINCAP (pin complexes only)
+	UInt32* ampInCaps;			// HDA_PARM_AMPCAP_IN (AFG default unless overridden)
+	UInt32* ampOutCaps;			// HDA_PARM_AMPCAP_OUT (AFG default unless overridden)
+	UInt32* configDefault;		// configuration default at enumeration (pin complexes only)
+	UInt16* connectionIndex;	// node n connects from connections[connectionIndex[n]..connectionIndex[n+1]-1]
+	UInt8* connections;			// expanded connection lists of all nodes
+};
+
+// One controller as shared by all IntelHDA instances on the same PCI device
+// (CodecCommander, PowerHook, ProbeInit and the codecs they drive): the lock
+// around its command registers (Immediate Command interface and CORB/RIRB),
+// the register mapping, what has been read about each codec, the verb trace
+// and which codecs are claimed
+#define HDA_MAX_CONTROLLERS	8
+
+// Codec identity read by any instance, -1 until read (a codec does not change while the controller is there)
+struct HDACodecIdentity
+{
+	UInt32 vendorId;
+	UInt32 subsystemId;
+	UInt16 audioRoot;
+};
+
+// Verb trace of one controller, allocated when tracing is first turned on.
+// Entries are claimed with an atomic increment of next, and valid once their
+// sequence matches (times are in absolute time until read).
+struct HDAVerbTrace
+{
+	volatile UInt32 next;	// sequence of the next entry
+	VerbTraceEntry entries[kVerbTraceEntries];
+};
+
+struct HDAController
+{
+	IOPCIDevice* device;
+	IORecursiveLock* lock;	// command registers, see IntelHDA::lockController
+	UInt32 references;
+	UInt32 acquired;	// acquisitions (including nested)
+	UInt32 contended;	// acquisitions that had to wait for another thread
+	UInt32 maxWait;		// longest wait (microseconds)
+	UInt64 totalWait;	// all waits (microseconds)
+	IOMemoryMap* memoryMap;	// made by the first instance to initialize
+	HDACodecIdentity codecs[HDA_MAX_CODECS];
+	HDAVerbTrace* trace;
+	volatile UInt32 tracing;
+	UInt16 claimed;		// codecs driven by a CodecCommander, see IntelHDA::claimCodec
+};
+
 enum HDACommandMode
 {
 	PIO,
 	DMA	
 };
 
+// Shadow of the last value written by SET verbs, used to skip writes that change nothing
+enum HDAShadowMode
+{
+	ShadowOff,		// send every write
+	ShadowVerify,	// skip a write when the codec reads back the shadowed value
+	ShadowTrust		// skip a write when the shadow already holds the value
+};
+
+struct HDAShadowStats
+{
+	UInt32 skipped;		// writes not sent
+	UInt32 verified;	// read backs that confirmed the shadow (ShadowVerify)
+	UInt32 mismatched;	// read backs that did not, so the write was sent
+	UInt32 invalidated;	// times the shadow was dropped (reset, settings lost)
+};
+
+// Function group resets, timed from the second reset until the codec reports
+// its power state has settled (microseconds)
+struct HDAResetStats
+{
+	UInt32 resets;
+	UInt32 timeouts;	// resets still not settled at the deadline
+	UInt32 lastReady;
+	UInt32 maxReady;
+};
+
 class IntelHDA
 {
 	IOPCIDevice* mDevice = NULL;
@@ -253,6 +399,35 @@ class IntelHDA
 	
 	pHDA_REG mRegMap = NULL;
 
+	// Instance whose transport carries this codec's commands (another codec on the same link)
+	IntelHDA* mTransport = NULL;
+
+	// Shared with other instances on the same controller (lock, mapping, codecs)
+	HDAController* mController = NULL;
+
+	// CORB/RIRB ring buffers (DMA command mode)
+	IOBufferMemoryDescriptor* mRingMemory = NULL;
+	volatile UInt32* mCORB = NULL;
+	volatile UInt32* mRIRB = NULL;		// pairs of response, extended response
+	UInt16 mRingEntries = 0;
+	UInt16 mCORBWritePointer = 0;
+	UInt16 mRIRBReadPointer = 0;
+
+	// Responses still owed by each codec for commands a timed out executeDMA gave up on,
+	// discarded as they arrive (until kDMALateTimeout ms after the timeout)
+	enum { kDMALateTimeout = 20 };
+	UInt16 mLateResponses[HDA_MAX_CODECS+1];
+	UInt64 mLateDeadline = 0;
+
+	// Unsolicited responses from this codec, queued as the RIRB is drained
+	enum { kUnsolicitedQueueSize = 16 };
+	UInt32 mUnsolicitedQueue[kUnsolicitedQueueSize];
+	UInt32 mUnsolicitedHead = 0;
+	UInt32 mUnsolicitedCount = 0;
+	UInt32 mUnsolicitedReceived = 0;
+	UInt32 mUnsolicitedDropped = 0;
+	bool mUnsolicitedEnabled = false;	// GCTL UNSOL was set by enableUnsolicited
+
 	// Initialized in constructor
 	HDACommandMode mCommandMode;
 	UInt32 mCodecVendorId;
@@ -263,6 +438,53 @@ class IntelHDA
 	// Read-once parameters
 	UInt32 mNodes = -1;
 	UInt16 mAudioRoot = -1;
+	UInt32 mLayoutID = -1;	// read again while the controller has none
+
+	// Widget graph, read once by enumerateTopology
+	HDATopology mTopology = {};
+	void* mTopologyMemory = NULL;
+	UInt32 mTopologySize = 0;
+
+	// GET_PARAM responses, which never change for a given codec
+	enum { kParamCacheSize = 512 };
+	struct ParamCacheEntry
+	{
+		UInt32 key;
+		UInt32 value;
+	};
+	ParamCacheEntry* mParamCache = NULL;
+	UInt32 mParamCacheHits = 0;
+	UInt32 mParamCacheMisses = 0;
+
+	// Last value written per (node, SET verb) since the codec was last reset.
+	// Entries written during the current send are trusted without a read back.
+	enum { kShadowSize = 256 };
+	enum { kShadowUnknown = 0x100 };
+	struct ShadowEntry
+	{
+		UInt32 key;
+		UInt32 stamp;
+		UInt16 value;	// kShadowUnknown if the last write failed
+	};
+	ShadowEntry* mShadow = NULL;
+	HDAShadowMode mShadowMode = ShadowOff;
+	UInt32 mShadowStamp = 0;
+	HDAShadowStats mShadowStats = {};
+
+	// verb completion timing (PIO verbs, and the gaps between DMA responses),
+	// expected latency starts at one link frame (~21us)
+	enum { kPIOMinTimeout = 1000, kPIOMaxTimeout = 10000, kPIOMaxBackoff = 64 };
+	HDALatencyStats mLatencyStats = {};
+	UInt32 mExpectedLatency = 21;
+	UInt32 mLatencyAverage = 21 << 3;
+
+	// per-HDA spec the function group must respond (D0) within 200ms of a reset,
+	// codecs without PS-SettingsReset are given at least kResetMinSettle ms
+	enum { kResetReadyTimeout = 220, kResetMinSettle = 10 };
+	HDAResetStats mResetStats = {};
+
+	// recorded with each traced command (VerbTrace.h)
+	UInt8 mTraceSource = kVerbTraceInit;
 	
 public:
 	// Constructor
@@ -270,8 +492,13 @@ public:
 	// Destructor
 	~IntelHDA();
 
+	// Controller table, set up once when the kext loads
+	static bool initControllers();
+	static void freeControllers();
+
 	bool initialize(bool regMapOnly = false);
 	bool setCodecAddress(UInt16 codecAddress);
+	bool setCommandMode(HDACommandMode commandMode);
 	UInt32 getLayoutID();
 
 	void applyIntelTCSEL();
@@ -284,7 +511,47 @@ public:
 	// Send a raw command (verb and payload combined)
 	UInt32 sendCommand(UInt32 command);
 
+	// Send an array of raw commands, pipelined through the active transport.
+	// responses (may be NULL) receives -1 for each command that failed.
+	// Returns the number of commands that succeeded.
+	UInt32 sendCommands(const UInt32* commands, UInt32* responses, UInt32 count);
+
 	bool resetCodec();
+	// Reset several codecs on the same controller together, so they share the settle time
+	static bool resetCodecs(IntelHDA* const* codecs, unsigned count);
+	inline const HDAResetStats& getResetStats() { return mResetStats; }
+
+	// Send commands through another instance's transport (codecs on the same link
+	// share the CORB/RIRB), keeping this instance's caches and topology
+	inline void setTransport(IntelHDA* transport) { mTransport = transport; }
+	inline IntelHDA* getTransport() { return mTransport ? mTransport : this; }
+
+	// Send an array of commands already carrying codec addresses (bits 31:28),
+	// possibly for several codecs, with no parameter cache lookups
+	UInt32 sendAddressedCommands(const UInt32* fullCommands, UInt32* responses, UInt32 count);
+
+	// Drop writes from an array of commands (codec address included) that the
+	// shadow shows to be no-ops, recording the rest as written. Returns the new count.
+	UInt32 elideRedundant(UInt32* fullCommands, UInt32 count);
+
+	void setShadowMode(HDAShadowMode shadowMode);
+	inline HDAShadowMode getShadowMode() { return mShadowMode; }
+	inline const HDAShadowStats& getShadowStats() { return mShadowStats; }
+	void invalidateShadow();
+	// Read the function group power state and drop the shadow if the codec
+	// reports its settings were lost (or does not answer). Returns true if dropped.
+	bool checkSettingsReset();
+
+	// Codecs that signalled presence since the last controller reset (STATESTS)
+	inline UInt16 getPresentCodecs() { return mRegMap ? mRegMap->STATESTS & 0x7FFF : 0; }
+
+	// Unsolicited responses, only delivered while the CORB/RIRB is run by this
+	// instance (DMA command mode). getUnsolicited drains the RIRB and returns up
+	// to max responses from this codec, oldest first.
+	bool enableUnsolicited(bool enable);
+	UInt32 getUnsolicited(UInt32* responses, UInt32 max);
+	inline UInt32 getUnsolicitedReceived() { return mUnsolicitedReceived; }
+	inline UInt32 getUnsolicitedDropped() { return mUnsolicitedDropped; }
 
 	inline UInt8 getCodecAddress() { return mCodecAddress; }
 	inline UInt8 getCodecGroupType() { return mCodecGroupType; }
@@ -298,15 +565,88 @@ public:
 	UInt8 getTotalNodes();
 	UInt8 getStartingNode();
 
+	// Read widget caps, pin caps, amp caps, connection lists and config defaults of all nodes
+	bool enumerateTopology();
+	inline const HDATopology& getTopology() { return mTopology; }
+	inline bool hasTopologyNode(UInt8 node) { return mTopologyMemory && node >= mTopology.startNode && node - mTopology.startNode < mTopology.nodeCount; }
+	inline UInt32 getWidgetCaps(UInt8 node) { return hasTopologyNode(node) ? mTopology.widgetCaps[node - mTopology.startNode] : 0; }
+	inline UInt32 getPinCaps(UInt8 node) { return hasTopologyNode(node) ? mTopology.pinCaps[node - mTopology.startNode] : 0; }
+	inline UInt32 getConfigDefault(UInt8 node) { return hasTopologyNode(node) ? mTopology.configDefault[node - mTopology.startNode] : 0; }
+	UInt16 getConnections(UInt8 node, const UInt8** connections);
+
+	// Fill buffer with a CodecDump snapshot (caps from the topology, the rest read
+	// now). Returns the bytes it takes, which is more than size if nothing was
+	// written because buffer is too small, 0 if the codec could not be read.
+	UInt32 dumpCodec(void* buffer, UInt32 size);
+
 #ifdef DOES_NOT_WORK
-	UInt16 getSTATESTS() { return mRegMap->STATESTS_SDIWAKE; }
+	UInt16 getSTATESTS() { return mRegMap->STATESTS; }
 	void resetHDA();
 #endif
 
 	inline IOPCIDevice* getPCIDevice() { return mDevice; }
+	inline HDACommandMode getCommandMode() { return mCommandMode; }
+
+	inline const HDALatencyStats& getLatencyStats() { return mLatencyStats; }
+	inline UInt32 getExpectedLatency() { return mExpectedLatency; }
+	UInt32 getLatencyMedian();
+
+	// Hold the controller's command registers across several sends (recursive)
+	void lockController();
+	void unlockController();
+	inline const HDAController* getController() { return mController; }
+
+	// Claim a codec on the controller for one CodecCommander to drive, false if
+	// another one has it already (claims are kept until released)
+	bool claimCodec(UInt8 codecAddress);
+	void releaseCodec(UInt8 codecAddress);
+
+	inline UInt32 getParamCacheHits() { return mParamCacheHits; }
+	inline UInt32 getParamCacheMisses() { return mParamCacheMisses; }
+
+	// Verb trace of the controller, shared by all instances on it. setTracing
+	// returns whether tracing was on. readTrace copies up to max entries from
+	// *cursor on (kVerbTraceOldest for the oldest kept), times in nanoseconds,
+	// advances *cursor and counts entries overwritten before they were read.
+	bool setTracing(bool enable);
+	inline bool getTracing() { return mController && mController->tracing; }
+	UInt32 readTrace(UInt32* cursor, VerbTraceEntry* entries, UInt32 max, UInt32* dropped);
+	inline void setTraceSource(UInt8 source) { mTraceSource = source; }
 
 private:
+	UInt32 executeCommands(const UInt32* fullCommands, UInt32* responses, UInt32 count);
+	UInt32 transmit(const UInt32* fullCommands, UInt32* responses, UInt32 count);
 	UInt32 executePIO(UInt32 command);
+	UInt32 getResponseTimeout();
+	bool waitForICS(UInt16* status, UInt32* elapsed);
+	void recordLatency(UInt32 elapsed);
+	void learnLatency(UInt32 elapsed);
+	inline void trace(UInt32 fullCommand, UInt32 response, UInt8 status)
+		{ if (mController && mController->tracing) recordTrace(fullCommand, response, status); }
+	void recordTrace(UInt32 fullCommand, UInt32 response, UInt8 status);
+	UInt32 executeDMA(const UInt32* commands, UInt32* responses, UInt32 count);
+	bool startDMA();
+	bool checkDMA();
+	void stopDMA();
+	void releaseRings();
+	bool isLateResponse(UInt8 codec);
+	void queueUnsolicited(UInt32 response, UInt32 responseEx);
+
+	void freeTopology();
+
+	static HDAController* attachController(IOPCIDevice* device);
+	inline HDACodecIdentity* getCodecIdentity()
+		{ return mController && mCodecAddress < HDA_MAX_CODECS ? &mController->codecs[mCodecAddress] : NULL; }
+	static void detachController(HDAController* controller);
+
+	bool lookupParameter(UInt32 fullCommand, UInt32* value);
+	void cacheParameter(UInt32 fullCommand, UInt32 value);
+	void invalidateParameterCache();
+
+	bool skipRedundant(UInt32 fullCommand);
+	ShadowEntry* lookupShadow(UInt32 fullCommand, bool create);
+	void forgetShadow(UInt32 fullCommand);
+
 	UInt16 getAudioRoot();
 };
 
@@ -0,0 +1,342 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "ProfileIndex.h"
+
+// Specificity of the plain names, probed in this order
+static const UInt32 kExactSpecificity[] = { 64, 48, 32, 16 };
+static const UInt32 kExactCodecMask[] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFF0000 };
+static const UInt32 kExactSubsystemMask[] = { 0xFFFFFFFF, 0xFFFF0000, 0, 0 };
+
+// Parse four hex digits ('x' for any), returns false if not a field
+static bool parseField(const char* str, UInt16* value, UInt16* mask)
+{
+    *value = 0;
+    *mask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = str[i];
+        *value <<= 4;
+        *mask <<= 4;
+        if (c == 'x')
+            continue;
+        *mask |= 0xF;
+        if (c >= '0' && c <= '9')
+            *value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            *value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            *value |= c - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+// Bits needed for n (bits left open by a range of n + 1 values)
+static UInt32 bitWidth(UInt32 n)
+{
+    UInt32 bits = 0;
+    while (n)
+    {
+        bits++;
+        n >>= 1;
+    }
+    return bits;
+}
+
+bool ProfileIndex::parseName(const char* name, Entry* entry)
+{
+    UInt16 value[4], mask[4];
+    UInt16 rangeHigh = 0;
+    bool range = false;
+    int fields = 0;
+    const char* str = name;
+    for (;;)
+    {
+        if (!parseField(str, &value[fields], &mask[fields]))
+            return false;
+        str += 4;
+        fields++;
+
+        // last field may end a range
+        if (fields == 4 && *str == '-')
+        {
+            UInt16 highMask;
+            if (mask[3] != 0xFFFF || !parseField(str + 1, &rangeHigh, &highMask) || highMask != 0xFFFF ||
+                rangeHigh < value[3])
+                return false;
+            range = true;
+            str += 5;
+        }
+        if (!*str)
+            break;
+        if (fields == 4 || *str != '_')
+            return false;
+        str++;
+        // subsystem fields follow "_HDA_"
+        if (fields == 2)
+        {
+            if (strncmp(str, "HDA_", 4))
+                return false;
+            str += 4;
+        }
+    }
+    entry->codec = (UInt32)value[0] << 16 | (fields > 1 ? value[1] : 0);
+    entry->codecMask = (UInt32)mask[0] << 16 | (fields > 1 ? mask[1] : 0);
+    entry->subsystemMask = (fields > 2 ? (UInt32)mask[2] << 16 : 0) | (fields > 3 ? mask[3] : 0);
+    entry->subsystemLow = (fields > 2 ? (UInt32)value[2] << 16 : 0) | (fields > 3 ? value[3] : 0);
+    entry->subsystemHigh = range ? (entry->subsystemLow & 0xFFFF0000) | rangeHigh : entry->subsystemLow;
+    entry->codec &= entry->codecMask;
+    entry->subsystemLow &= entry->subsystemMask;
+    entry->subsystemHigh &= entry->subsystemMask;
+    entry->specificity = __builtin_popcount(entry->codecMask) + __builtin_popcount(entry->subsystemMask) -
+        bitWidth(entry->subsystemHigh - entry->subsystemLow);
+    return true;
+}
+
+// Order of matching entries: most specific first, ties by name
+bool ProfileIndex::precedes(const Entry& entry, const Entry& other)
+{
+    if (entry.specificity != other.specificity)
+        return entry.specificity > other.specificity;
+    return strcmp(entry.name, other.name) < 0;
+}
+
+inline UInt32 ProfileIndex::hash(UInt32 codec, UInt32 subsystem, UInt32 specificity)
+{
+    return (codec * 0x9E3779B1) ^ (subsystem * 0x85EBCA77) ^ specificity;
+}
+
+void ProfileIndex::insertExact(const Entry& entry)
+{
+    UInt32 slot = hash(entry.codec, entry.subsystemLow, entry.specificity) & (mExactSize - 1);
+    for (; mExact[slot].profile; slot = (slot + 1) & (mExactSize - 1))
+    {
+        // same ids spelled differently ("10ec_0269", "10EC_0269"), keep the first by name
+        Entry& other = mExact[slot];
+        if (other.codec == entry.codec && other.subsystemLow == entry.subsystemLow && other.specificity == entry.specificity)
+        {
+            if (precedes(entry, other))
+                other = entry;
+            return;
+        }
+    }
+    mExact[slot] = entry;
+}
+
+const ProfileIndex::Entry* ProfileIndex::findExact(UInt32 codec, UInt32 subsystem, UInt32 specificity)
+{
+    if (!mExactSize)
+        return NULL;
+    UInt32 slot = hash(codec, subsystem, specificity) & (mExactSize - 1);
+    for (; mExact[slot].profile; slot = (slot + 1) & (mExactSize - 1))
+    {
+        const Entry& entry = mExact[slot];
+        if (entry.codec == codec && entry.subsystemLow == subsystem && entry.specificity == specificity)
+            return &entry;
+    }
+    return NULL;
+}
+
+bool ProfileIndex::compile(OSDictionary* profiles)
+{
+    OSCollectionIterator* iterator = OSCollectionIterator::withCollection(profiles);
+    if (!iterator)
+        return false;
+
+    // first pass counts, second fills in
+    UInt32 exactCount = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass)
+        {
+            // at most half full
+            for (mExactSize = exactCount ? 2 : 0; mExactSize && mExactSize < exactCount * 2; mExactSize <<= 1);
+            if (mExactSize && !(mExact = (Entry*)IOMalloc(mExactSize * sizeof(Entry))))
+                break;
+            if (mPatternCount && !(mPatterns = (Entry*)IOMalloc(mPatternCount * sizeof(Entry))))
+                break;
+            if (mExact)
+                bzero(mExact, mExactSize * sizeof(Entry));
+            mPatternCount = 0;
+            iterator->reset();
+        }
+
+        while (OSString* name = OSDynamicCast(OSString, iterator->getNextObject()))
+        {
+            Entry entry;
+            if (!parseName(name->getCStringNoCopy(), &entry))
+                continue;
+
+            // profile can be a string redirect to another one
+            OSObject* obj = profiles->getObject(name);
+            if (OSString* redirect = OSDynamicCast(OSString, obj))
+                obj = profiles->getObject(redirect);
+            entry.profile = OSDynamicCast(OSDictionary, obj);
+            if (!entry.profile)
+                continue;
+            entry.name = name->getCStringNoCopy();
+
+            bool exact = false;
+            for (int level = 0; level < 4 && !exact; level++)
+                exact = entry.specificity == kExactSpecificity[level] && entry.codecMask == kExactCodecMask[level] &&
+                    entry.subsystemMask == kExactSubsystemMask[level];
+            if (!pass)
+            {
+                if (exact)
+                    exactCount++;
+                else
+                    mPatternCount++;
+                continue;
+            }
+            if (exact)
+            {
+                insertExact(entry);
+                continue;
+            }
+
+            // keep patterns in lookup order
+            UInt32 i = mPatternCount++;
+            for (; i && precedes(entry, mPatterns[i - 1]); i--)
+                mPatterns[i] = mPatterns[i - 1];
+            mPatterns[i] = entry;
+        }
+    }
+    iterator->release();
+
+    DebugLog("Codec Profile index: %d names, %d patterns\n", exactCount, mPatternCount);
+    return (mExact || !exactCount) && (mPatterns || !mPatternCount);
+}
+
+ProfileIndex* ProfileIndex::withProfiles(OSDictionary* profiles)
+{
+    ProfileIndex* index = new ProfileIndex;
+    if (!index)
+        return NULL;
+    profiles->retain();
+    index->mProfiles = profiles;
+    if (!index->compile(profiles))
+    {
+        delete index;
+        return NULL;
+    }
+    return index;
+}
+
+ProfileIndex::~ProfileIndex()
+{
+    if (mExact)
+        IOFree(mExact, mExactSize * sizeof(Entry));
+    if (mPatterns)
+        IOFree(mPatterns, mPatternCount * sizeof(Entry));
+    OSSafeReleaseNULL(mProfiles);
+}
+
+OSDictionary* ProfileIndex::lookup(UInt32 codecVendorId, UInt32 subsystemId)
+{
+    // plain names: vendor_codec_HDA_full-subsystem first, then vendor_codec_HDA_vendorsubid,
+    // then vendor_codec, then vendor override (used for Intel HDMI)
+    const Entry* best = NULL;
+    for (int level = 0; level < 4 && !best; level++)
+        best = findExact(codecVendorId & kExactCodecMask[level], subsystemId & kExactSubsystemMask[level],
+                         kExactSpecificity[level]);
+
+    // a pattern only wins if it is more specific
+    for (UInt32 i = 0; i < mPatternCount; i++)
+    {
+        const Entry& entry = mPatterns[i];
+        if (best && entry.specificity <= best->specificity)
+            break;
+        UInt32 subsystem = subsystemId & entry.subsystemMask;
+        if ((codecVendorId & entry.codecMask) == entry.codec &&
+            subsystem >= entry.subsystemLow && subsystem <= entry.subsystemHigh)
+        {
+            best = &entry;
+            break;
+        }
+    }
+    return best ? best->profile : NULL;
+}
+
+// Cache of compiled indexes, looked up under a global lock
+
+#define kProfileIndexCacheSize  4
+
+static IOLock* gProfileIndexLock = NULL;
+static ProfileIndex* gProfileIndexes[kProfileIndexCacheSize];
+static OSDictionary* gProfileIndexKeys[kProfileIndexCacheSize];
+
+bool ProfileIndex::initIndexCache()
+{
+    gProfileIndexLock = IOLockAlloc();
+    bzero(gProfileIndexes, sizeof(gProfileIndexes));
+    bzero(gProfileIndexKeys, sizeof(gProfileIndexKeys));
+    return gProfileIndexLock != NULL;
+}
+
+void ProfileIndex::freeIndexCache()
+{
+    for (int i = 0; i < kProfileIndexCacheSize; i++)
+        delete gProfileIndexes[i];
+    bzero(gProfileIndexes, sizeof(gProfileIndexes));
+    bzero(gProfileIndexKeys, sizeof(gProfileIndexKeys));
+    if (gProfileIndexLock)
+    {
+        IOLockFree(gProfileIndexLock);
+        gProfileIndexLock = NULL;
+    }
+}
+
+OSDictionary* ProfileIndex::locate(OSDictionary* profiles, UInt32 codecVendorId, UInt32 subsystemId, bool cache)
+{
+    OSDictionary* result = NULL;
+    if (cache && gProfileIndexLock)
+    {
+        IOLockLock(gProfileIndexLock);
+        int empty = -1;
+        for (int i = 0; i < kProfileIndexCacheSize; i++)
+        {
+            if (gProfileIndexKeys[i] == profiles)
+            {
+                result = gProfileIndexes[i]->lookup(codecVendorId, subsystemId);
+                IOLockUnlock(gProfileIndexLock);
+                return result;
+            }
+            if (!gProfileIndexKeys[i] && empty < 0)
+                empty = i;
+        }
+        // the index keeps profiles retained, so the key can not be reused by another dictionary
+        if (empty >= 0 && (gProfileIndexes[empty] = withProfiles(profiles)))
+        {
+            gProfileIndexKeys[empty] = profiles;
+            result = gProfileIndexes[empty]->lookup(codecVendorId, subsystemId);
+            IOLockUnlock(gProfileIndexLock);
+            return result;
+        }
+        IOLockUnlock(gProfileIndexLock);
+    }
+
+    if (ProfileIndex* index = withProfiles(profiles))
+    {
+        result = index->lookup(codecVendorId, subsystemId);
+        delete index;
+    }
+    return result;
+}
@@ -0,0 +1,82 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_ProfileIndex_h
+#define CodecCommander_ProfileIndex_h
+
+#include "Common.h"
+
+// "Codec Profile" dictionary compiled into an index keyed by codec id
+// (vendor << 16 | device) and HDA subsystem id. Profile names are
+//   vvvv                       any codec of a vendor
+//   vvvv_cccc                  one codec
+//   vvvv_cccc_HDA_ssss         one codec, any subsystem of a subsystem vendor
+//   vvvv_cccc_HDA_ssss_dddd    one codec and subsystem
+// where any hex digit may be 'x' to match all values of that digit, and the
+// last field may be a range ("vvvv_cccc_HDA_ssss_dd00-ddff"). The most specific
+// matching profile wins: the one that leaves the fewest id bits open, and of
+// equally specific ones the first by name, so dictionary order never decides.
+class ProfileIndex
+{
+    struct Entry
+    {
+        UInt32 codec;
+        UInt32 codecMask;
+        UInt32 subsystemLow;    // masked subsystem id within [low, high]
+        UInt32 subsystemHigh;
+        UInt32 subsystemMask;
+        UInt32 specificity;     // id bits matched exactly
+        OSDictionary* profile;  // owned by the profiles dictionary
+        const char* name;       // likewise
+    };
+
+    OSDictionary* mProfiles = NULL;
+    // names without wildcards or ranges, open addressing on (codec, subsystem, specificity)
+    Entry* mExact = NULL;
+    UInt32 mExactSize = 0;
+    // the rest, most specific first, then by name
+    Entry* mPatterns = NULL;
+    UInt32 mPatternCount = 0;
+
+    static bool parseName(const char* name, Entry* entry);
+    static bool precedes(const Entry& entry, const Entry& other);
+    static inline UInt32 hash(UInt32 codec, UInt32 subsystem, UInt32 specificity);
+    bool compile(OSDictionary* profiles);
+    void insertExact(const Entry& entry);
+    const Entry* findExact(UInt32 codec, UInt32 subsystem, UInt32 specificity);
+
+public:
+    ~ProfileIndex();
+
+    // Compile profiles, NULL if out of memory
+    static ProfileIndex* withProfiles(OSDictionary* profiles);
+
+    // Most specific profile for a codec (redirects resolved), NULL if none matches
+    OSDictionary* lookup(UInt32 codecVendorId, UInt32 subsystemId);
+
+    // Indexes are compiled once per profiles dictionary (the "Codec Profile"
+    // property is shared by all instances of a personality) and kept until unload
+    static bool initIndexCache();
+    static void freeIndexCache();
+    // Look up through the cached index of profiles. Profiles that are not
+    // cached (cache false, or the cache is full) are compiled just for this lookup.
+    static OSDictionary* locate(OSDictionary* profiles, UInt32 codecVendorId, UInt32 subsystemId, bool cache = true);
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "VerbQueue.h"
+
+static inline UInt64 getUptimeMicroseconds()
+{
+    uint64_t abstime, nanoseconds;
+    clock_get_uptime(&abstime);
+    absolutetime_to_nanoseconds(abstime, &nanoseconds);
+    return nanoseconds / 1000;
+}
+
+VerbQueue::~VerbQueue()
+{
+    stop();
+    if (mLock)
+        IOLockFree(mLock);
+}
+
+bool VerbQueue::start()
+{
+    mLock = IOLockAlloc();
+    if (!mLock)
+        return false;
+
+    mRunning = true;
+    thread_t thread;
+    if (kernel_thread_start(&VerbQueue::threadMain, this, &thread) != KERN_SUCCESS)
+    {
+        mRunning = false;
+        return false;
+    }
+    thread_deallocate(thread);
+    return true;
+}
+
+void VerbQueue::stop()
+{
+    if (!mLock)
+        return;
+
+    IOLockLock(mLock);
+    mStopping = true;
+    IOLockWakeup(mLock, (event_t)&mIdle, true);
+    while (mRunning)
+        IOLockSleep(mLock, (event_t)&mRunning, THREAD_UNINT);
+    IOLockUnlock(mLock);
+}
+
+void VerbQueue::threadMain(void* parameter, wait_result_t result)
+{
+    ((VerbQueue*)parameter)->run();
+    thread_terminate(current_thread());
+}
+
+void VerbQueue::run()
+{
+    mThread = current_thread();
+
+    // client requests taken from the list but not run yet, oldest first
+    Request* clientRequests = NULL;
+    for (;;)
+    {
+        // all waiting driver requests go first
+        if (Request* request = take(kPriorityDriver))
+        {
+            while (request)
+            {
+                Request* next = request->next;
+                complete(request, kPriorityDriver);
+                request = next;
+            }
+            continue;
+        }
+
+        // then one client request, so driver requests submitted meanwhile can overtake the rest
+        if (!clientRequests)
+            clientRequests = take(kPriorityClient);
+        if (clientRequests)
+        {
+            Request* next = clientRequests->next;
+            complete(clientRequests, kPriorityClient);
+            clientRequests = next;
+            continue;
+        }
+
+        IOLockLock(mLock);
+        if (mStopping)
+        {
+            mRunning = false;
+            mThread = NULL;
+            IOLockWakeup(mLock, (event_t)&mRunning, false);
+            IOLockUnlock(mLock);
+            return;
+        }
+        // a producer that pushes after this check sees mIdle set and wakes us
+        mIdle = 1;
+        OSMemoryBarrier();
+        if (!mPending[kPriorityDriver] && !mPending[kPriorityClient])
+            IOLockSleep(mLock, (event_t)&mIdle, THREAD_UNINT);
+        mIdle = 0;
+        IOLockUnlock(mLock);
+    }
+}
+
+VerbQueue::Request* VerbQueue::take(Priority priority)
+{
+    // only this thread removes, and always the whole list, so there is no ABA problem
+    Request* list;
+    do
+    {
+        list = mPending[priority];
+        if (!list)
+            return NULL;
+    } while (!OSCompareAndSwapPtr(list, NULL, (void* volatile*)&mPending[priority]));
+
+    // pushed newest first, reverse into submission order
+    Request* ordered = NULL;
+    UInt32 depth = 0;
+    while (list)
+    {
+        Request* next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+        depth++;
+    }
+    if (depth > mStats[priority].maxDepth)
+        mStats[priority].maxDepth = depth;
+    return ordered;
+}
+
+void VerbQueue::complete(Request* request, Priority priority)
+{
+    request->result = request->action(request->target, request->args[0], request->args[1], request->args[2]);
+
+    Stats& stats = mStats[priority];
+    UInt32 latency = (UInt32)(getUptimeMicroseconds() - request->submitted);
+    stats.requests++;
+    stats.totalLatency += latency;
+    if (latency > stats.maxLatency)
+        stats.maxLatency = latency;
+
+    if (request->completion)
+    {
+        request->completion(request->owner, request->refcon, request->result);
+        IOFree(request, sizeof(Request) + sizeof(Commands));
+        return;
+    }
+
+    // the submitter returns (and its request goes away) as soon as done is seen
+    IOLockLock(mLock);
+    request->done = 1;
+    IOLockWakeup(mLock, (event_t)request, true);
+    IOLockUnlock(mLock);
+}
+
+UInt32 VerbQueue::runAction(Action action, void* target, void* arg0, void* arg1, void* arg2, Priority priority)
+{
+    // the queue thread would wait for itself
+    if (current_thread() == mThread)
+        return action(target, arg0, arg1, arg2);
+    if (!mRunning || mStopping)
+        return -1;
+
+    Request request;
+    request.action = action;
+    request.target = target;
+    request.args[0] = arg0;
+    request.args[1] = arg1;
+    request.args[2] = arg2;
+    request.result = -1;
+    request.done = 0;
+    request.submitted = getUptimeMicroseconds();
+    request.completion = NULL;
+    push(&request, priority);
+
+    IOLockLock(mLock);
+    while (!request.done)
+        IOLockSleep(mLock, (event_t)&request, THREAD_UNINT);
+    IOLockUnlock(mLock);
+
+    return request.result;
+}
+
+void VerbQueue::push(Request* request, Priority priority)
+{
+    Request* head;
+    do
+    {
+        head = mPending[priority];
+        request->next = head;
+    } while (!OSCompareAndSwapPtr(head, request, (void* volatile*)&mPending[priority]));
+
+    // the swap is a full barrier, so either this sees mIdle or the queue thread sees the request
+    if (mIdle)
+    {
+        IOLockLock(mLock);
+        IOLockWakeup(mLock, (event_t)&mIdle, true);
+        IOLockUnlock(mLock);
+    }
+}
+
+bool VerbQueue::submitAction(Action action, void* target, void* arg0, void* arg1, void* arg2,
+                             Completion completion, void* owner, void* refcon, Priority priority)
+{
+    if (!mRunning || mStopping || !completion)
+        return false;
+
+    // room for the parameters of submitCommands after the request
+    Request* request = (Request*)IOMalloc(sizeof(Request) + sizeof(Commands));
+    if (!request)
+        return false;
+    request->action = action;
+    request->target = target;
+    request->args[0] = arg0;
+    request->args[1] = arg1;
+    request->args[2] = arg2;
+    request->result = -1;
+    request->done = 0;
+    request->submitted = getUptimeMicroseconds();
+    request->completion = completion;
+    request->owner = owner;
+    request->refcon = refcon;
+    // from the queue thread this just queues the request, it runs after the current one
+    push(request, priority);
+    return true;
+}
+
+UInt32 VerbQueue::commandsAction(void* target, void* arg0, void* arg1, void* arg2)
+{
+    Commands* commands = (Commands*)target;
+    return commands->intelHDA->sendCommands(commands->commands, commands->responses, commands->count);
+}
+
+bool VerbQueue::submitCommands(IntelHDA* intelHDA, const UInt32* commands, UInt32* responses, UInt32 count,
+                               Completion completion, void* owner, void* refcon, Priority priority)
+{
+    if (!mRunning || mStopping || !completion)
+        return false;
+
+    Request* request = (Request*)IOMalloc(sizeof(Request) + sizeof(Commands));
+    if (!request)
+        return false;
+    Commands* parameters = (Commands*)(request + 1);
+    parameters->intelHDA = intelHDA;
+    parameters->commands = commands;
+    parameters->responses = responses;
+    parameters->count = count;
+    request->action = commandsAction;
+    request->target = parameters;
+    request->result = 0;
+    request->done = 0;
+    request->submitted = getUptimeMicroseconds();
+    request->completion = completion;
+    request->owner = owner;
+    request->refcon = refcon;
+    push(request, priority);
+    return true;
+}
+
+static UInt32 sendCommandAction(void* target, void* arg0, void* arg1, void* arg2)
+{
+    return ((IntelHDA*)target)->sendCommand((UInt32)(uintptr_t)arg0);
+}
+
+UInt32 VerbQueue::sendCommand(IntelHDA* intelHDA, UInt32 command, Priority priority)
+{
+    return runAction(sendCommandAction, intelHDA, (void*)(uintptr_t)command, NULL, NULL, priority);
+}
@@ -0,0 +1,131 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_VerbQueue_h
+#define CodecCommander_VerbQueue_h
+
+#include "Common.h"
+#include "IntelHDA.h"
+#include <libkern/OSAtomic.h>
+#include <kern/thread.h>
+
+// Requests sent to the codecs of one CodecCommander instance. Any thread
+// (power management, timers, user clients) can submit without taking a lock:
+// requests are pushed onto a lock-free list, and a single thread owned by the
+// queue runs them one at a time. Driver requests go ahead of user client
+// requests, so a power state change waits for at most the request in progress,
+// not for everything a user client has queued. Submitters either wait for the
+// result (runAction) or get it through a completion callback (submitAction).
+class VerbQueue
+{
+public:
+    // Runs on the queue thread, the result is handed back to the submitter
+    typedef UInt32 (*Action)(void* target, void* arg0, void* arg1, void* arg2);
+    // Called on the queue thread once an asynchronous request has run
+    typedef void (*Completion)(void* owner, void* refcon, UInt32 result);
+
+    enum Priority
+    {
+        kPriorityDriver,    // power management, timers, unsolicited responses
+        kPriorityClient,    // user client verbs
+        kPriorityCount
+    };
+
+    struct Stats
+    {
+        UInt32 requests;
+        UInt32 maxDepth;    // most requests waiting at once
+        UInt32 maxLatency;  // longest submit to completion (microseconds)
+        UInt64 totalLatency;
+    };
+
+private:
+    // Completion object, lives on the submitter's stack until done is set,
+    // or is allocated by submitAction and freed once its completion returns
+    struct Request
+    {
+        Request* next;
+        Action action;
+        void* target;
+        void* args[3];
+        UInt32 result;
+        UInt64 submitted;
+        volatile UInt32 done;
+        Completion completion;  // NULL if the submitter waits
+        void* owner;
+        void* refcon;
+    };
+
+    // parameters of submitCommands
+    struct Commands
+    {
+        IntelHDA* intelHDA;
+        const UInt32* commands;
+        UInt32* responses;
+        UInt32 count;
+    };
+
+    // pushed LIFO by producers, taken whole by the queue thread
+    Request* volatile mPending[kPriorityCount] = {};
+    Stats mStats[kPriorityCount] = {};
+
+    // only used to sleep and wake, never held while a request runs
+    IOLock* mLock = NULL;
+    thread_t mThread = NULL;
+    volatile UInt32 mIdle = 0;
+    bool mRunning = false;
+    bool mStopping = false;
+
+    static void threadMain(void* parameter, wait_result_t result);
+    void run();
+    Request* take(Priority priority);
+    void push(Request* request, Priority priority);
+    void complete(Request* request, Priority priority);
+    static UInt32 commandsAction(void* target, void* arg0, void* arg1, void* arg2);
+
+public:
+    ~VerbQueue();
+
+    // Start the queue thread
+    bool start();
+    // Run what is already queued, then end the queue thread. Nothing may be
+    // submitted once stop is called.
+    void stop();
+
+    // Run action on the queue thread and wait for it. Actions may submit
+    // further requests, which then run at once.
+    UInt32 runAction(Action action, void* target, void* arg0 = NULL, void* arg1 = NULL, void* arg2 = NULL,
+                     Priority priority = kPriorityDriver);
+    // Send one raw command (verb and payload) to a codec
+    UInt32 sendCommand(IntelHDA* intelHDA, UInt32 command, Priority priority = kPriorityDriver);
+
+    // Queue action and return at once, completion gets its result. Returns
+    // false (and completion is not called) if the request could not be queued.
+    bool submitAction(Action action, void* target, void* arg0, void* arg1, void* arg2,
+                      Completion completion, void* owner, void* refcon, Priority priority = kPriorityDriver);
+    // Queue a program of raw commands (see IntelHDA::sendCommands), completion
+    // gets the number that succeeded. commands and responses (may be NULL)
+    // must stay valid until then.
+    bool submitCommands(IntelHDA* intelHDA, const UInt32* commands, UInt32* responses, UInt32 count,
+                        Completion completion, void* owner, void* refcon, Priority priority = kPriorityDriver);
+
+    inline const Stats& getStats(Priority priority) { return mStats[priority]; }
+};
+
+#endif
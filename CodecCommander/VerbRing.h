@@ -0,0 +1,50 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_VerbRing_h
+#define CodecCommander_VerbRing_h
+
+// Verb ring shared by CodecCommanderClient and user space (plain C, also
+// included by hda-verb). Map it with clientMemoryForType/IOConnectMapMemory64
+// type kClientMemoryVerbRing.
+//
+// The counters run free, an entry is at (counter % kVerbRingEntries).
+//  - the client writes commands[submitted..], then advances submitted
+//  - the kext sends them and writes responses[] in place (-1 if a verb
+//    failed), then advances completed
+//  - while busy is set the kext is working on the ring and will pick up
+//    anything submitted meanwhile; otherwise the client rings the doorbell
+//    (method kClientRingDoorbell). A full barrier goes between advancing
+//    submitted and reading busy.
+// At most kVerbRingEntries commands may be outstanding (submitted - completed).
+
+#define kClientMemoryVerbRing   0
+#define kVerbRingEntries        1024
+
+typedef struct
+{
+    volatile UInt32 submitted;  // written by the client
+    volatile UInt32 completed;  // written by the kext
+    volatile UInt32 busy;       // written by the kext
+    UInt32 entries;             // kVerbRingEntries
+    UInt32 commands[kVerbRingEntries];
+    UInt32 responses[kVerbRingEntries];
+} VerbRing;
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_VerbTrace_h
+#define CodecCommander_VerbTrace_h
+
+// Verb trace of a controller (plain C, also included by hda-verb). While
+// tracing is on (kClientSetTrace), every command of every codec on the
+// controller is recorded: sent, answered from the parameter cache or skipped
+// as a no-op write. The last kVerbTraceEntries are kept; kClientReadTrace
+// copies entries from a sequence number on and returns where to continue.
+
+#define kVerbTraceEntries       4096
+#define kVerbTraceOldest        0xFFFFFFFF  // read from the oldest entry kept
+
+// where a command came from
+enum
+{
+    kVerbTraceInit = 0,         // start, codec profile applied
+    kVerbTraceWake,
+    kVerbTraceSleep,
+    kVerbTraceUser,             // user client (hda-verb)
+    kVerbTraceProbe,            // ProbeInit
+    kVerbTraceEvent,            // unsolicited response handling
+    kVerbTraceSourceCount
+};
+
+// what happened to it
+enum
+{
+    kVerbTraceSent = 0,         // answered by the codec
+    kVerbTraceFailed,           // no answer, response is -1
+    kVerbTraceCached,           // parameter answered from the cache
+    kVerbTraceSkipped,          // write skipped, the shadow holds the value
+};
+
+typedef struct
+{
+    UInt64 time;                // nanoseconds since boot
+    UInt32 sequence;
+    UInt32 command;             // codec address included
+    UInt32 response;
+    UInt8 status;
+    UInt8 source;
+    UInt16 reserved;
+} VerbTraceEntry;
+
+#endif
@@ -22,52 +22,227 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <IOKit/IOKitLib.h>
 
 #include <CoreFoundation/CoreFoundation.h>
 #include "hdaverb.h"
+#include "../CodecCommander/ClientMethods.h"
+#include "../CodecCommander/VerbRing.h"
+#include "../CodecCommander/CodecDump.h"
+#include "../CodecCommander/CodecEvent.h"
+#include "../CodecCommander/VerbTrace.h"
 
-static UInt32 execute_command(UInt32 command, UInt32 vendorId, UInt32 codecAddress, UInt32 functionGroup)
+/* which CodecCommander to talk to, unset fields match any */
+typedef struct
 {
-    io_connect_t dataPort;
+    UInt32 vendorId;            /* 0 for any, 0xvvvv for any codec of that vendor */
+    int codecAddress;           /* -1 for any */
+    char controller[32];        /* "HDEF", "1b" or "HDEF@1b", empty for any */
+} target_t;
+
+#define kMaxConnections 16
+
+/* open connections, one per service */
+static struct
+{
+    UInt64 entryId;
+    io_connect_t port;
+} connections[kMaxConnections];
+static int connectionCount;
+
+static bool get_number_property(io_service_t service, CFStringRef key, UInt64 *value)
+{
+    CFTypeRef property = IORegistryEntryCreateCFProperty(service, key, kCFAllocatorDefault, 0);
+    bool result = property && CFGetTypeID(property) == CFNumberGetTypeID() &&
+                  CFNumberGetValue((CFNumberRef)property, kCFNumberSInt64Type, value);
     
-    CFMutableDictionaryRef dict = IOServiceMatching("CodecCommander");
+    if (property)
+        CFRelease(property);
+    return result;
+}
+
+static bool get_string_property(io_service_t service, CFStringRef key, char *value, size_t size)
+{
+    CFTypeRef property = IORegistryEntryCreateCFProperty(service, key, kCFAllocatorDefault, 0);
+    bool result = property && CFGetTypeID(property) == CFStringGetTypeID() &&
+                  CFStringGetCString((CFStringRef)property, value, size, kCFStringEncodingUTF8);
+    
+    if (property)
+        CFRelease(property);
+    if (!result && size)
+        *value = 0;
+    return result;
+}
+
+static void set_number(CFMutableDictionaryRef dict, CFStringRef key, UInt64 value)
+{
+    CFNumberRef number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &value);
+    
+    CFDictionarySetValue(dict, key, number);
+    CFRelease(number);
+}
+
+/* "HDEF@1b" matches "HDEF", "1b" and itself */
+static bool match_controller(const char *controller, const char *wanted)
+{
+    const char *at = strchr(controller, '@');
+    size_t length = strlen(wanted);
+    
+    if (!strcasecmp(controller, wanted))
+        return true;
+    if (at && (size_t)(at - controller) == length && !strncasecmp(controller, wanted, length))
+        return true;
+    return at && !strcasecmp(at + 1, wanted);
+}
 
-    //REVIEW_REHABMAN: These extra filters don't work anyway...
-    //CFNumberRef vendorIdRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &vendorId);
-    //CFDictionarySetValue(dict, CFSTR("IOHDACodecVendorID"), vendorIdRef);
+/* CodecCommander services matching the target, address and full vendor id are matched by IOKit */
+static bool find_services(const target_t *target, io_iterator_t *iterator)
+{
+    CFMutableDictionaryRef dict = IOServiceMatching("CodecCommander");
+    CFMutableDictionaryRef properties = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                                                  &kCFTypeDictionaryValueCallBacks);
     
-    //CFNumberRef codecAddressRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &codecAddress);
-    //CFDictionarySetValue(dict, CFSTR("IOHDACodecAddress"), codecAddressRef);
+    if (target->codecAddress >= 0)
+        set_number(properties, CFSTR(kCodecAddress), target->codecAddress);
+    if (target->vendorId > 0xffff)
+        set_number(properties, CFSTR(kCodecVendorID), target->vendorId);
+    if (CFDictionaryGetCount(properties))
+        CFDictionarySetValue(dict, CFSTR(kIOPropertyMatchKey), properties);
+    CFRelease(properties);
     
-    //CFNumberRef functionGroupRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &functionGroup);
-    //CFDictionarySetValue(dict, CFSTR("IOHDACodecFunctionGroupType"), functionGroupRef);
+    return IOServiceGetMatchingServices(kIOMasterPortDefault, dict, iterator) == kIOReturnSuccess;
+}
+
+static bool match_service(io_service_t service, const target_t *target)
+{
+    UInt64 vendorId = 0;
+    char controller[64];
     
-    io_service_t service = IOServiceGetMatchingService(kIOMasterPortDefault, dict);
+    if (target->vendorId && target->vendorId <= 0xffff &&
+        (!get_number_property(service, CFSTR(kCodecVendorID), &vendorId) || (vendorId >> 16) != target->vendorId))
+        return false;
+    if (target->controller[0] &&
+        (!get_string_property(service, CFSTR(kCodecController), controller, sizeof(controller)) || !match_controller(controller, target->controller)))
+        return false;
+    return true;
+}
+
+/* codecs CodecCommander drives, for picking a target */
+static int list_codecs(void)
+{
+    target_t any = { 0, -1, "" };
+    io_iterator_t iterator;
+    io_service_t service;
     
-    if (!service)
+    if (!find_services(&any, &iterator))
+        return 1;
+    while ((service = IOIteratorNext(iterator)))
     {
-        printf("Could not locate CodecCommander kext, ensure it is loaded.\n");
-        return -1;
+        UInt64 vendorId = 0, address = 0;
+        char controller[64];
+        
+        get_number_property(service, CFSTR(kCodecVendorID), &vendorId);
+        get_number_property(service, CFSTR(kCodecAddress), &address);
+        get_string_property(service, CFSTR(kCodecController), controller, sizeof(controller));
+        printf("-c %s -a %d -v 0x%08x\n", controller[0] ? controller : "?", (int)address, (UInt32)vendorId);
+        IOObjectRelease(service);
+    }
+    IOObjectRelease(iterator);
+    return 0;
+}
+
+/* connection to the service (released here), opened once and kept until exit */
+static bool connect_service(io_service_t service, io_connect_t *dataPort)
+{
+    UInt64 entryId = 0;
+    IORegistryEntryGetRegistryEntryID(service, &entryId);
+    for (int i = 0; i < connectionCount; i++)
+    {
+        if (connections[i].entryId == entryId)
+        {
+            IOObjectRelease(service);
+            *dataPort = connections[i].port;
+            return true;
+        }
+    }
+    if (connectionCount == kMaxConnections)
+    {
+        printf("Too many codecs.\n");
+        IOObjectRelease(service);
+        return false;
     }
     
     // Create a connection to the IOService object
-    kern_return_t kr = IOServiceOpen(service, mach_task_self(), 0, &dataPort);
+    kern_return_t kr = IOServiceOpen(service, mach_task_self(), 0, dataPort);
     
     IOObjectRelease(service);
     
     if (kr != kIOReturnSuccess)
     {
         printf("Failed to open CodecCommander service: %08x.\n", kr);
-        return -1;
+        return false;
     }
     
+    connections[connectionCount].entryId = entryId;
+    connections[connectionCount++].port = *dataPort;
+    return true;
+}
+
+/* connection to the one service matching the target */
+static bool open_service(io_connect_t *dataPort, const target_t *target)
+{
+    io_iterator_t iterator;
+    io_service_t service, found = IO_OBJECT_NULL;
+    bool any = !target->vendorId && target->codecAddress < 0 && !target->controller[0];
+    int matches = 0;
+    
+    if (!find_services(target, &iterator))
+    {
+        printf("Could not locate CodecCommander kext, ensure it is loaded.\n");
+        return false;
+    }
+    while ((service = IOIteratorNext(iterator)))
+    {
+        // without a target, the first codec as before
+        if (match_service(service, target) && !matches++)
+            found = service;
+        else
+            IOObjectRelease(service);
+        if (any && found)
+            break;
+    }
+    IOObjectRelease(iterator);
+    
+    if (!found)
+    {
+        printf("Could not locate CodecCommander kext%s, ensure it is loaded.\n", any ? "" : " for this codec");
+        return false;
+    }
+    if (matches > 1)
+    {
+        printf("%d codecs match, pick one with -c, -a or -v (see -s).\n", matches);
+        IOObjectRelease(found);
+        return false;
+    }
+    
+    return connect_service(found, dataPort);
+}
+
+static void close_services(void)
+{
+    while (connectionCount)
+        IOServiceClose(connections[--connectionCount].port);
+}
+
+static UInt32 execute_command(io_connect_t dataPort, UInt32 command)
+{
     IOItemCount inputCount = 1;
     IOItemCount outputCount = 1;
     UInt64 input = command;
     UInt64 output;
     
-    kr = IOConnectCallScalarMethod(dataPort, 0, &input, inputCount, &output, &outputCount);
+    kern_return_t kr = IOConnectCallScalarMethod(dataPort, kClientExecuteVerb, &input, inputCount, &output, &outputCount);
     
     if (kr != kIOReturnSuccess)
         return -1;
@@ -75,6 +250,26 @@ static UInt32 execute_command(UInt32 command, UInt32 vendorId, UInt32 codecAddre
     return (UInt32)output;
 }
 
+/* one call per kClientMaxVerbs commands, failed commands respond -1 */
+static bool execute_commands(io_connect_t dataPort, const UInt32 *commands, UInt32 *responses, UInt32 count)
+{
+    for (UInt32 base = 0; base < count; base += kClientMaxVerbs)
+    {
+        UInt32 chunk = count - base < kClientMaxVerbs ? count - base : kClientMaxVerbs;
+        size_t outputSize = chunk * sizeof(UInt32);
+        
+        kern_return_t kr = IOConnectCallStructMethod(dataPort, kClientExecuteVerbs, &commands[base], chunk * sizeof(UInt32),
+                                                     &responses[base], &outputSize);
+        if (kr != kIOReturnSuccess)
+        {
+            fprintf(stderr, "Batch call failed: %08x.\n", kr);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
 static void list_keys(struct strtbl *tbl, int one_per_line)
 {
     int c = 0;
@@ -145,6 +340,22 @@ static void usage(void)
 {
     fprintf(stderr, "hda-verb for CodecCommander (based on alsa-tools hda-verb)\n");
     fprintf(stderr, "usage: hda-verb [option] nid verb param\n");
+    fprintf(stderr, "       hda-verb [option] -b < file\n");
+    fprintf(stderr, "       hda-verb [option] -d\n");
+    fprintf(stderr, "       hda-verb [option] --watch\n");
+    fprintf(stderr, "       hda-verb [option] [--trace on|off] [-t]\n");
+    fprintf(stderr, "   -c ctl  Codec on this controller (HDEF, HDAU, 1b or HDEF@1b)\n");
+    fprintf(stderr, "   -a addr Codec at this address\n");
+    fprintf(stderr, "   -v id   Codec with this vendor id (0x10ec0892, or 0x10ec for the vendor)\n");
+    fprintf(stderr, "   -s      List the codecs CodecCommander drives\n");
+    fprintf(stderr, "   -b      Batch: read \"nid verb param\" lines from stdin, send them all at once\n");
+    fprintf(stderr, "           (\"@ -c ctl -a addr -v id\" lines switch codec)\n");
+    fprintf(stderr, "   -r      Batch through the shared verb ring\n");
+    fprintf(stderr, "   -d      Dump all widgets of the codec\n");
+    fprintf(stderr, "   -w, --watch  Print sleep, wake, EAPD, reset and jack events of the codecs as they happen\n");
+    fprintf(stderr, "   -T, --trace on|off  Record every command sent to the codec's controller\n");
+    fprintf(stderr, "   -t      Print the recorded commands\n");
+    fprintf(stderr, "   -q      Quiet: print only the result\n");
     fprintf(stderr, "   -l      List known verbs and parameters\n");
     fprintf(stderr, "   -L      List known verbs and parameters (one per line)\n");
 }
@@ -157,43 +368,15 @@ static void list_verbs(int one_per_line)
     list_keys(hda_params, one_per_line);
 }
 
-int main(int argc, char **argv)
+/* parse "nid verb param" into a command, returns false after printing why not */
+static bool parse_command(char **p, UInt32 *command, bool quiet)
 {
     long nid, verb, param;
-    int c;
-    char **p;
-    bool quiet = false;
     
-    while ((c = getopt(argc, argv, "qlL")) >= 0)
-    {
-        switch (c)
-        {
-            case 'l':
-                list_verbs(0);
-                return 0;
-            case 'L':
-                list_verbs(1);
-                return 0;
-            case 'q':
-                quiet = true;
-                break;
-            default:
-                usage();
-                return 1;
-        }
-    }
-    
-    if (argc - optind < 3)
-    {
-        usage();
-        return 1;
-    }
-    
-    p = argv + optind;
     nid = strtol(*p, NULL, 0);
     if (nid < 0 || nid > 0xff) {
         fprintf(stderr, "invalid nid %s\n", *p);
-        return 1;
+        return false;
     }
     
     p++;
@@ -203,7 +386,7 @@ int main(int argc, char **argv)
         verb = lookup_str(hda_verbs, *p);
         
         if (verb < 0)
-            return 1;
+            return false;
     }
     else
     {
@@ -212,7 +395,7 @@ int main(int argc, char **argv)
         if (verb < 0 || verb > 0xfff)
         {
             fprintf(stderr, "invalid verb %s\n", *p);
-            return 1;
+            return false;
         }
     }
     
@@ -222,7 +405,7 @@ int main(int argc, char **argv)
         strtoupper(*p);
         param = lookup_str(hda_params, *p);
         if (param < 0)
-            return 1;
+            return false;
     }
     else
     {
@@ -231,22 +414,522 @@ int main(int argc, char **argv)
         if (param < 0 || param > 0xffff)
         {
             fprintf(stderr, "invalid param %s\n", *p);
-            return 1;
+            return false;
         }
     }
 
     if (!quiet)
         printf("nid = 0x%lx, verb = 0x%lx, param = 0x%lx\n", nid, verb, param);
     
-    UInt32 command = (UInt32)HDA_VERB(nid, verb, param);
-    // Execute command
-    UInt32 result = execute_command(command, 0x10ec0892, 0x0, 0x01);
+    *command = (UInt32)HDA_VERB(nid, verb, param);
+    return true;
+}
 
-    // Print result
+static void print_result(UInt32 command, UInt32 result, bool quiet)
+{
     if (quiet)
         printf("0x%08x\n", result);
     else
         printf("command 0x%08x --> result = 0x%08x\n", command, result);
+}
+
+/* same as execute_commands, through the shared verb ring: the kext is only called when it is idle */
+static bool execute_commands_ring(io_connect_t dataPort, const UInt32 *commands, UInt32 *responses, UInt32 count)
+{
+    mach_vm_address_t address = 0;
+    mach_vm_size_t size = 0;
+    
+    kern_return_t kr = IOConnectMapMemory64(dataPort, kClientMemoryVerbRing, mach_task_self(), &address, &size, kIOMapAnywhere);
+    if (kr != kIOReturnSuccess || size < sizeof(VerbRing))
+    {
+        printf("Failed to map verb ring: %08x.\n", kr);
+        return false;
+    }
+    
+    VerbRing *ring = (VerbRing *)address;
+    UInt32 first = ring->completed, submitted = 0, completed = 0;
+    while (completed < count)
+    {
+        // fill what is free, then ring unless the kext is still at work
+        UInt32 room = kVerbRingEntries - (submitted - completed);
+        UInt32 n = count - submitted < room ? count - submitted : room;
+        for (UInt32 i = 0; i < n; i++, submitted++)
+            ring->commands[(first + submitted) % kVerbRingEntries] = commands[submitted];
+        if (n)
+        {
+            __sync_synchronize();
+            ring->submitted = first + submitted;
+            __sync_synchronize();
+            if (!ring->busy && (kr = IOConnectCallScalarMethod(dataPort, kClientRingDoorbell, NULL, 0, NULL, NULL)) != kIOReturnSuccess)
+            {
+                printf("Doorbell failed: %08x.\n", kr);
+                break;
+            }
+        }
+        
+        UInt32 done = ring->completed - first;
+        __sync_synchronize();
+        if (done == completed)
+        {
+            usleep(50);
+            continue;
+        }
+        for (; completed < done; completed++)
+            responses[completed] = ring->responses[(first + completed) % kVerbRingEntries];
+    }
+    
+    IOConnectUnmapMemory64(dataPort, kClientMemoryVerbRing, mach_task_self(), address);
+    return completed == count;
+}
+
+static const char *widget_types[16] =
+{
+    "Audio Output", "Audio Input", "Audio Mixer", "Audio Selector", "Pin Complex", "Power Widget",
+    "Volume Knob Widget", "Beep Generator Widget", NULL, NULL, NULL, NULL, NULL, NULL, NULL, "Vendor Defined Widget"
+};
+
+static void print_dump(const CodecDumpHeader *header)
+{
+    const CodecDumpNode *nodes = (const CodecDumpNode *)((const UInt8 *)header + header->headerSize);
+    const UInt8 *connections = (const UInt8 *)nodes + header->nodeCount * header->nodeSize;
+    
+    printf("Codec: 0x%08x, revision 0x%08x, subsystem 0x%08x, address %d\n",
+           header->vendorId, header->revisionId, header->subsystemId, header->codecAddress);
+    printf("AFG node 0x%02x, power state 0x%08x\n", header->audioRoot, header->powerState);
+    
+    for (UInt32 i = 0; i < header->nodeCount; i++)
+    {
+        const CodecDumpNode *node = (const CodecDumpNode *)((const UInt8 *)nodes + i * header->nodeSize);
+        UInt32 type = (node->widgetCaps >> 20) & 0xF;
+        
+        printf("Node 0x%02x [%s] wcaps 0x%08x\n", node->node, widget_types[type] ? widget_types[type] : "Unknown", node->widgetCaps);
+        if (node->widgetCaps & (1 << 1))
+            printf("  Amp-In caps 0x%08x, vals [0x%02x 0x%02x]\n", node->ampInCaps, node->ampIn[0] & 0xFF, node->ampIn[1] & 0xFF);
+        if (node->widgetCaps & (1 << 2))
+            printf("  Amp-Out caps 0x%08x, vals [0x%02x 0x%02x]\n", node->ampOutCaps, node->ampOut[0] & 0xFF, node->ampOut[1] & 0xFF);
+        if (type == 0x4)
+        {
+            printf("  Pincap 0x%08x, Pin Default 0x%08x\n", node->pinCaps, node->configDefault);
+            printf("  Pin-ctls 0x%02x, Pin Sense 0x%08x", node->pinControl & 0xFF, node->pinSense);
+            if (node->pinCaps & (1 << 16))
+                printf(", EAPD 0x%02x", node->eapd & 0xFF);
+            printf("\n");
+        }
+        printf("  Power state 0x%08x\n", node->powerState);
+        /* mixers take all their inputs, no selection */
+        if (node->connectionLength)
+        {
+            printf("  Connection: %d\n    ", node->connectionLength);
+            for (UInt32 j = 0; j < node->connectionLength; j++)
+                printf(" 0x%02x%s", connections[node->connectionIndex + j],
+                       j == (node->connectionSelect & 0xFF) && node->connectionLength > 1 && type != 0x2 ? "*" : "");
+            printf("\n");
+        }
+    }
+}
+
+/* whole function group in one call, decoded */
+static int dump_codec(io_connect_t dataPort)
+{
+    size_t size = 16 * 1024;
+    UInt8 *buffer = NULL;
+    kern_return_t kr;
+    
+    for (;;)
+    {
+        UInt64 needed = 0;
+        uint32_t outputCount = 1;
+        size_t outputSize = size;
+        
+        free(buffer);
+        if (!(buffer = malloc(size)))
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        kr = IOConnectCallMethod(dataPort, kClientDumpCodec, NULL, 0, NULL, 0, &needed, &outputCount, buffer, &outputSize);
+        if (kr == kIOReturnNoSpace && needed > size)
+        {
+            size = needed;
+            continue;
+        }
+        break;
+    }
+    
+    const CodecDumpHeader *header = (const CodecDumpHeader *)buffer;
+    if (kr != kIOReturnSuccess || header->version != kCodecDumpVersion)
+    {
+        fprintf(stderr, "Codec dump failed: %08x.\n", kr);
+        free(buffer);
+        return 1;
+    }
+    print_dump(header);
+    free(buffer);
+    return 0;
+}
+
+static const char *event_names[kCodecEventCount] =
+{
+    "power state", "sleep", "wake", "EAPD failed", "codec reset", "jack"
+};
+
+/* one line per event, refcon is the controller of the codec */
+static void print_event(void *refcon, IOReturn result, void **args, UInt32 numArgs)
+{
+    if (result != kIOReturnSuccess || numArgs < kCodecEventArgs)
+        return;
+    
+    UInt32 type = (UInt32)(uintptr_t)args[kCodecEventArgType];
+    UInt32 value = (UInt32)(uintptr_t)args[kCodecEventArgValue];
+    UInt64 time = (UInt64)(uintptr_t)args[kCodecEventArgTime];
+    
+    printf("[%5llu.%06llu] %s codec %d: %s", (unsigned long long)(time / 1000000000), (unsigned long long)(time / 1000 % 1000000),
+           (const char *)refcon, (int)(uintptr_t)args[kCodecEventArgCodec], type < kCodecEventCount ? event_names[type] : "unknown");
+    if (type == kCodecEventPowerState)
+        printf(" %s", value == 0 ? "sleep" : "normal");
+    else if (type == kCodecEventEAPDFailed)
+        printf(" (logic level 0x%02x)", value);
+    else if (type == kCodecEventJack)
+        printf(" node 0x%02x %s", (int)(uintptr_t)args[kCodecEventArgNode], value ? "plugged" : "unplugged");
+    printf("\n");
+    fflush(stdout);
+}
+
+/* print events of every codec matching the target until interrupted */
+static int watch_events(const target_t *target)
+{
+    IONotificationPortRef notifyPort = IONotificationPortCreate(kIOMasterPortDefault);
+    io_iterator_t iterator;
+    io_service_t service;
+    int watched = 0;
+    
+    if (!notifyPort || !find_services(target, &iterator))
+    {
+        printf("Could not locate CodecCommander kext, ensure it is loaded.\n");
+        return 1;
+    }
+    CFRunLoopAddSource(CFRunLoopGetCurrent(), IONotificationPortGetRunLoopSource(notifyPort), kCFRunLoopDefaultMode);
+    
+    while ((service = IOIteratorNext(iterator)))
+    {
+        char controller[64];
+        io_connect_t dataPort;
+        
+        if (!match_service(service, target))
+        {
+            IOObjectRelease(service);
+            continue;
+        }
+        get_string_property(service, CFSTR(kCodecController), controller, sizeof(controller));
+        if (!connect_service(service, &dataPort))
+            continue;
+        
+        uint64_t reference[kOSAsyncRef64Count] = { 0 };
+        uint64_t mask = kCodecEventMaskAll;
+        reference[kIOAsyncCalloutFuncIndex] = (uint64_t)(uintptr_t)print_event;
+        reference[kIOAsyncCalloutRefconIndex] = (uint64_t)(uintptr_t)strdup(controller[0] ? controller : "?");
+        kern_return_t kr = IOConnectCallAsyncScalarMethod(dataPort, kClientRegisterEvents, IONotificationPortGetMachPort(notifyPort),
+                                                          reference, kOSAsyncRef64Count, &mask, 1, NULL, NULL);
+        if (kr != kIOReturnSuccess)
+            printf("Failed to register for events of %s: %08x.\n", controller, kr);
+        else
+            watched++;
+    }
+    IOObjectRelease(iterator);
+    
+    if (!watched)
+        return 1;
+    printf("Watching %d codec(s), ^C to stop.\n", watched);
+    fflush(stdout);
+    CFRunLoopRun();
+    return 0;
+}
+
+static const char *trace_sources[kVerbTraceSourceCount] = { "init", "wake", "sleep", "user", "probe", "event" };
+static const char *trace_status[] = { "sent", "failed", "cached", "skipped" };
+
+/* turn the controller's verb trace on or off */
+static int set_trace(io_connect_t dataPort, bool enable)
+{
+    UInt64 input = enable, wasOn = 0;
+    uint32_t outputCount = 1;
+    
+    kern_return_t kr = IOConnectCallScalarMethod(dataPort, kClientSetTrace, &input, 1, &wasOn, &outputCount);
+    if (kr != kIOReturnSuccess)
+    {
+        printf("Failed to switch verb trace: %08x.\n", kr);
+        return 1;
+    }
+    printf("Verb trace %s (was %s).\n", enable ? "on" : "off", wasOn ? "on" : "off");
+    return 0;
+}
+
+/* print the controller's verb trace, oldest entry first */
+static int print_trace(io_connect_t dataPort)
+{
+    VerbTraceEntry *entries = malloc(kVerbTraceEntries * sizeof(VerbTraceEntry));
+    UInt64 cursor = kVerbTraceOldest;
+    
+    if (!entries)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (;;)
+    {
+        UInt64 output[2] = { 0 };
+        uint32_t outputCount = 2;
+        size_t size = kVerbTraceEntries * sizeof(VerbTraceEntry);
+        
+        kern_return_t kr = IOConnectCallMethod(dataPort, kClientReadTrace, &cursor, 1, NULL, 0, output, &outputCount, entries, &size);
+        if (kr != kIOReturnSuccess)
+        {
+            printf("Failed to read verb trace: %08x.\n", kr);
+            free(entries);
+            return 1;
+        }
+        if (output[1])
+            printf("(%llu entries lost)\n", (unsigned long long)output[1]);
+        
+        size_t count = size / sizeof(VerbTraceEntry);
+        for (size_t i = 0; i < count; i++)
+        {
+            const VerbTraceEntry *entry = &entries[i];
+            printf("[%5llu.%06llu] codec %u nid 0x%02x verb 0x%05x --> 0x%08x %-7s %s\n",
+                   (unsigned long long)(entry->time / 1000000000), (unsigned long long)(entry->time / 1000 % 1000000),
+                   entry->command >> 28, (entry->command >> 20) & 0xFF, entry->command & 0xFFFFF, entry->response,
+                   entry->status < 4 ? trace_status[entry->status] : "?",
+                   entry->source < kVerbTraceSourceCount ? trace_sources[entry->source] : "?");
+        }
+        cursor = output[0];
+        // caught up
+        if (count < kVerbTraceEntries)
+            break;
+    }
+    free(entries);
+    return 0;
+}
+
+/* -c, -a or -v into the target */
+static bool parse_target(target_t *target, int option, const char *value)
+{
+    char *end;
+    
+    switch (option)
+    {
+        case 'c':
+            if (strlen(value) >= sizeof(target->controller))
+                break;
+            strcpy(target->controller, value);
+            return true;
+        case 'a':
+            target->codecAddress = (int)strtol(value, &end, 0);
+            if (*end || target->codecAddress < 0 || target->codecAddress > 15)
+                break;
+            return true;
+        case 'v':
+            target->vendorId = (UInt32)strtoul(value, &end, 16);
+            if (*end || !target->vendorId)
+                break;
+            return true;
+    }
+    fprintf(stderr, "invalid -%c %s\n", option, value);
+    return false;
+}
+
+/* read commands from stdin (blank lines and # comments skipped), send, print one result per command;
+   "@ -c HDAU -a 0" lines send the commands after them to another codec */
+static int batch(const target_t *target, bool quiet, bool ring)
+{
+    UInt32 *commands = NULL, *responses = NULL;
+    io_connect_t *ports = NULL, port = IO_OBJECT_NULL;
+    UInt32 count = 0, capacity = 0;
+    char line[256];
+    int lineNumber = 0, result = 1;
+    
+    while (fgets(line, sizeof(line), stdin))
+    {
+        char *args[7];
+        int n = 0;
+        
+        lineNumber++;
+        if (strchr(line, '#'))
+            *strchr(line, '#') = 0;
+        for (char *token = strtok(line, " \t\r\n"); token && n < 7; token = strtok(NULL, " \t\r\n"))
+            args[n++] = token;
+        if (!n)
+            continue;
+        if (!strcmp(args[0], "@"))
+        {
+            target_t next = { 0, -1, "" };
+            
+            for (int i = 1; i < n; i += 2)
+            {
+                if (i + 1 == n || args[i][0] != '-' || !args[i][1] || args[i][2] || !parse_target(&next, args[i][1], args[i + 1]))
+                {
+                    fprintf(stderr, "line %d: expected @ [-c controller] [-a address] [-v vendor]\n", lineNumber);
+                    goto done;
+                }
+            }
+            if (!open_service(&port, &next))
+                goto done;
+            continue;
+        }
+        if (n != 3)
+        {
+            fprintf(stderr, "line %d: expected nid verb param\n", lineNumber);
+            goto done;
+        }
+        
+        if (!port && !open_service(&port, target))
+            goto done;
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            UInt32 *grown = realloc(commands, capacity * sizeof(UInt32));
+            if (grown)
+                commands = grown;
+            io_connect_t *grownPorts = realloc(ports, capacity * sizeof(io_connect_t));
+            if (grownPorts)
+                ports = grownPorts;
+            if (!grown || !grownPorts)
+            {
+                fprintf(stderr, "out of memory\n");
+                goto done;
+            }
+        }
+        if (!parse_command(args, &commands[count], true))
+        {
+            fprintf(stderr, "line %d: invalid command\n", lineNumber);
+            goto done;
+        }
+        ports[count++] = port;
+    }
+    
+    responses = malloc((count ? count : 1) * sizeof(UInt32));
+    if (!responses)
+        goto done;
+    
+    // one batch per run of commands to the same codec
+    for (UInt32 base = 0, end; base < count; base = end)
+    {
+        for (end = base + 1; end < count && ports[end] == ports[base]; end++)
+            ;
+        if (!(ring ? execute_commands_ring : execute_commands)(ports[base], &commands[base], &responses[base], end - base))
+            goto done;
+    }
+    
+    for (UInt32 i = 0; i < count; i++)
+        print_result(commands[i], responses[i], quiet);
+    result = 0;
+    
+done:
+    free(responses);
+    free(ports);
+    free(commands);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    UInt32 command;
+    int c;
+    bool quiet = false, batched = false, ring = false, dump = false, watch = false, trace = false;
+    int tracing = -1;
+    static const struct option options[] =
+    {
+        { "watch", no_argument, NULL, 'w' },
+        { "trace", required_argument, NULL, 'T' },
+        { NULL, 0, NULL, 0 }
+    };
+    target_t target = { 0, -1, "" };
+    io_connect_t dataPort;
+    
+    atexit(close_services);
+    
+    while ((c = getopt_long(argc, argv, "a:c:v:T:bdrstwqlL", options, NULL)) >= 0)
+    {
+        switch (c)
+        {
+            case 'w':
+                watch = true;
+                break;
+            case 't':
+                trace = true;
+                break;
+            case 'T':
+                if (strcmp(optarg, "on") && strcmp(optarg, "off"))
+                {
+                    usage();
+                    return 1;
+                }
+                tracing = !strcmp(optarg, "on");
+                break;
+            case 'a':
+            case 'c':
+            case 'v':
+                if (!parse_target(&target, c, optarg))
+                    return 1;
+                break;
+            case 's':
+                return list_codecs();
+            case 'd':
+                dump = true;
+                break;
+            case 'b':
+                batched = true;
+                break;
+            case 'r':
+                batched = ring = true;
+                break;
+            case 'l':
+                list_verbs(0);
+                return 0;
+            case 'L':
+                list_verbs(1);
+                return 0;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    
+    if (watch)
+        return watch_events(&target);
+    
+    if (batched)
+        return batch(&target, quiet, ring);
+    
+    if (!dump && !trace && tracing < 0 && argc - optind < 3)
+    {
+        usage();
+        return 1;
+    }
+    
+    if (!dump && !trace && tracing < 0 && !parse_command(argv + optind, &command, quiet))
+        return 1;
+    
+    if (!open_service(&dataPort, &target))
+        return 1;
+    
+    if (tracing >= 0 && set_trace(dataPort, tracing))
+        return 1;
+    if (trace)
+        return print_trace(dataPort);
+    if (tracing >= 0)
+        return 0;
+    
+    if (dump)
+        return dump_codec(dataPort);
+    
+    // Execute command
+    UInt32 result = execute_command(dataPort, command);
+
+    // Print result
+    print_result(command, result, quiet);
 
     return 0;
 }
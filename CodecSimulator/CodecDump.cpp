@@ -0,0 +1,308 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "CodecDump.h"
+
+// The dump is line oriented: a header (Codec/Address/Vendor Id...), AFG
+// defaults and state, then one "Node 0xNN [...] wcaps" block per widget.
+// Each recognised line sets a parameter or a power on default of the current
+// node; lines for things the model does not track (controls, HDMI ELD,
+// digital converter state) are ignored.
+
+class CodecDumpParser
+{
+    CodecModel** mCodecs;
+    unsigned mLoaded;
+
+    CodecModel* mCodec;
+    UInt8 mNode;
+    unsigned mAddress;
+    UInt32 mVendorId, mSubsystemId, mRevisionId, mFunctionUnsol;
+    unsigned mPendingConnections;
+    std::vector<UInt8> mConnections;
+    int mSelectedConnection;
+
+    static bool startsWith(const char* line, const char* prefix)
+    {
+        return !strncmp(line, prefix, strlen(prefix));
+    }
+
+    CodecModel* getCodec()
+    {
+        if (!mCodec)
+        {
+            mCodec = new CodecModel(mVendorId, mSubsystemId, mRevisionId);
+            mCodec->setParameter(mCodec->getAFG(), HDA_PARM_FUNCGRP, HDA_TYPE_AFG | mFunctionUnsol << 8);
+            mNode = mCodec->getAFG();
+        }
+        return mCodec;
+    }
+
+    void finishConnections()
+    {
+        if (!mCodec)
+            return;
+        mCodec->setConnections(mNode, mConnections.empty() ? NULL : &mConnections[0], (unsigned)mConnections.size());
+        for (size_t i = 0; i < mConnections.size(); i++)
+        {
+            // node ids that do not fit the 7 bits of a short form entry need the long form
+            if (mConnections[i] & 0x80)
+            {
+                mCodec->setParameter(mNode, HDA_PARM_CONNLEN, (UInt32)mConnections.size() | 0x80);
+                break;
+            }
+        }
+        if (mSelectedConnection >= 0)
+            mCodec->setDefaultState(mNode, 0x701, mSelectedConnection);
+        mConnections.clear();
+        mPendingConnections = 0;
+    }
+
+    void finishCodec()
+    {
+        if (mPendingConnections)
+            finishConnections();
+        if (mCodec)
+        {
+            mCodec->finalize();
+            if (mAddress >= HDA_MAX_CODECS)
+            {
+                printf("codec dump: ignoring codec 0x%08x at invalid address %u\n", mVendorId, mAddress);
+                delete mCodec;
+            }
+            else
+            {
+                if (mCodecs[mAddress])
+                {
+                    printf("codec dump: codec 0x%08x replaces codec at address %u\n", mVendorId, mAddress);
+                    delete mCodecs[mAddress];
+                }
+                else
+                    mLoaded++;
+                mCodecs[mAddress] = mCodec;
+            }
+        }
+        mCodec = NULL;
+        mAddress = 0;
+        mVendorId = mSubsystemId = mRevisionId = mFunctionUnsol = 0;
+    }
+
+    static UInt32 parseAmpCaps(const char* text)
+    {
+        unsigned offset, steps, stepSize, mute;
+        if (sscanf(text, "ofs=0x%x, nsteps=0x%x, stepsize=0x%x, mute=%u", &offset, &steps, &stepSize, &mute) != 4)
+            return 0;
+        return (mute ? 1U<<31 : 0) | (stepSize & 0x7F) << 16 | (steps & 0x7F) << 8 | (offset & 0x7F);
+    }
+
+    // "[0x00 0x00] [0x80 0x80]": one bracket per amp index, left then right for stereo widgets
+    void parseAmpValues(const char* text, bool output)
+    {
+        unsigned index = 0;
+        for (const char* p = strchr(text, '['); p && index < 16; p = strchr(p + 1, '['), index++)
+        {
+            unsigned left, right;
+            int fields = sscanf(p, "[0x%x 0x%x]", &left, &right);
+            if (fields < 1)
+                break;
+            if (fields < 2)
+                right = left;
+            mCodec->setDefaultAmpGain(mNode, output, true, index, left);
+            mCodec->setDefaultAmpGain(mNode, output, false, index, right);
+        }
+    }
+
+    static UInt32 parsePowerStates(const char* text)
+    {
+        static const struct { const char* name; UInt32 bit; } states[] =
+        {
+            { "D0", 1<<0 }, { "D1", 1<<1 }, { "D2", 1<<2 }, { "D3", 1<<3 }, { "D3cold", 1<<4 },
+            { "S3D3cold", 1<<29 }, { "CLKSTOP", 1<<30 }, { "EPSS", 1U<<31 },
+        };
+        UInt32 result = 0;
+        char name[16];
+        int length;
+        while (sscanf(text, " %15s%n", name, &length) == 1)
+        {
+            for (unsigned i = 0; i < sizeof(states)/sizeof(states[0]); i++)
+                if (!strcmp(name, states[i].name))
+                    result |= states[i].bit;
+            text += length;
+        }
+        return result;
+    }
+
+    void parseConnections(const char* text)
+    {
+        unsigned nid;
+        int length;
+        while (mPendingConnections && sscanf(text, " 0x%x%n", &nid, &length) == 1)
+        {
+            text += length;
+            if (*text == '*')
+            {
+                mSelectedConnection = (int)mConnections.size();
+                text++;
+            }
+            mConnections.push_back(nid);
+            mPendingConnections--;
+        }
+        if (!mPendingConnections)
+            finishConnections();
+    }
+
+    void parseLine(const char* line)
+    {
+        while (*line == ' ' || *line == '\t')
+            line++;
+
+        // header
+        if (startsWith(line, "Codec:"))
+        {
+            finishCodec();
+            return;
+        }
+        if (sscanf(line, "Address: %u", &mAddress) == 1 ||
+            sscanf(line, "AFG Function Id: 0x%*x (unsol %u)", &mFunctionUnsol) == 1 ||
+            sscanf(line, "Vendor Id: 0x%x", &mVendorId) == 1 ||
+            sscanf(line, "Subsystem Id: 0x%x", &mSubsystemId) == 1 ||
+            sscanf(line, "Revision Id: 0x%x", &mRevisionId) == 1)
+            return;
+        if (!mVendorId)
+            return;     // not in an audio codec section
+
+        // connection list continues on the line after "Connection: n"
+        if (mPendingConnections)
+        {
+            parseConnections(line);
+            return;
+        }
+
+        unsigned a, b, c, d, e, f;
+        CodecModel* codec = getCodec();
+        UInt8 afg = codec->getAFG();
+
+        if (startsWith(line, "Default PCM:"))
+            mNode = afg;
+        else if (startsWith(line, "Default Amp-In caps:"))
+            codec->setParameter(afg, HDA_PARM_AMPCAP_IN, parseAmpCaps(line + strlen("Default Amp-In caps: ")));
+        else if (startsWith(line, "Default Amp-Out caps:"))
+            codec->setParameter(afg, HDA_PARM_AMPCAP_OUT, parseAmpCaps(line + strlen("Default Amp-Out caps: ")));
+        else if (sscanf(line, "State of AFG node 0x%x", &a) == 1)
+        {
+            codec->setAFG(a);
+            mNode = codec->getAFG();
+        }
+        else if (sscanf(line, "GPIO: io=%u, o=%u, i=%u, unsolicited=%u, wake=%u", &a, &b, &c, &d, &e) == 5)
+            codec->setParameter(afg, 0x11, (e ? 1U<<31 : 0) | (d ? 1<<30 : 0) | (c & 0xFF) << 16 | (b & 0xFF) << 8 | (a & 0xFF));
+        else if (sscanf(line, "IO[%u]: enable=%u, dir=%u, wake=%u, sticky=%u, data=%u", &a, &b, &c, &d, &e, &f) == 6 && a < 8)
+        {
+            // GPIO state is a bit per pin in F15 (data) .. F1A (sticky)
+            static const UInt16 verbs[] = { 0x716, 0x717, 0x718, 0x71A, 0x715 };
+            unsigned values[] = { b, c, d, e, f };
+            for (unsigned i = 0; i < sizeof(verbs)/sizeof(verbs[0]); i++)
+                if (values[i])
+                    codec->setDefaultState(afg, verbs[i], codec->getState(afg, verbs[i]) | 1 << a);
+            unsigned unsol;
+            if (const char* p = strstr(line, "unsol="))
+                if (sscanf(p, "unsol=%u", &unsol) == 1 && unsol)
+                    codec->setDefaultState(afg, 0x719, codec->getState(afg, 0x719) | 1 << a);
+        }
+        else if (sscanf(line, "Node 0x%x", &a) == 1)
+        {
+            const char* caps = strstr(line, "wcaps 0x");
+            if (!caps || sscanf(caps, "wcaps 0x%x", &b) != 1 || a >= CODEC_MAX_NODES)
+                return;
+            mNode = a;
+            mSelectedConnection = -1;
+            codec->addNode(mNode, b);
+        }
+        else if (sscanf(line, "rates [0x%x]", &a) == 1)
+            codec->setParameter(mNode, 0x0A, (codec->getNode(mNode)->params[0x0A] & ~0xFFF) | (a & 0xFFF));
+        else if (sscanf(line, "bits [0x%x]", &a) == 1)
+            codec->setParameter(mNode, 0x0A, (codec->getNode(mNode)->params[0x0A] & 0xFFF) | (a & 0x1F) << 16);
+        else if (sscanf(line, "formats [0x%x]", &a) == 1)
+            codec->setParameter(mNode, 0x0B, a);
+        else if (startsWith(line, "Amp-In caps:"))
+            codec->setParameter(mNode, HDA_PARM_AMPCAP_IN, parseAmpCaps(line + strlen("Amp-In caps: ")));
+        else if (startsWith(line, "Amp-Out caps:"))
+            codec->setParameter(mNode, HDA_PARM_AMPCAP_OUT, parseAmpCaps(line + strlen("Amp-Out caps: ")));
+        else if (startsWith(line, "Amp-In vals:"))
+            parseAmpValues(line, false);
+        else if (startsWith(line, "Amp-Out vals:"))
+            parseAmpValues(line, true);
+        else if (sscanf(line, "Pincap 0x%x", &a) == 1)
+            codec->setParameter(mNode, HDA_PARM_PINCAP, a);
+        else if (sscanf(line, "EAPD 0x%x", &a) == 1)
+            codec->setDefaultState(mNode, HDA_VERB_EAPDBTL_SET, a);
+        else if (sscanf(line, "Pin Default 0x%x", &a) == 1)
+            codec->setDefaultConfig(mNode, a);
+        else if (sscanf(line, "Pin-ctls: 0x%x", &a) == 1)
+            codec->setDefaultState(mNode, 0x707, a);
+        else if (sscanf(line, "Unsolicited: tag=%x, enabled=%u", &a, &b) == 2)
+            codec->setDefaultState(mNode, 0x708, (b ? 0x80 : 0) | (a & 0x3F));
+        else if (startsWith(line, "Power states:"))
+            codec->setParameter(mNode, HDA_PARM_PWRSTS, parsePowerStates(line + strlen("Power states:")));
+        else if (sscanf(line, "Power: setting=D%u", &a) == 1)
+            codec->setDefaultState(mNode, HDA_VERB_SET_PSTATE, a);
+        else if (sscanf(line, "Converter: stream=%u, channel=%u", &a, &b) == 2)
+            codec->setDefaultState(mNode, 0x706, (a & 0xF) << 4 | (b & 0xF));
+        else if (sscanf(line, "SDI-Select: %u", &a) == 1)
+            codec->setDefaultState(mNode, 0x704, a);
+        else if (sscanf(line, "Processing caps: benign=%u, ncoeff=%u", &a, &b) == 2)
+            codec->setParameter(mNode, 0x10, (b & 0xFF) << 8 | (a ? 1 : 0));
+        else if (sscanf(line, "Volume-Knob: delta=%u, steps=%u, direct=%u, val=%u", &a, &b, &c, &d) == 4)
+        {
+            codec->setParameter(mNode, 0x13, (a ? 0x80 : 0) | (b & 0x7F));
+            codec->setDefaultState(mNode, 0x70F, (c ? 0x80 : 0) | (d & 0x7F));
+        }
+        else if (sscanf(line, "Connection: %u", &a) == 1 && a)
+        {
+            mPendingConnections = a;
+            mSelectedConnection = -1;
+        }
+    }
+
+public:
+    CodecDumpParser(CodecModel* codecs[HDA_MAX_CODECS]) : mCodecs(codecs), mLoaded(0), mCodec(NULL), mNode(0),
+        mAddress(0), mVendorId(0), mSubsystemId(0), mRevisionId(0), mFunctionUnsol(0), mPendingConnections(0), mSelectedConnection(-1) {}
+
+    unsigned parse(FILE* file)
+    {
+        char line[1024];
+        while (fgets(line, sizeof(line), file))
+        {
+            line[strcspn(line, "\r\n")] = 0;
+            parseLine(line);
+        }
+        finishCodec();
+        return mLoaded;
+    }
+};
+
+unsigned loadCodecDump(const char* path, CodecModel* codecs[HDA_MAX_CODECS])
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return 0;
+    CodecDumpParser parser(codecs);
+    unsigned result = parser.parse(file);
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,32 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecSimulator_CodecDump_h
+#define CodecSimulator_CodecDump_h
+
+#include "CodecModel.h"
+#include "IntelHDA.h"
+
+// Build codec models from Linux codec dumps (/proc/asound/card*/codec#*, or
+// the codec sections of alsa-info.sh output). Each "Codec:" section becomes a
+// CodecModel stored in codecs[] at its "Address:". Returns the number of
+// codecs loaded (0 if the file could not be read or holds no audio codec).
+unsigned loadCodecDump(const char* path, CodecModel* codecs[HDA_MAX_CODECS]);
+
+#endif
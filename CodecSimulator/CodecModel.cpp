@@ -0,0 +1,362 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "CodecModel.h"
+
+#define kVendorWidgetCaps   0x00f00000  // vendor defined widget, no capabilities
+
+CodecModel::CodecModel(UInt32 vendorId, UInt32 subsystemId, UInt32 revisionId)
+{
+    memset(mNodes, 0, sizeof(mNodes));
+    mVendorId = vendorId;
+    mSubsystemId = mDefaultSubsystemId = subsystemId;
+    mAFG = 0x01;
+    mResetSettleTime = 5000000;     // 5ms
+    mReadyTime = 0;
+    mSettingsReset = false;
+    mReportsSettingsReset = true;
+    mCommandCount = 0;
+    mResetCount = 0;
+
+    // root node and audio function group
+    addNode(0x00, 0);
+    setParameter(0x00, 0x00, vendorId);
+    setParameter(0x00, 0x02, revisionId);
+    addNode(mAFG, 0);
+    setParameter(mAFG, 0x05, 0x00000101);  // AFG, unsolicited capable
+    setParameter(mAFG, 0x0F, 0x0000000F);  // D0-D3 supported
+}
+
+CodecModel::~CodecModel()
+{
+    for (int nid = 0; nid < CODEC_MAX_NODES; nid++)
+        delete mNodes[nid];
+}
+
+void CodecModel::setAFG(UInt8 nid)
+{
+    if (nid == mAFG || !nid || mNodes[nid])
+        return;
+    mNodes[nid] = mNodes[mAFG];
+    mNodes[mAFG] = NULL;
+    mAFG = nid;
+}
+
+CodecModel::Node* CodecModel::addNode(UInt8 nid, UInt32 widgetCaps)
+{
+    Node* node = mNodes[nid];
+    if (!node)
+    {
+        node = new Node();
+        node->present = true;
+        mNodes[nid] = node;
+    }
+    node->params[0x09] = widgetCaps;
+    return node;
+}
+
+void CodecModel::setParameter(UInt8 nid, UInt8 param, UInt32 value)
+{
+    if (mNodes[nid] && param < CODEC_MAX_PARAMS)
+        mNodes[nid]->params[param] = value;
+}
+
+void CodecModel::setConnections(UInt8 nid, const UInt8* connections, unsigned count)
+{
+    Node* node = mNodes[nid];
+    if (!node)
+        return;
+    node->connections.assign(connections, connections + count);
+    node->params[0x0E] = count & 0x7F;
+}
+
+void CodecModel::setDefaultState(UInt8 nid, UInt16 setVerb, UInt8 value)
+{
+    if (Node* node = mNodes[nid])
+        node->defaultState[setVerb & 0xFF] = node->state[setVerb & 0xFF] = value;
+}
+
+void CodecModel::setDefaultConfig(UInt8 nid, UInt32 configDefault)
+{
+    if (Node* node = mNodes[nid])
+        node->defaultConfig = node->configDefault = configDefault;
+}
+
+void CodecModel::setDefaultAmpGain(UInt8 nid, bool output, bool left, UInt8 index, UInt8 value)
+{
+    if (Node* node = mNodes[nid])
+        node->defaultAmpGain[output][left][index & 0xF] = node->ampGain[output][left][index & 0xF] = value;
+}
+
+void CodecModel::setDefaultCoef(UInt8 nid, UInt16 index, UInt16 value)
+{
+    if (Node* node = mNodes[nid])
+        node->defaultCoefs[index] = node->coefs[index] = value;
+}
+
+void CodecModel::setPresence(UInt8 nid, bool present)
+{
+    if (Node* node = mNodes[nid])
+        node->presence = present;
+}
+
+void CodecModel::finalize()
+{
+    int first = 0, last = -1;
+    for (int nid = mAFG + 1; nid < CODEC_MAX_NODES; nid++)
+    {
+        if (!mNodes[nid])
+            continue;
+        if (last < 0)
+            first = nid;
+        last = nid;
+    }
+    // fill holes in the node range, like a real codec every nid in range answers
+    for (int nid = first; nid <= last; nid++)
+        if (!mNodes[nid])
+            addNode(nid, kVendorWidgetCaps);
+    setParameter(0x00, 0x04, mAFG << 16 | 1);
+    setParameter(mAFG, 0x04, last < 0 ? 0 : first << 16 | (last - first + 1));
+}
+
+void CodecModel::reset()
+{
+    resetFunctionGroup(0);
+    mSubsystemId = mDefaultSubsystemId;
+    for (int nid = 0; nid < CODEC_MAX_NODES; nid++)
+        if (Node* node = mNodes[nid])
+            node->configDefault = node->defaultConfig;
+    mReadyTime = 0;
+}
+
+void CodecModel::resetFunctionGroup(UInt64 now)
+{
+    // Function group reset restores widget state, but not configuration
+    // defaults or the subsystem ID (those are owned by the BIOS).
+    for (int nid = 0; nid < CODEC_MAX_NODES; nid++)
+    {
+        Node* node = mNodes[nid];
+        if (!node)
+            continue;
+        memcpy(node->state, node->defaultState, sizeof(node->state));
+        memcpy(node->ampGain, node->defaultAmpGain, sizeof(node->ampGain));
+        node->coefIndex = node->defaultCoefIndex;
+        node->coefs = node->defaultCoefs;
+    }
+    mReadyTime = now + mResetSettleTime;
+    mSettingsReset = true;
+    mResetCount++;
+}
+
+UInt8 CodecModel::getState(UInt8 nid, UInt16 setVerb)
+{
+    return mNodes[nid] ? mNodes[nid]->state[setVerb & 0xFF] : 0;
+}
+
+UInt32 CodecModel::getConfigDefault(UInt8 nid)
+{
+    return mNodes[nid] ? mNodes[nid]->configDefault : 0;
+}
+
+bool CodecModel::execute(UInt32 command, UInt64 now, UInt32* response)
+{
+    UInt8 nid = (command >> 20) & 0xFF;
+    mCommandCount++;
+    Node* node = mNodes[nid];
+    *response = node ? executeVerb(node, nid, command, now) : 0;
+    return true;
+}
+
+UInt32 CodecModel::executeVerb(Node* node, UInt8 nid, UInt32 command, UInt64 now)
+{
+    UInt8 verb4 = (command >> 16) & 0xF;
+    UInt16 payload16 = command & 0xFFFF;
+
+    switch (verb4)
+    {
+        case 0x3:   // set amp gain/mute
+        {
+            unsigned index = (payload16 >> 8) & 0xF;
+            for (int output = 0; output < 2; output++)
+            {
+                if (!(payload16 & (output ? 1<<15 : 1<<14)))
+                    continue;
+                for (int left = 0; left < 2; left++)
+                    if (payload16 & (left ? 1<<13 : 1<<12))
+                        node->ampGain[output][left][index] = payload16 & 0xFF;
+            }
+            return 0;
+        }
+        case 0xB:   // get amp gain/mute
+            return node->ampGain[(payload16 >> 15) & 1][(payload16 >> 13) & 1][payload16 & 0xF];
+        case 0x5:   // set coefficient index
+            node->coefIndex = payload16;
+            return 0;
+        case 0xD:   // get coefficient index
+            return node->coefIndex;
+        case 0x4:   // set processing coefficient (index auto increments)
+            node->coefs[node->coefIndex++] = payload16;
+            return 0;
+        case 0xC:   // get processing coefficient (index auto increments)
+        {
+            std::map<UInt16, UInt16>::const_iterator it = node->coefs.find(node->coefIndex++);
+            return it == node->coefs.end() ? 0 : it->second;
+        }
+        case 0x7:
+        case 0xF:
+            break;
+        default:    // converter format and other 4-bit verbs are not modelled
+            return 0;
+    }
+
+    UInt16 verb = (command >> 8) & 0xFFF;
+    UInt8 payload = command & 0xFF;
+    switch (verb)
+    {
+        case 0xF00:     // get parameter
+            return payload < CODEC_MAX_PARAMS ? node->params[payload] : 0;
+
+        case 0xF02:     // get connection list entry
+        {
+            bool longForm = node->params[0x0E] & 0x80;
+            unsigned perResponse = longForm ? 2 : 4, bits = longForm ? 16 : 8;
+            UInt32 result = 0;
+            for (unsigned i = 0; i < perResponse && payload + i < node->connections.size(); i++)
+                result |= (UInt32)node->connections[payload + i] << (i * bits);
+            return result;
+        }
+
+        case 0xF05:     // get power state: actual in bits 7:4, setting in bits 3:0
+        {
+            UInt8 setting = node->state[0x05] & 0xF;
+            UInt8 afgActual = now < mReadyTime ? 3 : mNodes[mAFG]->state[0x05] & 0xF;
+            UInt8 actual = nid == mAFG ? (now < mReadyTime ? 3 : setting) : (setting > afgActual ? setting : afgActual);
+            return (nid == mAFG && mSettingsReset && mReportsSettingsReset ? 1<<10 : 0) | actual << 4 | setting;
+        }
+
+        case 0x705:     // set power state
+            node->state[0x05] = payload;
+            if (nid == mAFG)
+                mSettingsReset = false;
+            return 0;
+
+        case 0xF09:     // get pin sense
+            return node->presence ? 0x80000000 : 0;
+
+        case 0xF1C:     // get configuration default
+            return node->configDefault;
+
+        case 0x71C: case 0x71D: case 0x71E: case 0x71F:
+        {
+            unsigned shift = (verb - 0x71C) * 8;
+            node->configDefault = (node->configDefault & ~(0xFFU << shift)) | (UInt32)payload << shift;
+            return 0;
+        }
+
+        case 0xF20:     // get subsystem ID
+            return mSubsystemId;
+
+        case 0x720: case 0x721: case 0x722: case 0x723:
+        {
+            unsigned shift = (verb - 0x720) * 8;
+            mSubsystemId = (mSubsystemId & ~(0xFFU << shift)) | (UInt32)payload << shift;
+            return 0;
+        }
+
+        case 0x7FF:     // function group reset
+            if (nid == mAFG)
+                resetFunctionGroup(now);
+            return 0;
+
+        case 0x709:     // execute pin sense
+            return 0;
+    }
+
+    // generic 7xx/Fxx pairs: a byte of state indexed by the low byte of the verb
+    if ((verb & 0xF00) == 0x700)
+    {
+        node->state[verb & 0xFF] = payload;
+        return 0;
+    }
+    return node->state[verb & 0xFF];
+}
+
+// Realtek ALC283 (as in many Haswell/Broadwell laptops)
+
+struct DefaultWidget
+{
+    UInt8 nid;
+    UInt32 caps;
+    UInt32 pinCaps;
+    UInt32 config;
+    UInt8 connections[8];
+};
+
+static const DefaultWidget kALC283Widgets[] =
+{
+    { 0x02, 0x0000041d, 0, 0, { 0 } },                                          // DAC
+    { 0x03, 0x0000041d, 0, 0, { 0 } },                                          // DAC
+    { 0x06, 0x00000611, 0, 0, { 0 } },                                          // S/PDIF DAC
+    { 0x08, 0x0010051b, 0, 0, { 0x23 } },                                       // ADC
+    { 0x09, 0x0010051b, 0, 0, { 0x22 } },                                       // ADC
+    { 0x0b, 0x0020010b, 0, 0, { 0x18, 0x19, 0x1a, 0x1b, 0x1d } },               // loopback mixer
+    { 0x0c, 0x0020010b, 0, 0, { 0x02, 0x0b } },                                 // mixer
+    { 0x0d, 0x0020010b, 0, 0, { 0x03, 0x0b } },                                 // mixer
+    { 0x12, 0x0040040b, 0x00000020, 0x90a60140, { 0 } },                        // internal mic
+    { 0x14, 0x0040058d, 0x00010014, 0x90170110, { 0x0c, 0x0d } },               // speaker (EAPD)
+    { 0x18, 0x0040048b, 0x00003724, 0x03a19020, { 0 } },                        // mic jack
+    { 0x19, 0x0040048b, 0x00003724, 0x411111f0, { 0 } },
+    { 0x1a, 0x0040048b, 0x00003724, 0x411111f0, { 0 } },
+    { 0x1b, 0x0040058d, 0x0001373c, 0x411111f0, { 0x0c, 0x0d } },               // unused (EAPD)
+    { 0x1d, 0x00400400, 0x00000020, 0x40479b2d, { 0 } },
+    { 0x1e, 0x00400781, 0x00000014, 0x411111f0, { 0x06 } },                     // S/PDIF out
+    { 0x20, 0x00f00040, 0, 0, { 0 } },                                          // vendor (coefficients)
+    { 0x21, 0x0040058d, 0x0001001c, 0x0321101f, { 0x0c, 0x0d } },               // headphone (EAPD)
+    { 0x22, 0x0020010b, 0, 0, { 0x18, 0x19, 0x1a, 0x1b, 0x1d, 0x0b, 0x12 } },   // ADC mixer
+    { 0x23, 0x0020010b, 0, 0, { 0x18, 0x19, 0x1a, 0x1b, 0x1d, 0x0b, 0x12 } },   // ADC mixer
+};
+
+CodecModel* CodecModel::createDefault()
+{
+    CodecModel* codec = new CodecModel(0x10ec0283, 0x17aa2214, 0x00100003);
+    for (unsigned i = 0; i < sizeof(kALC283Widgets)/sizeof(kALC283Widgets[0]); i++)
+    {
+        const DefaultWidget& widget = kALC283Widgets[i];
+        codec->addNode(widget.nid, widget.caps);
+        unsigned count = 0;
+        while (count < sizeof(widget.connections) && widget.connections[count])
+            count++;
+        codec->setConnections(widget.nid, widget.connections, count);
+        if (widget.caps & 1<<2)
+            codec->setParameter(widget.nid, 0x12, 0x80000000 | 0x00025757);
+        if (widget.caps & 1<<1)
+            codec->setParameter(widget.nid, 0x0D, 0x80051f17);
+        if ((widget.caps >> 20 & 0xF) == 0x4)
+        {
+            codec->setParameter(widget.nid, 0x0C, widget.pinCaps);
+            codec->setDefaultConfig(widget.nid, widget.config);
+            if (widget.pinCaps & 1<<16)
+                codec->setDefaultState(widget.nid, 0x70C, 0x02);
+        }
+    }
+    codec->setPresence(0x21, true);
+    codec->setDefaultCoef(0x20, 0x07, 0x0020);
+    codec->finalize();
+    return codec;
+}
@@ -0,0 +1,119 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecSimulator_CodecModel_h
+#define CodecSimulator_CodecModel_h
+
+#include "KernelShim.h"
+#include <map>
+
+// Table driven model of an HDA codec: every node has a parameter table
+// (answered by GET_PARAM) and a byte of state per 12-bit SET verb, read back
+// by the matching GET verb (7xx/Fxx pairs). Verbs with wider or structured
+// state (power, config default, subsystem, amps, coefficients, connection
+// lists) are handled explicitly. Nodes are indexed directly by nid.
+
+#define CODEC_MAX_NODES     256
+#define CODEC_MAX_PARAMS    0x20
+
+class CodecModel
+{
+public:
+    struct Node
+    {
+        bool present;
+        UInt32 params[CODEC_MAX_PARAMS];
+        std::vector<UInt8> connections;
+
+        // power on defaults, restored by function group reset
+        UInt8 defaultState[256];
+        UInt32 defaultConfig;
+        UInt8 defaultAmpGain[2][2][16];
+        UInt16 defaultCoefIndex;
+        std::map<UInt16, UInt16> defaultCoefs;
+
+        // current state
+        UInt8 state[256];               // indexed by the low byte of 7xx/Fxx verbs
+        UInt32 configDefault;
+        UInt8 ampGain[2][2][16];        // [output][left][index]: mute in bit 7
+        UInt16 coefIndex;
+        std::map<UInt16, UInt16> coefs;
+        bool presence;                  // pin sense
+    };
+
+    CodecModel(UInt32 vendorId, UInt32 subsystemId, UInt32 revisionId);
+    ~CodecModel();
+
+    // Build the widget graph; the root node (0) and AFG (1 unless moved) are created by the constructor
+    void setAFG(UInt8 nid);
+    Node* addNode(UInt8 nid, UInt32 widgetCaps);
+    void setParameter(UInt8 nid, UInt8 param, UInt32 value);
+    void setConnections(UInt8 nid, const UInt8* connections, unsigned count);
+    void setDefaultState(UInt8 nid, UInt16 setVerb, UInt8 value);
+    void setDefaultConfig(UInt8 nid, UInt32 configDefault);
+    void setDefaultAmpGain(UInt8 nid, bool output, bool left, UInt8 index, UInt8 value);
+    void setDefaultCoef(UInt8 nid, UInt16 index, UInt16 value);
+    void setPresence(UInt8 nid, bool present);
+
+    // Fill in node count parameters once all nodes are added
+    void finalize();
+
+    // Execute a command (codec address stripped) at time now (ns); returns false if no response
+    bool execute(UInt32 command, UInt64 now, UInt32* response);
+
+    // Controller (link) reset: all state back to power on defaults
+    void reset();
+
+    // Time taken by the AFG to reach D0 after a function group reset
+    void setResetSettleTime(UInt64 nanoseconds) { mResetSettleTime = nanoseconds; }
+
+    // Whether GET_PSTATE of the AFG reports PS-SettingsReset (optional in the spec)
+    void setReportsSettingsReset(bool reports) { mReportsSettingsReset = reports; }
+
+    // Direct state access for verification
+    inline UInt32 getVendorId() { return mVendorId; }
+    inline UInt32 getSubsystemId() { return mSubsystemId; }
+    inline UInt8 getAFG() { return mAFG; }
+    inline Node* getNode(UInt8 nid) { return mNodes[nid]; }
+    UInt8 getState(UInt8 nid, UInt16 setVerb);
+    UInt32 getConfigDefault(UInt8 nid);
+    inline UInt32 getCommandCount() { return mCommandCount; }
+    inline UInt32 getResetCount() { return mResetCount; }
+
+    // Realtek ALC283 style laptop codec used when no codec dump is given
+    static CodecModel* createDefault();
+
+private:
+    Node* mNodes[CODEC_MAX_NODES];
+    UInt32 mVendorId;
+    UInt32 mSubsystemId;
+    UInt32 mDefaultSubsystemId;
+    UInt8 mAFG;
+    UInt64 mResetSettleTime;
+    UInt64 mReadyTime;          // AFG reports D0 actual state from this time on
+    bool mSettingsReset;        // PS-SettingsReset: reset since the last SET_PSTATE to the AFG
+    bool mReportsSettingsReset;
+    UInt32 mCommandCount;
+    UInt32 mResetCount;
+
+    void resetFunctionGroup(UInt64 now);
+    UInt32 executeVerb(Node* node, UInt8 nid, UInt32 command, UInt64 now);
+};
+
+#endif
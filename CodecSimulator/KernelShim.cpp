@@ -0,0 +1,364 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "KernelShim.h"
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+task_t kernel_task = NULL;
+
+static IORegistryPlane gServicePlane;
+const IORegistryPlane* gIOServicePlane = &gServicePlane;
+
+static OSBoolean gBooleanTrue(true);
+static OSBoolean gBooleanFalse(false);
+OSBoolean* const kOSBooleanTrue = &gBooleanTrue;
+OSBoolean* const kOSBooleanFalse = &gBooleanFalse;
+
+// timing (absolute time is in nanoseconds)
+
+void clock_get_uptime(uint64_t* result)
+{
+    // Every polling loop in the driver reads the clock, so this is where the
+    // simulated controller's link thread gets the CPU on hosts with few cores.
+    // (On real hardware the controller runs in parallel with the driver.)
+    sched_yield();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *result = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// same clock without yielding, for code that only stamps events
+uint64_t mach_absolute_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t* result)
+{
+    *result = abstime;
+}
+
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t* result)
+{
+    *result = nanoseconds;
+}
+
+void IODelay(unsigned microseconds)
+{
+    // busy-wait like the kernel does; usleep granularity is far too coarse
+    uint64_t start, now;
+    clock_get_uptime(&start);
+    do clock_get_uptime(&now);
+    while (now - start < microseconds * 1000ULL);
+}
+
+void IOSleep(unsigned milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
+
+// libkern containers
+
+OSString* OSString::withCString(const char* cString)
+{
+    OSString* result = new OSString;
+    result->mString = cString;
+    return result;
+}
+
+OSNumber* OSNumber::withNumber(UInt64 value, unsigned numberOfBits)
+{
+    OSNumber* result = new OSNumber;
+    result->mValue = numberOfBits < 64 ? value & ((1ULL << numberOfBits) - 1) : value;
+    return result;
+}
+
+OSBoolean* OSBoolean::withBoolean(bool value)
+{
+    // the kernel returns the shared constants; take a reference so callers can release it
+    OSBoolean* result = value ? kOSBooleanTrue : kOSBooleanFalse;
+    result->retain();
+    return result;
+}
+
+OSData* OSData::withCapacity(unsigned capacity)
+{
+    OSData* result = new OSData;
+    result->mCapacity = capacity;
+    result->mBytes.reserve(capacity);
+    return result;
+}
+
+OSData* OSData::withBytes(const void* bytes, unsigned length)
+{
+    OSData* result = withCapacity(length);
+    result->appendBytes(bytes, length);
+    return result;
+}
+
+bool OSData::appendByte(unsigned char byte, unsigned count)
+{
+    mBytes.insert(mBytes.end(), count, byte);
+    return true;
+}
+
+bool OSData::appendBytes(const void* bytes, unsigned length)
+{
+    mBytes.insert(mBytes.end(), (const UInt8*)bytes, (const UInt8*)bytes + length);
+    return true;
+}
+
+OSArray::~OSArray()
+{
+    for (size_t i = 0; i < mObjects.size(); i++)
+        mObjects[i]->release();
+}
+
+OSArray* OSArray::withCapacity(unsigned capacity)
+{
+    OSArray* result = new OSArray;
+    result->mObjects.reserve(capacity);
+    return result;
+}
+
+OSCollection* OSArray::copyCollection() const
+{
+    // deep copy of nested collections, shallow for leaf objects (matches libkern)
+    OSArray* result = withCapacity(getCount());
+    for (size_t i = 0; i < mObjects.size(); i++)
+    {
+        if (OSCollection* coll = OSDynamicCast(OSCollection, mObjects[i]))
+        {
+            OSCollection* copy = coll->copyCollection();
+            result->setObject(copy);
+            copy->release();
+        }
+        else
+            result->setObject(mObjects[i]);
+    }
+    return result;
+}
+
+bool OSArray::setObject(const OSObject* object)
+{
+    if (!object)
+        return false;
+    object->retain();
+    mObjects.push_back((OSObject*)object);
+    return true;
+}
+
+void OSArray::replaceObject(unsigned index, const OSObject* object)
+{
+    if (index >= mObjects.size() || !object)
+        return;
+    object->retain();
+    mObjects[index]->release();
+    mObjects[index] = (OSObject*)object;
+}
+
+void OSArray::removeObject(unsigned index)
+{
+    if (index >= mObjects.size())
+        return;
+    mObjects[index]->release();
+    mObjects.erase(mObjects.begin() + index);
+}
+
+OSDictionary::~OSDictionary()
+{
+    for (size_t i = 0; i < mEntries.size(); i++)
+    {
+        mEntries[i].first->release();
+        mEntries[i].second->release();
+    }
+}
+
+OSDictionary* OSDictionary::withCapacity(unsigned capacity)
+{
+    OSDictionary* result = new OSDictionary;
+    result->mEntries.reserve(capacity);
+    return result;
+}
+
+OSDictionary* OSDictionary::withDictionary(const OSDictionary* dict, unsigned capacity)
+{
+    OSDictionary* result = withCapacity(capacity);
+    result->merge(dict);
+    return result;
+}
+
+OSCollection* OSDictionary::copyCollection() const
+{
+    OSDictionary* result = withCapacity(getCount());
+    for (size_t i = 0; i < mEntries.size(); i++)
+    {
+        if (OSCollection* coll = OSDynamicCast(OSCollection, mEntries[i].second))
+        {
+            OSCollection* copy = coll->copyCollection();
+            result->setObject(mEntries[i].first, copy);
+            copy->release();
+        }
+        else
+            result->setObject(mEntries[i].first, mEntries[i].second);
+    }
+    return result;
+}
+
+OSObject* OSDictionary::getObject(const char* key) const
+{
+    for (size_t i = 0; i < mEntries.size(); i++)
+        if (mEntries[i].first->isEqualTo(key))
+            return mEntries[i].second;
+    return NULL;
+}
+
+bool OSDictionary::setObject(const char* key, const OSObject* object)
+{
+    if (!key || !object)
+        return false;
+    object->retain();
+    for (size_t i = 0; i < mEntries.size(); i++)
+    {
+        if (mEntries[i].first->isEqualTo(key))
+        {
+            mEntries[i].second->release();
+            mEntries[i].second = (OSObject*)object;
+            return true;
+        }
+    }
+    mEntries.push_back(std::make_pair(OSString::withCString(key), (OSObject*)object));
+    return true;
+}
+
+void OSDictionary::removeObject(const char* key)
+{
+    for (size_t i = 0; i < mEntries.size(); i++)
+    {
+        if (mEntries[i].first->isEqualTo(key))
+        {
+            mEntries[i].first->release();
+            mEntries[i].second->release();
+            mEntries.erase(mEntries.begin() + i);
+            return;
+        }
+    }
+}
+
+bool OSDictionary::merge(const OSDictionary* other)
+{
+    if (!other)
+        return false;
+    for (size_t i = 0; i < other->mEntries.size(); i++)
+        setObject(other->mEntries[i].first, other->mEntries[i].second);
+    return true;
+}
+
+OSCollectionIterator* OSCollectionIterator::withCollection(const OSCollection* collection)
+{
+    if (!collection)
+        return NULL;
+    OSCollectionIterator* iterator = new OSCollectionIterator;
+    iterator->mCollection = collection;
+    return iterator;
+}
+
+OSObject* OSCollectionIterator::getNextObject()
+{
+    if (const OSDictionary* dict = dynamic_cast<const OSDictionary*>(mCollection))
+        return (OSObject*)dict->getKey(mIndex++);
+    if (const OSArray* array = dynamic_cast<const OSArray*>(mCollection))
+        return array->getObject(mIndex++);
+    return NULL;
+}
+
+// IOKit registry
+
+IORegistryEntry::IORegistryEntry()
+{
+    mProperties = OSDictionary::withCapacity(8);
+}
+
+IORegistryEntry::~IORegistryEntry()
+{
+    mProperties->release();
+}
+
+bool IORegistryEntry::setProperty(const char* key, const char* string)
+{
+    OSString* value = OSString::withCString(string);
+    bool result = setProperty(key, value);
+    value->release();
+    return result;
+}
+
+bool IORegistryEntry::setProperty(const char* key, unsigned long long value, unsigned numberOfBits)
+{
+    OSNumber* number = OSNumber::withNumber(value, numberOfBits);
+    bool result = setProperty(key, number);
+    number->release();
+    return result;
+}
+
+void IORegistryEntry::attachToParent(IORegistryEntry* parent)
+{
+    mParent = parent;
+    parent->mChildren.push_back(this);
+}
+
+bool IORegistryEntry::getPath(char* path, int* length, const IORegistryPlane* plane) const
+{
+    std::string result = mName;
+    for (IORegistryEntry* entry = mParent; entry; entry = entry->mParent)
+        result = entry->mName + "/" + result;
+    result = "IOService:/" + result;
+    if ((int)result.length() >= *length)
+        return false;
+    strcpy(path, result.c_str());
+    *length = (int)result.length() + 1;
+    return true;
+}
+
+// Memory descriptors
+
+IOBufferMemoryDescriptor* IOBufferMemoryDescriptor::inTaskWithPhysicalMask(task_t task, IOOptionBits options, mach_vm_address_t capacity, mach_vm_address_t physicalMask)
+{
+    // the mask's low zero bits give the required alignment
+    size_t alignment = (size_t)(~physicalMask + 1);
+    if (alignment < sizeof(void*))
+        alignment = sizeof(void*);
+    size_t length = (size_t)((capacity + alignment - 1) & ~(alignment - 1));
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, alignment, length))
+        return NULL;
+    // host pointers must still satisfy the controller's addressing limit
+    if ((uintptr_t)buffer & ~physicalMask & ~(uintptr_t)(alignment - 1))
+    {
+        free(buffer);
+        return NULL;
+    }
+    IOBufferMemoryDescriptor* result = new IOBufferMemoryDescriptor;
+    result->mBuffer = buffer;
+    result->mLength = capacity;
+    return result;
+}
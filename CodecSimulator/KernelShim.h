@@ -0,0 +1,396 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+// User space stand-ins for the subset of libkern/IOKit used by IntelHDA.cpp and
+// Configuration.cpp, so they can be built unmodified against the simulator.
+// The headers in shim/ (IOKit/IOService.h, etc.) all resolve to this file.
+
+#ifndef CodecSimulator_KernelShim_h
+#define CodecSimulator_KernelShim_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int8_t SInt8;
+typedef int16_t SInt16;
+typedef int32_t SInt32;
+typedef int64_t SInt64;
+
+typedef int IOReturn;
+typedef int kern_return_t;
+typedef void* task_t;
+typedef uint64_t mach_vm_address_t;
+typedef uint64_t IOPhysicalAddress;
+typedef uintptr_t IOVirtualAddress;
+typedef uint64_t IOByteCount;
+typedef UInt32 IOOptionBits;
+
+#define kIOReturnSuccess        0
+#define kIOReturnError          ((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory       ((IOReturn)0xe00002bd)
+#define kIOReturnBadArgument    ((IOReturn)0xe00002c2)
+#define kIOReturnUnsupported    ((IOReturn)0xe00002c7)
+#define kIOReturnTimeout        ((IOReturn)0xe00002d6)
+#define kIOReturnNotReady       ((IOReturn)0xe00002d8)
+#define KERN_SUCCESS            0
+#define KERN_FAILURE            5
+
+#define kIODirectionInOut               3
+#define kIOMemoryPhysicallyContiguous   0x00000010
+
+#define kIOPCIConfigVendorID            0x00
+#define kIOPCIConfigDeviceID            0x02
+#define kIOPCIConfigSubSystemVendorID   0x2c
+
+extern task_t kernel_task;
+
+// logging and timing
+
+#define IOLog(args...) printf(args)
+
+void IODelay(unsigned microseconds);
+void IOSleep(unsigned milliseconds);
+void clock_get_uptime(uint64_t* result);
+uint64_t mach_absolute_time();
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t* result);
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t* result);
+
+static inline void OSSynchronizeIO() { std::atomic_thread_fence(std::memory_order_seq_cst); }
+
+static inline void* IOMalloc(size_t size) { return malloc(size); }
+static inline void IOFree(void* address, size_t size) { free(address); }
+
+// locks
+
+struct IOLock { std::mutex mutex; std::condition_variable condition; };
+struct IORecursiveLock { std::recursive_mutex mutex; };
+
+static inline IOLock* IOLockAlloc() { return new IOLock; }
+static inline void IOLockFree(IOLock* lock) { delete lock; }
+static inline void IOLockLock(IOLock* lock) { lock->mutex.lock(); }
+static inline bool IOLockTryLock(IOLock* lock) { return lock->mutex.try_lock(); }
+static inline void IOLockUnlock(IOLock* lock) { lock->mutex.unlock(); }
+
+typedef void* event_t;
+typedef int wait_result_t;
+#define THREAD_AWAKENED 0
+#define THREAD_UNINT    0
+
+// one condition per lock: a sleeper may also be woken by another event's
+// wakeup, which is harmless as sleepers recheck their condition
+static inline int IOLockSleep(IOLock* lock, event_t event, UInt32 interType)
+{
+    std::unique_lock<std::mutex> guard(lock->mutex, std::adopt_lock);
+    lock->condition.wait(guard);
+    guard.release();
+    return THREAD_AWAKENED;
+}
+static inline void IOLockWakeup(IOLock* lock, event_t event, bool oneThread) { lock->condition.notify_all(); }
+
+static inline IORecursiveLock* IORecursiveLockAlloc() { return new IORecursiveLock; }
+static inline void IORecursiveLockFree(IORecursiveLock* lock) { delete lock; }
+static inline void IORecursiveLockLock(IORecursiveLock* lock) { lock->mutex.lock(); }
+static inline bool IORecursiveLockTryLock(IORecursiveLock* lock) { return lock->mutex.try_lock(); }
+static inline void IORecursiveLockUnlock(IORecursiveLock* lock) { lock->mutex.unlock(); }
+
+// atomics
+
+static inline bool OSCompareAndSwapPtr(void* oldValue, void* newValue, void* volatile* address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline bool OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32* address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline void OSMemoryBarrier() { std::atomic_thread_fence(std::memory_order_seq_cst); }
+static inline SInt32 OSIncrementAtomic(volatile SInt32* address) { return __atomic_fetch_add(address, 1, __ATOMIC_SEQ_CST); }
+static inline SInt32 OSDecrementAtomic(volatile SInt32* address) { return __atomic_fetch_sub(address, 1, __ATOMIC_SEQ_CST); }
+
+// threads
+
+typedef void* thread_t;
+typedef void (*thread_continue_t)(void* parameter, wait_result_t result);
+
+static inline thread_t current_thread()
+{
+    static thread_local char self;
+    return &self;
+}
+static inline kern_return_t kernel_thread_start(thread_continue_t continuation, void* parameter, thread_t* newThread)
+{
+    std::thread(continuation, parameter, THREAD_AWAKENED).detach();
+    *newThread = NULL;
+    return KERN_SUCCESS;
+}
+static inline void thread_deallocate(thread_t thread) {}
+static inline kern_return_t thread_terminate(thread_t thread) { return KERN_SUCCESS; }
+
+// libkern containers
+
+class OSObject
+{
+    mutable int mRetainCount = 1;
+public:
+    virtual ~OSObject() {}
+    void retain() const { mRetainCount++; }
+    void release() const { if (--mRetainCount == 0) delete this; }
+    int getRetainCount() const { return mRetainCount; }
+};
+
+#define OSDynamicCast(type, inst) dynamic_cast<type*>((OSObject*)(inst))
+#define OSSafeRelease(inst) do { if (inst) (inst)->release(); } while (0)
+#define OSSafeReleaseNULL(inst) do { if (inst) (inst)->release(); (inst) = NULL; } while (0)
+
+class OSString : public OSObject
+{
+    std::string mString;
+public:
+    static OSString* withCString(const char* cString);
+    const char* getCStringNoCopy() const { return mString.c_str(); }
+    unsigned getLength() const { return (unsigned)mString.length(); }
+    bool isEqualTo(const char* cString) const { return mString == cString; }
+    bool isEqualTo(const OSString* string) const { return string && mString == string->mString; }
+};
+
+typedef OSString OSSymbol;
+
+class OSNumber : public OSObject
+{
+    UInt64 mValue;
+public:
+    static OSNumber* withNumber(UInt64 value, unsigned numberOfBits);
+    UInt8 unsigned8BitValue() const { return (UInt8)mValue; }
+    UInt16 unsigned16BitValue() const { return (UInt16)mValue; }
+    UInt32 unsigned32BitValue() const { return (UInt32)mValue; }
+    UInt64 unsigned64BitValue() const { return mValue; }
+};
+
+class OSBoolean : public OSObject
+{
+    bool mValue;
+public:
+    OSBoolean(bool value) : mValue(value) {}
+    static OSBoolean* withBoolean(bool value);
+    bool getValue() const { return mValue; }
+    bool isTrue() const { return mValue; }
+    bool isFalse() const { return !mValue; }
+};
+
+extern OSBoolean* const kOSBooleanTrue;
+extern OSBoolean* const kOSBooleanFalse;
+
+class OSData : public OSObject
+{
+    std::vector<UInt8> mBytes;
+    unsigned mCapacity = 0;
+public:
+    static OSData* withCapacity(unsigned capacity);
+    static OSData* withBytes(const void* bytes, unsigned length);
+    bool appendByte(unsigned char byte, unsigned count);
+    bool appendBytes(const void* bytes, unsigned length);
+    const void* getBytesNoCopy() const { return mBytes.empty() ? NULL : &mBytes[0]; }
+    void* getBytesNoCopy() { return mBytes.empty() ? NULL : &mBytes[0]; }
+    unsigned getLength() const { return (unsigned)mBytes.size(); }
+    unsigned getCapacity() const { return mCapacity > mBytes.size() ? mCapacity : (unsigned)mBytes.size(); }
+};
+
+class OSCollection : public OSObject
+{
+public:
+    virtual OSCollection* copyCollection() const = 0;
+    virtual unsigned getCount() const = 0;
+};
+
+class OSArray : public OSCollection
+{
+    std::vector<OSObject*> mObjects;
+public:
+    ~OSArray();
+    static OSArray* withCapacity(unsigned capacity);
+    OSCollection* copyCollection() const;
+    unsigned getCount() const { return (unsigned)mObjects.size(); }
+    OSObject* getObject(unsigned index) const { return index < mObjects.size() ? mObjects[index] : NULL; }
+    bool setObject(const OSObject* object);
+    void replaceObject(unsigned index, const OSObject* object);
+    void removeObject(unsigned index);
+};
+
+class OSDictionary : public OSCollection
+{
+    std::vector<std::pair<OSString*, OSObject*> > mEntries;
+public:
+    ~OSDictionary();
+    static OSDictionary* withCapacity(unsigned capacity);
+    static OSDictionary* withDictionary(const OSDictionary* dict, unsigned capacity = 0);
+    OSCollection* copyCollection() const;
+    unsigned getCount() const { return (unsigned)mEntries.size(); }
+    OSObject* getObject(const char* key) const;
+    OSObject* getObject(const OSString* key) const { return key ? getObject(key->getCStringNoCopy()) : NULL; }
+    bool setObject(const char* key, const OSObject* object);
+    bool setObject(const OSString* key, const OSObject* object) { return key && setObject(key->getCStringNoCopy(), object); }
+    void removeObject(const char* key);
+    bool merge(const OSDictionary* other);
+    const OSString* getKey(unsigned index) const { return index < mEntries.size() ? mEntries[index].first : NULL; }
+};
+
+// iterates keys of a dictionary, objects of an array
+class OSCollectionIterator : public OSObject
+{
+    const OSCollection* mCollection;
+    unsigned mIndex = 0;
+public:
+    static OSCollectionIterator* withCollection(const OSCollection* collection);
+    OSObject* getNextObject();
+    void reset() { mIndex = 0; }
+};
+
+// IOKit registry
+
+struct IORegistryPlane {};
+extern const IORegistryPlane* gIOServicePlane;
+
+class IORegistryEntry : public OSObject
+{
+    OSDictionary* mProperties;
+    IORegistryEntry* mParent = NULL;
+    std::vector<IORegistryEntry*> mChildren;
+    std::string mName;
+public:
+    IORegistryEntry();
+    ~IORegistryEntry();
+    static IORegistryEntry* fromPath(const char* path, const IORegistryPlane* plane = NULL) { return NULL; }
+
+    OSObject* getProperty(const char* key) const { return mProperties->getObject(key); }
+    OSObject* getProperty(const OSString* key) const { return mProperties->getObject(key); }
+    bool setProperty(const char* key, OSObject* object) { return mProperties->setObject(key, object); }
+    bool setProperty(const char* key, const char* string);
+    bool setProperty(const char* key, bool value) { return setProperty(key, value ? kOSBooleanTrue : kOSBooleanFalse); }
+    bool setProperty(const char* key, unsigned long long value, unsigned numberOfBits);
+    void removeProperty(const char* key) { mProperties->removeObject(key); }
+    OSDictionary* getPropertyTable() const { return mProperties; }
+
+    // simulator only: build the tree (entries are owned by their creator)
+    void attachToParent(IORegistryEntry* parent);
+    void setName(const char* name) { mName = name; }
+    const char* getName(const IORegistryPlane* plane = NULL) const { return mName.c_str(); }
+
+    IORegistryEntry* getParentEntry(const IORegistryPlane* plane) const { return mParent; }
+    IORegistryEntry* getChildEntry(const IORegistryPlane* plane) const { return mChildren.empty() ? NULL : mChildren[0]; }
+    bool getPath(char* path, int* length, const IORegistryPlane* plane) const;
+};
+
+class IOService : public IORegistryEntry
+{
+};
+
+// Memory descriptors
+
+class IOMemoryMap : public OSObject
+{
+    IOVirtualAddress mAddress;
+    IOByteCount mLength;
+public:
+    IOMemoryMap(IOVirtualAddress address, IOByteCount length) : mAddress(address), mLength(length) {}
+    IOVirtualAddress getVirtualAddress() const { return mAddress; }
+    IOByteCount getLength() const { return mLength; }
+};
+
+class IOMemoryDescriptor : public OSObject
+{
+public:
+    virtual IOPhysicalAddress getPhysicalAddress() = 0;
+    virtual IOByteCount getLength() const = 0;
+    virtual IOReturn prepare() { return kIOReturnSuccess; }
+    virtual IOReturn complete() { return kIOReturnSuccess; }
+};
+
+// Device memory is the simulated register file; its "physical" address is its host address
+class IODeviceMemory : public IOMemoryDescriptor
+{
+    void* mAddress;
+    IOByteCount mLength;
+public:
+    IODeviceMemory(void* address, IOByteCount length) : mAddress(address), mLength(length) {}
+    IOPhysicalAddress getPhysicalAddress() { return (IOPhysicalAddress)(uintptr_t)mAddress; }
+    IOByteCount getLength() const { return mLength; }
+    IOMemoryMap* map() { return new IOMemoryMap((IOVirtualAddress)mAddress, mLength); }
+};
+
+// DMA memory is host memory; the simulated controller dereferences its "physical" address directly
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+    void* mBuffer = NULL;
+    IOByteCount mLength = 0;
+public:
+    ~IOBufferMemoryDescriptor() { free(mBuffer); }
+    static IOBufferMemoryDescriptor* inTaskWithPhysicalMask(task_t task, IOOptionBits options, mach_vm_address_t capacity, mach_vm_address_t physicalMask);
+    void* getBytesNoCopy() { return mBuffer; }
+    IOPhysicalAddress getPhysicalAddress() { return (IOPhysicalAddress)(uintptr_t)mBuffer; }
+    IOByteCount getLength() const { return mLength; }
+};
+
+// PCI device: config space is a plain byte array, BAR0 is supplied by the simulator
+
+class IOPCIDevice : public IOService
+{
+    UInt8 mConfigSpace[256];
+    IODeviceMemory* mDeviceMemory = NULL;
+public:
+    IOPCIDevice() { memset(mConfigSpace, 0, sizeof(mConfigSpace)); }
+    ~IOPCIDevice() { OSSafeRelease(mDeviceMemory); }
+
+    // simulator only
+    void setDeviceMemory(IODeviceMemory* memory) { OSSafeRelease(mDeviceMemory); mDeviceMemory = memory; }
+
+    unsigned getDeviceMemoryCount() const { return mDeviceMemory ? 1 : 0; }
+    IODeviceMemory* getDeviceMemoryWithIndex(unsigned index) const { return index == 0 ? mDeviceMemory : NULL; }
+    bool setMemoryEnable(bool enable) { return true; }
+
+    UInt8 configRead8(UInt8 offset) const { return mConfigSpace[offset]; }
+    UInt16 configRead16(UInt8 offset) const { UInt16 value; memcpy(&value, &mConfigSpace[offset & 0xFE], sizeof(value)); return value; }
+    UInt32 configRead32(UInt8 offset) const { UInt32 value; memcpy(&value, &mConfigSpace[offset & 0xFC], sizeof(value)); return value; }
+    void configWrite8(UInt8 offset, UInt8 value) { mConfigSpace[offset] = value; }
+    void configWrite16(UInt8 offset, UInt16 value) { memcpy(&mConfigSpace[offset & 0xFE], &value, sizeof(value)); }
+    void configWrite32(UInt8 offset, UInt32 value) { memcpy(&mConfigSpace[offset & 0xFC], &value, sizeof(value)); }
+};
+
+// ACPI: the simulator has no namespace, so RMCF overrides are never found
+
+class IOACPIPlatformDevice : public IOService
+{
+public:
+    static IORegistryEntry* fromPath(const char* path) { return NULL; }
+    IOReturn evaluateObject(const char* name, OSObject** result) { return kIOReturnUnsupported; }
+};
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Plist.h"
+
+// Minimal recursive descent parser for the XML plist subset used by kext
+// Info.plist files: dict, array, key, string, integer, data, true and false.
+
+class PlistParser
+{
+    const char* mText;
+    const char* mEnd;
+
+    void skipSpace()
+    {
+        for (;;)
+        {
+            while (mText < mEnd && strchr(" \t\r\n", *mText))
+                mText++;
+            // skip prolog, doctype and comments
+            if (mEnd - mText >= 4 && !strncmp(mText, "<!--", 4))
+            {
+                const char* end = strstr(mText, "-->");
+                mText = end ? end + 3 : mEnd;
+            }
+            else if (mEnd - mText >= 2 && (!strncmp(mText, "<?", 2) || !strncmp(mText, "<!", 2)))
+            {
+                const char* end = strchr(mText, '>');
+                mText = end ? end + 1 : mEnd;
+            }
+            else
+                break;
+        }
+    }
+
+    // reads "<name>", "<name/>" or "</name>"; returns false at end of input
+    bool readTag(std::string& name, bool& closing, bool& empty)
+    {
+        skipSpace();
+        if (mText >= mEnd || *mText != '<')
+            return false;
+        const char* end = strchr(mText, '>');
+        if (!end)
+            return false;
+        const char* start = mText + 1;
+        closing = *start == '/';
+        if (closing)
+            start++;
+        empty = end[-1] == '/';
+        const char* nameEnd = start;
+        while (nameEnd < end && !strchr(" /\t", *nameEnd))
+            nameEnd++;
+        name.assign(start, nameEnd);
+        mText = end + 1;
+        return true;
+    }
+
+    // reads element text up to "</name>" and decodes the predefined entities
+    bool readText(const char* name, std::string& text)
+    {
+        std::string close = std::string("</") + name + ">";
+        const char* end = strstr(mText, close.c_str());
+        if (!end)
+            return false;
+        text.clear();
+        for (const char* p = mText; p < end; p++)
+        {
+            if (*p == '&')
+            {
+                static const struct { const char* entity; char ch; } entities[] =
+                    { { "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' } };
+                bool found = false;
+                for (unsigned i = 0; i < sizeof(entities)/sizeof(entities[0]); i++)
+                {
+                    size_t len = strlen(entities[i].entity);
+                    if (!strncmp(p, entities[i].entity, len))
+                    {
+                        text += entities[i].ch;
+                        p += len - 1;
+                        found = true;
+                        break;
+                    }
+                }
+                if (found)
+                    continue;
+            }
+            text += *p;
+        }
+        mText = end + close.length();
+        return true;
+    }
+
+    static OSData* decodeBase64(const std::string& text)
+    {
+        OSData* result = OSData::withCapacity((unsigned)text.length() * 3 / 4);
+        UInt32 accum = 0;
+        int bits = 0;
+        for (size_t i = 0; i < text.length(); i++)
+        {
+            char c = text[i];
+            int value;
+            if (c >= 'A' && c <= 'Z') value = c - 'A';
+            else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+            else if (c >= '0' && c <= '9') value = c - '0' + 52;
+            else if (c == '+') value = 62;
+            else if (c == '/') value = 63;
+            else continue;  // whitespace and padding
+            accum = accum << 6 | value;
+            bits += 6;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                result->appendByte((UInt8)(accum >> bits), 1);
+            }
+        }
+        return result;
+    }
+
+    OSObject* parseValue(const std::string& name, bool empty)
+    {
+        if (name == "dict")
+        {
+            OSDictionary* dict = OSDictionary::withCapacity(8);
+            if (empty)
+                return dict;
+            std::string tag, key;
+            bool closing, isEmpty;
+            while (readTag(tag, closing, isEmpty))
+            {
+                if (closing && tag == "dict")
+                    return dict;
+                if (tag != "key" || !readText("key", key) || !readTag(tag, closing, isEmpty) || closing)
+                    break;
+                OSObject* value = parseValue(tag, isEmpty);
+                if (!value)
+                    break;
+                dict->setObject(key.c_str(), value);
+                value->release();
+            }
+            dict->release();
+            return NULL;
+        }
+        if (name == "array")
+        {
+            OSArray* array = OSArray::withCapacity(4);
+            if (empty)
+                return array;
+            std::string tag;
+            bool closing, isEmpty;
+            while (readTag(tag, closing, isEmpty))
+            {
+                if (closing && tag == "array")
+                    return array;
+                OSObject* value = closing ? NULL : parseValue(tag, isEmpty);
+                if (!value)
+                    break;
+                array->setObject(value);
+                value->release();
+            }
+            array->release();
+            return NULL;
+        }
+        if (name == "true" || name == "false")
+            return OSBoolean::withBoolean(name == "true");
+
+        std::string text;
+        if (!empty && !readText(name.c_str(), text))
+            return NULL;
+        if (name == "string")
+            return OSString::withCString(text.c_str());
+        if (name == "integer")
+            return OSNumber::withNumber(strtoll(text.c_str(), NULL, 0), 64);
+        if (name == "data")
+            return decodeBase64(text);
+        if (name == "real" || name == "date")
+            return OSString::withCString(text.c_str());
+        return NULL;
+    }
+
+public:
+    PlistParser(const char* text, size_t length) : mText(text), mEnd(text + length) {}
+
+    OSObject* parse()
+    {
+        std::string tag;
+        bool closing, empty;
+        if (!readTag(tag, closing, empty) || tag != "plist" || closing)
+            return NULL;
+        if (!readTag(tag, closing, empty) || closing)
+            return NULL;
+        return parseValue(tag, empty);
+    }
+};
+
+OSObject* loadPlist(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    std::string text;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        text.append(buffer, length);
+    fclose(file);
+
+    PlistParser parser(text.c_str(), text.length());
+    return parser.parse();
+}
+
+OSObject* getPlistObject(OSObject* root, const char* path)
+{
+    std::string remaining = path;
+    OSObject* result = root;
+    while (result && !remaining.empty())
+    {
+        size_t slash = remaining.find('/');
+        std::string key = remaining.substr(0, slash);
+        remaining = slash == std::string::npos ? "" : remaining.substr(slash + 1);
+        OSDictionary* dict = OSDynamicCast(OSDictionary, result);
+        result = dict ? dict->getObject(key.c_str()) : NULL;
+    }
+    return result;
+}
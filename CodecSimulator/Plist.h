@@ -0,0 +1,32 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecSimulator_Plist_h
+#define CodecSimulator_Plist_h
+
+#include "KernelShim.h"
+
+// Load an XML property list (as found in CodecCommander-Info.plist or an
+// RMCF-style override) into OS* containers. Returns NULL on parse error.
+OSObject* loadPlist(const char* path);
+
+// Follow a "/" separated path of dictionary keys, e.g. "IOKitPersonalities/CodecCommander/Codec Profile"
+OSObject* getPlistObject(OSObject* root, const char* path);
+
+#endif
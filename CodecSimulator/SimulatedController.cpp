@@ -0,0 +1,340 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "SimulatedController.h"
+
+#define kRegisterSize       0x4000      // BAR0 size of Intel HDA controllers
+#define kFrameTime          20833       // ns, one 48kHz link frame
+#define kImmediateTimeout   64          // frames without response before ICB is dropped
+
+SimulatedController::SimulatedController(UInt16 pciVendorId, UInt16 pciDeviceId, UInt32 pciSubsystemId)
+{
+    mRegMemory = NULL;
+    if (posix_memalign(&mRegMemory, 4096, kRegisterSize))
+        abort();
+    memset(mRegMemory, 0, kRegisterSize);
+    mRegs = (pHDA_REG)mRegMemory;
+
+    mPCIDevice = new IOPCIDevice;
+    mPCIDevice->setName("HDEF");
+    mPCIDevice->configWrite16(kIOPCIConfigVendorID, pciVendorId);
+    mPCIDevice->configWrite16(kIOPCIConfigDeviceID, pciDeviceId);
+    mPCIDevice->configWrite32(kIOPCIConfigSubSystemVendorID, pciSubsystemId);
+    mPCIDevice->setDeviceMemory(new IODeviceMemory(mRegMemory, kRegisterSize));
+
+    memset(mCodecDevices, 0, sizeof(mCodecDevices));
+    memset(mFunctions, 0, sizeof(mFunctions));
+    memset(mCodecs, 0, sizeof(mCodecs));
+
+    mRunning = false;
+    mFrameTime = kFrameTime;
+    mFrameCount = 0;
+    mImmediateCount = 0;
+    mCORBCount = 0;
+    mResetRequested = false;
+    mStallUntil = 0;
+
+    // HDA 1.0, 64-bit capable, 4 output/4 input streams, all ring sizes
+    mRegs->VMAJ = 1;
+    mRegs->VMIN = 0;
+    mRegs->GCAP_64OK = 1;
+    mRegs->GCAP_NSDO = 0;
+    mRegs->GCAP_ISS = 4;
+    mRegs->GCAP_OSS = 4;
+    mRegs->CORBSIZE = HDA_RINGSIZE_CAP_2 | HDA_RINGSIZE_CAP_16 | HDA_RINGSIZE_CAP_256;
+    mRegs->RIRBSIZE = HDA_RINGSIZE_CAP_2 | HDA_RINGSIZE_CAP_16 | HDA_RINGSIZE_CAP_256;
+
+    // controller comes up out of reset, as left by firmware
+    mRegs->GCTL = HDA_GCTL_CRST;
+    linkReset();
+}
+
+SimulatedController::~SimulatedController()
+{
+    stop();
+    for (int i = 0; i < HDA_MAX_CODECS; i++)
+    {
+        OSSafeRelease(mFunctions[i]);
+        OSSafeRelease(mCodecDevices[i]);
+    }
+    OSSafeRelease(mPCIDevice);
+    free(mRegMemory);
+}
+
+IOService* SimulatedController::attachCodec(UInt8 address, CodecModel* codec)
+{
+    if (address >= HDA_MAX_CODECS || mCodecs[address])
+        return NULL;
+
+    std::lock_guard<std::mutex> lock(mCodecLock);
+    mCodecs[address] = codec;
+    mRegs->STATESTS |= 1 << address;
+
+    // IOHDACodecDevice/IOHDACodecFunction as published by AppleHDAController
+    char name[32];
+    snprintf(name, sizeof(name), "IOHDACodecDevice@%d", address);
+    IOService* device = new IOService;
+    device->setName(name);
+    device->attachToParent(mPCIDevice);
+    device->setProperty(kCodecAddress, address, 32);
+    device->setProperty(kCodecVendorID, codec->getVendorId(), 32);
+    mCodecDevices[address] = device;
+
+    IOService* function = new IOService;
+    function->setName("IOHDACodecFunction@1");
+    function->attachToParent(device);
+    function->setProperty(kCodecFuncGroupType, HDA_TYPE_AFG, 32);
+    function->setProperty(kCodecSubsystemID, codec->getSubsystemId(), 32);
+    mFunctions[address] = function;
+
+    return function;
+}
+
+void SimulatedController::start()
+{
+    if (mRunning)
+        return;
+    mRunning = true;
+    mThread = std::thread(&SimulatedController::run, this);
+}
+
+void SimulatedController::stop()
+{
+    if (!mRunning)
+        return;
+    mRunning = false;
+    mThread.join();
+}
+
+void SimulatedController::postUnsolicited(UInt8 address, UInt32 response)
+{
+    std::lock_guard<std::mutex> lock(mUnsolicitedLock);
+    mUnsolicited.push_back(std::make_pair(address, response));
+}
+
+void SimulatedController::setPresence(UInt8 address, UInt8 nid, bool present)
+{
+    if (address >= HDA_MAX_CODECS || !mCodecs[address])
+        return;
+
+    UInt8 control;
+    {
+        std::lock_guard<std::mutex> lock(mCodecLock);
+        mCodecs[address]->setPresence(nid, present);
+        control = mCodecs[address]->getState(nid, HDA_VERB_SET_UNSOLICITED_ENABLE);
+    }
+    if (HDA_UNSOL_ENABLED(control))
+        postUnsolicited(address, (UInt32)HDA_UNSOL_ENABLE_TAG(control) << 26);
+}
+
+void SimulatedController::resetController()
+{
+    mResetRequested = true;
+    while (mResetRequested && mRunning)
+        IOSleep(1);
+}
+
+void SimulatedController::stallLink(UInt32 microseconds)
+{
+    mStallUntil = mach_absolute_time() + microseconds * 1000ULL;
+}
+
+void SimulatedController::run()
+{
+    UInt64 next;
+    clock_get_uptime(&next);
+    while (mRunning)
+    {
+        runFrame();
+        mFrameCount++;
+        if (!mFrameTime)
+            continue;
+
+        // pace frames by spinning, sleeping is far too coarse for 20us
+        next += mFrameTime;
+        UInt64 now;
+        clock_get_uptime(&now);
+        if (now > next + 100 * (UInt64)mFrameTime)
+            next = now;     // fell far behind (descheduled), don't try to catch up
+        while (now < next)
+            clock_get_uptime(&now);
+    }
+}
+
+void SimulatedController::linkReset()
+{
+    mInReset = false;
+    mCORBReadPointer = 0;
+    mRIRBWritePointer = 0;
+    mPendingSource = kNone;
+    mPendingValid = false;
+    mImmediateFrames = 0;
+    mRegs->CORBWP = 0;
+    mRegs->CORBRP = 0;
+    mRegs->CORBCTL = 0;
+    mRegs->RIRBWP = 0;
+    mRegs->RIRBCTL = 0;
+    mRegs->RIRBSTS = 0;
+    mRegs->ICS = 0;
+
+    std::lock_guard<std::mutex> lock(mCodecLock);
+    UInt16 present = 0;
+    for (int i = 0; i < HDA_MAX_CODECS; i++)
+    {
+        if (!mCodecs[i])
+            continue;
+        mCodecs[i]->reset();
+        present |= 1 << i;
+    }
+    mRegs->STATESTS |= present;
+}
+
+UInt16 SimulatedController::ringMask(UInt8 sizeRegister)
+{
+    switch (sizeRegister & 0x3)
+    {
+        case HDA_RINGSIZE_2: return 1;
+        case HDA_RINGSIZE_16: return 15;
+        default: return 255;
+    }
+}
+
+void SimulatedController::writeRIRB(UInt32 response, UInt32 responseEx)
+{
+    UInt16 mask = ringMask(mRegs->RIRBSIZE);
+    volatile UInt32* rirb = (volatile UInt32*)(uintptr_t)((UInt64)mRegs->RIRBUBASE << 32 | mRegs->RIRBLBASE);
+    mRIRBWritePointer = (mRIRBWritePointer + 1) & mask;
+    rirb[mRIRBWritePointer * 2] = response;
+    rirb[mRIRBWritePointer * 2 + 1] = responseEx;
+    OSSynchronizeIO();
+    mRegs->RIRBWP = mRIRBWritePointer;
+    mRegs->RIRBSTS |= HDA_RIRBSTS_RINTFL;
+}
+
+void SimulatedController::sendCommand(UInt32 command, int source)
+{
+    UInt8 address = command >> 28;
+    UInt64 now;
+    clock_get_uptime(&now);
+
+    mPendingSource = (source == kImmediate) ? kImmediate : kCORB;
+    mPendingCodec = address;
+    mPendingValid = false;
+
+    // nobody answers on an SDI line without a codec
+    std::lock_guard<std::mutex> lock(mCodecLock);
+    if (address < HDA_MAX_CODECS && mCodecs[address])
+        mPendingValid = mCodecs[address]->execute(command & 0x0FFFFFFF, now, &mPendingResponse);
+}
+
+void SimulatedController::runFrame()
+{
+    // GCTL CRST low holds the link in reset, rising edge re-enumerates codecs
+    if (!(mRegs->GCTL & HDA_GCTL_CRST))
+    {
+        mInReset = true;
+        return;
+    }
+    if (mInReset)
+        linkReset();
+    if (mResetRequested)
+    {
+        // everything but GCTL CRST reads back as its power on default
+        mRegs->GCTL &= ~HDA_GCTL_UNSOL;
+        mRegs->CORBLBASE = mRegs->CORBUBASE = 0;
+        mRegs->RIRBLBASE = mRegs->RIRBUBASE = 0;
+        linkReset();
+        mResetRequested = false;
+        return;
+    }
+
+    // pointer resets requested by the driver
+    if (mRegs->CORBRP & HDA_CORBRP_RST)
+        mCORBReadPointer = 0;   // bit reads back set until the driver clears it
+    if (mRegs->RIRBWP & HDA_RIRBWP_RST)
+    {
+        mRIRBWritePointer = 0;
+        mRegs->RIRBWP = 0;
+    }
+
+    // response to last frame's command
+    if (mPendingSource == kCORB)
+    {
+        if (mPendingValid && (mRegs->RIRBCTL & HDA_RIRBCTL_DMAEN))
+            writeRIRB(mPendingResponse, mPendingCodec);
+        mPendingSource = kNone;
+    }
+    else if (mPendingSource == kImmediate)
+    {
+        if (!(mRegs->ICS & 0x1))
+        {
+            // driver gave up on the command
+            mPendingSource = kNone;
+        }
+        else if (mPendingValid)
+        {
+            mRegs->IRR = mPendingResponse;
+            OSSynchronizeIO();
+            mRegs->ICS = 0x2 | (mPendingCodec & 0xF) << 4;
+            mPendingSource = kNone;
+        }
+        else if (++mImmediateFrames >= kImmediateTimeout)
+        {
+            mRegs->ICS = 0;
+            mPendingSource = kNone;
+        }
+    }
+    else if (mRegs->GCTL & HDA_GCTL_UNSOL)
+    {
+        // unsolicited responses use frames without a solicited response
+        std::lock_guard<std::mutex> lock(mUnsolicitedLock);
+        if (!mUnsolicited.empty() && (mRegs->RIRBCTL & HDA_RIRBCTL_DMAEN))
+        {
+            writeRIRB(mUnsolicited.front().second, mUnsolicited.front().first | 1<<4);
+            mUnsolicited.pop_front();
+        }
+    }
+    if (mPendingSource != kNone)
+        return;
+    if (mStallUntil && mach_absolute_time() < mStallUntil)
+        return;
+
+    // at most one command per frame, CORB has priority over the immediate interface
+    if ((mRegs->CORBCTL & HDA_CORBCTL_RUN) && !(mRegs->CORBRP & HDA_CORBRP_RST))
+    {
+        UInt16 mask = ringMask(mRegs->CORBSIZE);
+        if (mCORBReadPointer != (mRegs->CORBWP & mask))
+        {
+            volatile UInt32* corb = (volatile UInt32*)(uintptr_t)((UInt64)mRegs->CORBUBASE << 32 | mRegs->CORBLBASE);
+            mCORBReadPointer = (mCORBReadPointer + 1) & mask;
+            OSSynchronizeIO();
+            UInt32 command = corb[mCORBReadPointer];
+            mRegs->CORBRP = mCORBReadPointer;
+            mCORBCount++;
+            sendCommand(command, kCORB);
+            return;
+        }
+    }
+    if (mRegs->ICS & 0x1)
+    {
+        mImmediateCount++;
+        mImmediateFrames = 0;
+        sendCommand(mRegs->ICW, kImmediate);
+    }
+}
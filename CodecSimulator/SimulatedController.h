@@ -0,0 +1,114 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecSimulator_SimulatedController_h
+#define CodecSimulator_SimulatedController_h
+
+#include "IntelHDA.h"
+#include "CodecModel.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Software Intel HDA controller. The register file is an HDA_REG block in
+// host memory, exposed as BAR0 of a fake IOPCIDevice, so IntelHDA maps and
+// drives it exactly as it would real hardware. A link thread runs one frame
+// per 20.83us: it sends at most one command (CORB first, else the immediate
+// command) to the attached CodecModels and returns the response in the next
+// frame, through the RIRB or IRR/ICS.
+//
+// Registers are plain memory, so write-1-to-clear bits (ICS IRV, RIRBSTS,
+// STATESTS) read back whatever the driver last wrote; the link thread only
+// owns the bits hardware would set.
+
+class SimulatedController
+{
+public:
+    SimulatedController(UInt16 pciVendorId = 0x8086, UInt16 pciDeviceId = 0x9c20, UInt32 pciSubsystemId = 0x221417aa);
+    ~SimulatedController();
+
+    // Attach a codec (not owned) at an SDI address and publish an IOHDACodecFunction for it
+    IOService* attachCodec(UInt8 address, CodecModel* codec);
+    IOService* getCodecFunction(UInt8 address) { return address < HDA_MAX_CODECS ? mFunctions[address] : NULL; }
+    IOPCIDevice* getPCIDevice() { return mPCIDevice; }
+
+    void start();
+    void stop();
+
+    // Queue an unsolicited response (delivered through the RIRB when GCTL UNSOL is set)
+    void postUnsolicited(UInt8 address, UInt32 response);
+
+    // Plug or unplug a jack, posting the pin's unsolicited response if it has them enabled
+    void setPresence(UInt8 address, UInt8 nid, bool present);
+
+    // Controller reset as across sleep/wake: ring registers cleared, codecs re-enumerated
+    void resetController();
+
+    // Send no commands for a while (codec busy), so outstanding ones are answered late
+    void stallLink(UInt32 microseconds);
+
+    // Time of one link frame (48kHz) in ns, 0 runs the link as fast as possible
+    void setFrameTime(UInt32 nanoseconds) { mFrameTime = nanoseconds; }
+
+    inline UInt64 getFrameCount() { return mFrameCount; }
+    inline UInt32 getImmediateCount() { return mImmediateCount; }
+    inline UInt32 getCORBCount() { return mCORBCount; }
+
+    // Serializes access to codec models between the link thread and verification code
+    std::mutex& getCodecLock() { return mCodecLock; }
+
+private:
+    pHDA_REG mRegs;
+    void* mRegMemory;
+    IOPCIDevice* mPCIDevice;
+    IOService* mCodecDevices[HDA_MAX_CODECS];
+    IOService* mFunctions[HDA_MAX_CODECS];
+    CodecModel* mCodecs[HDA_MAX_CODECS];
+
+    std::thread mThread;
+    volatile bool mRunning;
+    std::mutex mCodecLock;
+    UInt32 mFrameTime;
+    UInt64 mFrameCount;
+    UInt32 mImmediateCount;
+    UInt32 mCORBCount;
+
+    // link state
+    volatile bool mResetRequested;
+    volatile UInt64 mStallUntil;
+    bool mInReset;
+    UInt16 mCORBReadPointer;
+    UInt16 mRIRBWritePointer;
+    enum { kNone, kImmediate, kCORB } mPendingSource;
+    bool mPendingValid;
+    UInt8 mPendingCodec;
+    UInt32 mPendingResponse;
+    UInt32 mImmediateFrames;     // frames the immediate command has been outstanding
+    std::mutex mUnsolicitedLock;
+    std::deque<std::pair<UInt8, UInt32> > mUnsolicited;
+
+    void run();
+    void runFrame();
+    void linkReset();
+    void sendCommand(UInt32 command, int source);
+    void writeRIRB(UInt32 response, UInt32 responseEx);
+    UInt16 ringMask(UInt8 sizeRegister);
+};
+
+#endif
@@ -0,0 +1,1013 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+// hda-sim: runs the kext's IntelHDA and Configuration code against a
+// simulated controller and codec, to benchmark the PIO and DMA transports
+// and to check that profiles do to the codec what they claim to do.
+
+#include "SimulatedController.h"
+#include "CodecDump.h"
+#include "CodecManager.h"
+#include "Configuration.h"
+#include "Plist.h"
+#include "ProfileIndex.h"
+#include "VerbQueue.h"
+#include <getopt.h>
+#include <map>
+#include <thread>
+
+static int gFailures = 0;
+
+#define Check(cond, args...) do { if (!(cond)) { gFailures++; printf("FAIL: " args); } } while (0)
+
+static UInt64 getTimeMicroseconds()
+{
+    UInt64 now;
+    clock_get_uptime(&now);
+    return now / 1000;
+}
+
+static const char* modeName(HDACommandMode mode)
+{
+    return mode == DMA ? "DMA" : "PIO";
+}
+
+static void usage()
+{
+    printf("usage: hda-sim [options]\n"
+           "  -c path           codec dump (/proc/asound/card*/codec#*) to simulate, may be\n"
+           "                    repeated (default: built-in ALC283 at addresses 0 and 2)\n"
+           "  -m pio|dma|both   transport(s) to exercise (default: both)\n"
+           "  -n count          verbs per timed run (default: 1000)\n"
+           "  -p path           Info.plist with the Codec Profile to replay\n"
+           "                    (default: CodecCommander/CodecCommander-Info.plist)\n"
+           "  -f ns             link frame time, 0 for unpaced (default: 20833)\n");
+}
+
+// EAPD capable pins according to the model, the answer the kext must find
+static std::vector<UInt8> modelEAPDNodes(CodecModel* codec)
+{
+    std::vector<UInt8> result;
+    for (int nid = 0; nid < CODEC_MAX_NODES; nid++)
+    {
+        CodecModel::Node* node = codec->getNode(nid);
+        if (node && HDA_WIDGET_TYPE(node->params[HDA_PARM_AUDIOCAP]) == HDA_WIDGET_TYPE_PIN &&
+            HDA_PINCAP_IS_EAPD_CAPABLE(node->params[HDA_PARM_PINCAP]))
+            result.push_back(nid);
+    }
+    return result;
+}
+
+// EAPD capable pins as found by CodecCommander::start
+static std::vector<UInt8> scanEAPDNodes(IntelHDA* intelHDA)
+{
+    std::vector<UInt8> result;
+    if (!intelHDA->enumerateTopology())
+        return result;
+    UInt8 start = intelHDA->getStartingNode();
+    UInt8 end = start + intelHDA->getTotalNodes();
+    for (UInt8 node = start; node < end; node++)
+    {
+        if (HDA_WIDGET_TYPE(intelHDA->getWidgetCaps(node)) == HDA_WIDGET_TYPE_PIN &&
+            HDA_PINCAP_IS_EAPD_CAPABLE(intelHDA->getPinCaps(node)))
+            result.push_back(node);
+    }
+    return result;
+}
+
+static void printLatency(IntelHDA* intelHDA)
+{
+    const HDALatencyStats& stats = intelHDA->getLatencyStats();
+    if (!stats.count)
+        return;
+    printf("  PIO latency: %u verbs, %u timeouts, min %u us, median %u us, max %u us, expected %u us\n",
+           stats.count, stats.timeouts, stats.min, intelHDA->getLatencyMedian(), stats.max, intelHDA->getExpectedLatency());
+}
+
+// Waits up to 100ms for unsolicited responses to arrive through the RIRB
+static UInt32 waitForUnsolicited(IntelHDA* intelHDA, UInt32* responses, UInt32 max)
+{
+    UInt32 count = 0;
+    for (int i = 0; i < 100 && !count; i++)
+    {
+        count = intelHDA->getUnsolicited(responses, max);
+        if (!count)
+            IOSleep(1);
+    }
+    return count;
+}
+
+// Enables jack events on the first presence detect pin and checks they arrive
+// with their tag, both when the RIRB is idle and while a batch is in flight.
+static void unsolicited(SimulatedController* controller, IntelHDA* intelHDA, UInt8 address)
+{
+    const UInt8 tag = 5;
+    UInt8 pin = 0;
+    UInt16 start = intelHDA->getStartingNode();
+    for (UInt16 node = start; node < start + intelHDA->getTotalNodes() && !pin; node++)
+        if (HDA_WIDGET_TYPE(intelHDA->getWidgetCaps(node)) == HDA_WIDGET_TYPE_PIN && (intelHDA->getPinCaps(node) & (1<<2)))
+            pin = node;
+    if (!pin)
+    {
+        printf("  unsolicited: no presence detect pin\n");
+        return;
+    }
+
+    Check(intelHDA->enableUnsolicited(true), "enableUnsolicited\n");
+    intelHDA->sendCommand(pin, HDA_VERB_SET_UNSOLICITED_ENABLE, (UInt8)(0x80 | tag));
+    bool present = HDA_PIN_SENSE_PRESENCE(intelHDA->sendCommand(pin, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL));
+
+    // idle RIRB
+    UInt32 responses[4];
+    UInt64 begin = getTimeMicroseconds();
+    controller->setPresence(address, pin, !present);
+    UInt32 count = waitForUnsolicited(intelHDA, responses, arrsize(responses));
+    UInt64 latency = getTimeMicroseconds() - begin;
+    Check(count == 1 && HDA_UNSOL_TAG(responses[0]) == tag, "%u unsolicited responses, first 0x%08x\n", count, count ? responses[0] : 0);
+    UInt32 sense = intelHDA->sendCommand(pin, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+    Check(!HDA_PIN_SENSE_PRESENCE(sense) == present, "pin sense 0x%08x after jack event\n", sense);
+
+    // queued while executeDMA owns the RIRB
+    UInt32 commands[32];
+    for (unsigned i = 0; i < arrsize(commands); i++)
+        commands[i] = HDA_COMMAND_12(pin, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+    controller->setPresence(address, pin, present);
+    Check(intelHDA->sendCommands(commands, NULL, arrsize(commands)) == arrsize(commands), "sendCommands with jack event\n");
+    count = waitForUnsolicited(intelHDA, responses, arrsize(responses));
+    Check(count == 1 && HDA_UNSOL_TAG(responses[0]) == tag, "%u unsolicited responses during batch\n", count);
+
+    intelHDA->sendCommand(pin, HDA_VERB_SET_UNSOLICITED_ENABLE, HDA_PARM_NULL);
+    Check(intelHDA->enableUnsolicited(false), "disableUnsolicited\n");
+    printf("  unsolicited: jack events on node 0x%02x, %u received, first after %llu us\n", pin, intelHDA->getUnsolicitedReceived(), (unsigned long long)latency);
+}
+
+// Stalls the link so a batch times out and is answered late, then resets the
+// controller under the transport; neither may hand a command someone else's response.
+static void dmaRecovery(SimulatedController* controller, CodecModel* codec, IntelHDA* intelHDA)
+{
+    UInt32 subsystemId = codec->getSubsystemId();
+    UInt32 commands[8], responses[8];
+    for (unsigned i = 0; i < arrsize(commands); i++)
+        commands[i] = HDA_COMMAND_12(codec->getAFG(), HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+    controller->stallLink(5000);
+    UInt32 succeeded = intelHDA->sendCommands(commands, responses, arrsize(commands));
+    Check(succeeded < arrsize(commands), "sendCommands completed %u commands on a stalled link\n", succeeded);
+    IOSleep(10);
+    UInt32 response = intelHDA->sendCommand(codec->getAFG(), HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL);
+    Check(response == subsystemId, "subsystem id 0x%08x after late responses\n", response);
+
+    UInt32 corbCount = controller->getCORBCount();
+    controller->resetController();
+    response = intelHDA->sendCommand(codec->getAFG(), HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL);
+    Check(response == subsystemId, "subsystem id 0x%08x after controller reset\n", response);
+    Check(controller->getCORBCount() > corbCount, "command after controller reset did not go through the CORB\n");
+    printf("  recovery: %u of %u commands before link stall, rings reprogrammed after controller reset\n",
+           succeeded, (unsigned)arrsize(commands));
+}
+
+static void benchmark(SimulatedController* controller, CodecModel* codec, UInt8 address, HDACommandMode mode, unsigned count)
+{
+    printf("%s transport (codec 0x%08x at address %d)\n", modeName(mode), codec->getVendorId(), address);
+
+    IntelHDA intelHDA(controller->getCodecFunction(address), mode);
+    Check(intelHDA.initialize(), "IntelHDA::initialize\n");
+    Check(intelHDA.getCommandMode() == mode, "command mode is %s\n", modeName(intelHDA.getCommandMode()));
+    Check(intelHDA.getCodecVendorId() == codec->getVendorId(), "vendor id 0x%08x\n", intelHDA.getCodecVendorId());
+    Check(intelHDA.getSubsystemId() == codec->getSubsystemId(), "subsystem id 0x%08x\n", intelHDA.getSubsystemId());
+
+    // power state is settled, so actual (bits 7:4) matches the setting (bits 3:0), PS-SettingsReset aside
+    UInt8 afg = codec->getAFG();
+    UInt32 powerState = codec->getState(afg, HDA_VERB_SET_PSTATE) * 0x11;
+    UInt64 start = getTimeMicroseconds();
+    for (unsigned i = 0; i < count; i++)
+    {
+        UInt32 response = intelHDA.sendCommand(afg, HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+        Check((response & 0xFF) == powerState, "GET_PSTATE returned 0x%08x\n", response);
+    }
+    UInt64 single = getTimeMicroseconds() - start;
+
+    std::vector<UInt32> commands(count, HDA_COMMAND_12(afg, HDA_VERB_GET_PSTATE, HDA_PARM_NULL));
+    std::vector<UInt32> responses(count);
+    start = getTimeMicroseconds();
+    UInt32 succeeded = intelHDA.sendCommands(&commands[0], &responses[0], count);
+    UInt64 batch = getTimeMicroseconds() - start;
+    Check(succeeded == count, "sendCommands completed %u of %u\n", succeeded, count);
+    for (unsigned i = 0; i < count; i++)
+        Check((responses[i] & 0xFF) == powerState, "sendCommands response %u is 0x%08x\n", i, responses[i]);
+
+    printf("  %u verbs: sendCommand %llu us (%.1f us/verb), sendCommands %llu us (%.1f us/verb)\n", count,
+           (unsigned long long)single, (double)single / count, (unsigned long long)batch, (double)batch / count);
+
+    start = getTimeMicroseconds();
+    std::vector<UInt8> eapd = scanEAPDNodes(&intelHDA);
+    UInt64 scan = getTimeMicroseconds() - start;
+    Check(eapd == modelEAPDNodes(codec), "EAPD scan found %u nodes\n", (unsigned)eapd.size());
+    printf("  topology: %u nodes, %u connections, %u EAPD pins, %llu us\n",
+           intelHDA.getTopology().nodeCount, intelHDA.getTopology().connectionCount, (unsigned)eapd.size(), (unsigned long long)scan);
+
+    if (mode == DMA)
+    {
+        unsolicited(controller, &intelHDA, address);
+        dmaRecovery(controller, codec, &intelHDA);
+    }
+
+    start = getTimeMicroseconds();
+    Check(intelHDA.resetCodec(), "resetCodec\n");
+    UInt64 reset = getTimeMicroseconds() - start;
+    Check(intelHDA.getVendorId() == codec->getVendorId() >> 16, "vendor id after reset\n");
+    // the model takes 5ms to reach D0, the reset must wait for that but not much longer
+    const HDAResetStats& resetStats = intelHDA.getResetStats();
+    Check(resetStats.lastReady >= 5000 && !resetStats.timeouts, "reset ready after %u us\n", resetStats.lastReady);
+    printf("  resetCodec: %llu us (ready after %u us)\n", (unsigned long long)reset, resetStats.lastReady);
+
+    // without PS-SettingsReset the power state alone is not trusted before 10ms
+    codec->setReportsSettingsReset(false);
+    Check(intelHDA.resetCodec(), "resetCodec without PS-SettingsReset\n");
+    Check(resetStats.lastReady >= 10000 && !resetStats.timeouts, "reset without PS-SettingsReset ready after %u us\n", resetStats.lastReady);
+    codec->setReportsSettingsReset(true);
+
+    printLatency(&intelHDA);
+}
+
+// Replays CodecCommander's custom command handling for one state and checks
+// that every SET verb sent left the codec in the state it asked for, and that
+// the program compiled by Configuration holds the same commands.
+static void replay(SimulatedController* controller, CodecModel* codec, IntelHDA* intelHDA, Configuration* config,
+                   CodecCommanderState state, const char* stateName, bool (*selected)(const CustomCommand*))
+{
+    std::map<UInt32, UInt8> expected;   // (nid << 12 | verb) -> payload, last write wins
+    std::vector<UInt32> program;
+    unsigned commandCount = 0;
+    UInt64 elapsed = 0;
+
+    OSArray* commands = config->getCustomCommands();
+    UInt32 layoutID = intelHDA->getLayoutID();
+    for (unsigned i = 0; commands && i < commands->getCount(); i++)
+    {
+        CustomCommand* customCommand = (CustomCommand*)((OSData*)commands->getObject(i))->getBytesNoCopy();
+        if (!selected(customCommand) || ((UInt32)-1 != customCommand->layoutID && layoutID != customCommand->layoutID))
+            continue;
+
+        UInt64 start = getTimeMicroseconds();
+        UInt32 sent = intelHDA->sendCommands(customCommand->Commands, NULL, customCommand->CommandCount);
+        elapsed += getTimeMicroseconds() - start;
+        Check(sent == customCommand->CommandCount, "%s: %u of %u commands sent\n", stateName, sent, customCommand->CommandCount);
+        commandCount += customCommand->CommandCount;
+
+        for (UInt32 j = 0; j < customCommand->CommandCount; j++)
+        {
+            UInt32 command = customCommand->Commands[j];
+            program.push_back((UInt32)intelHDA->getCodecAddress() << 28 | (command & 0x0FFFFFFF));
+            UInt16 verb = (command >> 8) & 0xFFF;
+            if ((verb & 0xF00) != 0x700 || verb == HDA_VERB_RESET)
+                continue;   // only 12-bit SET verbs have state to verify
+            expected[(command >> 20 & 0xFF) << 12 | verb] = command & 0xFF;
+        }
+    }
+
+    const CustomProgram& compiled = config->getCustomProgram(state);
+    Check(compiled.CommandCount == program.size() &&
+          (program.empty() || !memcmp(compiled.Commands, &program[0], program.size() * sizeof(UInt32))),
+          "%s: compiled program has %u commands, expected %u\n", stateName, compiled.CommandCount, (unsigned)program.size());
+
+    std::lock_guard<std::mutex> lock(controller->getCodecLock());
+    for (std::map<UInt32, UInt8>::const_iterator it = expected.begin(); it != expected.end(); ++it)
+    {
+        UInt8 nid = it->first >> 12;
+        UInt16 verb = it->first & 0xFFF;
+        UInt8 actual;
+        if (verb >= HDA_VERB_SET_CONFIG_DEFAULT_BYTES_0 && verb <= HDA_VERB_SET_CONFIG_DEFAULT_BYTES_3)
+            actual = codec->getConfigDefault(nid) >> ((verb - HDA_VERB_SET_CONFIG_DEFAULT_BYTES_0) * 8);
+        else
+            actual = codec->getState(nid, verb);
+        Check(actual == it->second, "%s: node 0x%02x verb 0x%03x is 0x%02x, expected 0x%02x\n", stateName, nid, verb, actual, it->second);
+    }
+    printf("  %s: %u custom commands in %llu us, %u verified\n", stateName, commandCount, (unsigned long long)elapsed, (unsigned)expected.size());
+}
+
+static bool onInit(const CustomCommand* command) { return command->OnInit; }
+static bool onSleep(const CustomCommand* command) { return command->OnSleep; }
+static bool onWake(const CustomCommand* command) { return command->OnWake; }
+
+// Same batching as CodecCommander::setEAPD
+static void setEAPD(SimulatedController* controller, CodecModel* codec, IntelHDA* intelHDA, const std::vector<UInt8>& nodes, UInt8 logicLevel)
+{
+    std::vector<UInt32> commands;
+    for (size_t i = 0; i < nodes.size(); i++)
+        commands.push_back(HDA_COMMAND_12(nodes[i], HDA_VERB_EAPDBTL_SET, logicLevel));
+    if (!commands.empty())
+        Check(intelHDA->sendCommands(&commands[0], NULL, (UInt32)commands.size()) == commands.size(), "setEAPD\n");
+
+    std::lock_guard<std::mutex> lock(controller->getCodecLock());
+    for (size_t i = 0; i < nodes.size(); i++)
+        Check(codec->getState(nodes[i], HDA_VERB_EAPDBTL_SET) == logicLevel, "EAPD of node 0x%02x\n", nodes[i]);
+}
+
+static void replayProfile(SimulatedController* controller, CodecModel* codec, UInt8 address, const char* path)
+{
+    OSObject* plist = loadPlist(path);
+    Check(plist, "unable to load %s\n", path);
+    OSObject* profile = getPlistObject(plist, "IOKitPersonalities/" kCodecCommanderKey "/" kCodecProfile);
+    Check(profile, "no %s in %s\n", kCodecProfile, path);
+    if (!profile)
+    {
+        OSSafeRelease(plist);
+        return;
+    }
+
+    printf("Profile replay (%s, codec address %d)\n", path, address);
+    IntelHDA intelHDA(controller->getCodecFunction(address), PIO);
+    Check(intelHDA.initialize(), "IntelHDA::initialize\n");
+
+    Configuration* config = new Configuration(profile, &intelHDA, kCodecCommanderKey);
+    if (config->getDisable())
+    {
+        printf("  profile disables CodecCommander for codec 0x%08x\n", intelHDA.getCodecVendorId());
+        delete config;
+        OSSafeRelease(plist);
+        return;
+    }
+    if (config->getCommandMode() != intelHDA.getCommandMode())
+        intelHDA.setCommandMode(config->getCommandMode());
+    printf("  codec 0x%08x, %s transport, %u custom commands\n", intelHDA.getCodecVendorId(),
+           modeName(intelHDA.getCommandMode()), config->getCustomCommands()->getCount());
+
+    std::vector<UInt8> eapd;
+    if (config->getUpdateNodes())
+    {
+        UInt64 start = getTimeMicroseconds();
+        eapd = scanEAPDNodes(&intelHDA);
+        UInt64 scan = getTimeMicroseconds() - start;
+        Check(eapd == modelEAPDNodes(codec), "EAPD scan found %u nodes\n", (unsigned)eapd.size());
+        printf("  EAPD scan: %u nodes in %llu us\n", (unsigned)eapd.size(), (unsigned long long)scan);
+    }
+
+    // start, sleep and wake as CodecCommander sequences them
+    replay(controller, codec, &intelHDA, config, kStateInit, "init", onInit);
+    if (config->getUpdateNodes())
+        setEAPD(controller, codec, &intelHDA, eapd, 0x02);
+    if (config->getSleepNodes())
+        setEAPD(controller, codec, &intelHDA, eapd, 0x00);
+    replay(controller, codec, &intelHDA, config, kStateSleep, "sleep", onSleep);
+    if (config->getPerformReset())
+        Check(intelHDA.resetCodec(), "resetCodec on wake\n");
+    replay(controller, codec, &intelHDA, config, kStateWake, "wake", onWake);
+    if (config->getUpdateNodes())
+        setEAPD(controller, codec, &intelHDA, eapd, 0x02);
+
+    delete config;
+    OSSafeRelease(plist);
+}
+
+static UInt32 codecCommands(SimulatedController* controller, CodecModel* codec)
+{
+    std::lock_guard<std::mutex> lock(controller->getCodecLock());
+    return codec->getCommandCount();
+}
+
+// Sends a wake program (EAPD and pin control of the EAPD pins) repeatedly and
+// checks which writes reach the codec in each shadow mode, including after
+// another driver changed a value and after a reset it did not tell us about.
+static void shadow(SimulatedController* controller, CodecModel* codec, UInt8 address)
+{
+    printf("Shadow registers (codec address %d)\n", address);
+    IntelHDA intelHDA(controller->getCodecFunction(address), PIO);
+    IntelHDA other(controller->getCodecFunction(address), PIO);
+    Check(intelHDA.initialize() && other.initialize(), "IntelHDA::initialize\n");
+
+    std::vector<UInt8> eapd = scanEAPDNodes(&intelHDA);
+    std::vector<UInt32> program;
+    for (size_t i = 0; i < eapd.size(); i++)
+    {
+        program.push_back(HDA_COMMAND_12(eapd[i], 0x707, 0x40));
+        program.push_back(HDA_COMMAND_12(eapd[i], HDA_VERB_EAPDBTL_SET, 0x02));
+    }
+    if (program.empty())
+        return;
+    UInt32 size = (UInt32)program.size();
+
+    intelHDA.setShadowMode(ShadowTrust);
+    UInt32 before = codecCommands(controller, codec);
+    Check(intelHDA.sendCommands(&program[0], NULL, size) == size, "first send\n");
+    UInt32 first = codecCommands(controller, codec) - before;
+    before += first;
+    Check(intelHDA.sendCommands(&program[0], NULL, size) == size, "second send\n");
+    UInt32 second = codecCommands(controller, codec) - before;
+    Check(first == size && second == 0, "trust: %u then %u of %u writes sent\n", first, second, size);
+
+    // another driver clears EAPD behind our back: trusting misses it, verifying does not
+    other.sendCommand(eapd[0], HDA_VERB_EAPDBTL_SET, 0x00);
+    intelHDA.setShadowMode(ShadowVerify);
+    Check(intelHDA.sendCommands(&program[0], NULL, size) == size, "first verified send\n");
+    before = codecCommands(controller, codec);
+    Check(intelHDA.sendCommands(&program[0], NULL, size) == size, "verified send\n");
+    UInt32 verified = codecCommands(controller, codec) - before;
+    other.sendCommand(eapd[0], HDA_VERB_EAPDBTL_SET, 0x00);
+    Check(intelHDA.sendCommands(&program[0], NULL, size) == size, "verified send after change\n");
+    {
+        std::lock_guard<std::mutex> lock(controller->getCodecLock());
+        Check(codec->getState(eapd[0], HDA_VERB_EAPDBTL_SET) == 0x02, "verify mode did not restore EAPD\n");
+    }
+    const HDAShadowStats& stats = intelHDA.getShadowStats();
+    Check(verified == size && stats.mismatched == 1, "verify: %u verbs for %u writes, %u mismatched\n", verified, size, stats.mismatched);
+
+    // another driver resets the codec: PS-SettingsReset tells us the shadow is stale
+    intelHDA.setShadowMode(ShadowTrust);
+    Check(intelHDA.sendCommands(&program[0], NULL, size) == size, "trusted send\n");
+    Check(!intelHDA.checkSettingsReset(), "settings reset reported without a reset\n");
+    UInt8 afg = codec->getAFG();
+    other.sendCommand(afg, HDA_VERB_RESET, HDA_PARM_NULL);
+    other.sendCommand(afg, HDA_VERB_RESET, HDA_PARM_NULL);
+    IOSleep(10);
+    Check(intelHDA.checkSettingsReset(), "settings reset not detected\n");
+    before = codecCommands(controller, codec);
+    Check(intelHDA.sendCommands(&program[0], NULL, size) == size, "send after reset\n");
+    Check(codecCommands(controller, codec) - before == size, "writes after reset were skipped\n");
+    printf("  %u writes: trust sends %u then %u, verify %u verbs, %u skipped, %u verified, %u mismatched, %u invalidated\n",
+           size, first, second, verified, stats.skipped, stats.verified, stats.mismatched, stats.invalidated);
+}
+
+// Reads a different verb from each of two codecs on the controller from two
+// threads at once, as two CodecCommander instances waking together would, and
+// checks the controller lock kept every response with its command.
+static void contention(SimulatedController* controller, CodecModel* codecs[HDA_MAX_CODECS], unsigned count)
+{
+    UInt8 addresses[2];
+    unsigned found = 0;
+    for (int address = 0; address < HDA_MAX_CODECS && found < 2; address++)
+        if (codecs[address])
+            addresses[found++] = address;
+    if (found < 2)
+        return;
+
+    printf("Controller lock (codecs %d and %d from two threads)\n", addresses[0], addresses[1]);
+    IntelHDA* intelHDA[2];
+    for (int i = 0; i < 2; i++)
+    {
+        intelHDA[i] = new IntelHDA(controller->getCodecFunction(addresses[i]), PIO);
+        Check(intelHDA[i]->initialize(), "IntelHDA::initialize of codec %d\n", addresses[i]);
+    }
+    const HDAController* lock = intelHDA[0]->getController();
+    Check(lock && lock == intelHDA[1]->getController(), "codecs on one controller do not share its lock\n");
+    UInt32 acquired = lock ? lock->acquired : 0;
+
+    // different verbs on each thread, so a response handed to the wrong thread shows
+    UInt32 commands[2] = {
+        HDA_COMMAND_12(codecs[addresses[0]]->getAFG(), HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL),
+        HDA_COMMAND_12(codecs[addresses[1]]->getAFG(), HDA_VERB_GET_PSTATE, HDA_PARM_NULL)
+    };
+    UInt32 expected[2];
+    for (int i = 0; i < 2; i++)
+        expected[i] = intelHDA[i]->sendCommand(commands[i]);
+    Check(expected[0] != expected[1], "both threads expect 0x%08x\n", expected[0]);
+
+    // a timeout (the simulated controller starved of CPU) is not a mix up
+    unsigned errors[2] = {}, timeouts[2] = {};
+    UInt64 start = getTimeMicroseconds();
+    std::thread threads[2];
+    for (int i = 0; i < 2; i++)
+    {
+        threads[i] = std::thread([&, i]()
+        {
+            for (unsigned n = 0; n < count; n++)
+            {
+                UInt32 response = intelHDA[i]->sendCommand(commands[i]);
+                if (response == (UInt32)-1)
+                    timeouts[i]++;
+                else if (response != expected[i])
+                    errors[i]++;
+            }
+        });
+    }
+    for (int i = 0; i < 2; i++)
+        threads[i].join();
+    UInt64 elapsed = getTimeMicroseconds() - start;
+
+    Check(!errors[0] && !errors[1], "%u and %u wrong responses\n", errors[0], errors[1]);
+    if (lock)
+        printf("  %u verbs in %llu us (%u timed out), %u acquisitions, %u contended, max wait %u us\n",
+               2 * count, (unsigned long long)elapsed, timeouts[0] + timeouts[1], lock->acquired - acquired, lock->contended, lock->maxWait);
+    for (int i = 0; i < 2; i++)
+        delete intelHDA[i];
+}
+
+static UInt32 nestedAction(void* target, void* intelHDA, void* command, void*)
+{
+    return ((VerbQueue*)target)->sendCommand((IntelHDA*)intelHDA, (UInt32)(uintptr_t)command);
+}
+
+struct AsyncCheck
+{
+    UInt32 expected;
+    std::atomic<unsigned> completed;
+    std::atomic<unsigned> failed;
+};
+
+static void asyncDone(void* owner, void* refcon, UInt32 result)
+{
+    AsyncCheck* check = (AsyncCheck*)owner;
+    if (result != check->expected)
+        check->failed++;
+    check->completed++;
+}
+
+// Runs a user client dump (several threads sending verbs back to back) through
+// a VerbQueue while power management sends requests of its own, and checks
+// every request got its own response. The latencies show how long driver
+// requests waited compared to the client verbs they overtook. Then queues the
+// same verbs asynchronously, which returns long before they are sent.
+static void verbQueue(SimulatedController* controller, CodecModel* codec, UInt8 address, unsigned count)
+{
+    enum { kDumpThreads = 4 };
+    printf("Verb queue (codec address %d, %d client threads)\n", address, kDumpThreads);
+    IntelHDA intelHDA(controller->getCodecFunction(address), PIO);
+    Check(intelHDA.initialize(), "IntelHDA::initialize\n");
+    VerbQueue queue;
+    if (!queue.start())
+    {
+        Check(false, "VerbQueue::start\n");
+        return;
+    }
+
+    UInt8 afg = codec->getAFG();
+    UInt32 dumpCommand = HDA_COMMAND_12(afg, HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL);
+    UInt32 powerCommand = HDA_COMMAND_12(afg, HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+    UInt32 dumpExpected = intelHDA.sendCommand(dumpCommand);
+    UInt32 powerExpected = intelHDA.sendCommand(powerCommand);
+    Check(dumpExpected != powerExpected, "dump and power verbs both expect 0x%08x\n", dumpExpected);
+
+    std::atomic<unsigned> dumpErrors(0), timeouts(0), running(kDumpThreads);
+    std::thread threads[kDumpThreads];
+    for (int i = 0; i < kDumpThreads; i++)
+    {
+        threads[i] = std::thread([&]()
+        {
+            for (unsigned n = 0; n < count / kDumpThreads; n++)
+            {
+                UInt32 response = queue.sendCommand(&intelHDA, dumpCommand, VerbQueue::kPriorityClient);
+                if (response == (UInt32)-1)
+                    timeouts++;
+                else if (response != dumpExpected)
+                    dumpErrors++;
+            }
+            running--;
+        });
+    }
+    unsigned powerErrors = 0;
+    while (running)
+    {
+        UInt32 response = queue.sendCommand(&intelHDA, powerCommand);
+        if (response == (UInt32)-1)
+            timeouts++;
+        else if (response != powerExpected)
+            powerErrors++;
+        IOSleep(1);
+    }
+    for (int i = 0; i < kDumpThreads; i++)
+        threads[i].join();
+    Check(!dumpErrors && !powerErrors, "%u client and %u driver wrong responses\n", (unsigned)dumpErrors, powerErrors);
+
+    // an action that submits must not wait for the queue thread, which is running it
+    UInt32 nested = queue.runAction(nestedAction, &queue, &intelHDA, (void*)(uintptr_t)powerCommand);
+    Check(nested == powerExpected, "nested request returned 0x%08x\n", nested);
+
+    const VerbQueue::Stats& client = queue.getStats(VerbQueue::kPriorityClient);
+    const VerbQueue::Stats& driver = queue.getStats(VerbQueue::kPriorityDriver);
+    Check(client.requests == count / kDumpThreads * kDumpThreads, "%u client requests completed\n", client.requests);
+    UInt32 clientRequests = client.requests;
+    printf("  client: %u verbs (%u timed out), up to %u waiting, latency avg %llu max %u us\n",
+           client.requests, (unsigned)timeouts, client.maxDepth, client.requests ? (unsigned long long)(client.totalLatency / client.requests) : 0ULL, client.maxLatency);
+    printf("  driver: %u requests, latency avg %llu max %u us\n",
+           driver.requests, driver.requests ? (unsigned long long)(driver.totalLatency / driver.requests) : 0ULL, driver.maxLatency);
+
+    // each completion reports one command sent, the responses are checked once all are in
+    std::vector<UInt32> responses(count, 0);
+    AsyncCheck async;
+    async.expected = 1;
+    async.completed = 0;
+    async.failed = 0;
+    UInt64 start = getTimeMicroseconds();
+    unsigned submitted = 0;
+    for (unsigned n = 0; n < count; n++)
+        if (queue.submitCommands(&intelHDA, &dumpCommand, &responses[n], 1, asyncDone, &async, NULL, VerbQueue::kPriorityClient))
+            submitted++;
+    UInt64 submitTime = getTimeMicroseconds() - start;
+    for (int wait = 0; async.completed < submitted && wait < 5000; wait++)
+        IOSleep(1);
+    UInt64 completeTime = getTimeMicroseconds() - start;
+    unsigned wrong = 0;
+    for (unsigned n = 0; n < count; n++)
+        if (responses[n] != dumpExpected && responses[n] != (UInt32)-1)
+            wrong++;
+    Check(submitted == count && async.completed == count, "%u of %u async verbs submitted, %u completed\n",
+          submitted, count, (unsigned)async.completed);
+    Check(!wrong, "%u wrong async responses\n", wrong);
+    Check(client.requests - clientRequests == async.completed, "queue ran %u async requests\n", client.requests - clientRequests);
+    printf("  async: %u verbs (%u failed), queued in %llu us, completed in %llu us\n",
+           count, (unsigned)async.failed, (unsigned long long)submitTime, (unsigned long long)completeTime);
+    queue.stop();
+}
+
+// Wakes all codecs twice, once one codec after the other as separate
+// CodecCommander instances would, then through a CodecManager as one instance
+// with CodecAddressMask does, and checks EAPD ended up set on every codec.
+// Checks most-specific-match of the profile index on a hand made profile
+// dictionary, and that every plain profile name of the Info.plist finds itself.
+// Snapshot of the whole function group, checked against the model
+static void dumpCodec(SimulatedController* controller, CodecModel* codec, UInt8 address)
+{
+    printf("Codec dump (codec address %d)\n", address);
+    IntelHDA intelHDA(controller->getCodecFunction(address), PIO);
+    Check(intelHDA.initialize(), "IntelHDA::initialize\n");
+
+    UInt32 size = intelHDA.dumpCodec(NULL, 0);
+    Check(size > sizeof(CodecDumpHeader), "dumpCodec size %u\n", size);
+    std::vector<UInt8> buffer(size);
+    UInt32 before = codecCommands(controller, codec);
+    UInt64 start = getTimeMicroseconds();
+    Check(intelHDA.dumpCodec(&buffer[0], size) == size, "dumpCodec\n");
+    UInt64 elapsed = getTimeMicroseconds() - start;
+    UInt32 commands = codecCommands(controller, codec) - before;
+
+    const CodecDumpHeader* header = (const CodecDumpHeader*)&buffer[0];
+    const CodecDumpNode* nodes = (const CodecDumpNode*)&buffer[header->headerSize];
+    const UInt8* connections = (const UInt8*)&nodes[header->nodeCount];
+    Check(header->version == kCodecDumpVersion && header->size == size && header->vendorId == codec->getVendorId() &&
+          header->audioRoot == codec->getAFG(), "dump header\n");
+
+    std::lock_guard<std::mutex> lock(controller->getCodecLock());
+    unsigned pins = 0;
+    for (unsigned i = 0; i < header->nodeCount; i++)
+    {
+        const CodecDumpNode& node = nodes[i];
+        CodecModel::Node* model = codec->getNode(node.node);
+        Check(model && node.widgetCaps == model->params[HDA_PARM_AUDIOCAP], "node 0x%02x widget caps\n", node.node);
+        if (!model)
+            continue;
+        Check(node.connectionLength == model->connections.size() &&
+              (model->connections.empty() || !memcmp(&connections[node.connectionIndex], &model->connections[0], node.connectionLength)),
+              "node 0x%02x connections\n", node.node);
+        if (HDA_WIDGET_TYPE(node.widgetCaps) != HDA_WIDGET_TYPE_PIN)
+            continue;
+        Check(node.configDefault == codec->getConfigDefault(node.node), "node 0x%02x config default\n", node.node);
+        Check((node.pinControl & 0xFF) == codec->getState(node.node, 0x707), "node 0x%02x pin control\n", node.node);
+        if (HDA_PINCAP_IS_EAPD_CAPABLE(node.pinCaps))
+            Check((node.eapd & 0xFF) == codec->getState(node.node, HDA_VERB_EAPDBTL_SET), "node 0x%02x EAPD\n", node.node);
+        pins++;
+    }
+    printf("  %u nodes (%u pins verified), %u bytes, %u codec commands in %llu us\n", header->nodeCount, pins, size, commands, (unsigned long long)elapsed);
+}
+
+static void verbTrace(SimulatedController* controller, CodecModel* codec, UInt8 address)
+{
+    printf("Verb trace (codec address %d)\n", address);
+    IntelHDA intelHDA(controller->getCodecFunction(address), PIO);
+    Check(intelHDA.initialize(), "IntelHDA::initialize\n");
+    intelHDA.setTraceSource(kVerbTraceUser);
+
+    std::vector<VerbTraceEntry> entries(kVerbTraceEntries);
+    UInt32 cursor = kVerbTraceOldest, dropped;
+    Check(!intelHDA.readTrace(&cursor, &entries[0], kVerbTraceEntries, &dropped), "trace is empty until turned on\n");
+    Check(!intelHDA.setTracing(true) && intelHDA.getTracing(), "setTracing(true)\n");
+
+    // sent, answered from the parameter cache, sent
+    UInt8 afg = codec->getAFG();
+    UInt32 commands[3] = { HDA_COMMAND_12(afg, HDA_VERB_GET_PARAM, HDA_PARM_REVISION), HDA_COMMAND_12(afg, HDA_VERB_GET_PARAM, HDA_PARM_REVISION),
+                           HDA_COMMAND_12(afg, HDA_VERB_GET_PSTATE, HDA_PARM_NULL) };
+    const UInt8 status[3] = { kVerbTraceSent, kVerbTraceCached, kVerbTraceSent };
+    UInt32 responses[3];
+    for (int i = 0; i < 3; i++)
+        responses[i] = intelHDA.sendCommand(commands[i]);
+    cursor = kVerbTraceOldest;
+    UInt32 count = intelHDA.readTrace(&cursor, &entries[0], kVerbTraceEntries, &dropped);
+    Check(count == 3 && !dropped, "read %u entries, %u dropped\n", count, dropped);
+    for (UInt32 i = 0; i < count && i < 3; i++)
+    {
+        const VerbTraceEntry& entry = entries[i];
+        Check(entry.sequence == entries[0].sequence + i && entry.command == ((UInt32)address << 28 | commands[i]) &&
+              entry.response == responses[i] && entry.status == status[i] && entry.source == kVerbTraceUser &&
+              entry.time >= entries[0].time, "entry %u: 0x%08x -> 0x%08x, status %u, source %u\n",
+              i, entry.command, entry.response, entry.status, entry.source);
+    }
+
+    // shared by the instances on the controller, and read on from where the last read stopped
+    {
+        IntelHDA other(controller->getCodecFunction(address), PIO);
+        Check(other.initialize() && other.getTracing(), "second instance sees the trace on\n");
+        other.sendCommand(commands[2]);
+        count = other.readTrace(&cursor, &entries[0], kVerbTraceEntries, &dropped);
+        Check(count == 1 && entries[0].source == kVerbTraceInit, "second instance's command traced\n");
+    }
+
+    // cost per command, answered from the parameter cache so the link is left out
+    const unsigned kCached = 100000;
+    UInt64 timings[2];
+    for (int on = 0; on < 2; on++)
+    {
+        intelHDA.setTracing(on);
+        UInt64 start = getTimeMicroseconds();
+        for (unsigned i = 0; i < kCached; i++)
+            intelHDA.sendCommand(commands[1]);
+        timings[on] = getTimeMicroseconds() - start;
+    }
+
+    // the last kVerbTraceEntries are kept, what was overwritten is counted
+    UInt32 old = cursor;
+    count = intelHDA.readTrace(&cursor, &entries[0], kVerbTraceEntries, &dropped);
+    Check(count == kVerbTraceEntries && dropped == kCached - kVerbTraceEntries && cursor == old + kCached,
+          "wrapped: read %u, dropped %u\n", count, dropped);
+    Check(intelHDA.setTracing(false) && !intelHDA.getTracing(), "setTracing(false)\n");
+    intelHDA.sendCommand(commands[1]);
+    Check(!intelHDA.readTrace(&cursor, &entries[0], kVerbTraceEntries, &dropped), "nothing traced while off\n");
+
+    printf("  cached command %llu ns untraced, %llu ns traced\n", (unsigned long long)(timings[0] * 1000 / kCached), (unsigned long long)(timings[1] * 1000 / kCached));
+}
+
+static void profileIndex(const char* path)
+{
+    printf("Profile index\n");
+
+    static const char* names[] =
+    {
+        "10ec", "10ec_0269", "10ec_0269_HDA_17aa", "10ec_0269_HDA_17aa_2211",
+        "10ec_0269_HDA_17aa_22xx", "10ec_0269_HDA_17aa_2200-220f", "1106_xxxx_HDA_1028",
+        // equally specific, added in reverse name order
+        "10ec_0269_HDA_17aa_23x0", "10ec_0269_HDA_17aa_230x", "10ec_0269_HDA_17aa_2212", "10EC_0269_HDA_17AA_2212"
+    };
+    OSDictionary* profiles = OSDictionary::withCapacity(10);
+    OSDictionary* dicts[sizeof(names) / sizeof(names[0])];
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        dicts[i] = OSDictionary::withCapacity(0);
+        profiles->setObject(names[i], dicts[i]);
+        dicts[i]->release();
+    }
+    OSString* redirect = OSString::withCString("10ec");
+    profiles->setObject("8086", redirect);
+    redirect->release();
+    OSDictionary* defaultProfile = OSDictionary::withCapacity(0);
+    profiles->setObject("Default", defaultProfile);
+    defaultProfile->release();
+
+    static const struct { UInt32 codec, subsystem; int expected; } lookups[] =
+    {
+        { 0x10ec0269, 0x17aa2211, 3 },  // exact
+        { 0x10ec0269, 0x17aa2205, 5 },  // range of 16 beats 2 wildcard digits
+        { 0x10ec0269, 0x17aa22f0, 4 },
+        { 0x10ec0269, 0x17aa3000, 2 },
+        { 0x10ec0269, 0x10280000, 1 },
+        { 0x10ec0282, 0x17aa2211, 0 },
+        { 0x80862812, 0x00000000, 0 },  // redirect
+        { 0x11060397, 0x10280001, 6 },
+        { 0x11060397, 0x10430001, -1 },
+        { 0x10ec0269, 0x17aa2300, 8 },  // ties go by name
+        { 0x10ec0269, 0x17aa2310, 7 },
+        { 0x10ec0269, 0x17aa2212, 10 },
+    };
+    for (unsigned i = 0; i < sizeof(lookups) / sizeof(lookups[0]); i++)
+    {
+        OSDictionary* found = ProfileIndex::locate(profiles, lookups[i].codec, lookups[i].subsystem);
+        OSDictionary* expected = lookups[i].expected < 0 ? NULL : dicts[lookups[i].expected];
+        Check(found == expected, "profile for 0x%08x/0x%08x\n", lookups[i].codec, lookups[i].subsystem);
+    }
+    profiles->release();
+
+    OSObject* plist = loadPlist(path);
+    OSDictionary* shipped = OSDynamicCast(OSDictionary,
+        plist ? getPlistObject(plist, "IOKitPersonalities/" kCodecCommanderKey "/" kCodecProfile) : NULL);
+    if (!shipped)
+    {
+        OSSafeRelease(plist);
+        return;
+    }
+    unsigned count = 0;
+    UInt64 start = getTimeMicroseconds();
+    for (unsigned i = 0; i < shipped->getCount(); i++)
+    {
+        const char* name = shipped->getKey(i)->getCStringNoCopy();
+        unsigned vendor, codec = 0, subVendor = 0, subDevice = 0;
+        int fields = sscanf(name, "%4x_%4x_HDA_%4x_%4x", &vendor, &codec, &subVendor, &subDevice);
+        static const char* formats[] = { "", "%04x", "%04x_%04x", "%04x_%04x_HDA_%04x", "%04x_%04x_HDA_%04x_%04x" };
+        char plain[sizeof("vvvv_cccc_HDA_ssss_dddd")];
+        snprintf(plain, sizeof(plain), formats[fields > 0 ? fields : 0], vendor, codec, subVendor, subDevice);
+        if (strcasecmp(name, plain))
+            continue;
+        OSObject* obj = shipped->getObject(name);
+        if (OSString* str = OSDynamicCast(OSString, obj))
+            obj = shipped->getObject(str);
+        OSDictionary* found = ProfileIndex::locate(shipped, vendor << 16 | codec, subVendor << 16 | subDevice);
+        Check(found == obj, "profile %s not found by its ids\n", name);
+        count++;
+    }
+    printf("  %u profiles looked up in %llu us\n", count, (unsigned long long)(getTimeMicroseconds() - start));
+    OSSafeRelease(plist);
+}
+
+static void manageCodecs(SimulatedController* controller, CodecModel* codecs[HDA_MAX_CODECS], UInt8 first, const char* path)
+{
+    OSObject* plist = loadPlist(path);
+    OSObject* profile = plist ? getPlistObject(plist, "IOKitPersonalities/" kCodecCommanderKey "/" kCodecProfile) : NULL;
+    if (!profile)
+    {
+        OSSafeRelease(plist);
+        return;
+    }
+
+    IntelHDA* intelHDA[HDA_MAX_CODECS] = {};
+    Configuration* config[HDA_MAX_CODECS] = {};
+    OSArray* eapd[HDA_MAX_CODECS] = {};
+    UInt16 mask = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!codecs[address])
+            continue;
+        intelHDA[address] = new IntelHDA(controller->getCodecFunction(address), PIO);
+        Check(intelHDA[address]->initialize(), "IntelHDA::initialize of codec %d\n", address);
+        config[address] = new Configuration(profile, intelHDA[address], kCodecCommanderKey);
+        eapd[address] = CodecManager::findEAPDNodes(intelHDA[address]);
+        mask |= 1 << address;
+    }
+    printf("Codec manager (codec mask 0x%04x)\n", mask);
+
+    // another instance on the same codec gets its configuration without asking the codec again
+    IntelHDA other(controller->getCodecFunction(first), PIO);
+    Check(other.initialize(), "IntelHDA::initialize of second instance\n");
+    UInt32 commands = controller->getImmediateCount() + controller->getCORBCount();
+    Configuration shared(profile, &other, kCodecCommanderKey);
+    Check(shared.getLayoutID() == config[first]->getLayoutID() &&
+          shared.getCustomProgram(kStateWake).CommandCount == config[first]->getCustomProgram(kStateWake).CommandCount,
+          "Configuration of second instance of codec %d differs\n", first);
+    Check(controller->getImmediateCount() + controller->getCORBCount() == commands,
+          "identity verbs sent again (%u)\n", controller->getImmediateCount() + controller->getCORBCount() - commands);
+
+    // one CodecCommander per codec: a second claim fails until the first is released
+    Check(intelHDA[first]->claimCodec(first), "claim of codec %d\n", first);
+    Check(!other.claimCodec(first), "second claim of codec %d\n", first);
+    intelHDA[first]->releaseCodec(first);
+    Check(other.claimCodec(first), "claim of released codec %d\n", first);
+    other.releaseCodec(first);
+
+    // separate instances: each resets and sets up its own codec
+    UInt64 start = getTimeMicroseconds();
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!intelHDA[address] || config[address]->getDisable())
+            continue;
+        CodecManager single(intelHDA[address], config[address], eapd[address]);
+        single.resetCodecs();
+        single.customCommands(kStateWake);
+        single.setEAPD(0x02);
+    }
+    UInt64 sequential = getTimeMicroseconds() - start;
+
+    // one instance driving the others along with its own codec
+    CodecManager manager(intelHDA[first], config[first], eapd[first]);
+    UInt16 added = manager.addCodecs(mask & ~(1 << first), profile, kCodecCommanderKey, controller->getCodecFunction(first));
+    start = getTimeMicroseconds();
+    Check(manager.resetCodecs(), "CodecManager::resetCodecs\n");
+    manager.customCommands(kStateWake);
+    Check(manager.setEAPD(0x02), "CodecManager::setEAPD\n");
+    UInt64 managed = getTimeMicroseconds() - start;
+
+    // reset leaves EAPD at its default, so clear it and set it again to see the batched commands land
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+        for (unsigned i = 0; eapd[address] && i < eapd[address]->getCount(); i++)
+            intelHDA[address]->sendCommand(((OSNumber*)eapd[address]->getObject(i))->unsigned8BitValue(), HDA_VERB_EAPDBTL_SET, 0);
+    Check(manager.setEAPD(0x02), "CodecManager::setEAPD\n");
+
+    std::lock_guard<std::mutex> lock(controller->getCodecLock());
+    unsigned pins = 0;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!eapd[address] || !(manager.getCodecMask() & (1 << address)) || !config[address]->getUpdateNodes())
+            continue;
+        for (unsigned i = 0; i < eapd[address]->getCount(); i++, pins++)
+        {
+            UInt8 nid = ((OSNumber*)eapd[address]->getObject(i))->unsigned8BitValue();
+            Check(codecs[address]->getState(nid, HDA_VERB_EAPDBTL_SET) == 0x02, "EAPD of codec %d node 0x%02x\n", address, nid);
+        }
+    }
+    printf("  wake: codecs one by one %llu us, managed (added 0x%04x) %llu us, %u EAPD pins verified\n", (unsigned long long)sequential, added, (unsigned long long)managed, pins);
+
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        OSSafeRelease(eapd[address]);
+        delete config[address];
+        delete intelHDA[address];
+    }
+    OSSafeRelease(plist);
+}
+
+int main(int argc, char** argv)
+{
+    bool pio = true, dma = true;
+    unsigned count = 1000;
+    UInt32 frameTime = 20833;
+    const char* plistPath = "CodecCommander/CodecCommander-Info.plist";
+    CodecModel* codecs[HDA_MAX_CODECS] = {};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:m:n:p:f:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (!loadCodecDump(optarg, codecs))
+                {
+                    printf("no codec loaded from %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'm':
+                pio = !strcasecmp(optarg, "pio") || !strcasecmp(optarg, "both");
+                dma = !strcasecmp(optarg, "dma") || !strcasecmp(optarg, "both");
+                break;
+            case 'n':
+                count = (unsigned)strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                plistPath = optarg;
+                break;
+            case 'f':
+                frameTime = (UInt32)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage();
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (!count || (!pio && !dma))
+    {
+        usage();
+        return 2;
+    }
+
+    int first = -1;
+    IntelHDA::initControllers();
+    ProfileIndex::initIndexCache();
+    SimulatedController* controller = new SimulatedController();
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+    {
+        if (!codecs[address])
+            continue;
+        if (first < 0)
+            first = address;
+        controller->attachCodec(address, codecs[address]);
+    }
+    if (first < 0)
+    {
+        first = 0;
+        codecs[first] = CodecModel::createDefault();
+        controller->attachCodec(first, codecs[first]);
+        codecs[2] = CodecModel::createDefault();
+        controller->attachCodec(2, codecs[2]);
+    }
+    controller->setFrameTime(frameTime);
+    controller->start();
+
+    if (pio)
+        benchmark(controller, codecs[first], first, PIO, count);
+    if (dma)
+        benchmark(controller, codecs[first], first, DMA, count);
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+        if (codecs[address])
+            replayProfile(controller, codecs[address], address, plistPath);
+    shadow(controller, codecs[first], first);
+    contention(controller, codecs, count);
+    verbQueue(controller, codecs[first], first, count);
+    manageCodecs(controller, codecs, first, plistPath);
+    dumpCodec(controller, codecs[first], first);
+    verbTrace(controller, codecs[first], first);
+    profileIndex(plistPath);
+
+    controller->stop();
+    printf("%llu link frames, %u immediate commands, %u CORB commands\n",
+           (unsigned long long)controller->getFrameCount(), controller->getImmediateCount(), controller->getCORBCount());
+    delete controller;
+    for (int address = 0; address < HDA_MAX_CODECS; address++)
+        delete codecs[address];
+    ProfileIndex::freeIndexCache();
+    IntelHDA::freeControllers();
+
+    if (gFailures)
+        printf("%d check(s) failed\n", gFailures);
+    else
+        printf("all checks passed\n");
+    return gFailures ? 1 : 0;
+}
@@ -0,0 +1,2 @@
+// simulator stand-in, see CodecSimulator/KernelShim.h
+#include "KernelShim.h"
@@ -1,36 +1,5 @@
 #!/bin/bash
 
-HDA_AUDIO_AFG=0x01
-HDA_PIN_COMPLEX=0x04
-
-cmdResult=0
-function sendCommand()
-{
-    result=`hda-verb -q "$1" "$2" "$3"`
-    let cmdResult=result
-}
-
-function findAudioRootNode()
-{
-    local result=-1
-    sendCommand 0 PARAMETERS NODE_COUNT
-    start=$(( ($cmdResult >> 16) & 0xFF ))
-    end=$(( $start + (($cmdResult >> 0) & 0xFF) ))
-    #echo $start...$end
-    n=$start
-    while [[ $n -lt $end ]]; do
-        #echo Testing node $n
-        sendCommand $n PARAMETERS FUNCTION_TYPE
-        let type=$(($cmdResult & 0x7F))
-        if [[ $type -eq $HDA_AUDIO_AFG ]]; then
-            let result=$n
-            break
-        fi
-        ((n++))
-    done
-    echo $result
-}
-
 function shifty()
 {
     local result=$(( ($1 >> $2) & ((1 << ($3-$2+1))-1) ))
@@ -63,29 +32,27 @@ function parseConfig()
     printf "\tSequence: (0x%x)\n" $val
 }
 
-if [[ "$1" != "" ]]; then
+if [[ "$1" != "" && "$1" != -* ]]; then
     parseConfig "$1"
     exit
 fi
 
-rootNode=`findAudioRootNode`
-#echo $rootNode
-
-sendCommand $rootNode PARAMETERS NODE_COUNT
-#printf "result=0x%08x\n" $cmdResult
-start=$(( ($cmdResult >> 16) & 0xFF ))
-end=$(( $start + (($cmdResult >> 0) & 0xFF) ))
-#echo $start...$end
-n=$start
-while [[ $n -lt $end ]]; do
-    sendCommand $n PARAMETERS AUDIO_WIDGET_CAP
-    let type=$((($cmdResult >> 20) & 0x0F))
-    if [[ $type -eq $HDA_PIN_COMPLEX ]]; then
-        sendCommand $n GET_CONFIG_DEFAULT 0
-        let config=$cmdResult
-        printf "Node 0x%02x [Pin Complex] : Pin Config 0x%08x\n" $n $config
+# hda-verb options picking the codec, e.g. ./config_dump.sh -c HDAU -a 0
+TARGET=("$@")
+
+# the kext finds the function group and reads every widget in one call
+dump=`hda-verb "${TARGET[@]}" -d` || { echo "hda-verb -d failed" >&2; exit 1; }
+
+pinNode='^Node (0x[0-9a-f]+) \[Pin Complex\]'
+pinDefault='Pin Default (0x[0-9a-f]+)'
+node=
+while read -r line; do
+    if [[ $line =~ $pinNode ]]; then
+        node=${BASH_REMATCH[1]}
+    elif [[ -n $node && $line =~ $pinDefault ]]; then
+        let config=${BASH_REMATCH[1]}
+        printf "Node 0x%02x [Pin Complex] : Pin Config 0x%08x\n" $node $config
         parseConfig $config
+        node=
     fi
-    ((n = $n+1))
-done
-
+done <<< "$dump"
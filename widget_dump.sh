@@ -14,48 +14,20 @@
 # 15 14 13 12 11 10 9 8 7 6 5 4 3 2 1 0 
 #  0  1  1  1  0  0 0 0 0 0 0 0 0 0 1 1 = 0x7003
 
-function dump
-{
-	echo -e "\t\tnid = $1 --> result `hda-verb $1 $2 $3 | tail -c 11`"
-}
+NIDS="0x02 0x03 0x04 0x05 0x06 0x07 0x08 0x09 0x0a 0x0b 0x0c 0x0d 0x0e 0x0f 0x10 0x11 0x12 0x13 0x14 0x15 0x16 0x17 0x18 0x19 0x1a 0x1b 0x1c 0x1d 0x1e 0x1f 0x20 0x21 0x22 0x23 0x24"
+
+# hda-verb options picking the codec, e.g. ./widget_dump.sh -c HDAU -a 0
+TARGET=("$@")
 
+# one hda-verb call (and one kext request) for all nodes
 function dump_all
 {
-	dump 0x02 $1 $2
-	dump 0x03 $1 $2
-	dump 0x04 $1 $2
-	dump 0x05 $1 $2
-	dump 0x06 $1 $2
-	dump 0x07 $1 $2
-	dump 0x08 $1 $2
-	dump 0x09 $1 $2
-	dump 0x0a $1 $2
-	dump 0x0b $1 $2
-	dump 0x0c $1 $2
-	dump 0x0d $1 $2
-	dump 0x0e $1 $2
-	dump 0x0f $1 $2
-	dump 0x10 $1 $2
-	dump 0x11 $1 $2
-	dump 0x12 $1 $2
-	dump 0x13 $1 $2
-	dump 0x14 $1 $2
-	dump 0x15 $1 $2
-	dump 0x16 $1 $2
-	dump 0x17 $1 $2
-	dump 0x18 $1 $2
-	dump 0x19 $1 $2
-	dump 0x1a $1 $2
-	dump 0x1b $1 $2
-	dump 0x1c $1 $2
-	dump 0x1d $1 $2
-	dump 0x1e $1 $2
-	dump 0x1f $1 $2
-	dump 0x20 $1 $2
-	dump 0x21 $1 $2
-	dump 0x22 $1 $2
-	dump 0x23 $1 $2
-	dump 0x24 $1 $2
+	local nids=($NIDS)
+	local results
+	results=(`for nid in $NIDS; do echo "$nid $1 $2"; done | hda-verb "${TARGET[@]}" -q -b`) || { echo "hda-verb -b failed for $1" >&2; exit 1; }
+	for i in ${!nids[@]}; do
+		echo -e "\t\tnid = ${nids[$i]} --> result ${results[$i]}"
+	done
 }
 
 #echo -e "\tConnection Selector"